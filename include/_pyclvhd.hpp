@@ -3,6 +3,7 @@
 
 #include "clvHd.hpp"
 #include <limits> // For std::numeric_limits
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
@@ -10,6 +11,53 @@ namespace py = pybind11;
 
 namespace ClvHd
 {
+/**
+ * @brief Pop the pending frames of a ring as numpy arrays (timestamps,
+ * frames x channels).
+ */
+inline py::tuple
+pop_ring(ClvHd::SampleRing &ring)
+{
+    size_t n = ring.size();
+    py::array_t<double> ts(n);
+    py::array_t<double> values({n, ring.channels()});
+    ring.pop(ts.mutable_data(), values.mutable_data(), n);
+    return py::make_tuple(ts, values);
+}
+
+/**
+ * @brief Feed a block to a processing stage by chunks of chunk frames and
+ * empty its output ring after each one, so that a block larger than the
+ * ring does not drop output. Returns all the output frames as numpy arrays.
+ */
+template <typename Stage>
+py::tuple
+process_chunks(Stage &stage,
+               const double *ts,
+               const double *block,
+               size_t n_frames,
+               size_t in_ch,
+               size_t chunk)
+{
+    const size_t out_ch = stage.output.channels();
+    std::vector<double> out_ts, out_values;
+    for(size_t done = 0; done < n_frames; done += chunk)
+    {
+        stage.process(ts + done, block + done * in_ch,
+                      std::min(chunk, n_frames - done));
+        size_t n = stage.output.size(), old = out_ts.size();
+        out_ts.resize(old + n);
+        out_values.resize((old + n) * out_ch);
+        stage.output.pop(out_ts.data() + old, out_values.data() + old * out_ch,
+                         n);
+    }
+    py::array_t<double> rts(out_ts.size());
+    py::array_t<double> values({out_ts.size(), out_ch});
+    std::copy(out_ts.begin(), out_ts.end(), rts.mutable_data());
+    std::copy(out_values.begin(), out_values.end(), values.mutable_data());
+    return py::make_tuple(rts, values);
+}
+
 class pyDevice : public ClvHd::Device
 {
     public:
@@ -118,7 +166,8 @@ class pyEMG_ADS1293Pack : public ClvHd::EMG_ADS1293Pack
             py::list _chx_high_freq,
             py::list _R1,
             int R2,
-            py::list _R3)
+            py::list _R3,
+            bool synchronous)
     {
         ClvHd::EMG_ADS1293Config config;
         config.enable(_chx_enable[0].cast<bool>(), _chx_enable[1].cast<bool>(),
@@ -138,14 +187,84 @@ class pyEMG_ADS1293Pack : public ClvHd::EMG_ADS1293Pack
         }
         config.set_R2(R2);
         config.set_clock_intern(true);
+        config.set_synchronous(synchronous);
         this->configure(config);
     };
 
 
+    /**
+     * @brief Plan the decimation settings for a target rate, measure the
+     * round-trip time of the link and configure the modules if feasible.
+     */
+    py::tuple
+    pyplan(double target_rate,
+           bool precise,
+           py::list _chx_enable,
+           int baud,
+           double poll_period)
+    {
+        bool chx_enable[3];
+        for(size_t i = 0; i < 3; ++i) chx_enable[i] = _chx_enable[i].cast<bool>();
+        ClvHd::LinkModel link;
+        link.baud = baud;
+        link.poll_period_s = poll_period;
+        double rtt = ClvHd::RatePlanner::measure_rtt(m_device->controller);
+        if(rtt > 0)
+            link.rtt_s = rtt;
+        ClvHd::RatePlan plan = ClvHd::RatePlanner::plan(
+            target_rate, precise, chx_enable, this->modules.size(), link);
+        logln(plan.str(), true);
+        if(plan.feasible)
+        {
+            this->configure(plan.config);
+            m_monitor.set_plan(plan);
+        }
+        return py::make_tuple(plan.feasible, plan.odr, plan.str());
+    };
+
+    /**
+     * @brief Read all the modules once and return the new fast and precise
+     * frames as two lists of (timestamp, [values]).
+     */
+    py::tuple
+    pyread_streams()
+    {
+        this->read_streams();
+        return py::make_tuple(pop_frames(this->fast_ring),
+                              pop_frames(this->precise_ring));
+    };
+
+    /**
+     * @brief Pop the frames pushed by an Acquisition thread, without reading.
+     */
+    py::tuple
+    pop_streams()
+    {
+        return py::make_tuple(pop_frames(this->fast_ring),
+                              pop_frames(this->precise_ring));
+    };
+
+    /**
+     * @brief Pop the pending frames of one stream as numpy arrays
+     * (timestamps, frames x channels), ready for FilterBank.process().
+     */
+    py::tuple
+    pop_block(bool precise)
+    {
+        return pop_ring(precise ? this->precise_ring : this->fast_ring);
+    };
+
+    std::string
+    rate_report()
+    {
+        return m_monitor.str();
+    };
+
     py::tuple
     pyread_all(bool fast = true)
     {
         std::vector<ClvHd::Value *> values = this->read_all(fast);
+        m_monitor.update(*this);
         double timestamp = values[0]->time_s + values[0]->time_ns / 1000000.0;
         py::list module_list;
         for(size_t i = 0; i < values.size(); i++)
@@ -159,6 +278,588 @@ class pyEMG_ADS1293Pack : public ClvHd::EMG_ADS1293Pack
         }
         return py::make_tuple(timestamp, module_list);
     };
+
+    private:
+    py::list
+    pop_frames(ClvHd::SampleRing &ring)
+    {
+        py::list frames;
+        size_t nb_ch = ring.channels();
+        double ts;
+        std::vector<double> values(nb_ch);
+        while(ring.pop(&ts, values.data(), 1) == 1)
+            frames.append(py::make_tuple(ts, values));
+        return frames;
+    };
+
+    ClvHd::RateMonitor m_monitor;
+};
+
+class pyAcquisition : public ClvHd::Acquisition
+{
+    public:
+    pyAcquisition(ClvHd::pyEMG_ADS1293Pack &pack, int verbose = -1)
+        : ClvHd::Acquisition(&pack, verbose),
+          ESC::CLI(verbose, "pyClvHd-Acquisition") {};
+
+    void
+    pystart(std::string policy,
+            int priority,
+            int cpu,
+            bool lock_memory,
+            bool busy_poll,
+            double period)
+    {
+        ClvHd::AcquisitionOptions options;
+        if(policy == "fifo")
+            options.policy = ClvHd::AcquisitionOptions::FIFO;
+        else if(policy == "rr")
+            options.policy = ClvHd::AcquisitionOptions::RR;
+        else if(policy != "other")
+            throw log_error("Unknown policy " + policy +
+                            " (other, fifo or rr)");
+        options.priority = priority;
+        options.cpu = cpu;
+        options.lock_memory = lock_memory;
+        options.busy_poll = busy_poll;
+        options.period_s = period;
+        this->start(options);
+    };
+
+    py::dict
+    pystats()
+    {
+        ClvHd::AcquisitionStats s = this->stats();
+        py::dict d;
+        d["reads"] = s.reads;
+        d["errors"] = s.errors;
+        d["latency_mean"] = s.latency_mean;
+        d["latency_max"] = s.latency_max;
+        d["period_mean"] = s.period_mean;
+        d["period_jitter"] = s.period_jitter;
+        d["period_max"] = s.period_max;
+        d["wakeup_mean"] = s.wakeup_mean;
+        d["wakeup_max"] = s.wakeup_max;
+        return d;
+    };
+};
+
+/**
+ * @brief Filter in place a float64 C-contiguous block (frames x channels).
+ */
+inline void
+pyfilter_process(ClvHd::FilterBank &bank, py::array block)
+{
+    if(!py::isinstance<py::array_t<double>>(block) ||
+       !(block.flags() & py::array::c_style) || !block.writeable())
+        throw std::runtime_error(
+            "The block must be a writeable C-contiguous float64 array");
+    size_t nch = bank.channels();
+    size_t n_frames = 0;
+    if(block.ndim() == 2 && (size_t)block.shape(1) == nch)
+        n_frames = block.shape(0);
+    else if(block.ndim() == 1 && nch == 1) // samples of a single channel
+        n_frames = block.shape(0);
+    else if(block.ndim() == 1 && (size_t)block.shape(0) == nch) // one frame
+        n_frames = 1;
+    else
+        throw std::runtime_error("The block must be frames x " +
+                                 std::to_string(nch) + " channels");
+    double *data = static_cast<double *>(block.mutable_data());
+    py::gil_scoped_release release;
+    bank.process(data, n_frames);
+}
+
+class pyFeatureExtractor : public ClvHd::FeatureExtractor
+{
+    public:
+    pyFeatureExtractor(int nb_channels,
+                       int window,
+                       int hop,
+                       double zc_threshold,
+                       double ssc_threshold)
+        : ClvHd::FeatureExtractor(
+              nb_channels, window, hop, zc_threshold, ssc_threshold) {};
+
+    /**
+     * @brief Feed a block (timestamps, frames x channels) and return the new
+     * feature vectors (timestamps, vectors x (5 x channels)).
+     */
+    py::tuple
+    pyprocess(py::array_t<double, py::array::c_style | py::array::forcecast> ts,
+              py::array_t<double, py::array::c_style | py::array::forcecast>
+                  block)
+    {
+        if(block.size() != ts.size() * this->channels())
+            throw std::runtime_error("The block must be frames x " +
+                                     std::to_string(this->channels()) +
+                                     " channels");
+        // At most one vector per hop frames (+1) per chunk
+        size_t chunk = std::max<size_t>(
+            1, this->output.capacity() / 2 * this->hop());
+        return process_chunks(*this, ts.data(), block.data(), ts.size(),
+                              this->channels(), chunk);
+    };
+
+    /**
+     * @brief Feed the pending frames of a pack stream.
+     */
+    py::tuple
+    process_pack(ClvHd::pyEMG_ADS1293Pack &pack, bool precise)
+    {
+        this->process(precise ? pack.precise_ring : pack.fast_ring);
+        return pop_ring(this->output);
+    };
+};
+
+class pyResampler : public ClvHd::Resampler
+{
+    public:
+    pyResampler(int nb_channels, double fs_in, double fs_out, int zeros)
+        : ClvHd::Resampler(nb_channels, fs_in, fs_out, zeros) {};
+
+    /**
+     * @brief Feed a block (timestamps, frames x channels) and return the
+     * uniformly sampled frames (timestamps, frames x channels).
+     */
+    py::tuple
+    pyprocess(py::array_t<double, py::array::c_style | py::array::forcecast> ts,
+              py::array_t<double, py::array::c_style | py::array::forcecast>
+                  block)
+    {
+        if(block.size() != ts.size() * this->channels())
+            throw std::runtime_error("The block must be frames x " +
+                                     std::to_string(this->channels()) +
+                                     " channels");
+        // At most L/M output frames (+1) per input frame
+        size_t chunk = std::max<size_t>(
+            1, this->output.capacity() / 2 * this->M() / this->L());
+        return process_chunks(*this, ts.data(), block.data(), ts.size(),
+                              this->channels(), chunk);
+    };
+
+    py::tuple
+    process_pack(ClvHd::pyEMG_ADS1293Pack &pack, bool precise)
+    {
+        this->process(precise ? pack.precise_ring : pack.fast_ring);
+        return pop_ring(this->output);
+    };
+};
+
+class pySpectralAnalyzer : public ClvHd::SpectralAnalyzer
+{
+    public:
+    pySpectralAnalyzer(int nb_channels,
+                       double fs,
+                       size_t window,
+                       double overlap,
+                       int averages)
+        : ClvHd::SpectralAnalyzer(nb_channels, fs, window, overlap, averages)
+    {};
+
+    /**
+     * @brief Feed a block (timestamps, frames x channels) and return the new
+     * spectral feature frames.
+     */
+    py::tuple
+    pyprocess(py::array_t<double, py::array::c_style | py::array::forcecast> ts,
+              py::array_t<double, py::array::c_style | py::array::forcecast>
+                  block)
+    {
+        if(block.size() != ts.size() * this->channels())
+            throw std::runtime_error("The block must be frames x " +
+                                     std::to_string(this->channels()) +
+                                     " channels");
+        {
+            py::gil_scoped_release release;
+            this->process(ts.data(), block.data(), ts.size());
+        }
+        return pop_ring(this->output);
+    };
+
+    py::tuple
+    process_pack(ClvHd::pyEMG_ADS1293Pack &pack, bool precise)
+    {
+        this->process(precise ? pack.precise_ring : pack.fast_ring);
+        return pop_ring(this->output);
+    };
+
+    py::array_t<double>
+    frequencies()
+    {
+        size_t bins = this->window() / 2 + 1;
+        py::array_t<double> f(bins);
+        for(size_t k = 0; k < bins; k++)
+            f.mutable_data()[k] = k * this->resolution();
+        return f;
+    };
+};
+
+class pyDetector : public ClvHd::Detector
+{
+    public:
+    pyDetector(int nb_channels, double fs, ClvHd::DetectorConfig config)
+        : ClvHd::Detector(nb_channels, fs, config) {};
+
+    /**
+     * @brief Function called with each event by process() and
+     * process_pack() (None to disable).
+     */
+    void
+    set_callback(py::object callback)
+    {
+        m_callback = callback;
+    };
+
+    py::list
+    pyprocess(py::array_t<double, py::array::c_style | py::array::forcecast> ts,
+              py::array_t<double, py::array::c_style | py::array::forcecast>
+                  block)
+    {
+        if(block.size() != ts.size() * this->channels())
+            throw std::runtime_error("The block must be frames x " +
+                                     std::to_string(this->channels()) +
+                                     " channels");
+        this->process(ts.data(), block.data(), ts.size());
+        return dispatch();
+    };
+
+    py::list
+    process_pack(ClvHd::pyEMG_ADS1293Pack &pack, bool precise)
+    {
+        this->process(precise ? pack.precise_ring : pack.fast_ring);
+        return dispatch();
+    };
+
+    private:
+    py::list
+    dispatch()
+    {
+        py::list list;
+        ClvHd::Event event;
+        while(this->pop(event))
+        {
+            if(!m_callback.is_none())
+                m_callback(event);
+            list.append(event);
+        }
+        return list;
+    };
+
+    py::object m_callback = py::none();
+};
+
+class pyClassifier : public ClvHd::Classifier
+{
+    public:
+    pyClassifier(int verbose = -1)
+        : ClvHd::Classifier(verbose), ESC::CLI(verbose, "pyClvHd-Classifier") {};
+
+    /**
+     * @brief Function called with each decision change by process() and
+     * process_features() (None to disable).
+     */
+    void
+    pyset_callback(py::object callback)
+    {
+        m_pycallback = callback;
+    };
+
+    py::tuple
+    pypredict(py::array_t<double, py::array::c_style | py::array::forcecast>
+                  features)
+    {
+        if(features.size() != this->inputs())
+            throw std::runtime_error("The feature vector must have " +
+                                     std::to_string(this->inputs()) +
+                                     " values");
+        py::array_t<float> probs(this->classes());
+        int label = this->predict(features.data(), probs.mutable_data());
+        return py::make_tuple(label, probs);
+    };
+
+    /**
+     * @brief Classify feature vectors (timestamps, vectors x inputs) and
+     * return the decisions.
+     */
+    py::list
+    pyprocess(py::array_t<double, py::array::c_style | py::array::forcecast> ts,
+              py::array_t<double, py::array::c_style | py::array::forcecast>
+                  features,
+              double clock_offset)
+    {
+        if(features.size() != ts.size() * this->inputs())
+            throw std::runtime_error("The features must be vectors x " +
+                                     std::to_string(this->inputs()) +
+                                     " values");
+        this->process(ts.data(), features.data(), ts.size(), clock_offset);
+        return dispatch();
+    };
+
+    /**
+     * @brief Classify the pending vectors of a feature extractor.
+     */
+    py::list
+    process_features(ClvHd::pyFeatureExtractor &extractor, double clock_offset)
+    {
+        if(this->process(extractor.output, clock_offset) < 0)
+            throw std::runtime_error("The feature vectors must have " +
+                                     std::to_string(this->inputs()) +
+                                     " values");
+        return dispatch();
+    };
+
+    private:
+    py::list
+    dispatch()
+    {
+        py::list list;
+        ClvHd::Decision decision;
+        int last = m_pylast;
+        while(this->decisions.pop(decision))
+        {
+            if(decision.label != last && !m_pycallback.is_none())
+                m_pycallback(decision);
+            last = decision.label;
+            list.append(decision);
+        }
+        m_pylast = last;
+        return list;
+    };
+
+    py::object m_pycallback = py::none();
+    int m_pylast = -1;
+};
+
+class pySignalQuality : public ClvHd::SignalQuality
+{
+    public:
+    pySignalQuality(int nb_channels, double fs, double line_hz, double period_s)
+        : ClvHd::SignalQuality(nb_channels, fs, line_hz, period_s) {};
+
+    /**
+     * @brief Feed a block (timestamps, frames x channels) and return the new
+     * status frames (timestamps, frames x (4 x channels)).
+     */
+    py::tuple
+    pyprocess(py::array_t<double, py::array::c_style | py::array::forcecast> ts,
+              py::array_t<double, py::array::c_style | py::array::forcecast>
+                  block)
+    {
+        if(block.size() != ts.size() * this->channels())
+            throw std::runtime_error("The block must be frames x " +
+                                     std::to_string(this->channels()) +
+                                     " channels");
+        this->process(ts.data(), block.data(), ts.size());
+        return pop_ring(this->output);
+    };
+
+    /**
+     * @brief Feed the pending frames and error reports of a pack.
+     */
+    py::tuple
+    process_pack(ClvHd::pyEMG_ADS1293Pack &pack, bool precise)
+    {
+        this->process_errors(pack.errors);
+        this->process(precise ? pack.precise_ring : pack.fast_ring);
+        return pop_ring(this->output);
+    };
+
+    void
+    set_rails_pack(ClvHd::pyEMG_ADS1293Pack &pack, double margin)
+    {
+        std::vector<double> low, high;
+        pack.rails(low, high);
+        this->set_rails(low, high, margin);
+    };
+};
+
+class pySpatialFilter : public ClvHd::SpatialFilter
+{
+    public:
+    /**
+     * @brief Swap the matrix, or reconfigure the filter if the dimensions
+     * change.
+     */
+    void
+    set(const ClvHd::SpatialMatrix &matrix)
+    {
+        if(matrix.ignored() > 0)
+            throw std::runtime_error(
+                std::to_string(matrix.ignored()) +
+                " coefficients of the matrix are out of its " +
+                std::to_string(matrix.rows()) + " x " +
+                std::to_string(matrix.cols()) + " size");
+        if(!this->swap(matrix))
+            this->configure(matrix);
+    };
+
+    py::tuple
+    pyprocess(py::array_t<double, py::array::c_style | py::array::forcecast> ts,
+              py::array_t<double, py::array::c_style | py::array::forcecast>
+                  block)
+    {
+        if(block.size() != ts.size() * this->inputs())
+            throw std::runtime_error("The block must be frames x " +
+                                     std::to_string(this->inputs()) +
+                                     " channels");
+        // One output frame per input frame
+        return process_chunks(*this, ts.data(), block.data(), ts.size(),
+                              this->inputs(), this->output.capacity() / 2);
+    };
+
+    py::tuple
+    process_pack(ClvHd::pyEMG_ADS1293Pack &pack, bool precise)
+    {
+        ClvHd::SampleRing &ring = precise ? pack.precise_ring : pack.fast_ring;
+        if(ring.channels() != (size_t)this->inputs())
+            throw std::runtime_error("The filter takes " +
+                                     std::to_string(this->inputs()) +
+                                     " channels, the pack stream has " +
+                                     std::to_string(ring.channels()));
+        std::vector<double> ts(ring.size()), block(ts.size() * ring.channels());
+        size_t n = ring.pop(ts.data(), block.data(), ts.size());
+        return process_chunks(*this, ts.data(), block.data(), n,
+                              this->inputs(), this->output.capacity() / 2);
+    };
+};
+
+class pyRecorder : public ClvHd::Recorder
+{
+    public:
+    pyRecorder(int verbose = -1)
+        : ClvHd::Recorder(verbose), ESC::CLI(verbose, "pyClvHd-Recorder") {};
+
+    void
+    pywrite(py::array_t<double, py::array::c_style | py::array::forcecast> ts,
+            py::array_t<double, py::array::c_style | py::array::forcecast>
+                block)
+    {
+        if(block.size() != ts.size() * this->channels())
+            throw std::runtime_error("The block must be frames x " +
+                                     std::to_string(this->channels()) +
+                                     " channels");
+        this->write(ts.data(), block.data(), ts.size());
+    };
+
+    /**
+     * @brief Record the pending frames of a pack stream with its markers
+     * interleaved.
+     */
+    size_t
+    record_pack(ClvHd::pyEMG_ADS1293Pack &pack, bool precise)
+    {
+        return this->record(precise ? pack.precise_ring : pack.fast_ring,
+                            pack.markers);
+    };
+};
+
+class pyShmPublisher : public ClvHd::ShmPublisher
+{
+    public:
+    pyShmPublisher(int verbose = -1)
+        : ClvHd::ShmPublisher(verbose),
+          ESC::CLI(verbose, "pyClvHd-ShmPublisher") {};
+
+    void
+    pywrite(py::array_t<double, py::array::c_style | py::array::forcecast> ts,
+            py::array_t<double, py::array::c_style | py::array::forcecast>
+                block)
+    {
+        if(!this->is_open())
+            throw std::runtime_error("The ring is not open");
+        if(block.size() != ts.size() * this->channels())
+            throw std::runtime_error("The block must be frames x " +
+                                     std::to_string(this->channels()) +
+                                     " channels");
+        this->write(ts.data(), block.data(), ts.size());
+    };
+
+    size_t
+    publish_pack(ClvHd::pyEMG_ADS1293Pack &pack, bool precise)
+    {
+        return this->publish(precise ? pack.precise_ring : pack.fast_ring);
+    };
+};
+
+class pyShmReader : public ClvHd::ShmReader
+{
+    public:
+    pyShmReader(int verbose = -1)
+        : ClvHd::ShmReader(verbose), ESC::CLI(verbose, "pyClvHd-ShmReader") {};
+
+    /**
+     * @brief Contiguous pending frames as read-only numpy views of the
+     * shared memory (no copy), valid until consume(). The views point into
+     * the mapping: detach() and attach() refuse to unmap it while one of
+     * them is alive.
+     */
+    py::tuple
+    pypeek(py::object self)
+    {
+        const double *ts = nullptr, *values = nullptr;
+        size_t n = this->peek(ts, values);
+        size_t ch = this->channels();
+        py::array_t<double> ts_view({n}, {sizeof(double)},
+                                    const_cast<double *>(ts), self);
+        py::array_t<double> values_view(
+            {n, ch}, {ch * sizeof(double), sizeof(double)},
+            const_cast<double *>(values), self);
+        ts_view.attr("setflags")(py::arg("write") = false);
+        values_view.attr("setflags")(py::arg("write") = false);
+        drop_dead_views();
+        m_views.emplace_back(ts_view);
+        m_views.emplace_back(values_view);
+        return py::make_tuple(ts_view, values_view);
+    };
+
+    int
+    pyattach(const std::string &name)
+    {
+        check_peek();
+        return this->attach(name);
+    };
+
+    void
+    pydetach()
+    {
+        check_peek();
+        this->detach();
+    };
+
+    py::tuple
+    pyread(size_t max_frames)
+    {
+        size_t n = std::min(max_frames, this->pending());
+        py::array_t<double> ts(n);
+        py::array_t<double> values({n, this->channels()});
+        n = this->read(ts.mutable_data(), values.mutable_data(), n);
+        ts.resize({n});
+        values.resize({n, this->channels()});
+        return py::make_tuple(ts, values);
+    };
+
+    private:
+    void
+    drop_dead_views()
+    {
+        std::vector<py::weakref> alive;
+        for(py::weakref &view : m_views)
+            if(!view().is_none())
+                alive.push_back(view);
+        m_views.swap(alive);
+    };
+
+    void
+    check_peek()
+    {
+        drop_dead_views();
+        if(!m_views.empty())
+            throw std::runtime_error(
+                "Delete the peeked views before unmapping the ring");
+    };
+
+    std::vector<py::weakref> m_views; // Views of the mapping given by peek()
 };
 
 } // namespace ClvHd
@@ -169,7 +870,58 @@ PYBIND11_MODULE(pyclvhd, m)
         .def(py::init<int>(), py::arg("verbose") = -1)
         .def("initSerial", &ClvHd::pyDevice::initSerial, py::arg("path"),
              py::arg("baud") = 460800, py::arg("flags") = O_RDWR | O_NOCTTY,
-             "Initialize the serial connection to the controller board");
+             "Initialize the serial connection to the controller board")
+        .def("initBoards", &ClvHd::pyDevice::initBoards, py::arg("paths"),
+             py::arg("baud") = 460800,
+             "Open several controller boards as one device (modules numbered "
+             "board after board), returns the number of modules")
+        .def("initMono", &ClvHd::pyDevice::initMono,
+             py::arg("nb_modules") = 1, py::arg("timeout") = 5.,
+             "Wait for the MONOMOD Wi-Fi modules to connect, returns the "
+             "number of modules")
+        .def("setCache", &ClvHd::pyDevice::setCache, py::arg("path"),
+             "Enable the topology and configuration cache (call before "
+             "initSerial)")
+        .def(
+            "setSpiClock",
+            [](ClvHd::pyDevice &device, uint32_t clock) {
+                return device.controller != nullptr
+                           ? device.controller->setSpiClock(clock)
+                           : -1;
+            },
+            py::arg("clock"),
+            "Set the SPI clock of the modules (Hz), returns the applied "
+            "clock or -1")
+        .def(
+            "setAggregation",
+            [](ClvHd::pyDevice &device, uint16_t packet, uint16_t budget_us) {
+                return device.controller != nullptr
+                           ? device.controller->setAggregation(packet,
+                                                               budget_us)
+                           : -1;
+            },
+            py::arg("packet") = 64, py::arg("budget_us") = 0,
+            "Aggregate the replies in transfers of packet multiples (0 to "
+            "disable), returns the applied packet size or -1")
+        .def(
+            "streamStats",
+            [](ClvHd::pyDevice &device, int id) {
+                ClvHd::MonoController *mono =
+                    dynamic_cast<ClvHd::MonoController *>(device.controller);
+                if(mono == nullptr)
+                    throw std::runtime_error("Not a MONOMOD device");
+                ClvHd::StreamStats s = mono->streamStats(id);
+                py::dict dict;
+                dict["datagrams"] = s.datagrams;
+                dict["samples"] = s.samples;
+                dict["lost"] = s.lost;
+                dict["duplicates"] = s.duplicates;
+                dict["reordered"] = s.reordered;
+                dict["late"] = s.late;
+                return dict;
+            },
+            py::arg("id"),
+            "Reception counters of the UDP stream of a MONOMOD module");
     // .def("setRGB", &ClvHd::pyDevice::setRGB,
     //      py::arg("id_module"), py::arg("id_led"), py::arg("rgb"),
     //      "Set the RGB color of the given LED of the given module")
@@ -181,18 +933,448 @@ PYBIND11_MODULE(pyclvhd, m)
     //      "Start the acquisition of the EMG modules")
     // .def("read_all", &ClvHd::pyDevice::read_all, "Read all the EMG data");
 
+    m.def("host_clock", &ClvHd::host_clock,
+          "Host monotonic clock (s), the time base of the latencies and "
+          "of mark_at()");
+
+    py::class_<ClvHd::Marker>(m, "Marker")
+        .def_readonly("timestamp", &ClvHd::Marker::timestamp)
+        .def_readonly("host", &ClvHd::Marker::host)
+        .def_readonly("code", &ClvHd::Marker::code)
+        .def_property_readonly("label", &ClvHd::Marker::str)
+        .def("__repr__", [](const ClvHd::Marker &mk) {
+            return "<marker " + mk.str() + " (" + std::to_string(mk.code) +
+                   ") at " + std::to_string(mk.timestamp) + ">";
+        });
+
     py::class_<ClvHd::pyEMG_ADS1293Pack>(m, "EMG_ADS1293Pack")
         .def(py::init<ClvHd::pyDevice &, int>(), py::arg("device"),
-             py::arg("verbose") = -1)
+             py::arg("verbose") = -1, py::keep_alive<1, 2>())
         .def("setup", &ClvHd::pyEMG_ADS1293Pack::pysetup,
              py::arg("route_table"), py::arg("chx_enable"),
              py::arg("chx_high_res"), py::arg("chx_high_freq"), py::arg("R1"),
-             py::arg("R2"), py::arg("R3"),
-             "Setup the ADS1293 EMG modules in the device")
+             py::arg("R2"), py::arg("R3"), py::arg("synchronous") = false,
+             "Setup the ADS1293 EMG modules in the device (synchronous: the "
+             "first module clocks the others and starts them with SYNCB)")
         .def("start_acquisition", &ClvHd::pyEMG_ADS1293Pack::start_acquisition,
              "Start the acquisition of the EMG modules")
+        .def(
+            "check_sync",
+            [](ClvHd::pyEMG_ADS1293Pack &pack, int reads) {
+                ClvHd::SyncReport r = pack.check_sync(reads);
+                py::dict dict;
+                dict["locked"] = r.locked;
+                dict["osc"] = r.osc;
+                dict["errors"] = r.errors;
+                dict["samples"] = r.samples;
+                dict["skew"] = r.skew;
+                dict["skew_max"] = r.skew_max;
+                dict["resolution"] = r.resolution;
+                return dict;
+            },
+            py::arg("reads") = 256,
+            "Verify the clock lock of the modules and measure the skew of "
+            "their samples to the first module (s)")
         .def("read_all", &ClvHd::pyEMG_ADS1293Pack::pyread_all,
-             py::arg("fast") = true, "Read all the EMG data from the device");
+             py::arg("fast") = true, "Read all the EMG data from the device")
+        .def("read_streams", &ClvHd::pyEMG_ADS1293Pack::pyread_streams,
+             "Read the fast and precise data in one transaction (returns two "
+             "lists of (timestamp, values))")
+        .def("start_fifo", &ClvHd::pyEMG_ADS1293Pack::start_fifo,
+             py::arg("source") = FIFO_POLL, py::arg("compressed") = false,
+             "Sample at conversion time in the controller FIFO (source: 1 "
+             "poll, 2 DRDYB, compressed: delta coded transfers), returns the "
+             "active source (0: no FIFO)")
+        .def("stop_fifo", &ClvHd::pyEMG_ADS1293Pack::stop_fifo,
+             "Read the registers directly again")
+        .def("fifo_overflows", &ClvHd::pyEMG_ADS1293Pack::fifo_overflows,
+             "Number of fetches reporting samples dropped by the controller")
+        .def("odr", &ClvHd::pyEMG_ADS1293Pack::odr, py::arg("precise") = true,
+             "Nominal output data rate of the fast or precise stream")
+        .def("plan", &ClvHd::pyEMG_ADS1293Pack::pyplan,
+             py::arg("target_rate"), py::arg("precise") = true,
+             py::arg("chx_enable") = std::vector<bool>{true, true, true},
+             py::arg("baud") = 460800, py::arg("poll_period") = 0.,
+             "Choose and apply the decimation settings fitting the link "
+             "(returns feasible, odr, report)")
+        .def("rate_report", &ClvHd::pyEMG_ADS1293Pack::rate_report,
+             "Achieved rate against the plan")
+        .def("pop_block", &ClvHd::pyEMG_ADS1293Pack::pop_block,
+             py::arg("precise") = true,
+             "Pop the pending frames of a stream as numpy arrays (timestamps, "
+             "frames x channels)")
+        .def("pop_streams", &ClvHd::pyEMG_ADS1293Pack::pop_streams,
+             "Pop the frames read by an Acquisition thread (returns two lists "
+             "of (timestamp, values))")
+        .def("calibrate", &ClvHd::pyEMG_ADS1293Pack::calibrate,
+             py::arg("amplitude") = 2.4 / 12, py::arg("samples") = 64,
+             py::arg("settle") = 8,
+             "Measure the offset and gain of every channel with the test "
+             "signals (returns the number of calibrated channels)")
+        .def(
+            "calibration",
+            [](ClvHd::pyEMG_ADS1293Pack &pack, size_t module) {
+                if(module >= pack.modules.size())
+                    throw std::runtime_error("No module " +
+                                             std::to_string(module));
+                const ClvHd::EMG_ADS1293::Calibration &c =
+                    ((ClvHd::EMG_ADS1293 *)pack.modules[module])->calibration();
+                py::dict dict;
+                dict["offset"] = std::vector<double>(c.offset, c.offset + 3);
+                dict["gain"] = std::vector<double>(c.gain, c.gain + 3);
+                dict["fast_offset"] =
+                    std::vector<double>(c.fast_offset, c.fast_offset + 3);
+                dict["fast_gain"] =
+                    std::vector<double>(c.fast_gain, c.fast_gain + 3);
+                dict["vbat"] = std::vector<double>(c.vbat, c.vbat + 3);
+                return dict;
+            },
+            py::arg("module"), "Calibration of a module of the pack")
+        .def(
+            "mark",
+            [](ClvHd::pyEMG_ADS1293Pack &pack, const std::string &label,
+               int code) { return pack.markers.mark(label, code); },
+            py::arg("label"), py::arg("code") = 0,
+            "Insert a marker stamped now in the time base of the streams "
+            "(lock free, from any thread)")
+        .def(
+            "mark_at",
+            [](ClvHd::pyEMG_ADS1293Pack &pack, double host,
+               const std::string &label, int code) {
+                return pack.markers.mark_at(host, label, code);
+            },
+            py::arg("host"), py::arg("label"), py::arg("code") = 0,
+            "Insert a marker stamped at a host time (pyclvhd.host_clock())")
+        .def(
+            "pop_markers",
+            [](ClvHd::pyEMG_ADS1293Pack &pack) {
+                py::list list;
+                ClvHd::Marker marker;
+                while(pack.markers.pop(marker)) list.append(marker);
+                return list;
+            },
+            "Pop the pending markers (a Recorder reads its own copy of them)")
+        .def("host_offset", &ClvHd::pyEMG_ADS1293Pack::host_offset,
+             "Host clock minus controller timestamps (s), NaN before the "
+             "first read");
+
+    py::class_<ClvHd::pyAcquisition>(m, "Acquisition")
+        .def(py::init<ClvHd::pyEMG_ADS1293Pack &, int>(), py::arg("pack"),
+             py::arg("verbose") = -1, py::keep_alive<1, 2>())
+        .def("start", &ClvHd::pyAcquisition::pystart,
+             py::arg("policy") = "other", py::arg("priority") = 50,
+             py::arg("cpu") = -1, py::arg("lock_memory") = false,
+             py::arg("busy_poll") = true, py::arg("period") = 0.001,
+             "Start the acquisition thread (policy: other, fifo or rr)")
+        .def("stop", &ClvHd::pyAcquisition::stop,
+             py::call_guard<py::gil_scoped_release>(),
+             "Stop the acquisition thread")
+        .def("running", &ClvHd::pyAcquisition::running)
+        .def("stats", &ClvHd::pyAcquisition::pystats,
+             "Latency and jitter statistics of the thread (s)")
+        .def("applied", &ClvHd::pyAcquisition::applied,
+             "Real-time options that could be applied")
+        .def("error", &ClvHd::pyAcquisition::error,
+             "Exception that stopped the thread, empty if none");
+
+    py::class_<ClvHd::FilterBank>(m, "FilterBank")
+        .def(py::init<int, double>(), py::arg("nb_channels"), py::arg("fs"))
+        .def("add_bandpass", &ClvHd::FilterBank::add_bandpass, py::arg("low"),
+             py::arg("high"), py::arg("order") = 2,
+             "Add a Butterworth band-pass")
+        .def("add_highpass", &ClvHd::FilterBank::add_highpass, py::arg("fc"),
+             py::arg("order") = 2, "Add a Butterworth high-pass (DC removal)")
+        .def("add_lowpass", &ClvHd::FilterBank::add_lowpass, py::arg("fc"),
+             py::arg("order") = 2, "Add a Butterworth low-pass")
+        .def("add_notch", &ClvHd::FilterBank::add_notch, py::arg("f0"),
+             py::arg("harmonics") = 1, py::arg("Q") = 30.,
+             "Add notches at f0 and its harmonics")
+        .def("clear", &ClvHd::FilterBank::clear, "Remove all the stages")
+        .def("reset", &ClvHd::FilterBank::reset, "Reset the filter state")
+        .def("process", &ClvHd::pyfilter_process, py::arg("block"),
+             "Filter in place a float64 numpy block (frames x channels)");
+
+    py::class_<ClvHd::pyFeatureExtractor>(m, "FeatureExtractor")
+        .def(py::init<int, int, int, double, double>(), py::arg("nb_channels"),
+             py::arg("window") = 200, py::arg("hop") = 50,
+             py::arg("zc_threshold") = 0., py::arg("ssc_threshold") = 0.)
+        .def("process", &ClvHd::pyFeatureExtractor::pyprocess, py::arg("ts"),
+             py::arg("block"),
+             "Feed a block and return the new feature vectors (timestamps, "
+             "[RMS, MAV, WL, ZC, SSC] x channels)")
+        .def("process_pack", &ClvHd::pyFeatureExtractor::process_pack,
+             py::arg("pack"), py::arg("precise") = true,
+             "Feed the pending frames of a pack stream and return the new "
+             "feature vectors")
+        .def("reset", &ClvHd::pyFeatureExtractor::reset)
+        .def("size", &ClvHd::pyFeatureExtractor::size,
+             "Length of a feature vector")
+        .def_static("feature_name", &ClvHd::FeatureExtractor::feature_name);
+
+    py::class_<ClvHd::pyResampler>(m, "Resampler")
+        .def(py::init<int, double, double, int>(), py::arg("nb_channels"),
+             py::arg("fs_in"), py::arg("fs_out"), py::arg("zeros") = 8)
+        .def("process", &ClvHd::pyResampler::pyprocess, py::arg("ts"),
+             py::arg("block"),
+             "Feed a block and return the uniformly sampled frames")
+        .def("process_pack", &ClvHd::pyResampler::process_pack,
+             py::arg("pack"), py::arg("precise") = true,
+             "Feed the pending frames of a pack stream and return the "
+             "uniformly sampled frames")
+        .def("reset", &ClvHd::pyResampler::reset)
+        .def("delay", &ClvHd::pyResampler::delay,
+             "Group delay of the filter (s)")
+        .def("rate", &ClvHd::pyResampler::rate, "Exact output rate (Hz)");
+
+    py::class_<ClvHd::pySpectralAnalyzer>(m, "SpectralAnalyzer")
+        .def(py::init<int, double, size_t, double, int>(),
+             py::arg("nb_channels"), py::arg("fs"), py::arg("window") = 256,
+             py::arg("overlap") = 0.5, py::arg("averages") = 8)
+        .def("set_range", &ClvHd::pySpectralAnalyzer::set_range,
+             py::arg("fmin"), py::arg("fmax"),
+             "Frequency range of the MNF, MDF and total power (Hz)")
+        .def("add_band", &ClvHd::pySpectralAnalyzer::add_band, py::arg("low"),
+             py::arg("high"), "Publish the power of a band (Hz)")
+        .def("process", &ClvHd::pySpectralAnalyzer::pyprocess, py::arg("ts"),
+             py::arg("block"),
+             "Feed a block and return the new spectral features (timestamps, "
+             "[MNF, MDF, power, bands...] x channels)")
+        .def("process_pack", &ClvHd::pySpectralAnalyzer::process_pack,
+             py::arg("pack"), py::arg("precise") = true,
+             "Feed the pending frames of a pack stream and return the new "
+             "spectral features")
+        .def("psd", &ClvHd::pySpectralAnalyzer::psd, py::arg("channel"),
+             "Averaged power spectral density of a channel")
+        .def("frequencies", &ClvHd::pySpectralAnalyzer::frequencies,
+             "Frequencies of the PSD bins (Hz)")
+        .def("reset", &ClvHd::pySpectralAnalyzer::reset)
+        .def("size", &ClvHd::pySpectralAnalyzer::size,
+             "Length of a feature frame");
+
+    py::class_<ClvHd::Event>(m, "Event")
+        .def_readonly("timestamp", &ClvHd::Event::timestamp)
+        .def_readonly("detected", &ClvHd::Event::detected)
+        .def_readonly("channel", &ClvHd::Event::channel)
+        .def_readonly("onset", &ClvHd::Event::onset)
+        .def_readonly("value", &ClvHd::Event::value)
+        .def_readonly("delay", &ClvHd::Event::delay)
+        .def("__repr__", [](const ClvHd::Event &e) {
+            return std::string(e.onset ? "<onset" : "<offset") + " ch" +
+                   std::to_string(e.channel) + " at " +
+                   std::to_string(e.timestamp) + ">";
+        });
+
+    py::class_<ClvHd::DetectorConfig>(m, "DetectorConfig")
+        .def(py::init<>())
+        .def_readwrite("teager", &ClvHd::DetectorConfig::teager)
+        .def_readwrite("envelope_hz", &ClvHd::DetectorConfig::envelope_hz)
+        .def_readwrite("h_on", &ClvHd::DetectorConfig::h_on)
+        .def_readwrite("h_off", &ClvHd::DetectorConfig::h_off)
+        .def_readwrite("min_on", &ClvHd::DetectorConfig::min_on)
+        .def_readwrite("min_off", &ClvHd::DetectorConfig::min_off)
+        .def_readwrite("baseline_s", &ClvHd::DetectorConfig::baseline_s)
+        .def_readwrite("warmup_s", &ClvHd::DetectorConfig::warmup_s);
+
+    py::class_<ClvHd::pyDetector>(m, "Detector")
+        .def(py::init<int, double, ClvHd::DetectorConfig>(),
+             py::arg("nb_channels"), py::arg("fs"),
+             py::arg("config") = ClvHd::DetectorConfig())
+        .def("set_callback", &ClvHd::pyDetector::set_callback,
+             py::arg("callback"), "Function called with each Event")
+        .def("process", &ClvHd::pyDetector::pyprocess, py::arg("ts"),
+             py::arg("block"), "Feed a block and return the new events")
+        .def("process_pack", &ClvHd::pyDetector::process_pack,
+             py::arg("pack"), py::arg("precise") = true,
+             "Feed the pending frames of a pack stream and return the new "
+             "events")
+        .def("active", &ClvHd::pyDetector::active, py::arg("channel"))
+        .def("reset", &ClvHd::pyDetector::reset)
+        .def("stats",
+             [](ClvHd::pyDetector &d) {
+                 ClvHd::DetectorStats s = d.stats();
+                 py::dict dict;
+                 dict["events"] = s.events;
+                 dict["dropped"] = s.dropped;
+                 dict["delay_mean"] = s.delay_mean;
+                 dict["delay_max"] = s.delay_max;
+                 return dict;
+             },
+             "Detection to consumption delay of the events (s)")
+        .def_static("now", &ClvHd::Detector::now,
+                    "Host clock of Event.detected (s)");
+
+    py::class_<ClvHd::Decision>(m, "Decision")
+        .def_readonly("timestamp", &ClvHd::Decision::timestamp)
+        .def_readonly("decided", &ClvHd::Decision::decided)
+        .def_readonly("label", &ClvHd::Decision::label)
+        .def_readonly("probability", &ClvHd::Decision::probability)
+        .def_readonly("latency", &ClvHd::Decision::latency)
+        .def("__repr__", [](const ClvHd::Decision &d) {
+            return "<class " + std::to_string(d.label) + " (" +
+                   std::to_string(d.probability) + ") at " +
+                   std::to_string(d.timestamp) + ">";
+        });
+
+    py::class_<ClvHd::pyClassifier>(m, "Classifier")
+        .def(py::init<int>(), py::arg("verbose") = -1)
+        .def("load", &ClvHd::pyClassifier::load, py::arg("path"),
+             "Load a model (.json or binary)")
+        .def("save", &ClvHd::pyClassifier::save, py::arg("path"),
+             "Save the model in the binary format")
+        .def("inputs", &ClvHd::pyClassifier::inputs)
+        .def("classes", &ClvHd::pyClassifier::classes)
+        .def_readwrite("labels", &ClvHd::pyClassifier::labels)
+        .def("set_callback", &ClvHd::pyClassifier::pyset_callback,
+             py::arg("callback"),
+             "Function called with the Decision when the class changes")
+        .def("predict", &ClvHd::pyClassifier::pypredict, py::arg("features"),
+             "Classify one feature vector (returns label, probabilities)")
+        .def("process", &ClvHd::pyClassifier::pyprocess, py::arg("ts"),
+             py::arg("features"),
+             py::arg("clock_offset") = std::numeric_limits<double>::quiet_NaN(),
+             "Classify feature vectors and return the decisions")
+        .def("process_features", &ClvHd::pyClassifier::process_features,
+             py::arg("extractor"),
+             py::arg("clock_offset") = std::numeric_limits<double>::quiet_NaN(),
+             "Classify the pending vectors of a FeatureExtractor (clock_offset: "
+             "EMG_ADS1293Pack.host_offset())")
+        .def("stats",
+             [](ClvHd::pyClassifier &c) {
+                 ClvHd::ClassifierStats s = c.stats();
+                 py::dict dict;
+                 dict["decisions"] = s.decisions;
+                 dict["latency_mean"] = s.latency_mean;
+                 dict["latency_max"] = s.latency_max;
+                 dict["inference_mean"] = s.inference_mean;
+                 dict["inference_max"] = s.inference_max;
+                 return dict;
+             },
+             "Sample to decision latency and inference time (s)");
+
+    py::class_<ClvHd::pySignalQuality>(m, "SignalQuality")
+        .def(py::init<int, double, double, double>(), py::arg("nb_channels"),
+             py::arg("fs"), py::arg("line_hz") = 50., py::arg("period_s") = .5)
+        .def("set_rails", &ClvHd::pySignalQuality::set_rails_pack,
+             py::arg("pack"), py::arg("margin") = 0.01,
+             "Use the saturation levels of the channels of a pack")
+        .def("set_flat_threshold", &ClvHd::pySignalQuality::set_flat_threshold,
+             py::arg("threshold"))
+        .def("process", &ClvHd::pySignalQuality::pyprocess, py::arg("ts"),
+             py::arg("block"),
+             "Feed a block and return the new status frames (timestamps, "
+             "[LINE_RATIO, SATURATION, FLATLINE, ERRORS] x channels)")
+        .def("process_pack", &ClvHd::pySignalQuality::process_pack,
+             py::arg("pack"), py::arg("precise") = true,
+             "Feed the pending frames and error reports of a pack and return "
+             "the new status frames")
+        .def("reset", &ClvHd::pySignalQuality::reset)
+        .def("period", &ClvHd::pySignalQuality::period,
+             "Samples per status frame")
+        .def("size", &ClvHd::pySignalQuality::size,
+             "Length of a status frame");
+
+    py::class_<ClvHd::SpatialMatrix>(m, "SpatialMatrix")
+        .def_static(
+            "dense",
+            [](py::array_t<double, py::array::c_style | py::array::forcecast>
+                   values) {
+                if(values.ndim() != 2)
+                    throw std::runtime_error("The matrix must be 2D");
+                return ClvHd::SpatialMatrix::dense(
+                    values.shape(0), values.shape(1), values.data());
+            },
+            py::arg("values"), "Dense matrix (outputs x channels)")
+        .def_static("bipolar", &ClvHd::SpatialMatrix::bipolar,
+                    py::arg("nb_channels"), py::arg("pairs"),
+                    "One output x[a] - x[b] per pair (a, b)")
+        .def_static("differential", &ClvHd::SpatialMatrix::differential,
+                    py::arg("nb_channels"), py::arg("grid"),
+                    py::arg("double_diff") = false,
+                    "Single or double differential along the grid rows "
+                    "(grid of channel indices, -1 if none)")
+        .def_static("laplacian", &ClvHd::SpatialMatrix::laplacian,
+                    py::arg("nb_channels"), py::arg("grid"),
+                    "Laplacian of the grid (channel indices, -1 if none)")
+        .def("rows", &ClvHd::SpatialMatrix::rows)
+        .def("cols", &ClvHd::SpatialMatrix::cols)
+        .def("sparse", &ClvHd::SpatialMatrix::sparse)
+        .def("ignored", &ClvHd::SpatialMatrix::ignored,
+             "Coefficients out of the matrix (not applied), rejected by "
+             "SpatialFilter.set");
+
+    py::class_<ClvHd::pySpatialFilter>(m, "SpatialFilter")
+        .def(py::init<>())
+        .def("set", &ClvHd::pySpatialFilter::set, py::arg("matrix"),
+             "Set the matrix (swapped atomically if the dimensions match)")
+        .def("process", &ClvHd::pySpatialFilter::pyprocess, py::arg("ts"),
+             py::arg("block"),
+             "Feed a block and return the virtual channels (timestamps, "
+             "frames x outputs)")
+        .def("process_pack", &ClvHd::pySpatialFilter::process_pack,
+             py::arg("pack"), py::arg("precise") = true,
+             "Feed the pending frames of a pack stream and return the "
+             "virtual channels")
+        .def("outputs", &ClvHd::pySpatialFilter::outputs);
+
+    py::class_<ClvHd::pyRecorder>(m, "Recorder")
+        .def(py::init<int>(), py::arg("verbose") = -1)
+        .def("open", &ClvHd::pyRecorder::open, py::arg("path"),
+             py::arg("nb_channels"),
+             py::arg("names") = std::vector<std::string>(),
+             "Open the file (one 'timestamp, values...' line per frame)")
+        .def("write", &ClvHd::pyRecorder::pywrite, py::arg("ts"),
+             py::arg("block"), "Write a block (frames x channels)")
+        .def("close", &ClvHd::pyRecorder::close)
+        .def("record_pack", &ClvHd::pyRecorder::record_pack,
+             py::arg("pack"), py::arg("precise") = true,
+             "Record the pending frames of a pack stream, with the markers "
+             "of the pack interleaved at their timestamps")
+        .def("frames", &ClvHd::pyRecorder::frames,
+             "Number of frames written");
+
+    py::class_<ClvHd::pyShmPublisher>(m, "ShmPublisher")
+        .def(py::init<int>(), py::arg("verbose") = -1)
+        .def("open", &ClvHd::pyShmPublisher::open, py::arg("name"),
+             py::arg("nb_channels"), py::arg("capacity") = 1 << 16,
+             py::arg("rate") = 0.,
+             "Create the shared-memory ring (name like '/clvhd_precise')")
+        .def("write", &ClvHd::pyShmPublisher::pywrite, py::arg("ts"),
+             py::arg("block"), "Publish a block (frames x channels)")
+        .def("publish_pack", &ClvHd::pyShmPublisher::publish_pack,
+             py::arg("pack"), py::arg("precise") = true,
+             "Publish the pending frames of a pack stream")
+        .def("close", &ClvHd::pyShmPublisher::close)
+        .def("frames", &ClvHd::pyShmPublisher::frames,
+             "Number of frames published");
+
+    py::class_<ClvHd::pyShmReader>(m, "ShmReader")
+        .def(py::init<int>(), py::arg("verbose") = -1)
+        .def("attach", &ClvHd::pyShmReader::pyattach, py::arg("name"),
+             "Attach read-only to a ring, from its newest frame (-1 if it "
+             "does not exist)")
+        .def("detach", &ClvHd::pyShmReader::pydetach,
+             "Unmap the ring, the peeked views must be deleted first")
+        .def(
+            "peek",
+            [](py::object self) {
+                return self.cast<ClvHd::pyShmReader &>().pypeek(self);
+            },
+            "Pending frames as read-only views of the shared memory "
+            "(timestamps, frames x channels), until consume(). detach() "
+            "is refused while a view is alive")
+        .def("consume", &ClvHd::pyShmReader::consume, py::arg("n"),
+             "Release n peeked frames, returns how many of them were not "
+             "overwritten meanwhile")
+        .def("read", &ClvHd::pyShmReader::pyread,
+             py::arg("max_frames") = std::numeric_limits<size_t>::max(),
+             "Copy the pending frames (timestamps, frames x channels)")
+        .def("pending", &ClvHd::pyShmReader::pending)
+        .def("closed", &ClvHd::pyShmReader::closed,
+             "True once the publisher closed the ring")
+        .def("channels", &ClvHd::pyShmReader::channels)
+        .def("rate", &ClvHd::pyShmReader::rate)
+        .def("lost", &ClvHd::pyShmReader::lost,
+             "Frames overwritten before they were read");
         
 }
 
@@ -1,5 +1,18 @@
+#include "clvHd_acquisition.hpp"
+#include "clvHd_classifier.hpp"
 #include "clvHd_controller.hpp"
+#include "clvHd_detector.hpp"
 #include "clvHd_device.hpp"
+#include "clvHd_features.hpp"
+#include "clvHd_filter.hpp"
+#include "clvHd_marker.hpp"
 #include "clvHd_module.hpp"
 #include "clvHd_module_ADS1293EMG.hpp"
+#include "clvHd_planner.hpp"
+#include "clvHd_quality.hpp"
+#include "clvHd_recorder.hpp"
+#include "clvHd_resampler.hpp"
+#include "clvHd_shm.hpp"
+#include "clvHd_spatial.hpp"
+#include "clvHd_spectral.hpp"
 // #include "clvHdADS1298EMG.hpp"
\ No newline at end of file
@@ -0,0 +1,156 @@
+#ifndef __CLV_HD_ACQUISITION_HPP__
+#define __CLV_HD_ACQUISITION_HPP__
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <stdint.h> // uint8_t, uint16_t, uint32_t, uint64_t
+
+#include "clvHd_module_ADS1293EMG.hpp"
+#include "strANSIseq.hpp"
+
+namespace ClvHd
+{
+
+/**
+ * @brief Options of the acquisition thread.
+ *
+ * The real-time options need privileges (CAP_SYS_NICE, RLIMIT_MEMLOCK);
+ * when they are not available the thread keeps running with what could be
+ * applied and the failures are reported by Acquisition::applied().
+ */
+struct AcquisitionOptions
+{
+    enum Policy
+    {
+        OTHER = 0, // Default time-sharing scheduling
+        FIFO = 1,  // Real-time, first in first out (SCHED_FIFO)
+        RR = 2     // Real-time, round robin (SCHED_RR)
+    };
+
+    Policy policy = OTHER;
+    int priority = 50;                 // Real-time priority (1 to 99)
+    int cpu = -1;                      // CPU to pin the thread to, -1: any
+    bool lock_memory = false;          // mlockall and pre-fault the stack
+    size_t prefault_stack = 256 * 1024; // Bytes of stack touched when locking
+    bool busy_poll = true;             // Read back to back (no sleep)
+    double period_s = 0.001;           // Read period when not busy polling
+};
+
+/**
+ * @brief Latency and jitter statistics of the acquisition thread (s).
+ */
+struct AcquisitionStats
+{
+    uint64_t reads = 0;          // Number of transactions
+    uint64_t errors = 0;         // Number of failed transactions
+    double latency_mean = 0;     // Duration of a transaction
+    double latency_max = 0;
+    double period_mean = 0;      // Interval between two transactions
+    double period_jitter = 0;    // Standard deviation of the interval
+    double period_max = 0;       // Longest gap between two transactions
+    double wakeup_mean = 0;      // Lateness of the wake up (period mode)
+    double wakeup_max = 0;
+
+    std::string
+    str() const;
+};
+
+/**
+ * @brief Acquisition engine: a thread driving the transactions of a pack.
+ *
+ * The thread calls EMG_ADS1293Pack::read_streams() in a loop, either back to
+ * back (busy poll) or at a fixed period (absolute deadlines), and the
+ * consumers pop the frames from the pack rings. A failed transaction
+ * (std::string error) is counted and the loop goes on; any other exception
+ * stops the loop and is kept in error().
+ */
+class Acquisition : virtual public ESC::CLI
+{
+    public:
+    Acquisition(EMG_ADS1293Pack *pack, int verbose = -1)
+        : ESC::CLI(verbose, "ClvHd-Acquisition"), m_pack(pack) {};
+    ~Acquisition() { stop(); };
+
+    /**
+     * @brief Start the acquisition thread.
+     *
+     * @param options Scheduling, affinity, memory locking and polling mode.
+     */
+    void
+    start(const AcquisitionOptions &options = AcquisitionOptions());
+
+    /**
+     * @brief Stop and join the thread. If start() locked the memory, the
+     * locks are released with munlockall(), which applies to the whole
+     * process (mlockall() cannot lock a single thread).
+     */
+    void
+    stop();
+
+    bool
+    running()
+    {
+        return m_running.load();
+    };
+
+    /**
+     * @brief Statistics since the start of the thread.
+     */
+    AcquisitionStats
+    stats()
+    {
+        std::lock_guard<std::mutex> lock(m_stats_mutex);
+        return m_stats;
+    };
+
+    /**
+     * @brief Report of the options that could be applied.
+     */
+    std::string
+    applied()
+    {
+        std::lock_guard<std::mutex> lock(m_stats_mutex);
+        return m_applied;
+    };
+
+    /**
+     * @brief Exception that stopped the thread, empty if none.
+     */
+    std::string
+    error()
+    {
+        std::lock_guard<std::mutex> lock(m_stats_mutex);
+        return m_error;
+    };
+
+    private:
+    void
+    loop();
+
+    std::string
+    apply_options();
+
+    /**
+     * @brief Stop the loop on an unexpected exception and keep its message.
+     */
+    void
+    fail(AcquisitionStats &s, const std::string &error);
+
+    EMG_ADS1293Pack *m_pack;
+    AcquisitionOptions m_options;
+    std::thread m_thread;
+    std::atomic<bool> m_running{false};
+    bool m_locked = false; // mlockall() applied by the thread
+
+    std::mutex m_stats_mutex;
+    AcquisitionStats m_stats;
+    std::string m_applied;
+    std::string m_error;
+};
+
+} // namespace ClvHd
+
+#endif // __CLV_HD_ACQUISITION_HPP__
@@ -0,0 +1,126 @@
+#ifndef __CLV_HD_CACHE_HPP__
+#define __CLV_HD_CACHE_HPP__
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stdint.h> // uint8_t, uint16_t, uint32_t, uint64_t
+
+#include "strANSIseq.hpp"
+
+namespace ClvHd
+{
+
+/**
+ * @brief On-disk cache of the topology and register images of a device.
+ *
+ * Each entry is keyed by the controller version and the number of modules on
+ * the chain. For every module it stores the detected type, a fingerprint of
+ * the configuration that was applied and the resulting register image, so a
+ * reconnecting device can skip the module probing and only rewrite the
+ * registers that differ from the cached image.
+ *
+ * The file is a plain text file:
+ * @code
+ * [v3.0-n4]
+ * <id> <type> <config fingerprint> <register image in hex> [calibration]
+ * @endcode
+ * The optional calibration is a comma separated list of values (see
+ * EMG_ADS1293Pack::calibrate()).
+ */
+class ConfigCache : virtual public ESC::CLI
+{
+    public:
+    struct ModuleImage
+    {
+        std::string type;          // Module type ("" if unknown)
+        std::string config;        // Fingerprint of the applied configuration
+        std::vector<uint8_t> regs; // Register image after configuration
+        std::vector<double> calibration; // Calibration of the channels
+    };
+
+    struct Entry
+    {
+        std::string key;
+        std::vector<ModuleImage> modules;
+    };
+
+    ConfigCache(const std::string &path, int verbose = -1)
+        : ESC::CLI(verbose, "ClvHd-Cache"), m_path(path) {};
+    ~ConfigCache() {};
+
+    /**
+     * @brief Build the key identifying a controller and its module chain.
+     *
+     * @param version Version of the controller board (see Controller::getVersion).
+     * @param nb_modules Number of modules found on the chain.
+     * @return std::string Key of the cache entry.
+     */
+    static std::string
+    make_key(const std::string &version, int nb_modules)
+    {
+        return "v" + version + "-n" + std::to_string(nb_modules);
+    };
+
+    /**
+     * @brief Load the cache file. A missing file is not an error.
+     * @return int Number of entries loaded, -1 if the file is corrupted.
+     */
+    int
+    load();
+
+    /**
+     * @brief Write the cache file.
+     * @return int 0 if success, -1 if error.
+     */
+    int
+    save();
+
+    /**
+     * @brief Get the entry corresponding to the key.
+     * @return Entry* The entry or nullptr if the key is not cached.
+     */
+    Entry *
+    find(const std::string &key)
+    {
+        auto it = m_entries.find(key);
+        return (it == m_entries.end()) ? nullptr : &it->second;
+    };
+
+    /**
+     * @brief Get the entry corresponding to the key, create it if needed.
+     *
+     * @param key Key of the entry (see make_key).
+     * @param nb_modules Number of modules of the chain.
+     */
+    Entry &
+    entry(const std::string &key, int nb_modules)
+    {
+        Entry &e = m_entries[key];
+        e.key = key;
+        if(e.modules.size() < (size_t)nb_modules)
+            e.modules.resize(nb_modules);
+        return e;
+    };
+
+    void
+    clear()
+    {
+        m_entries.clear();
+    };
+
+    const std::string &
+    path()
+    {
+        return m_path;
+    };
+
+    private:
+    std::string m_path;
+    std::map<std::string, Entry> m_entries;
+};
+
+} // namespace ClvHd
+
+#endif // __CLV_HD_CACHE_HPP__
@@ -0,0 +1,223 @@
+#ifndef __CLV_HD_CLASSIFIER_HPP__
+#define __CLV_HD_CLASSIFIER_HPP__
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <stdint.h> // uint8_t, uint16_t, uint32_t, uint64_t
+
+#include "clvHd_module.hpp"
+#include "clvHd_ring.hpp"
+#include "strANSIseq.hpp"
+
+namespace ClvHd
+{
+
+/**
+ * @brief Dense layer y = f(W x + b). The weights are stored transposed
+ * (inputs x outputs) so the kernel accumulates contiguous output vectors.
+ */
+struct Layer
+{
+    enum Activation
+    {
+        LINEAR = 0,
+        RELU,
+        TANH,
+        SIGMOID,
+        SOFTMAX
+    };
+
+    int inputs = 0;
+    int outputs = 0;
+    Activation activation = LINEAR;
+    std::vector<float> weights_t; // inputs x outputs
+    std::vector<float> bias;
+};
+
+/**
+ * @brief Decision of the classifier.
+ */
+struct Decision
+{
+    double timestamp = 0; // Timestamp of the feature vector (last sample)
+    double decided = 0;   // Host time of the decision (host_clock(), s)
+    int label = -1;       // Most probable class
+    float probability = 0;
+    double latency = 0;   // Sample to decision (s), NaN if clock unknown
+};
+
+/**
+ * @brief Latency statistics of the classifier (s).
+ */
+struct ClassifierStats
+{
+    uint64_t decisions = 0;
+    double latency_mean = 0;   // Sample timestamp to decision
+    double latency_max = 0;
+    double inference_mean = 0; // Duration of one inference
+    double inference_max = 0;
+};
+
+/**
+ * @brief Inference of a linear (LDA) or small dense network on feature
+ * vectors.
+ *
+ * The model is a stack of dense layers, optionally preceded by a
+ * standardisation of the inputs, loaded from a JSON file:
+ * {"labels": ["rest", ...], "mean": [...], "std": [...],
+ *  "layers": [{"weights": [[...], ...], "bias": [...], "activation": "relu"}]}
+ * (weights as outputs x inputs, activation linear, relu, tanh, sigmoid or
+ * softmax) or from the equivalent binary file written by save().
+ *
+ * Each decision carries the class probabilities and the latency from the
+ * sample timestamp to the decision, using the host offset of the
+ * controller clock (EMG_ADS1293Pack::host_offset()). The feedback (RGB
+ * color of a module per class, or a callback) is sent when the decision
+ * changes; it writes to the controller, so run the classifier in the thread
+ * doing the reads.
+ */
+class Classifier : virtual public ESC::CLI
+{
+    public:
+    Classifier(int verbose = -1) : ESC::CLI(verbose, "ClvHd-Classifier") {};
+
+    /**
+     * @brief Load a model (JSON if the path ends with .json, binary
+     * otherwise).
+     *
+     * @return int 0 if success, -1 otherwise.
+     */
+    int
+    load(const std::string &path);
+
+    int
+    load_json(const std::string &path);
+
+    int
+    load_binary(const std::string &path);
+
+    /**
+     * @brief Save the model in the binary format.
+     */
+    int
+    save(const std::string &path) const;
+
+    /**
+     * @brief Remove the layers and the normalisation.
+     */
+    void
+    clear();
+
+    /**
+     * @brief Append a dense layer.
+     *
+     * @param weights Weights (outputs x inputs, row major).
+     */
+    void
+    add_layer(int inputs,
+              int outputs,
+              const float *weights,
+              const float *bias,
+              Layer::Activation activation);
+
+    void
+    set_normalization(const std::vector<float> &mean,
+                      const std::vector<float> &std);
+
+    int
+    inputs() const
+    {
+        return m_layers.empty() ? 0 : m_layers.front().inputs;
+    };
+
+    int
+    classes() const
+    {
+        return m_layers.empty() ? 0 : m_layers.back().outputs;
+    };
+
+    /**
+     * @brief Run the network on one feature vector.
+     *
+     * @param features inputs() values.
+     * @param probabilities Destination of classes() values (or nullptr).
+     * @return int Most probable class.
+     */
+    int
+    predict(const double *features, float *probabilities = nullptr);
+
+    /**
+     * @brief Classify feature vectors and emit the decisions.
+     *
+     * @param clock_offset Host offset of the timestamps (NaN if unknown).
+     * @return int Number of decisions.
+     */
+    int
+    process(const double *timestamps,
+            const double *features,
+            size_t n_vectors,
+            double clock_offset);
+
+    /**
+     * @brief Classify all the pending vectors of a ring (e.g. the output of
+     * a FeatureExtractor).
+     *
+     * @return int Number of decisions, -1 if the ring does not have inputs()
+     * channels.
+     */
+    int
+    process(SampleRing &features, double clock_offset);
+
+    /**
+     * @brief Function called when the decision changes.
+     */
+    void
+    set_callback(std::function<void(const Decision &)> callback)
+    {
+        m_callback = callback;
+    };
+
+    /**
+     * @brief Show the decision with the LED of a module (one color per
+     * class, nullptr to disable).
+     */
+    void
+    set_rgb_feedback(Module *module, const std::vector<RGBColor> &colors)
+    {
+        m_feedback_module = module;
+        m_feedback_colors = colors;
+    };
+
+    ClassifierStats
+    stats() const
+    {
+        return m_stats;
+    };
+
+    std::vector<std::string> labels; // Names of the classes
+    Ring<Decision> decisions;        // Decisions
+    SampleRing probabilities;        // Class probabilities (per decision)
+
+    private:
+    void
+    resize_outputs();
+
+    std::vector<Layer> m_layers;
+    std::vector<float> m_mean;
+    std::vector<float> m_inv_std;
+    std::vector<float> m_a, m_b; // Activations (scratch)
+    std::vector<float> m_p;      // Probabilities of a decision (scratch)
+    int m_last_label = -1;
+    std::function<void(const Decision &)> m_callback;
+    Module *m_feedback_module = nullptr;
+    std::vector<RGBColor> m_feedback_colors;
+    ClassifierStats m_stats;
+    uint64_t m_latencies = 0;
+    RingBlock m_block{64}; // Scratch of process(ring)
+};
+
+} // namespace ClvHd
+
+#endif // __CLV_HD_CLASSIFIER_HPP__
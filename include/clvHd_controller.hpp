@@ -13,10 +13,46 @@
 #include "strANSIseq.hpp"
 #include "clvHd_module.hpp" // Module class
 
+// Largest reply payload (in bytes) every controller firmware can buffer
+#define CLVHD_MAX_REPLY_SIZE 246
+// Largest long reply (16 bits size) of the 3.4 firmwares: 32 modules of 64
+// bytes
+#define CLVHD_LONG_REPLY_SIZE 2048
+
+// Sources of the controller FIFO (see Controller::startFifo)
+#define FIFO_STOP 0
+#define FIFO_POLL 1  // Polling of DATA_STATUS by the controller
+#define FIFO_DRDYB 2 // Data ready interrupt
+// Flags of a FIFO fetch (see Controller::fetchFifo)
+#define FIFO_OVERFLOW 0b01 // Samples dropped since the last fetch
+#define FIFO_PENDING 0b10  // Samples left in the FIFO
+#define FIFO_COMPRESSED 0b100 // Delta coded drain (see Controller::drainFifo)
 
 namespace ClvHd
 {
 
+/**
+ * @brief Frames of a bulk drain of the controller FIFO (see
+ * Controller::drainFifo), with their timestamps unpacked.
+ */
+struct FifoFrames
+{
+    uint32_t mask = 0;                // Modules of the frames
+    uint8_t size = 0;                 // Bytes per module
+    uint8_t flags = 0;                // FIFO_OVERFLOW | FIFO_PENDING | ...
+    uint64_t timestamp = 0;           // Controller clock at the reply (us)
+    size_t count = 0;                 // Number of frames
+    size_t stride = 0;                // Bytes per frame (modules x size)
+    std::vector<uint64_t> timestamps; // Controller clock (us)
+    std::vector<uint8_t> data;        // count x stride bytes
+
+    const uint8_t *
+    frame(size_t i) const
+    {
+        return data.data() + i * stride;
+    };
+};
+
 /**
  * @brief The CleverHand Controller board class
  * @author Alexis Devillard
@@ -108,8 +144,129 @@ class Controller : virtual public ESC::CLI
      * @brief Get the version of the controller board.
      * @return The version of the controller board as a std::string. If an empty string is returned, an error occured.
      */
-    std::string
-    getVersion(uint8_t *major = nullptr, uint8_t *minor = nullptr);
+    virtual std::string
+    getVersion(uint8_t *major = nullptr, uint8_t *minor = nullptr)
+    {
+        (void)major;
+        (void)minor;
+        return "";
+    };
+
+    /**
+     * @brief Get the number of modules already enumerated by the controller
+     * board, without running the enumeration again.
+     * @return The number of modules, 0 if the chain was not enumerated yet.
+     */
+    virtual uint8_t
+    getNbModules()
+    {
+        return 0;
+    };
+
+    /**
+     * @brief Largest reply payload of the controller (in bytes), to split
+     * the reads of many modules.
+     */
+    virtual size_t
+    maxReplySize()
+    {
+        return CLVHD_MAX_REPLY_SIZE;
+    };
+
+    /**
+     * @brief Sample the modules given by the mask_id at conversion time in
+     * the FIFO of the controller board (see fetchFifo()).
+     *
+     * @param mask_id Mask of the modules to sample.
+     * @param n_cmd Number of bytes of the read command.
+     * @param cmd Read command sent to every module at each sample.
+     * @param size Number of bytes read from every module.
+     * @param source FIFO_STOP, FIFO_POLL or FIFO_DRDYB.
+     * @return int Active source, -1 if the controller has no FIFO.
+     */
+    virtual int
+    startFifo(uint32_t mask_id,
+              uint8_t n_cmd,
+              uint8_t *cmd,
+              uint8_t size,
+              uint8_t source)
+    {
+        (void)mask_id;
+        (void)n_cmd;
+        (void)cmd;
+        (void)size;
+        (void)source;
+        return -1;
+    };
+
+    /**
+     * @brief Move up to max_entries samples of the FIFO in buff.
+     *
+     * The reply is [count | flags | count x (u32 timestamp (us) | size bytes
+     * per module)], flags being a combination of FIFO_OVERFLOW and
+     * FIFO_PENDING.
+     *
+     * @param buff Buffer of CLVHD_MAX_REPLY_SIZE bytes.
+     * @param timestamp Timestamp of the reply.
+     * @return int Number of bytes read, -1 if the controller has no FIFO.
+     */
+    virtual int
+    fetchFifo(uint8_t max_entries, uint8_t *buff, uint64_t *timestamp = nullptr)
+    {
+        (void)max_entries;
+        (void)buff;
+        (void)timestamp;
+        return -1;
+    };
+
+    /**
+     * @brief Move up to max_frames samples of the FIFO in frames, in one
+     * transaction (as many as the controller buffer holds).
+     *
+     * @param compressed Ask for delta coded samples (ADS1293 windows of the
+     * DATA_STATUS read), if the controller supports it. The frames are
+     * decoded the same.
+     * @return int Number of frames, -1 if the controller has no bulk drain
+     * (see fetchFifo()).
+     */
+    virtual int
+    drainFifo(uint16_t max_frames, FifoFrames &frames, bool compressed = false)
+    {
+        (void)max_frames;
+        (void)frames;
+        (void)compressed;
+        return -1;
+    };
+
+    /**
+     * @brief Set the SPI clock of the modules bus.
+     *
+     * @param clock Requested clock (Hz), limited to the maximum of the
+     * modules by the controller.
+     * @return int Applied clock (Hz), -1 if the controller cannot set it.
+     */
+    virtual int
+    setSpiClock(uint32_t clock)
+    {
+        (void)clock;
+        return -1;
+    };
+
+    /**
+     * @brief Aggregate the replies of the controller in transfers of packet
+     * multiples, each reply waiting at most budget_us.
+     *
+     * @param packet Transfer granularity (USB packet size), 0 to disable.
+     * @return int Applied packet size, -1 if the controller cannot
+     * aggregate.
+     */
+    virtual int
+    setAggregation(uint16_t packet, uint16_t budget_us)
+    {
+        (void)packet;
+        (void)budget_us;
+        return -1;
+    };
 
     operator std::string() const { return "Controller board"; };
 
@@ -2,12 +2,17 @@
 #define __CLV_HD_MONO_HPP__
 
 #include <algorithm> // for std::copy
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
-
-#include <tcp_client.hpp>
-#include <udp_client.hpp>
+#include <vector>
 
 #define TCP_PORT 5000
 #define UDP_PORT 12345
@@ -16,158 +21,284 @@
 
 namespace ClvHd
 {
+
+/**
+ * @brief Reception counters of the UDP stream of a module.
+ */
+struct StreamStats
+{
+    uint64_t datagrams = 0;  // Datagrams received
+    uint64_t samples = 0;    // Samples delivered
+    uint64_t lost = 0;       // Samples of the datagrams given up
+    uint64_t duplicates = 0; // Datagrams received twice
+    uint64_t reordered = 0;  // Datagrams received ahead of a missing one
+    uint64_t late = 0;       // Datagrams given up or older than the first
+};
+
+/**
+ * @brief Controller of the MONOMOD Wi-Fi modules (one ADS chip per module).
+ *
+ * The modules broadcast "MONOMOD" on the UDP port and are answered with
+ * the TCP port, then connect and identify themselves with their MAC
+ * address ('A' | n | mac). A single I/O thread runs the discovery socket,
+ * the listening socket and the connections of all the modules on one epoll
+ * loop, and parses their messages as they arrive. The module ids follow the
+ * order of identification, and a module reconnecting with the same MAC gets
+ * its id back.
+ *
+ * The commands are sent from the calling thread: readCmd_multi() sends the
+ * read ('r' | size | n_cmd | cmd) to every masked module first, then waits
+ * for their replies ('R' | n | data), so the modules answer in parallel.
+ * The timestamps are the host clock (us) at the last reply. The replies are
+ * not tagged, so after a timeout the connections still owing a reply are
+ * dropped, and the modules reconnect.
+ *
+ * In FIFO mode (startFifo()), the modules poll their own DATA_STATUS and
+ * send their samples in batches over UDP: 'S' | id | n | count | u32 seq |
+ * u32 index of the first sample | count x (u32 module clock (us) | n
+ * bytes). The datagrams are received in bulk (recvmmsg) by the I/O thread
+ * and put back in order in a window of each module: a missing datagram is
+ * given up when the window is full or after the hold time, and its samples
+ * are counted as lost (see streamStats()). drainFifo() maps the module
+ * clocks to the host clock and merges the samples of the modules closer
+ * than half a sample period into frames, like MultiController.
+ */
 class MonoController : public Controller
 {
     public:
-    MonoController(int verbose = -1)
-        : ESC::CLI(verbose, "monoclvhd"), serverTCP(TCP_PORT, 10, verbose - 1),
-          serverUDP(UDP_PORT, 10, verbose - 1)
+    MonoController(int verbose = -1,
+                   uint16_t tcp_port = TCP_PORT,
+                   uint16_t udp_port = UDP_PORT)
+        : ESC::CLI(verbose, "monoclvhd"), m_tcp_port(tcp_port),
+          m_udp_port(udp_port)
     {
         logln("created", true);
     };
     ~MonoController()
     {
+        stop();
         logln("destroyed", true);
-        serverTCP.stop();
-        serverUDP.stop();
     };
 
+    /**
+     * @brief Open the discovery and listening sockets and start the I/O
+     * thread.
+     */
     void
-    start()
-    {
-        try
-        {
-            serverTCP.set_callback(callbackTCP, this);
-            serverTCP.set_callback_newClient(newClient, this);
-            serverTCP.start();
-            serverUDP.set_callback(callbackUDP, this);
-            serverUDP.start();
-        }
-        catch(const std::string &e)
-        {
-            std::cerr << e << '\n';
-        }
-    };
+    start();
 
     void
-    stop()
-    {
-        serverTCP.stop();
-        serverUDP.stop();
-        for(auto &client : m_clients) { client.second.join(); }
-        logln("stopped", true);
-    };
-
-    virtual void setRGB(int id_module, RGBColor &color)
-    {
-        (void)id_module;
-        (void)color;
-    }
-
+    stop();
 
-    uint8_t setup()
-    {return 0;};
+    virtual void
+    setRGB(int id_module, RGBColor &color) override;
 
-    static void
-    callbackTCP(Communication::Server *server,
-                uint8_t *buffer,
-                size_t size,
-                void *addr,
-                void *data)
+    /**
+     * @brief Number of identified modules (the module ids are 0 to n-1).
+     */
+    uint8_t
+    setup() override
     {
-        // Communication::SOCKET s = *(Communication::SOCKET *)addr;
-        // MonoController *clvhd = (MonoController *)data;
-        (void)server;
-        (void)buffer;
-        (void)size;
-        (void)addr;
-        (void)data;
+        return nbClients();
     };
 
-    static void
-    callbackUDP(Communication::Server *server,
-                uint8_t *buffer,
-                size_t size,
-                void *addr,
-                void *data)
+    uint8_t
+    getNbModules() override
     {
-        (void)buffer;
-        (void)size;
-        (void)data;
-        uint16_t port = TCP_PORT;
-        // MonoController *clvhd = (MonoController *)data;
-        Communication::UDPServer *serverUDP =
-            (Communication::UDPServer *)server;
-        serverUDP->send_data((uint8_t *)&port, sizeof(port), addr);
+        return nbClients();
     };
 
-    static void
-    newClient(Communication::Server *server,
-              void *addr,
-              Communication::SOCKET s,
-              void *data)
-    {
-        (void)server;
-        (void)addr;
-        MonoController *clvhd = (MonoController *)data;
-        clvhd->logln("New client", true);
-        clvhd->addClient(s);
-    };
+    /**
+     * @brief Wait until nb modules are identified.
+     *
+     * @return int Number of identified modules.
+     */
+    int
+    waitModules(int nb, double timeout);
 
-    void
-    addClient(Communication::SOCKET s)
-    {
-        m_clients[s] = std::thread(&MonoController::clientThread, this, s);
-    };
+    int
+    nbClients();
 
-    void
-    clientThread(Communication::SOCKET s);
+    /**
+     * @brief MAC address of a module, empty if unknown.
+     */
+    std::string
+    macAddress(int id);
 
-    int
-    nbClients()
+    /**
+     * @brief Time a reply may take before a read fails (s).
+     */
+    void
+    set_timeout(double timeout)
     {
-        return m_clients.size();
+        m_timeout = timeout;
     };
 
-
     virtual int
     readCmd_multi(uint32_t mask_id,
                   uint8_t n_cmd,
                   uint8_t *cmd,
                   uint8_t size,
                   const void *buff,
-                  uint64_t *timestamp = nullptr) override
-    {
-        (void)mask_id;
-        (void)n_cmd;
-        (void)cmd;
-        (void)size;
-        (void)buff;
-        (void)timestamp;
-        return 0;
-    };
-
+                  uint64_t *timestamp = nullptr) override;
 
     virtual int
     writeCmd_multi(uint32_t mask_id,
                    uint8_t n_cmd,
                    uint8_t *cmd,
                    uint8_t size = 0,
-                   const void *data = nullptr) override
+                   const void *data = nullptr) override;
+
+    /**
+     * @brief Start (or stop, FIFO_STOP) the UDP streams of the masked
+     * modules. The modules always poll DATA_STATUS.
+     *
+     * @return int FIFO_POLL, FIFO_STOP, or -1 if a module is not connected.
+     */
+    virtual int
+    startFifo(uint32_t mask_id,
+              uint8_t n_cmd,
+              uint8_t *cmd,
+              uint8_t size,
+              uint8_t source) override;
+
+    /**
+     * @brief Merge the samples received from the streams into frames, in
+     * the host clock (us). FIFO_OVERFLOW is set if samples were lost since
+     * the last drain. The samples are never compressed.
+     */
+    virtual int
+    drainFifo(uint16_t max_frames,
+              FifoFrames &frames,
+              bool compressed = false) override;
+
+    StreamStats
+    streamStats(int id);
+
+    /**
+     * @brief Reorder window of the streams: a missing datagram is given up
+     * when window datagrams wait behind it, or after hold seconds. A module
+     * silent for hold seconds is not waited for by drainFifo().
+     */
+    void
+    set_reorder(size_t window, double hold)
     {
-        (void)mask_id;
-        (void)n_cmd;
-        (void)cmd;
-        (void)size;
-        (void)data;
-        return 0;
+        m_window = window;
+        m_hold = hold;
     };
 
     private:
-    std::unordered_map<Communication::SOCKET, std::thread> m_clients;
-    Communication::TCPServer serverTCP;
-    Communication::UDPServer serverUDP;
+    struct Client
+    {
+        int fd = -1;
+        int id = -1;                // Module id once identified
+        std::vector<uint8_t> rx;    // Bytes not parsed yet
+        std::vector<uint8_t> reply; // Last 'R' payload
+        bool replied = false;
+    };
+
+    void
+    ioLoop();
+
+    void
+    acceptClients();
+
+    /**
+     * @brief Receive the pending datagrams in batches: discovery requests
+     * and stream samples.
+     */
+    void
+    receiveDatagrams();
+
+    /**
+     * @brief Read the available bytes of a client and parse its messages.
+     *
+     * @return false if the connection is closed.
+     */
+    bool
+    receive(Client &client);
+
+    void
+    closeClient(int fd);
+
+    /**
+     * @brief Detach the connection of a module from its id and shut it down
+     * (m_mutex held), so no reply can arrive on it anymore.
+     */
+    void
+    dropClient(int id);
+
+    struct Datagram
+    {
+        double arrival = 0; // Host clock (s)
+        uint32_t index = 0; // Index of the first sample
+        uint8_t count = 0;
+        std::vector<uint8_t> samples;
+    };
+
+    struct Stream
+    {
+        bool active = false;
+        uint8_t size = 0;                  // Bytes per sample
+        bool started = false;              // First datagram received
+        uint64_t first = 0;                // First datagram received
+        uint64_t next = 0;                 // Next datagram expected
+        uint32_t index = 0;                // Next sample expected
+        std::map<uint64_t, Datagram> held; // Waiting for a missing one
+        std::deque<std::pair<uint64_t, uint64_t>> gaps; // Given up [a, b)
+        uint32_t clock = 0;     // Last module clock (us), for the wraps
+        uint64_t wraps = 0;     // Unwrapped high bits of the module clock
+        double offset = NAN;    // Host minus module clock (us)
+        double period = 0;      // Mean sample period (us)
+        uint64_t covered = 0;   // Host time up to which samples arrived
+        bool overflow = false;  // Samples lost since the last drain
+        std::deque<uint64_t> times; // Samples not merged yet (host us)
+        std::deque<uint8_t> data;
+        StreamStats stats;
+    };
+
+    /**
+     * @brief Parse a stream datagram into the window of its module (I/O
+     * thread, m_mutex held).
+     */
+    void
+    ingest(const uint8_t *buff, size_t size, double arrival);
+
+    /**
+     * @brief Deliver the datagrams of the window that are in order, giving
+     * up the missing ones that waited too long (m_mutex held).
+     */
+    void
+    release(Stream &s, double now);
+
+    void
+    deliver(Stream &s, const Datagram &d);
+
+    /**
+     * @brief Send a message to a module (calling thread).
+     */
+    int
+    send(int id, const uint8_t *data, size_t size);
+
+    uint16_t m_tcp_port;
+    uint16_t m_udp_port;
+    double m_timeout = 1;
+    int m_epoll = -1;
+    int m_listen = -1;
+    int m_udp = -1;
+    int m_wake = -1; // eventfd stopping the I/O thread
+    std::thread m_io;
+    std::atomic<bool> m_running{false};
+
+    std::mutex m_mutex; // Clients, ids and replies
+    std::condition_variable m_cond;
+    std::unordered_map<int, std::unique_ptr<Client>> m_clients; // fd ->
+    std::vector<std::string> m_macs; // MAC of each module id
+    std::vector<int> m_fds;          // Connection of each module id, -1 if none
+    std::vector<Stream> m_streams;   // UDP stream of each module id
+    size_t m_window = 16;
+    double m_hold = 0.1;
 };
 } // namespace ClvHd
 
-#endif // __CLV_HD_MONO_HPP__
\ No newline at end of file
+#endif // __CLV_HD_MONO_HPP__
@@ -0,0 +1,255 @@
+#ifndef __CLVHDCONTROLLER_MULTI_HPP
+#define __CLVHDCONTROLLER_MULTI_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h> // uint8_t, uint16_t, uint32_t, uint64_t
+
+#include "clvHd_controller.hpp"
+#include "clvHd_controller_serial.hpp"
+
+namespace ClvHd
+{
+
+/**
+ * @brief Controller board on a non-blocking serial port, read by the I/O
+ * thread of a MultiController.
+ *
+ * The commands are written from the calling thread. The I/O thread moves
+ * the received bytes into the board ring (pump()) and the replies are
+ * parsed by the SerialController methods, which wait on the ring.
+ */
+class BoardLink : public SerialController
+{
+    public:
+    BoardLink(int verbose = -1)
+        : ESC::CLI(verbose, "ClvHd-Board"), SerialController(verbose){};
+    ~BoardLink();
+
+    /**
+     * @brief Open the port in raw mode, non-blocking.
+     *
+     * @return int 0 on success, -1 on error.
+     */
+    int
+    open(const char *path, int baud = 460800);
+
+    int
+    fd() const
+    {
+        return m_fd;
+    };
+
+    int
+    sendCmd(uint8_t *data, size_t size) override;
+    using SerialController::sendCmd;
+
+    /**
+     * @brief Move the available bytes of the port into the ring (I/O
+     * thread).
+     *
+     * @return false if the port was closed or failed.
+     */
+    bool
+    pump();
+
+    /**
+     * @brief Time a reply may take before the read fails (s).
+     */
+    void
+    set_timeout(double timeout)
+    {
+        m_timeout = timeout;
+    };
+
+    /**
+     * @brief After a failed reply, wait for the line to be quiet for a
+     * timeout and drop the received bytes, so that a late reply is not
+     * taken for the next one.
+     */
+    void
+    resync() override;
+
+    protected:
+    int
+    receive(uint8_t *buff, size_t size) override;
+
+    private:
+    int m_fd = -1;
+    double m_timeout = 1;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::vector<uint8_t> m_ring; // Received bytes, consumed from m_head
+    size_t m_head = 0;
+    uint64_t m_received = 0; // Bytes received since the opening
+    bool m_closed = false;
+};
+
+/**
+ * @brief Several controller boards seen as one controller.
+ *
+ * The modules of the boards are numbered globally, board after board (at
+ * most 32 modules in all, the width of the module masks): the masks of the
+ * Controller methods are split per board and the replies concatenated in
+ * the global order. A single I/O thread waits on all the ports with epoll
+ * and demultiplexes the received bytes into per-board rings, so a request
+ * is sent to every board before any reply is awaited and the boards work
+ * in parallel.
+ *
+ * Each board has its own clock: the timestamps are mapped to the clock of
+ * the first board through the offset of each board clock to the host clock
+ * (minimum over the replies, following the drift). drainFifo() merges the
+ * frames of the boards into frames of all the modules, pairing the samples
+ * of the boards closer than half a sample period; a board without a sample
+ * at that time contributes a null DATA_STATUS (no new data).
+ */
+class MultiController : public Controller
+{
+    public:
+    MultiController(int verbose = -1)
+        : ESC::CLI(verbose, "ClvHd-MultiController"){};
+    ~MultiController();
+
+    /**
+     * @brief Open a controller board. The modules are numbered by setup().
+     *
+     * @return int Index of the board, -1 on error.
+     */
+    int
+    addBoard(const char *path, int baud = 460800);
+
+    size_t
+    nbBoards() const
+    {
+        return m_boards.size();
+    };
+
+    BoardLink *
+    board(size_t i)
+    {
+        return m_boards[i].link.get();
+    };
+
+    /**
+     * @brief Board of a global module id.
+     *
+     * @param local Id of the module on its board.
+     * @return int Index of the board, -1 if no board has the module.
+     */
+    int
+    boardOf(int id, int *local = nullptr) const;
+
+    /**
+     * @brief Offset of the clock of a board to the clock of the first board
+     * (s), NaN before the first replies.
+     */
+    double
+    clockOffset(size_t board) const;
+
+    uint8_t
+    setup() override;
+
+    uint8_t
+    getNbModules() override;
+
+    std::string
+    getVersion(uint8_t *major = nullptr, uint8_t *minor = nullptr) override;
+
+    int
+    readCmd_multi(uint32_t mask_id,
+                  uint8_t n_cmd,
+                  uint8_t *cmd,
+                  uint8_t size,
+                  const void *buff,
+                  uint64_t *timestamp = nullptr) override;
+
+    int
+    writeCmd_multi(uint32_t mask_id,
+                   uint8_t n_cmd,
+                   uint8_t *cmd,
+                   uint8_t size = 0,
+                   const void *data = nullptr) override;
+
+    void
+    setRGB(int id_module, RGBColor &color) override;
+
+    size_t
+    maxReplySize() override;
+
+    int
+    startFifo(uint32_t mask_id,
+              uint8_t n_cmd,
+              uint8_t *cmd,
+              uint8_t size,
+              uint8_t source) override;
+
+    int
+    drainFifo(uint16_t max_frames,
+              FifoFrames &frames,
+              bool compressed = false) override;
+
+    int
+    setSpiClock(uint32_t clock) override;
+
+    int
+    setAggregation(uint16_t packet, uint16_t budget_us) override;
+
+    private:
+    struct Board
+    {
+        std::unique_ptr<BoardLink> link;
+        int first = 0;          // Global id of the first module
+        int nb = 0;             // Number of modules
+        uint32_t fifo_mask = 0; // Local mask of the FIFO
+        double offset = NAN;    // Host clock minus board clock (s)
+        FifoFrames pending;     // Drained frames not merged yet
+        size_t pos = 0;         // First pending frame
+        uint64_t covered = 0;   // Aligned time up to which frames arrived
+        double period = 0;      // Mean sample period (us)
+    };
+
+    uint32_t
+    localMask(const Board &b, uint32_t mask_id) const
+    {
+        uint64_t bits = ((uint64_t)1 << b.nb) - 1;
+        return (uint32_t)((mask_id >> b.first) & bits);
+    };
+
+    /**
+     * @brief Update the clock offset of a board with the timestamp of a
+     * reply received now.
+     */
+    void
+    updateOffset(Board &b, uint64_t timestamp);
+
+    /**
+     * @brief Board timestamp (us) in the clock of the first board.
+     */
+    uint64_t
+    align(const Board &b, uint64_t timestamp) const;
+
+    /**
+     * @brief Merge the pending frames of the boards into frames.
+     */
+    size_t
+    merge(size_t max_frames, FifoFrames &frames);
+
+    void
+    ioLoop();
+
+    std::vector<Board> m_boards;
+    int m_epoll = -1;
+    int m_wake = -1; // eventfd stopping the I/O thread
+    std::thread m_io;
+    std::atomic<bool> m_running{false};
+    uint8_t m_fifo_size = 0; // Bytes per module of the FIFO frames
+};
+
+} // namespace ClvHd
+#endif // __CLVHDCONTROLLER_MULTI_HPP
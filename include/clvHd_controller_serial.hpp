@@ -1,5 +1,6 @@
 #ifndef __CLVHDCONTROLLER_SERIAL_HPP
 #define __CLVHDCONTROLLER_SERIAL_HPP
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 #include <iostream> // std::cout, std::endl
@@ -20,6 +21,7 @@
 
 #define CLVHD_PACKET_SIZE 6
 #define CLVHD_BUFFER_SIZE 1024
+#define CLVHD_BATCH_MAGIC 0xA5 // First byte of an aggregated transfer
 
 namespace ClvHd
 {
@@ -44,6 +46,8 @@ class SerialController : public Controller
         : ESC::CLI(verbose, "ClvHd-Controller"), m_serial(verbose) {};
     ~SerialController()
     {
+        if(!m_opened)
+            return;
         sendCmd('z');
         m_serial.close_connection();
     };
@@ -52,6 +56,7 @@ class SerialController : public Controller
     open(const char *path, int baud = 460800, int flags = O_RDWR | O_NOCTTY)
     {
         m_serial.open_connection(path, baud, flags);
+        m_opened = true;
     };
 
     virtual void
@@ -95,6 +100,7 @@ class SerialController : public Controller
 
     /**
      * @brief readReply Read a reply from the controller board. The reply contains a timestamp, a size and the data.
+     * A size of 0xFF is followed by a 16 bits size (long reply).
      *
      * @param buff Buffer to store the data.
      * @param timestamp Timestamp of the reply.
@@ -105,7 +111,7 @@ class SerialController : public Controller
     {
         // Read the timestamp and the size of the data (8 bytes + 1 byte)
         // printf("readReply\n");
-        int n = m_serial.readS(m_buffer, 9);
+        int n = read(m_buffer, 9);
         // printf("n: %d \t size: %d\n", n, m_buffer[8]);
         if(n == 9)
         {
@@ -121,7 +127,16 @@ class SerialController : public Controller
 
             if(timestamp != nullptr)
                 *timestamp = *(uint64_t *)m_buffer;
-            n = m_serial.readS(buff, m_buffer[8]);
+            // 0xFF: long reply, the 16 bits size follows (firmware 3.4)
+            size_t size = m_buffer[8];
+            if(size == 0xFF)
+            {
+                uint16_t size16;
+                if(read((uint8_t *)&size16, 2) != 2)
+                    return -1;
+                size = size16;
+            }
+            n = read(buff, size);
             // printf("n: %d \t size: %d\n", n, m_buffer[8]);
             return n;
         }
@@ -147,16 +162,29 @@ class SerialController : public Controller
                   const void *buff,
                   uint64_t *timestamp = nullptr) override
     {
-        uint8_t msg[6];
-        *(uint32_t *)msg = mask_id;
-        msg[4] = size;
-        msg[5] = n_cmd;
-        sendCmd('r');
-        sendCmd(msg, 6);
-        sendCmd(cmd, n_cmd);
+        if(requestRead(mask_id, n_cmd, cmd, size) < 0)
+            return -1;
         return readReply((uint8_t *)buff, timestamp);
     };
 
+    /**
+     * @brief requestRead Send the read command of readCmd_multi() without
+     * waiting for the reply (see readReply()), to overlap the reads of
+     * several boards.
+     */
+    int
+    requestRead(uint32_t mask_id, uint8_t n_cmd, uint8_t *cmd, uint8_t size)
+    {
+        uint8_t msg[7];
+        msg[0] = 'r';
+        std::memcpy(msg + 1, &mask_id, 4);
+        msg[5] = size;
+        msg[6] = n_cmd;
+        if(sendCmd(msg, 7) < 0)
+            return -1;
+        return sendCmd(cmd, n_cmd);
+    };
+
     /**
      * @brief writeReg_multi write size byte to the modules given by the mask_id.
      *
@@ -192,7 +220,7 @@ class SerialController : public Controller
      * @return The number of modules connected to the controller board.
      */
     uint8_t
-    getNbModules()
+    getNbModules() override
     {
         sendCmd('n'); // Request the number of modules and their types
         uint8_t nb = 0;
@@ -225,7 +253,7 @@ class SerialController : public Controller
      * @return The version of the controller board as a std::string. If an empty string is returned, an error occured.
      */
     std::string
-    getVersion(uint8_t *major = nullptr, uint8_t *minor = nullptr)
+    getVersion(uint8_t *major = nullptr, uint8_t *minor = nullptr) override
     {
         sendCmd('v');
         uint8_t ans[2];
@@ -242,11 +270,353 @@ class SerialController : public Controller
             return "";
     };
 
+    /**
+     * @brief Sample the modules at conversion time in the FIFO of the
+     * controller board (firmware 3.1 or later).
+     * @return The active source, -1 if the firmware has no FIFO.
+     */
+    int
+    startFifo(uint32_t mask_id,
+              uint8_t n_cmd,
+              uint8_t *cmd,
+              uint8_t size,
+              uint8_t source) override
+    {
+        // The bytes of the command would be parsed as commands by an older
+        // firmware
+        if(version() < 256 * 3 + 1)
+            return -1;
+        uint8_t msg[6];
+        *(uint32_t *)msg = mask_id;
+        msg[4] = size;
+        msg[5] = n_cmd;
+        sendCmd('f');
+        sendCmd(msg, 6);
+        sendCmd(cmd, n_cmd);
+        sendCmd(&source, 1);
+        uint8_t ans[3];
+        if(readReply(ans) != 3)
+            return -1;
+        logln("FIFO source " + std::to_string((int)ans[0]) + ", " +
+                  std::to_string(*(uint16_t *)(ans + 1)) + " samples",
+              true);
+        return ans[0];
+    };
+
+    int
+    fetchFifo(uint8_t max_entries,
+              uint8_t *buff,
+              uint64_t *timestamp = nullptr) override
+    {
+        uint8_t msg[2] = {'F', max_entries};
+        sendCmd(msg, 2);
+        return readReply(buff, timestamp);
+    };
+
+    /**
+     * @brief Drain the FIFO in one reply with a 16 bits size and compact
+     * timestamps (firmware 3.2 or later): [mask | n | count | flags |
+     * timestamp of the first frame (u32) | count x (u16 delay from the
+     * previous frame (us) | n bytes per module)].
+     *
+     * Compressed (firmware 3.6 or later, flags FIFO_COMPRESSED), each
+     * module of a frame is its DATA_STATUS byte followed by the zigzag
+     * varints of the differences of the 3 pace (16 bits) and 3 ECG (24 bits)
+     * values with the previous frame of the reply. The frames with bit 15
+     * of their delay set are sent raw.
+     */
+    int
+    drainFifo(uint16_t max_frames,
+              FifoFrames &frames,
+              bool compressed = false) override
+    {
+        if(!requestDrain(max_frames, compressed))
+            return -1;
+        return readDrain(frames);
+    };
+
+    /**
+     * @brief requestDrain Send the drain command of drainFifo() without
+     * waiting for the reply (see readDrain()).
+     *
+     * @return false if the firmware has no bulk drain.
+     */
+    bool
+    requestDrain(uint16_t max_frames, bool compressed = false)
+    {
+        if(version() < 256 * 3 + 2)
+            return false;
+        compressed = compressed && version() >= 256 * 3 + 6;
+        uint8_t msg[3] = {(uint8_t)(compressed ? 'Z' : 'D'), 0, 0};
+        std::memcpy(msg + 1, &max_frames, 2);
+        return sendCmd(msg, 3) == 3;
+    };
+
+    /**
+     * @brief readDrain Read and unpack the reply of a drain.
+     *
+     * @return int Number of frames, -1 on error.
+     */
+    int
+    readDrain(FifoFrames &frames)
+    {
+        // [u64 timestamp | u16 size] header of the bulk reply
+        if(read(m_buffer, 10) != 10)
+            return -1;
+        uint64_t reply_ts = *(uint64_t *)m_buffer;
+        uint16_t size;
+        std::memcpy(&size, m_buffer + 8, 2);
+        m_bulk.resize(size);
+        if(size < 12 || read(m_bulk.data(), size) != size)
+            return -1;
+
+        const uint8_t *b = m_bulk.data();
+        uint16_t count;
+        uint32_t ts;
+        std::memcpy(&frames.mask, b, 4);
+        frames.size = b[4];
+        std::memcpy(&count, b + 5, 2);
+        frames.flags = b[7];
+        std::memcpy(&ts, b + 8, 4);
+        size_t nb = 0;
+        for(uint32_t m = frames.mask; m != 0; m &= m - 1) nb++;
+        const size_t bytes = nb * frames.size;
+        const bool coded = frames.flags & FIFO_COMPRESSED;
+        if(coded ? frames.size != 16
+                 : size != 12 + count * (2 + bytes))
+            return -1;
+
+        frames.timestamp = reply_ts;
+        frames.count = count;
+        frames.stride = bytes;
+        frames.timestamps.resize(count);
+        frames.data.resize(count * bytes);
+        if(coded)
+            m_prev.assign(nb * 6, 0);
+        // The 32 bits timestamps are unwrapped with the 64 bits of the reply
+        uint32_t age = (uint32_t)reply_ts - ts;
+        uint64_t t = (reply_ts >= age) ? reply_ts - age : 0;
+        const uint8_t *p = b + 12;
+        const uint8_t *end = b + size;
+        for(size_t i = 0; i < count; i++)
+        {
+            uint16_t dt;
+            if(p + 2 > end)
+                return -1;
+            std::memcpy(&dt, p, 2);
+            p += 2;
+            uint8_t *f = frames.data.data() + i * bytes;
+            bool raw = !coded || (dt & 0x8000);
+            t += coded ? (dt & 0x7FFF) : dt;
+            frames.timestamps[i] = t;
+            if(raw)
+            {
+                if(p + bytes > end)
+                    return -1;
+                std::memcpy(f, p, bytes);
+                p += bytes;
+                if(coded)
+                    for(size_t m = 0; m < nb; m++)
+                        for(int k = 0; k < 6; k++)
+                            m_prev[6 * m + k] = value(f + 16 * m, k);
+            }
+            else if((p = decode(p, end, f, nb)) == nullptr)
+                return -1;
+        }
+        return (p == end) ? count : -1;
+    };
+
+    /**
+     * @brief Set the SPI clock of the modules bus (firmware 3.3 or later).
+     * @return The applied clock (Hz), -1 if the firmware cannot set it.
+     */
+    int
+    setSpiClock(uint32_t clock) override
+    {
+        if(version() < 256 * 3 + 3)
+            return -1;
+        uint8_t msg[5] = {'c', 0, 0, 0, 0};
+        std::memcpy(msg + 1, &clock, 4);
+        sendCmd(msg, 5);
+        uint32_t applied;
+        if(readReply((uint8_t *)&applied) != 4)
+            return -1;
+        return applied;
+    };
+
+    /**
+     * @brief Largest reply of the firmware: long replies since 3.4.
+     */
+    size_t
+    maxReplySize() override
+    {
+        return (version() >= 256 * 3 + 4) ? CLVHD_LONG_REPLY_SIZE
+                                          : CLVHD_MAX_REPLY_SIZE;
+    };
+
+    /**
+     * @brief Let the controller aggregate its replies in transfers of
+     * packet multiples (firmware 3.5 or later), sent after at most
+     * budget_us. The replies are unpacked transparently.
+     *
+     * @param packet USB packet size (64 full speed, 512 high speed), 0 to
+     * send every reply on its own.
+     * @return The applied packet size, -1 if the firmware cannot aggregate.
+     */
+    int
+    setAggregation(uint16_t packet, uint16_t budget_us) override
+    {
+        if(version() < 256 * 3 + 5)
+            return -1;
+        uint8_t msg[5] = {'a', 0, 0, 0, 0};
+        std::memcpy(msg + 1, &packet, 2);
+        std::memcpy(msg + 3, &budget_us, 2);
+        sendCmd(msg, 5);
+        // Replied in the previous mode
+        uint16_t applied;
+        if(readReply((uint8_t *)&applied, nullptr) != 2)
+            return -1;
+        m_packet = applied;
+        m_rx.clear();
+        m_rx_pos = 0;
+        return applied;
+    };
+
     operator std::string() const { return "Controller board"; };
 
+    /**
+     * @brief Drop the rest of the aggregated transfer being read, after a
+     * failed reply, so the next reply starts on a transfer boundary.
+     */
+    virtual void
+    resync()
+    {
+        m_rx.clear();
+        m_rx_pos = 0;
+    };
+
+    protected:
+    /**
+     * @brief Read exactly size bytes of the link (blocking).
+     */
+    virtual int
+    receive(uint8_t *buff, size_t size)
+    {
+        return m_serial.readS(buff, size);
+    };
+
     private:
+    /**
+     * @brief Read size bytes of replies, from the serial link or from the
+     * aggregated transfers [0xA5 | u16 size | replies | padding to the
+     * packet size].
+     */
+    int
+    read(uint8_t *buff, size_t size)
+    {
+        if(m_packet == 0)
+            return receive(buff, size);
+        size_t done = 0;
+        while(done < size)
+        {
+            if(m_rx_pos == m_rx.size())
+            {
+                uint8_t header[3];
+                if(receive(header, 3) != 3 ||
+                   header[0] != CLVHD_BATCH_MAGIC)
+                    return -1;
+                uint16_t length;
+                std::memcpy(&length, header + 1, 2);
+                size_t padded =
+                    (3 + length + m_packet - 1) / m_packet * m_packet - 3;
+                m_rx.resize(padded);
+                if(receive(m_rx.data(), padded) != (int)padded)
+                    return -1;
+                m_rx.resize(length);
+                m_rx_pos = 0;
+            }
+            size_t k = std::min(size - done, m_rx.size() - m_rx_pos);
+            std::memcpy(buff + done, m_rx.data() + m_rx_pos, k);
+            m_rx_pos += k;
+            done += k;
+        }
+        return done;
+    };
+
+    /**
+     * @brief Firmware version as 256 * major + minor (queried once, 0 if
+     * the board does not answer).
+     */
+    int
+    version()
+    {
+        if(m_version < 0)
+        {
+            uint8_t major = 0, minor = 0;
+            m_version = getVersion(&major, &minor).empty()
+                            ? 0
+                            : 256 * major + minor;
+        }
+        return m_version;
+    };
+
     uint8_t m_buffer[CLVHD_BUFFER_SIZE];
+    /**
+     * @brief Pace (k < 3, 16 bits) or ECG (24 bits) value k of the big
+     * endian window of a module.
+     */
+    static int32_t
+    value(const uint8_t *window, int k)
+    {
+        const uint8_t *v = (k < 3) ? window + 1 + 2 * k : window + 7 + 3 * (k - 3);
+        return (k < 3) ? (v[0] << 8) | v[1] : (v[0] << 16) | (v[1] << 8) | v[2];
+    };
+
+    /**
+     * @brief Decode the delta coded windows of nb modules of a frame in f.
+     *
+     * @return const uint8_t* End of the coded frame, nullptr if truncated.
+     */
+    const uint8_t *
+    decode(const uint8_t *p, const uint8_t *end, uint8_t *f, size_t nb)
+    {
+        for(size_t m = 0; m < nb; m++, f += 16)
+        {
+            if(p >= end)
+                return nullptr;
+            std::memset(f, 0, 16);
+            f[0] = *p++;
+            for(int k = 0; k < 6; k++)
+            {
+                uint32_t z = 0;
+                for(int shift = 0;; shift += 7)
+                {
+                    if(p >= end || shift > 28)
+                        return nullptr;
+                    z |= (uint32_t)(*p & 0x7F) << shift;
+                    if(!(*p++ & 0x80))
+                        break;
+                }
+                int32_t &prev = m_prev[6 * m + k];
+                prev += (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+                uint8_t *v = (k < 3) ? f + 1 + 2 * k : f + 7 + 3 * (k - 3);
+                if(k >= 3)
+                    *v++ = prev >> 16;
+                v[0] = prev >> 8;
+                v[1] = prev;
+            }
+        }
+        return p;
+    };
+
+    std::vector<uint8_t> m_bulk; // Payload of the bulk replies
+    std::vector<int32_t> m_prev; // Values of the delta coded drain
     Communication::Serial m_serial;
+    bool m_opened = false;
+    int m_version = -1; // 256 * major + minor, -1 if not queried yet
+    uint16_t m_packet = 0;     // Packet size of the aggregated replies
+    std::vector<uint8_t> m_rx; // Replies of the last aggregated transfer
+    size_t m_rx_pos = 0;
 };
 } // namespace ClvHd
 #endif // __CLVHDCONTROLLER_SERIAL_HPP
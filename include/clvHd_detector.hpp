@@ -0,0 +1,170 @@
+#ifndef __CLV_HD_DETECTOR_HPP__
+#define __CLV_HD_DETECTOR_HPP__
+
+#include <string>
+#include <vector>
+
+#include <stdint.h> // uint8_t, uint16_t, uint32_t, uint64_t
+
+#include "clvHd_ring.hpp"
+
+namespace ClvHd
+{
+
+/**
+ * @brief Muscle activation event.
+ */
+struct Event
+{
+    double timestamp = 0; // Timestamp of the first active (inactive) sample
+    double detected = 0;  // Host time of the detection (Detector::now(), s)
+    int channel = -1;
+    bool onset = true;    // Onset or offset
+    double value = 0;     // Envelope at the detection
+    int delay = 0;        // Samples between the crossing and the detection
+};
+
+/**
+ * @brief Parameters of the activation detector.
+ */
+struct DetectorConfig
+{
+    bool teager = true;       // Teager-Kaiser energy, rectified signal if not
+    double envelope_hz = 20;  // Cut-off of the envelope low-pass (0: none)
+    double h_on = 5;          // Onset threshold (baseline std above mean)
+    double h_off = 2;         // Offset threshold (hysteresis)
+    int min_on = 10;          // Samples above h_on to confirm an onset
+    int min_off = 50;         // Samples below h_off to confirm an offset
+    double baseline_s = 2;    // Time constant of the baseline (at rest)
+    double warmup_s = 1;      // Baseline learning time before any detection
+};
+
+/**
+ * @brief Latency statistics of the consumed events (s).
+ */
+struct DetectorStats
+{
+    uint64_t events = 0;
+    uint64_t dropped = 0;   // Events lost because the queue was full
+    double delay_mean = 0;  // Detection to consumption
+    double delay_max = 0;
+};
+
+/**
+ * @brief Per-channel double-threshold activation detector.
+ *
+ * Each sample updates the envelope of the channel (Teager-Kaiser energy or
+ * rectified signal, smoothed by a one-pole low-pass). At rest, the mean and
+ * the deviation of the envelope are tracked as an adaptive baseline. An
+ * onset is confirmed when the envelope stays above mean + h_on x std for
+ * min_on samples, an offset when it stays below mean + h_off x std for
+ * min_off samples, so the detection delay is bounded by min_on (min_off)
+ * samples. The events are pushed in a lock-free queue as soon as the sample
+ * confirming them is processed.
+ */
+class Detector
+{
+    public:
+    Detector(int nb_channels = 0,
+             double fs = 1000,
+             const DetectorConfig &config = DetectorConfig(),
+             size_t capacity = 1024)
+    {
+        configure(nb_channels, fs, config, capacity);
+    };
+
+    void
+    configure(int nb_channels,
+              double fs,
+              const DetectorConfig &config = DetectorConfig(),
+              size_t capacity = 1024);
+
+    /**
+     * @brief Clear the baselines and the states (new recording).
+     */
+    void
+    reset();
+
+    /**
+     * @brief Feed frames of nb_channels values (NaN hold the previous value).
+     *
+     * @return int Number of events pushed.
+     */
+    int
+    process(const double *timestamps, const double *frames, size_t n_frames);
+
+    /**
+     * @brief Feed all the pending frames of a ring, -1 if it does not have
+     * nb_channels channels.
+     */
+    int
+    process(SampleRing &ring);
+
+    /**
+     * @brief Pop the next event and account for its detection to
+     * consumption delay.
+     */
+    bool
+    pop(Event &event);
+
+    /**
+     * @brief Current activation of a channel.
+     */
+    bool
+    active(int channel) const
+    {
+        return m_state[channel].active;
+    };
+
+    DetectorStats
+    stats() const
+    {
+        DetectorStats s = m_stats;
+        s.dropped = events.dropped();
+        return s;
+    };
+
+    int
+    channels() const
+    {
+        return m_channels;
+    };
+
+    /**
+     * @brief Host monotonic clock (s), the time base of Event::detected.
+     */
+    static double
+    now()
+    {
+        return host_clock();
+    };
+
+    Ring<Event> events; // Detected events
+
+    private:
+    struct Channel
+    {
+        double x1 = 0, x2 = 0; // Previous samples
+        double env = 0;        // Envelope
+        double mean = 0;       // Baseline mean of the envelope
+        double var = 0;        // Baseline variance of the envelope
+        bool active = false;
+        int count = 0;         // Consecutive samples beyond the threshold
+        double since = 0;      // Timestamp of the first of them
+    };
+
+    int m_channels = 0;
+    double m_fs = 1;
+    DetectorConfig m_config;
+    double m_env_alpha = 1;
+    double m_base_alpha = 0;
+    uint64_t m_warmup = 0;
+    uint64_t m_count = 0;
+    std::vector<Channel> m_state;
+    DetectorStats m_stats;
+    RingBlock m_block; // Scratch for process(SampleRing &)
+};
+
+} // namespace ClvHd
+
+#endif // __CLV_HD_DETECTOR_HPP__
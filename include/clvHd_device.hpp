@@ -1,12 +1,16 @@
 #ifndef __CLV_HD_DEVICE_HPP__
 #define __CLV_HD_DEVICE_HPP__
 
+#include "clvHd_cache.hpp"
 #include "clvHd_controller.hpp"
 #include "clvHd_module.hpp"
 
 #include "clvHd_controller_mono.hpp"
+#include "clvHd_controller_multi.hpp"
 #include "clvHd_controller_serial.hpp"
 
+#include <algorithm>
+
 namespace ClvHd
 {
 class Device : virtual public ESC::CLI
@@ -14,7 +18,38 @@ class Device : virtual public ESC::CLI
 
     public:
     Device(int verbose = -1) : ESC::CLI(verbose, "ClvHd-Device") {};
-    ~Device() {};
+    ~Device()
+    {
+        for(Module *m : modules) delete m;
+        if(m_cache != nullptr)
+            delete m_cache;
+    };
+
+    /**
+     * @brief Enable the on-disk topology and configuration cache.
+     * Must be called before initSerial(). When the cache holds an entry for
+     * the controller version and module chain, the enumeration is replaced
+     * by the version and module count requests, the module probing by one
+     * REVID read of all the modules, and the register configuration of the
+     * module packs by the write of the differing registers.
+     *
+     * @param path Path of the cache file.
+     * @return int Number of cached entries, -1 if the file is corrupted.
+     */
+    int
+    setCache(const std::string &path)
+    {
+        if(m_cache != nullptr)
+            delete m_cache;
+        m_cache = new ConfigCache(path, m_verbose);
+        int n = m_cache->load();
+        if(n < 0)
+        {
+            logln("Corrupted cache " + path + ", starting from scratch", true);
+            m_cache->clear();
+        }
+        return n;
+    };
 
     uint8_t
     initSerial(const char *path, int baud = 460800, int flags = O_RDWR | O_NOCTTY)
@@ -27,21 +62,89 @@ class Device : virtual public ESC::CLI
         return this->setup();
     };
 
+    /**
+     * @brief Open several controller boards as a single controller: the
+     * modules are numbered board after board and the boards are read in
+     * parallel by one I/O thread (see MultiController).
+     *
+     * @return uint8_t Total number of modules.
+     */
     uint8_t
-    initMono()
+    initBoards(const std::vector<std::string> &paths, int baud = 460800)
     {
         if(controller != nullptr)
             delete controller;
-        controller = new MonoController(m_verbose);
+        controller = nullptr;
+        MultiController *c = new MultiController(m_verbose);
+        for(const std::string &path : paths)
+            if(c->addBoard(path.c_str(), baud) < 0)
+            {
+                delete c;
+                throw log_error("Cannot open the board " + path);
+            }
+        controller = c;
+        return this->setup();
+    };
+
+    /**
+     * @brief Start the servers of the MONOMOD Wi-Fi modules and wait for
+     * them to connect (see MonoController).
+     *
+     * @param nb_modules Number of modules to wait for.
+     * @param timeout Time to wait for them (s).
+     * @return uint8_t Number of connected modules.
+     */
+    uint8_t
+    initMono(int nb_modules = 1, double timeout = 5)
+    {
+        if(controller != nullptr)
+            delete controller;
+        controller = nullptr;
+        MonoController *c = new MonoController(m_verbose);
+        c->start();
+        controller = c;
+        if(c->waitModules(nb_modules, timeout) < nb_modules)
+            logln("Only " + std::to_string(c->nbClients()) + " of " +
+                      std::to_string(nb_modules) + " modules connected",
+                  true);
         return this->setup();
     };
 
     uint8_t
     setup()
     {
-        int nb_modules = controller->setup();
+        int nb_modules = -1;
+        std::string version;
+        m_cache_entry = nullptr;
+        if(m_cache != nullptr)
+        {
+            // A controller that already enumerated its chain reports it
+            // without pulsing the modules again.
+            version = controller->getVersion();
+            nb_modules = controller->getNbModules();
+            if(nb_modules == 0 || nb_modules == 0xff)
+                nb_modules = -1;
+        }
+        if(nb_modules < 0)
+            nb_modules = controller->setup();
+
+        // On reconnection the previous modules are deleted, the module packs
+        // forget them and are set up again on the new ones.
+        for(ModulePack *pack : m_packs) pack->clearModules();
+        for(Module *m : modules) delete m;
+        modules.clear();
+        sensorValues.clear();
+        actuatorValues.clear();
         for(int i = 0; i < nb_modules; i++)
             addModule(new Module(controller, i, m_verbose));
+
+        if(m_cache != nullptr && nb_modules > 0 && nb_modules != 0xff)
+        {
+            std::string key = ConfigCache::make_key(version, nb_modules);
+            if(m_cache->find(key) != nullptr)
+                logln("Cached topology found for " + key, true);
+            m_cache_entry = &m_cache->entry(key, nb_modules);
+        }
         return nb_modules;
     }
 
@@ -67,11 +170,53 @@ class Device : virtual public ESC::CLI
         actuatorValues.push_back(&module->actuatorValue);
     };
 
+    /**
+     * @brief Register a module pack, told when the modules are deleted (see
+     * ModulePack).
+     */
+    void
+    attachPack(ModulePack *pack)
+    {
+        m_packs.push_back(pack);
+    };
+
+    void
+    detachPack(ModulePack *pack)
+    {
+        m_packs.erase(std::remove(m_packs.begin(), m_packs.end(), pack),
+                      m_packs.end());
+    };
+
     std::vector<Value *> sensorValues;
     std::vector<Value *> actuatorValues;
 
+    /**
+     * @brief Get the cache entry of the current controller and module chain.
+     * @return ConfigCache::Entry* The entry or nullptr if the cache is disabled.
+     */
+    ConfigCache::Entry *
+    cacheEntry()
+    {
+        return m_cache_entry;
+    };
+
+    /**
+     * @brief Write the cache file, if the cache is enabled.
+     */
+    void
+    saveCache()
+    {
+        if(m_cache != nullptr)
+            m_cache->save();
+    };
+
     std::vector<Module *> modules;
     Controller *controller = nullptr;
+
+    protected:
+    ConfigCache *m_cache = nullptr;
+    ConfigCache::Entry *m_cache_entry = nullptr;
+    std::vector<ModulePack *> m_packs;
 };
 
 } // namespace ClvHd
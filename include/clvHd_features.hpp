@@ -0,0 +1,147 @@
+#ifndef __CLV_HD_FEATURES_HPP__
+#define __CLV_HD_FEATURES_HPP__
+
+#include <string>
+#include <vector>
+
+#include <stdint.h> // uint8_t, uint16_t, uint32_t, uint64_t
+
+#include "clvHd_ring.hpp"
+
+namespace ClvHd
+{
+
+/**
+ * @brief Sliding-window EMG features computed incrementally.
+ *
+ * Each sample adds its contributions to running sums and the sample leaving
+ * the window removes its own, so a sample costs O(1) whatever the window.
+ * The window is a ring of contributions stored [slot][feature][channel],
+ * with the channels contiguous. Every hop samples, a feature vector is pushed
+ * in the output ring: the timestamp of the last sample and the values
+ * [RMS ch0..chN-1, MAV ch0.., WL ch0.., ZC ch0.., SSC ch0..].
+ * A NaN sample (channel without a new sample) does not enter the window:
+ * RMS and MAV are averaged over the new samples of the window, WL, ZC and
+ * SSC summed over them, and the features of a channel without any new
+ * sample in the window are NaN.
+ */
+class FeatureExtractor
+{
+    public:
+    enum Feature
+    {
+        RMS = 0, // Root mean square
+        MAV,     // Mean absolute value
+        WL,      // Waveform length (sum of |x[n] - x[n-1]|)
+        ZC,      // Zero crossings
+        SSC,     // Slope sign changes
+        NB_FEATURES
+    };
+
+    FeatureExtractor(int nb_channels = 0,
+                     int window = 200,
+                     int hop = 50,
+                     double zc_threshold = 0,
+                     double ssc_threshold = 0)
+    {
+        configure(nb_channels, window, hop, zc_threshold, ssc_threshold);
+    };
+
+    /**
+     * @brief Set the channels, window and hop (in samples) and the thresholds
+     * of the zero crossings and slope sign changes. Clears the state.
+     */
+    void
+    configure(int nb_channels,
+              int window,
+              int hop,
+              double zc_threshold = 0,
+              double ssc_threshold = 0,
+              size_t capacity = 1024);
+
+    /**
+     * @brief Clear the window (start of a new recording).
+     */
+    void
+    reset();
+
+    /**
+     * @brief Feed frames of nb_channels values.
+     *
+     * @param timestamps Timestamps of the frames (s).
+     * @param frames Values (n_frames x nb_channels).
+     * @param n_frames Number of frames.
+     * @return int Number of feature vectors pushed in output.
+     */
+    int
+    process(const double *timestamps, const double *frames, size_t n_frames);
+
+    /**
+     * @brief Feed all the pending frames of a ring (e.g. a pack stream).
+     *
+     * @return int Number of feature vectors pushed in output, -1 if the ring
+     * does not have nb_channels channels.
+     */
+    int
+    process(SampleRing &ring);
+
+    static std::string
+    feature_name(int feature);
+
+    int
+    channels() const
+    {
+        return m_channels;
+    };
+
+    int
+    window() const
+    {
+        return m_window;
+    };
+
+    int
+    hop() const
+    {
+        return m_hop;
+    };
+
+    /**
+     * @brief Size of a feature vector (NB_FEATURES x nb_channels).
+     */
+    int
+    size() const
+    {
+        return NB_FEATURES * m_channels;
+    };
+
+    SampleRing output; // Feature vectors
+
+    private:
+    void
+    emit(double timestamp);
+
+    void
+    resum();
+
+    static const int NEW = NB_FEATURES; // Sum of the new samples
+    static const int NB_SUMS = NB_FEATURES + 1;
+
+    int m_channels = 0;
+    int m_window = 1;
+    int m_hop = 1;
+    double m_zc_threshold = 0;
+    double m_ssc_threshold = 0;
+
+    uint64_t m_count = 0;           // Frames received
+    std::vector<uint64_t> m_seen;   // New samples received per channel
+    std::vector<double> m_contrib;  // window x sum x channel
+    std::vector<double> m_sum;      // sum x channel
+    std::vector<double> m_prev1;    // x[n-1] per channel
+    std::vector<double> m_prev2;    // x[n-2] per channel
+    RingBlock m_block;              // Scratch for process(SampleRing &)
+};
+
+} // namespace ClvHd
+
+#endif // __CLV_HD_FEATURES_HPP__
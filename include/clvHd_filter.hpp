@@ -0,0 +1,184 @@
+#ifndef __CLV_HD_FILTER_HPP__
+#define __CLV_HD_FILTER_HPP__
+
+#include <string>
+#include <vector>
+
+#include <stdint.h> // uint8_t, uint16_t, uint32_t, uint64_t
+
+namespace ClvHd
+{
+
+/**
+ * @brief Coefficients of a second order section (a0 normalised to 1).
+ *
+ * y[n] = b0 x[n] + b1 x[n-1] + b2 x[n-2] - a1 y[n-1] - a2 y[n-2]
+ */
+struct Biquad
+{
+    double b0 = 1, b1 = 0, b2 = 0, a1 = 0, a2 = 0;
+
+    static Biquad
+    lowpass(double fc, double fs, double Q = 0.70710678118654752);
+    static Biquad
+    highpass(double fc, double fs, double Q = 0.70710678118654752);
+    static Biquad
+    notch(double f0, double fs, double Q = 30);
+    /**
+     * @brief First order sections (b2 = a2 = 0) for odd Butterworth orders.
+     */
+    static Biquad
+    lowpass1(double fc, double fs);
+    static Biquad
+    highpass1(double fc, double fs);
+
+    /**
+     * @brief Butterworth filter of the given order as second order sections.
+     */
+    static std::vector<Biquad>
+    butter_lowpass(int order, double fc, double fs);
+    static std::vector<Biquad>
+    butter_highpass(int order, double fc, double fs);
+};
+
+/**
+ * @brief Streaming cascade of biquads applied to every channel.
+ *
+ * The filter keeps its state between the calls, so each sample is processed
+ * once whatever the size of the blocks. The blocks are frames of nb_channels
+ * contiguous values (the layout of SampleRing). The states are stored per
+ * stage with the channels contiguous, so the inner loop over the channels
+ * runs one channel per SIMD lane. The NaN values (channels without a new
+ * sample in read_streams()) are passed through and leave the state unchanged.
+ */
+class FilterBank
+{
+    public:
+    FilterBank(int nb_channels = 0, double fs = 1000)
+        : m_channels(nb_channels), m_fs(fs) {};
+
+    /**
+     * @brief Change the number of channels and the sampling rate. The stages
+     * must be added again.
+     */
+    void
+    resize(int nb_channels, double fs)
+    {
+        m_channels = nb_channels;
+        m_fs = fs;
+        clear();
+    };
+
+    /**
+     * @brief Remove all the stages.
+     */
+    void
+    clear()
+    {
+        m_stages.clear();
+        m_z1.clear();
+        m_z2.clear();
+    };
+
+    /**
+     * @brief Reset the state of every channel (start of a new recording).
+     */
+    void
+    reset()
+    {
+        m_z1.assign(m_z1.size(), 0);
+        m_z2.assign(m_z2.size(), 0);
+    };
+
+    void
+    add(const Biquad &stage);
+
+    /**
+     * @brief Butterworth band-pass (high-pass and low-pass of the given
+     * order each).
+     */
+    void
+    add_bandpass(double low, double high, int order = 2);
+
+    /**
+     * @brief Butterworth high-pass, e.g. removal of the DC offset.
+     */
+    void
+    add_highpass(double fc, int order = 2);
+
+    void
+    add_lowpass(double fc, int order = 2);
+
+    /**
+     * @brief Notch at f0 and at its harmonics below the Nyquist frequency.
+     *
+     * @param f0 Line frequency (50 or 60Hz).
+     * @param harmonics Number of frequencies notched (1: f0 only).
+     * @param Q Quality factor (f0 / bandwidth).
+     */
+    void
+    add_notch(double f0, int harmonics = 1, double Q = 30);
+
+    /**
+     * @brief Filter a block of frames in place.
+     *
+     * @param data Frames of nb_channels values (n_frames x nb_channels).
+     * @param n_frames Number of frames.
+     */
+    void
+    process(double *data, size_t n_frames)
+    {
+        size_t nch = m_channels;
+        for(size_t f = 0; f < n_frames; f++)
+        {
+            double *__restrict x = data + f * nch;
+            for(size_t s = 0; s < m_stages.size(); s++)
+            {
+                const Biquad c = m_stages[s];
+                double *__restrict z1 = m_z1.data() + s * nch;
+                double *__restrict z2 = m_z2.data() + s * nch;
+                // Transposed direct form II, one channel per lane
+                for(size_t ch = 0; ch < nch; ch++)
+                {
+                    double in = x[ch];
+                    bool valid = (in == in);
+                    double y = c.b0 * in + z1[ch];
+                    double n1 = c.b1 * in - c.a1 * y + z2[ch];
+                    double n2 = c.b2 * in - c.a2 * y;
+                    z1[ch] = valid ? n1 : z1[ch];
+                    z2[ch] = valid ? n2 : z2[ch];
+                    x[ch] = y;
+                }
+            }
+        }
+    };
+
+    int
+    channels() const
+    {
+        return m_channels;
+    };
+
+    double
+    fs() const
+    {
+        return m_fs;
+    };
+
+    const std::vector<Biquad> &
+    stages() const
+    {
+        return m_stages;
+    };
+
+    private:
+    int m_channels;
+    double m_fs;
+    std::vector<Biquad> m_stages;
+    std::vector<double> m_z1; // stage x channel
+    std::vector<double> m_z2;
+};
+
+} // namespace ClvHd
+
+#endif // __CLV_HD_FILTER_HPP__
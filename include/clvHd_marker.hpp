@@ -0,0 +1,156 @@
+#ifndef __CLV_HD_MARKER_HPP__
+#define __CLV_HD_MARKER_HPP__
+
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <string>
+
+#include <stdint.h> // uint8_t, uint16_t, uint32_t, uint64_t
+
+#include "clvHd_ring.hpp"
+
+namespace ClvHd
+{
+
+/**
+ * @brief Event marker (stimulus, trigger...) in the time base of the
+ * acquisition streams.
+ */
+struct Marker
+{
+    double timestamp = 0; // Stream time base (controller clock, s)
+    double host = 0;      // Host time of the marker (host_clock(), s)
+    int code = 0;
+    char label[48] = {};  // Null terminated, truncated
+
+    std::string
+    str() const
+    {
+        return std::string(label);
+    };
+};
+
+/**
+ * @brief Read position of one consumer of a Markers queue.
+ */
+struct MarkerCursor
+{
+    size_t next = 0;          // Position of the next marker to read
+    uint64_t lost = 0;        // Markers overwritten before being read
+    bool has_pending = false; // Marker popped but later than the frames
+    Marker pending;
+};
+
+/**
+ * @brief Marker queue of a pack.
+ *
+ * The markers are stamped with the host clock and mapped to the stream time
+ * base with the host offset estimated by the acquisition (read atomically,
+ * so a marker never waits for a read). The queue is a bounded lock-free
+ * broadcast ring (sequence number per cell): any thread can insert markers,
+ * and every consumer reads all of them in order of insertion through its own
+ * MarkerCursor, so the recorder and the LSL publisher do not take each
+ * other's markers. When the ring is full, the oldest marker is overwritten
+ * and a consumer lagging by more than the capacity counts it as lost.
+ */
+class Markers
+{
+    public:
+    /**
+     * @param offset Host offset of the stream (host_clock() = timestamp +
+     * offset), NaN or nullptr to keep the host clock.
+     */
+    Markers(const std::atomic<double> *offset = nullptr, size_t capacity = 256);
+
+    /**
+     * @brief Insert a marker stamped now.
+     *
+     * @return bool Always true (the oldest marker is overwritten).
+     */
+    bool
+    mark(const std::string &label, int code = 0)
+    {
+        return mark_at(host_clock(), label, code);
+    };
+
+    /**
+     * @brief Insert a marker stamped at a host time (host_clock() of the
+     * event, e.g. taken by the experiment software at the stimulus).
+     */
+    bool
+    mark_at(double host, const std::string &label, int code = 0);
+
+    /**
+     * @brief Stream timestamp of a host time.
+     */
+    double
+    to_stream(double host) const
+    {
+        double offset = (m_offset != nullptr)
+                            ? m_offset->load(std::memory_order_relaxed)
+                            : NAN;
+        return std::isnan(offset) ? host : host - offset;
+    };
+
+    /**
+     * @brief Cursor of a new consumer, at the oldest marker kept.
+     */
+    MarkerCursor
+    cursor() const;
+
+    /**
+     * @brief Read the next marker of a consumer.
+     */
+    bool
+    pop(MarkerCursor &cursor, Marker &marker) const;
+
+    /**
+     * @brief Read the next marker of a consumer if it is not later than a
+     * timestamp, to interleave the markers with frames.
+     */
+    bool
+    pop_until(MarkerCursor &cursor, double timestamp, Marker &marker) const;
+
+    /**
+     * @brief Read the next marker of the default consumer (LSL publisher,
+     * Python pop_markers()).
+     */
+    bool
+    pop(Marker &marker)
+    {
+        return pop(m_cursor, marker);
+    };
+
+    bool
+    pop_until(double timestamp, Marker &marker)
+    {
+        return pop_until(m_cursor, timestamp, marker);
+    };
+
+    /**
+     * @brief Markers lost by the default consumer.
+     */
+    uint64_t
+    dropped() const
+    {
+        return m_cursor.lost;
+    };
+
+    private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence; // Position + 1, 0 while written
+        Marker marker;
+    };
+
+    const std::atomic<double> *m_offset;
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask;
+    alignas(64) std::atomic<size_t> m_enqueue{0};
+    MarkerCursor m_cursor; // Default consumer
+};
+
+} // namespace ClvHd
+
+#endif // __CLV_HD_MARKER_HPP__
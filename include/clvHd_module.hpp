@@ -99,12 +99,15 @@ class Module : public virtual ESC::CLI
     std::string m_type;
 };
 
+/**
+ * @brief Group of modules of a device handled together. The modules belong
+ * to the device, which must outlive its packs.
+ */
 class ModulePack : virtual public ESC::CLI
 {
     public:
-    ModulePack(Device *device, int verbose = -1)
-        : ESC::CLI(verbose, "ModulePack"), m_device(device) {};
-    ~ModulePack() {};
+    ModulePack(Device *device, int verbose = -1);
+    ~ModulePack();
 
     virtual void
     setup() {};
@@ -132,6 +135,19 @@ class ModulePack : virtual public ESC::CLI
         actuatorValues.push_back(&module->actuatorValue);
     };
 
+    /**
+     * @brief Forget the modules, deleted by the device on reconnection (set
+     * the pack up again).
+     */
+    void
+    clearModules()
+    {
+        modules.clear();
+        sensorValues.clear();
+        actuatorValues.clear();
+        m_mask = 0;
+    };
+
     std::vector<Module *> modules;
     std::vector<Value *> sensorValues;
     std::vector<Value *> actuatorValues;
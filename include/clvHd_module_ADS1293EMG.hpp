@@ -1,15 +1,20 @@
 #ifndef CLV_HD_ADS1293EMG_H
 #define CLV_HD_ADS1293EMG_H
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cstring>
 #include <iostream>
+#include <limits>
 #include <string>
 #include <vector>
 
 #include "clvHd_controller.hpp"
 #include "clvHd_device.hpp"
+#include "clvHd_marker.hpp"
 #include "clvHd_module_ADS1293EMG_registers.hpp"
+#include "clvHd_ring.hpp"
 #include "strANSIseq.hpp"
 #include <stdint.h> // uint8_t, uint16_t, uint32_t, uint64_t
 
@@ -66,6 +71,30 @@ class EMG_ADS1293Config
     {
         this->clock_intern = clock_intern;
     }
+    void
+    set_synchronous(bool synchronous)
+    {
+        this->synchronous = synchronous;
+    }
+
+    /**
+     * @brief fingerprint Compact string identifying the configuration (used
+     * as key of the configuration cache).
+     */
+    std::string
+    fingerprint() const
+    {
+        std::string s;
+        for(int i = 0; i < 3; i++)
+            s += std::to_string(chx_enable[i]) +
+                 std::to_string(route_table[i][0]) +
+                 std::to_string(route_table[i][1]) +
+                 std::to_string(chx_high_res[i]) +
+                 std::to_string(chx_high_freq[i]) + "." +
+                 std::to_string(R1[i]) + "." + std::to_string(R3[i]) + "/";
+        return s + std::to_string(R2) + (clock_intern ? "i" : "e") +
+               (synchronous ? "s" : "");
+    }
 
     bool chx_enable[3] = {true, true, true}; // Enable channel 1
     int route_table[3][2] = {
@@ -80,6 +109,7 @@ class EMG_ADS1293Config
     int R2 = 4;                     // Gain R2 of the INA channels
     int R3[3] = {4, 4, 4};          // Gain R3 of the INA channels
     bool clock_intern = true;       // Use internal clock
+    bool synchronous = false; // Shared clock of the first module and SYNCB
 };
 
 
@@ -103,6 +133,31 @@ class EMG_ADS1293 : public Module
         uint8_t padding;
     } Error;
 
+    /**
+     * @brief Per-channel calibration of the analog front end, measured by
+     * EMG_ADS1293Pack::calibrate(). The corrected value is
+     * (v - offset) / gain, v being the nominal conversion of the code.
+     */
+    struct Calibration
+    {
+        double offset[3] = {0, 0, 0};      // Precise offset (V)
+        double gain[3] = {1, 1, 1};        // Precise gain (measured/nominal)
+        double fast_offset[3] = {0, 0, 0}; // Fast offset (V)
+        double fast_gain[3] = {1, 1, 1};   // Fast gain
+        double vbat[3] = {0, 0, 0};        // Corrected VBAT reading (V)
+    };
+
+    /**
+     * @brief Errors of a channel decoded from the error registers (see
+     * channel_errors()).
+     */
+    enum ChannelError
+    {
+        LEAD_OFF = 0x1,     // Lead off on one of the routed inputs
+        OUT_OF_RANGE = 0x2, // INA or sigma-delta out of range
+        MODULE_ERROR = 0x4  // Common mode, RLD, battery or sync error
+    };
+
     enum CLK_SRC
     {
         EXTERN = 1,
@@ -166,6 +221,9 @@ class EMG_ADS1293 : public Module
      * @param R1 Gain R1 of the INA channels.
      * @param R2 Gain R2 of the INA channels.
      * @param R3 Gain R3 of the INA channels.
+     * @param clock_intern Run from the internal oscillator, or from the CLK
+     * pin.
+     * @param clock_output Output the clock on the CLK pin (clock master).
      */
     int
     setup(int route_table[3][2],
@@ -175,7 +233,8 @@ class EMG_ADS1293 : public Module
           int R1[3],
           int R2,
           int R3[3],
-          bool clock_intern = true);
+          bool clock_intern = true,
+          bool clock_output = false);
     
     /**
      * @brief route_channel Route the EMG channels to the input electrodes.
@@ -204,6 +263,16 @@ class EMG_ADS1293 : public Module
     Mode
     get_mode();
 
+    /**
+     * @brief set_mode Write the mode of several modules in one transaction.
+     *
+     * @return int Number of bytes written.
+     */
+    static int
+    set_mode(Controller *controller,
+             const std::vector<EMG_ADS1293 *> &modules,
+             Mode mode);
+
     int
     config_clock(bool start, CLK_SRC src, bool en_output);
 
@@ -214,6 +283,14 @@ class EMG_ADS1293 : public Module
     bool
     is_clock_output_enabled();
 
+    /**
+     * @brief config_sync Drive the SYNCB pin at the start of the conversions
+     * (synchronisation master), or take it as an input that realigns the
+     * digital filters (default).
+     */
+    int
+    config_sync(bool output);
+
     int
     enable_ADC(bool ch1, bool ch2, bool ch3);
     bool
@@ -248,7 +325,43 @@ class EMG_ADS1293 : public Module
     get_filters(int R1[3], int *R2, int R3[3]);
 
     void
-    update_adc_max();
+    decode_filters(int R1[3], int *R2, int R3[3]);
+
+    /**
+     * @brief update_adc_max Update the ADC full scales from the decimation rates.
+     *
+     * @param pull If true the decimation registers are read from the module,
+     * otherwise the local register image is used.
+     */
+    void
+    update_adc_max(bool pull = true);
+
+    /**
+     * @brief odr Output data rate of a channel, from the local register image.
+     *
+     * @param precise Rate of the precise (ECG) data instead of the fast (pace) one.
+     * @param ch Channel (0, 1, 2).
+     * @return double Output data rate (Hz).
+     */
+    double
+    odr(bool precise, int ch);
+
+    /**
+     * @brief load_regs Restore the local register image (e.g. from a cache)
+     * and the state derived from it, without any transaction.
+     *
+     * @param regs Register image starting at CONFIG_REG.
+     * @param n Size of the image.
+     */
+    void
+    load_regs(const uint8_t *regs, size_t n);
+
+    /**
+     * @brief is_config_reg Check if a register holds configuration (as
+     * opposed to the mode, the status, the data or reserved registers).
+     */
+    static bool
+    is_config_reg(uint8_t reg);
 
     double
     read_precise_value(int ch, bool converted = true);
@@ -262,15 +375,74 @@ class EMG_ADS1293 : public Module
     double
     fast_value(int ch, bool converted = true);
 
+    /**
+     * @brief conv Nominal conversion of a fast code (no calibration).
+     */
     double
     conv(uint16_t val);
 
+    /**
+     * @brief conv Calibrated conversion of a precise code of channel ch.
+     */
     double
     conv(int ch, int32_t val);
 
+    /**
+     * @brief conv_fast Calibrated conversion of a fast code of channel ch.
+     */
+    double
+    conv_fast(int ch, uint16_t val);
+
+    /**
+     * @brief volts Nominal conversion of a (decoded, averaged) code.
+     */
+    double
+    volts(bool precise, int ch, double code) const
+    {
+        return (code / (precise ? m_precise_adc_max[ch] : m_fast_adc_max) -
+                0.5) *
+               4.8 / 3.5;
+    };
+
+    /**
+     * @brief set_calibration Set the calibration, folded into the
+     * conversions as a single multiply-add per value.
+     */
+    void
+    set_calibration(const Calibration &calibration)
+    {
+        m_calibration = calibration;
+        update_conv();
+    };
+
+    const Calibration &
+    calibration() const
+    {
+        return m_calibration;
+    };
+
     int
     get_error();
 
+    /**
+     * @brief channel_errors Errors of a channel (ChannelError flags) from
+     * the local image of the error registers (see get_error()).
+     */
+    uint8_t
+    channel_errors(int ch) const;
+
+    /**
+     * @brief rails Converted values of the lowest and highest precise codes
+     * of a channel (the saturation levels).
+     */
+    void
+    rails(int ch, double &low, double &high) const
+    {
+        low = m_precise_bias[ch];
+        high = std::fma((double)m_precise_adc_max[ch], m_precise_scale[ch],
+                        m_precise_bias[ch]);
+    };
+
     std::string
     error_range_str();
 
@@ -363,9 +535,45 @@ class EMG_ADS1293 : public Module
     //ESC::CLI for static functions
     static ESC::CLI s_cli;
 
+    void
+    update_conv();
+
     int32_t *m_precise_value[3];
     int32_t m_fast_adc_max;
     int32_t m_precise_adc_max[3];
+
+    // Conversions with the calibration folded in: v = code * scale + bias
+    Calibration m_calibration;
+    double m_fast_scale[3];
+    double m_fast_bias[3];
+    double m_precise_scale[3];
+    double m_precise_bias[3];
+};
+
+/**
+ * @brief Clock lock and inter-module skew of a pack in synchronous mode (see
+ * EMG_ADS1293Pack::check_sync()).
+ */
+struct SyncReport
+{
+    bool locked = false;         // Shared clock running and no sync error
+    std::vector<uint8_t> osc;    // OSC_CN of each module
+    std::vector<uint8_t> errors; // ERROR_SYNC of each module
+    std::vector<int> samples;    // Precise samples of each module
+    std::vector<double> skew;    // Mean delay of the samples after the master (s)
+    std::vector<double> skew_max; // Largest delay (s, absolute)
+    double resolution = 0;       // Period of the reads, resolution of the skew (s)
+};
+
+/**
+ * @brief Error registers of a module, read when its ALARMB flag is set.
+ */
+struct ErrorReport
+{
+    double timestamp = 0; // Timestamp of the read raising the alarm
+    int module = -1;      // Index of the module in the pack
+    uint8_t regs[7] = {}; // ERROR_LOD to ERROR_MISC
+    uint8_t flags[3] = {}; // EMG_ADS1293::ChannelError of each channel
 };
 
 class EMG_ADS1293Pack : public ModulePack
@@ -381,6 +589,8 @@ class EMG_ADS1293Pack : public ModulePack
     setup()
     {
         logln("Setting up EMG_ADS1293Pack", true);
+        if(this->setup_cached())
+            return;
         logln("Scanning the " + std::to_string(m_device->modules.size()) +
                   " modules: ",
               true);
@@ -402,6 +612,11 @@ class EMG_ADS1293Pack : public ModulePack
                     //delete and replace the device default module
                     delete m_device->modules[i];
                     m_device->modules[i] = emg;
+                    m_device->sensorValues[i] = &emg->sensorValue;
+                    m_device->actuatorValues[i] = &emg->actuatorValue;
+                    if(m_device->cacheEntry() != nullptr)
+                        m_device->cacheEntry()->modules[emg->id].type =
+                            "EMG_ADS1293";
                 }
                 else
                 {
@@ -416,26 +631,615 @@ class EMG_ADS1293Pack : public ModulePack
         }
     };
 
+    /**
+     * @brief setup_cached Type the modules recorded as ADS1293 in the device
+     * cache entry, after checking their REVID in a single transaction.
+     *
+     * @return true if the cached topology was confirmed, false if the modules
+     * must be probed one by one.
+     */
+    bool
+    setup_cached()
+    {
+        ConfigCache::Entry *entry = m_device->cacheEntry();
+        if(entry == nullptr)
+            return false;
+
+        uint32_t mask = 0;
+        std::vector<size_t> index;
+        for(size_t i = 0; i < m_device->modules.size(); i++)
+            if((size_t)m_device->modules[i]->id < entry->modules.size() &&
+               entry->modules[m_device->modules[i]->id].type == "EMG_ADS1293" &&
+               !m_device->modules[i]->typed)
+            {
+                mask |= ((uint32_t)1) << m_device->modules[i]->id;
+                index.push_back(i);
+            }
+        if(index.empty())
+            return false;
+
+        std::vector<uint8_t> revid(index.size());
+        uint8_t cmd = ADS1293_Reg::REVID_REG | 0b10000000;
+        int n = m_device->controller->readCmd_multi(mask, 1, &cmd, 1,
+                                                    revid.data());
+        if((size_t)n != index.size() ||
+           std::count(revid.begin(), revid.end(), 1) != (int)index.size())
+        {
+            logln("Cached topology does not match, scanning the modules", true);
+            return false;
+        }
+
+        for(size_t i : index)
+        {
+            EMG_ADS1293 *emg = new EMG_ADS1293(
+                m_device->controller, m_device->modules[i]->id, m_verbose);
+            this->addModule(emg);
+            delete m_device->modules[i];
+            m_device->modules[i] = emg;
+            m_device->sensorValues[i] = &emg->sensorValue;
+            m_device->actuatorValues[i] = &emg->actuatorValue;
+        }
+        logln("Cached topology confirmed: " + std::to_string(index.size()) +
+                  " modules",
+              true);
+        return true;
+    };
+
+    /**
+     * @brief configure Set up all the modules with a configuration.
+     *
+     * In synchronous mode, the first module is the clock master: it runs
+     * from its oscillator, outputs its clock on CLK and drives SYNCB, while
+     * the other modules run from CLK (EXTERN) and realign on SYNCB. The CLK
+     * and SYNCB lines of the modules must be wired together.
+     */
     void configure(EMG_ADS1293Config &config)
     {
+        m_sync = config.synchronous && this->modules.size() > 1;
+        std::string fingerprint = config.fingerprint();
+        if(this->restore(fingerprint))
+        {
+            this->load_calibration();
+            return;
+        }
+
+        // The master is set up first, the others need its clock to start
         for(size_t i = 0; i < this->modules.size(); i++)
         {
             EMG_ADS1293 *emg = (EMG_ADS1293 *)this->modules[i];
+            bool master = m_sync && i == 0;
             emg->setup(config.route_table, config.chx_enable,
                        config.chx_high_res, config.chx_high_freq, config.R1,
-                       config.R2, config.R3, config.clock_intern);
+                       config.R2, config.R3,
+                       m_sync ? master : config.clock_intern, master);
+            emg->config_sync(master);
+        }
+
+        ConfigCache::Entry *entry = m_device->cacheEntry();
+        if(entry != nullptr)
+        {
+            for(size_t i = 0; i < this->modules.size(); i++)
+            {
+                EMG_ADS1293 *emg = (EMG_ADS1293 *)this->modules[i];
+                ConfigCache::ModuleImage &img = entry->modules[emg->id];
+                img.type = "EMG_ADS1293";
+                img.config = fingerprint;
+                img.regs.assign(emg->regsAddr(),
+                                emg->regsAddr() + ADS1293_Reg::DATA_STATUS_REG);
+            }
+            m_device->saveCache();
+            this->load_calibration();
+        }
+    };
+
+    /**
+     * @brief restore Apply a cached configuration: the live configuration
+     * registers of all modules are read in as few transactions as possible
+     * and only the registers that differ from the cached images are written.
+     *
+     * @param fingerprint Fingerprint of the requested configuration.
+     * @return true if the configuration was restored from the cache.
+     */
+    bool
+    restore(const std::string &fingerprint)
+    {
+        ConfigCache::Entry *entry = m_device->cacheEntry();
+        if(entry == nullptr || this->modules.empty())
+            return false;
+        for(auto &m : this->modules)
+        {
+            ConfigCache::ModuleImage &img = entry->modules[m->id];
+            if(img.config != fingerprint ||
+               img.regs.size() != ADS1293_Reg::DATA_STATUS_REG)
+                return false;
+        }
+
+        // Read the configuration window of as many modules as a reply holds
+        const size_t size = ADS1293_Reg::DATA_STATUS_REG;
+        const size_t per_read = m_device->controller->maxReplySize() / size;
+        std::vector<uint8_t> live(size * this->modules.size());
+        uint8_t cmd = ADS1293_Reg::CONFIG_REG | 0b10000000;
+        for(size_t i = 0; i < this->modules.size(); i += per_read)
+        {
+            uint32_t mask = 0;
+            size_t nb = std::min(per_read, this->modules.size() - i);
+            for(size_t j = i; j < i + nb; j++)
+                mask |= ((uint32_t)1) << this->modules[j]->id;
+            int n = m_device->controller->readCmd_multi(
+                mask, 1, &cmd, size, live.data() + size * i);
+            if((size_t)n != size * nb)
+                return false;
+        }
+
+        int nb_writes = 0;
+        for(size_t i = 0; i < this->modules.size(); i++)
+        {
+            EMG_ADS1293 *emg = (EMG_ADS1293 *)this->modules[i];
+            const uint8_t *cached = entry->modules[emg->id].regs.data();
+            const uint8_t *current = live.data() + size * i;
+            std::vector<uint8_t> diff;
+            for(uint8_t reg = 0; reg < size; reg++)
+                if(EMG_ADS1293::is_config_reg(reg) &&
+                   cached[reg] != current[reg] && reg != OSC_CN_REG)
+                    diff.push_back(reg);
+            if(cached[OSC_CN_REG] != current[OSC_CN_REG])
+                diff.push_back(OSC_CN_REG); // clock started last
+
+            // The module keeps converting if nothing changed
+            if(diff.empty())
+            {
+                emg->load_regs(current, size);
+                continue;
+            }
+            emg->load_regs(cached, size);
+            emg->set_mode(EMG_ADS1293::POWER_DOWN);
+            for(uint8_t reg : diff) emg->writeReg(reg, cached[reg]);
+            nb_writes += diff.size() + 1;
         }
+        logln("Configuration restored from the cache (" +
+                  std::to_string(nb_writes) + " registers written)",
+              true);
+        return true;
     };
 
+    /**
+     * @brief calibrate Measure the offset and the gain of every channel with
+     * the internal test signals and store them in the modules (and in the
+     * device cache).
+     *
+     * Each channel is routed in turn to the zero, positive and negative test
+     * signals: the offset is the reading of the zero signal and the gain the
+     * measured over the nominal test amplitude. The VBAT monitor is read
+     * last as a check of the corrected conversion. The routing and the mode
+     * of the modules are restored afterwards. The streams must not be read
+     * meanwhile (no Acquisition thread running).
+     *
+     * @param amplitude Nominal amplitude of the test signals (V).
+     * @param samples Precise samples averaged per channel and signal.
+     * @param settle Samples discarded after each routing change.
+     * @return int Number of calibrated channels.
+     */
+    int
+    calibrate(double amplitude = 2.4 / 12, int samples = 64, int settle = 8)
+    {
+        const size_t nb = this->modules.size();
+        const uint8_t routes = ADS1293_Reg::FLEX_CH0_CN_REG;
+        const uint8_t vbat = ADS1293_Reg::FLEX_VBAT_CN_REG;
+        std::vector<uint8_t> saved(4 * nb), mode(nb);
+        for(size_t i = 0; i < nb; i++)
+        {
+            EMG_ADS1293 *emg = (EMG_ADS1293 *)this->modules[i];
+            std::copy(emg->regsAddr() + routes, emg->regsAddr() + routes + 3,
+                      saved.data() + 4 * i);
+            saved[4 * i + 3] = emg->regsAddr()[vbat];
+            mode[i] = emg->regsAddr()[ADS1293_Reg::CONFIG_REG];
+            emg->set_calibration(EMG_ADS1293::Calibration());
+            emg->set_mode(EMG_ADS1293::START_CONV);
+        }
+
+        // Mean codes [signal][module * 3 + ch] of the fast and precise data
+        enum Signal
+        {
+            ZERO = 0,
+            POS,
+            NEG,
+            VBAT
+        };
+        std::vector<double> fast[4], precise[4];
+        for(int sig = ZERO; sig <= VBAT; sig++)
+        {
+            for(size_t i = 0; i < nb; i++)
+            {
+                EMG_ADS1293 *emg = (EMG_ADS1293 *)this->modules[i];
+                for(int ch = 0; ch < 3; ch++)
+                {
+                    if(sig == VBAT)
+                        emg->writeReg(routes + ch, saved[4 * i + ch]);
+                    else
+                        emg->route_channel_test(ch, sig != NEG, sig != POS);
+                }
+                if(sig == VBAT)
+                    emg->route_vbat(true, true, true);
+            }
+            measure(samples, settle, fast[sig], precise[sig]);
+        }
+
+        int calibrated = 0;
+        for(size_t i = 0; i < nb; i++)
+        {
+            EMG_ADS1293 *emg = (EMG_ADS1293 *)this->modules[i];
+            for(int ch = 0; ch < 4; ch++)
+            {
+                uint8_t reg = (ch < 3) ? routes + ch : vbat;
+                emg->regsAddr()[reg] = saved[4 * i + ch];
+                emg->writeReg(reg, saved[4 * i + ch]);
+            }
+            emg->set_mode((EMG_ADS1293::Mode)mode[i]);
+
+            EMG_ADS1293::Calibration c;
+            for(int ch = 0; ch < 3; ch++)
+            {
+                size_t k = 3 * i + ch;
+                if(std::isnan(precise[ZERO][k]))
+                    continue; // disabled or not converting
+                double gain = std::abs(emg->volts(true, ch, precise[POS][k]) -
+                                       emg->volts(true, ch, precise[NEG][k])) /
+                              (2 * amplitude);
+                double fast_gain =
+                    std::abs(emg->volts(false, ch, fast[POS][k]) -
+                             emg->volts(false, ch, fast[NEG][k])) /
+                    (2 * amplitude);
+                if(!(gain > 0.5 && gain < 1.5 && fast_gain > 0.5 &&
+                     fast_gain < 1.5))
+                {
+                    logln("Module " + std::to_string(emg->id) + " ch" +
+                              std::to_string(ch) + ": implausible gain " +
+                              std::to_string(gain) + ", not calibrated",
+                          true);
+                    continue;
+                }
+                c.offset[ch] = emg->volts(true, ch, precise[ZERO][k]);
+                c.gain[ch] = gain;
+                c.fast_offset[ch] = emg->volts(false, ch, fast[ZERO][k]);
+                c.fast_gain[ch] = fast_gain;
+                c.vbat[ch] =
+                    (emg->volts(true, ch, precise[VBAT][k]) - c.offset[ch]) /
+                    gain;
+                calibrated++;
+                logln("Module " + std::to_string(emg->id) + " ch" +
+                          std::to_string(ch) +
+                          ": offset=" + std::to_string(c.offset[ch] * 1e3) +
+                          "mV gain=" + std::to_string(c.gain[ch]) +
+                          " vbat=" + std::to_string(c.vbat[ch]) + "V",
+                      true);
+            }
+            emg->set_calibration(c);
+        }
+        this->save_calibration();
+        return calibrated;
+    };
+
+    /**
+     * @brief save_calibration Store the calibration of the modules in the
+     * device cache (if enabled).
+     */
+    void
+    save_calibration()
+    {
+        ConfigCache::Entry *entry = m_device->cacheEntry();
+        if(entry == nullptr)
+            return;
+        for(auto &m : this->modules)
+        {
+            const EMG_ADS1293::Calibration &c =
+                ((EMG_ADS1293 *)m)->calibration();
+            std::vector<double> &v = entry->modules[m->id].calibration;
+            v.clear();
+            for(const double *a : {c.offset, c.gain, c.fast_offset, c.fast_gain})
+                v.insert(v.end(), a, a + 3);
+        }
+        m_device->saveCache();
+    };
+
+    /**
+     * @brief load_calibration Apply the calibration stored in the device
+     * cache (if any).
+     *
+     * @return int Number of modules calibrated from the cache.
+     */
+    int
+    load_calibration()
+    {
+        ConfigCache::Entry *entry = m_device->cacheEntry();
+        if(entry == nullptr)
+            return 0;
+        int n = 0;
+        for(auto &m : this->modules)
+        {
+            const std::vector<double> &v = entry->modules[m->id].calibration;
+            if(v.size() != 12)
+                continue;
+            EMG_ADS1293::Calibration c;
+            for(int ch = 0; ch < 3; ch++)
+            {
+                c.offset[ch] = v[ch];
+                c.gain[ch] = v[3 + ch];
+                c.fast_offset[ch] = v[6 + ch];
+                c.fast_gain[ch] = v[9 + ch];
+            }
+            ((EMG_ADS1293 *)m)->set_calibration(c);
+            n++;
+        }
+        if(n > 0)
+            logln("Calibration of " + std::to_string(n) +
+                      " modules loaded from the cache",
+                  true);
+        return n;
+    };
+
+    /**
+     * @brief start_acquisition Start the conversions. In synchronous mode,
+     * the other modules are started in one transaction and the master last:
+     * its SYNCB pulse then starts their filters on the same clock edge.
+     */
     void
     start_acquisition()
     {
-        for(size_t i = 0; i < this->modules.size(); i++)
+        if(m_sync)
         {
-            logln("start acquisition module " + std::to_string(i), true);
-            ((EMG_ADS1293 *)this->modules[i])
+            logln("start synchronous acquisition of " +
+                      std::to_string(this->modules.size()) + " modules",
+                  true);
+            std::vector<EMG_ADS1293 *> slaves;
+            for(size_t i = 1; i < this->modules.size(); i++)
+                slaves.push_back((EMG_ADS1293 *)this->modules[i]);
+            EMG_ADS1293::set_mode(m_device->controller, slaves,
+                                  EMG_ADS1293::START_CONV);
+            ((EMG_ADS1293 *)this->modules[0])
                 ->set_mode(EMG_ADS1293::START_CONV);
         }
+        else
+            for(size_t i = 0; i < this->modules.size(); i++)
+            {
+                logln("start acquisition module " + std::to_string(i), true);
+                ((EMG_ADS1293 *)this->modules[i])
+                    ->set_mode(EMG_ADS1293::START_CONV);
+            }
+        fast_ring.resize(3 * this->modules.size());
+        precise_ring.resize(3 * this->modules.size());
+    };
+
+    bool
+    synchronous() const
+    {
+        return m_sync;
+    };
+
+    /**
+     * @brief check_sync Verify the clock lock of the modules and measure the
+     * skew of their samples.
+     *
+     * The clock registers and the sync errors of all modules are read in
+     * one transaction each: the pack is locked if the master runs its
+     * oscillator with the clock output, the others run from CLK and no
+     * module reports a sync error. Then the data of all modules is read
+     * reads times back to back: each precise sample of a module is paired
+     * with the closest sample of the master and the delay between the reads
+     * that first saw them is averaged. The skew is thus quantised by the
+     * period of the reads (resolution): locked modules show a null skew and
+     * the same number of samples. The streams must not be read meanwhile
+     * (no Acquisition thread running, no FIFO).
+     *
+     * @param reads Number of data reads.
+     */
+    SyncReport
+    check_sync(int reads = 256)
+    {
+        const size_t nb = this->modules.size();
+        SyncReport r;
+        if(nb == 0)
+            return r;
+
+        // OSC_CN, then ERROR_STATUS to ERROR_SYNC of every module
+        r.osc.resize(nb);
+        std::vector<uint8_t> errors(5 * nb);
+        uint8_t cmd = ADS1293_Reg::OSC_CN_REG | 0b10000000;
+        int n = m_device->controller->readCmd_multi(m_mask, 1, &cmd, 1,
+                                                    r.osc.data());
+        cmd = ADS1293_Reg::ERROR_STATUS_REG | 0b10000000;
+        int m = m_device->controller->readCmd_multi(m_mask, 1, &cmd, 5,
+                                                    errors.data());
+        if((size_t)n != nb || (size_t)m != 5 * nb)
+            throw log_error("Error reading the clock configuration");
+        r.locked = m_sync;
+        r.errors.resize(nb);
+        for(size_t i = 0; i < nb; i++)
+        {
+            // STRTCLK | OSC source | EN_CLKOUT
+            uint8_t expected = (i == 0) ? 0b101 : 0b110;
+            r.errors[i] = errors[5 * i + 4];
+            bool edge = errors[5 * i] & 0b10000000; // SYNCEDGEERR
+            if(r.osc[i] != expected || edge || r.errors[i] != 0)
+                r.locked = false;
+        }
+
+        // Reads at which each module had a new precise sample
+        std::vector<std::vector<uint64_t>> ready(nb);
+        std::vector<uint8_t> buffer(16 * nb);
+        uint64_t first = 0, last = 0;
+        cmd = ADS1293_Reg::DATA_STATUS_REG | 0b10000000;
+        for(int k = 0; k < reads; k++)
+        {
+            uint64_t timestamp = 0;
+            n = m_device->controller->readCmd_multi(m_mask, 1, &cmd, 16,
+                                                    buffer.data(), &timestamp);
+            if((size_t)n != 16 * nb)
+                throw log_error("Error reading EMG data");
+            first = (k == 0) ? timestamp : first;
+            last = timestamp;
+            for(size_t i = 0; i < nb; i++)
+                if(buffer[16 * i] & 0b11100000)
+                    ready[i].push_back(timestamp);
+        }
+        r.resolution = (reads > 1) ? (last - first) / 1e6 / (reads - 1) : 0;
+
+        const double nan = std::numeric_limits<double>::quiet_NaN();
+        const double period = 1e6 / std::max(odr(true), 1e-3); // us
+        const std::vector<uint64_t> &master = ready[0];
+        r.samples.resize(nb);
+        r.skew.assign(nb, nan);
+        r.skew_max.assign(nb, nan);
+        for(size_t i = 0; i < nb; i++)
+        {
+            r.samples[i] = ready[i].size();
+            double sum = 0, max = 0;
+            int paired = 0;
+            size_t j = 0;
+            for(uint64_t t : ready[i])
+            {
+                while(j + 1 < master.size() &&
+                      std::abs((double)master[j + 1] - (double)t) <=
+                          std::abs((double)master[j] - (double)t))
+                    j++;
+                if(master.empty())
+                    break;
+                double d = (double)t - (double)master[j];
+                if(std::abs(d) > period / 2)
+                    continue; // No sample of the master at that time
+                sum += d;
+                max = std::max(max, std::abs(d));
+                paired++;
+            }
+            if(paired > 0)
+            {
+                r.skew[i] = sum / paired / 1e6;
+                r.skew_max[i] = max / 1e6;
+            }
+            logln("Module " + std::to_string(this->modules[i]->id) +
+                      ": OSC_CN=" + std::to_string(r.osc[i]) +
+                      " ERROR_SYNC=" + std::to_string(r.errors[i]) + " " +
+                      std::to_string(r.samples[i]) + " samples, skew " +
+                      std::to_string(r.skew[i] * 1e6) + "us (max " +
+                      std::to_string(r.skew_max[i] * 1e6) + "us)",
+                  true);
+        }
+        logln(std::string(r.locked ? "Modules locked" : "Modules NOT locked") +
+                  " (read period " + std::to_string(r.resolution * 1e6) +
+                  "us)",
+              true);
+        return r;
+    };
+
+    /**
+     * @brief Nominal output data rate of the fast or precise stream (rate of
+     * the first enabled channel of the first module).
+     */
+    double
+    odr(bool precise)
+    {
+        for(auto &m : this->modules)
+            for(int ch = 0; ch < 3; ch++)
+                if(((EMG_ADS1293 *)m)->odr(precise, ch) > 0)
+                    return ((EMG_ADS1293 *)m)->odr(precise, ch);
+        return 0;
+    };
+
+    /**
+     * @brief read_streams Read all the modules in one transaction and decode
+     * both the fast (pace) and the precise (ECG) samples of the register
+     * block. The DATA_STATUS flags gate each stream: a frame is pushed in
+     * fast_ring (resp. precise_ring) only if at least one module reports a
+     * new pace (resp. ECG) sample. In a pushed frame, the channels without a
+     * new sample are NaN, so are the disabled channels (they never report
+     * one). After
+     * start_fifo(), it fetches the samples buffered by the controller
+     * instead, each one with the timestamp of its conversion.
+     *
+     * @return int Bit 0 set if a fast frame was pushed, bit 1 if a precise
+     * frame was pushed.
+     */
+    int
+    read_streams()
+    {
+        if(m_fifo != FIFO_STOP)
+            return read_fifo();
+
+        uint64_t timestamp = 0;
+        m_buffer.resize(16 * this->modules.size());
+        uint8_t cmd = ADS1293_Reg::DATA_STATUS_REG | 0b10000000;
+        int n = m_device->controller->readCmd_multi(m_mask, 1, &cmd, 16,
+                                                    m_buffer.data(), &timestamp);
+        if((size_t)n != 16 * this->modules.size())
+            throw log_error("Error reading EMG data");
+        update_host_offset(timestamp);
+        return decode(m_buffer.data(), timestamp);
+    };
+
+    /**
+     * @brief start_fifo Let the controller read the modules at conversion
+     * time into its FIFO, timestamped when the samples are ready, and fetch
+     * them in bulk in read_streams(). With FIFO_DRDYB, the modules drive
+     * DRDYB on the precise (ECG) data of their first enabled channel, so
+     * the entries are taken at the precise rate only: when the fast (pace)
+     * stream is faster, this would decimate it below its nominal rate, and
+     * FIFO_POLL (which takes every pace or ECG sample) is used instead.
+     *
+     * @param source FIFO_POLL or FIFO_DRDYB (falls back to FIFO_POLL if the
+     * controller has no DRDYB input wired, or if the fast stream is faster
+     * than the precise one).
+     * @param compressed Drain the samples delta coded (about half the bytes
+     * on the link at rest), if the controller supports it.
+     * @return int Active source, FIFO_STOP if the controller has no FIFO
+     * (read_streams() keeps reading the registers directly).
+     */
+    int
+    start_fifo(int source = FIFO_POLL, bool compressed = false)
+    {
+        if(source == FIFO_DRDYB && odr(false) > odr(true))
+        {
+            logln("DRDYB follows the precise samples, polling to keep the "
+                  "fast stream at " +
+                      std::to_string(odr(false)) + "Hz",
+                  true);
+            source = FIFO_POLL;
+        }
+        if(source == FIFO_DRDYB)
+            for(auto &m : this->modules)
+            {
+                EMG_ADS1293 *emg = (EMG_ADS1293 *)m;
+                uint8_t shdn = emg->regsAddr()[ADS1293_Reg::AFE_SHDN_CN_REG];
+                int ch = 0;
+                while(ch < 2 && (shdn & (0b001001 << ch))) ch++;
+                emg->writeReg(ADS1293_Reg::DRDYB_SRC_REG, 0b1000 << ch);
+            }
+        uint8_t cmd = ADS1293_Reg::DATA_STATUS_REG | 0b10000000;
+        int active =
+            m_device->controller->startFifo(m_mask, 1, &cmd, 16, source);
+        m_fifo = (active > 0) ? active : FIFO_STOP;
+        m_fifo_bulk = true;
+        m_fifo_compressed = compressed;
+        if(m_fifo == FIFO_STOP)
+            logln("The controller has no FIFO, reading the registers", true);
+        return m_fifo;
+    };
+
+    void
+    stop_fifo()
+    {
+        if(m_fifo == FIFO_STOP)
+            return;
+        uint8_t cmd = ADS1293_Reg::DATA_STATUS_REG | 0b10000000;
+        m_device->controller->startFifo(m_mask, 1, &cmd, 16, FIFO_STOP);
+        m_fifo = FIFO_STOP;
+    };
+
+    /**
+     * @brief Number of samples dropped by the controller FIFO (full).
+     */
+    uint64_t
+    fifo_overflows() const
+    {
+        return m_fifo_overflows;
     };
 
     std::vector<Value *> &
@@ -474,6 +1278,318 @@ class EMG_ADS1293Pack : public ModulePack
         delete[] buffer;
         return sensorValues;
     };
+
+    /**
+     * @brief Offset from the controller timestamps of the streams to the
+     * host clock (host_clock() = timestamp + offset), estimated by
+     * read_streams(). NaN before the first read.
+     */
+    double
+    host_offset() const
+    {
+        return m_host_offset.load(std::memory_order_relaxed);
+    };
+
+    /**
+     * @brief Saturation levels of the precise values of every channel.
+     */
+    void
+    rails(std::vector<double> &low, std::vector<double> &high)
+    {
+        low.resize(3 * this->modules.size());
+        high.resize(3 * this->modules.size());
+        for(size_t i = 0; i < this->modules.size(); i++)
+            for(int ch = 0; ch < 3; ch++)
+                ((EMG_ADS1293 *)this->modules[i])
+                    ->rails(ch, low[3 * i + ch], high[3 * i + ch]);
+    };
+
+    SampleRing fast_ring;    // Fast (pace) frames of read_streams()
+    SampleRing precise_ring; // Precise (ECG) frames of read_streams()
+    Ring<ErrorReport> errors{256}; // Errors of the alarmed modules
+    // Markers in the time base of the streams (any thread can insert them)
+    Markers markers{&m_host_offset};
+    double error_period = 0.1; // Minimum time between two error reads (s)
+
+    protected:
+    /**
+     * @brief read_fifo Fetch the samples of the controller FIFO (until it is
+     * empty or after max_fetches replies) and decode them with their own
+     * timestamps.
+     */
+    int
+    read_fifo(int max_fetches = 16)
+    {
+        if(m_fifo_bulk)
+        {
+            int pushed = 0;
+            for(int f = 0; f < max_fetches; f++)
+            {
+                int n = m_device->controller->drainFifo(0xFFFF, m_frames,
+                                                        m_fifo_compressed);
+                if(n < 0 && f == 0 && m_frames.stride == 0)
+                {
+                    // No bulk drain: one reply at a time, if an entry of all
+                    // the modules fits in a reply
+                    if(2 + 4 + 16 * this->modules.size() >
+                       CLVHD_MAX_REPLY_SIZE)
+                    {
+                        stop_fifo();
+                        logln("A FIFO entry of " +
+                                  std::to_string(this->modules.size()) +
+                                  " modules does not fit in a reply, reading "
+                                  "the registers",
+                              true);
+                        return read_streams();
+                    }
+                    m_fifo_bulk = false;
+                    return read_fifo(max_fetches);
+                }
+                if(n < 0 || m_frames.stride != 16 * this->modules.size())
+                    throw log_error("Error reading the EMG FIFO");
+                pushed |= decode_frames();
+                if(!(m_frames.flags & FIFO_PENDING))
+                    break;
+            }
+            return pushed;
+        }
+
+        const size_t entry = 4 + 16 * this->modules.size();
+        m_buffer.resize(CLVHD_MAX_REPLY_SIZE);
+        int pushed = 0;
+        for(int f = 0; f < max_fetches; f++)
+        {
+            uint64_t timestamp = 0;
+            int n = m_device->controller->fetchFifo(255, m_buffer.data(),
+                                                    &timestamp);
+            if(n < 2 || (size_t)n != 2 + m_buffer[0] * entry)
+                throw log_error("Error reading the EMG FIFO");
+            update_host_offset(timestamp);
+            if(m_buffer[1] & FIFO_OVERFLOW)
+            {
+                m_fifo_overflows++;
+                logln("Controller FIFO overflow", true);
+            }
+            for(size_t k = 0; k < m_buffer[0]; k++)
+            {
+                const uint8_t *e = m_buffer.data() + 2 + k * entry;
+                uint32_t ts;
+                std::memcpy(&ts, e, 4);
+                // 32 bits timestamp of the sample, unwrapped with the reply's
+                uint32_t age = (uint32_t)timestamp - ts;
+                uint64_t t = (timestamp >= age) ? timestamp - age : 0;
+                pushed |= decode(e + 4, t);
+            }
+            if(!(m_buffer[1] & FIFO_PENDING))
+                break;
+        }
+        return pushed;
+    };
+
+    /**
+     * @brief decode_frames Decode the frames of a bulk drain.
+     */
+    int
+    decode_frames()
+    {
+        int pushed = 0;
+        update_host_offset(m_frames.timestamp);
+        if(m_frames.flags & FIFO_OVERFLOW)
+        {
+            m_fifo_overflows++;
+            logln("Controller FIFO overflow", true);
+        }
+        for(size_t k = 0; k < m_frames.count; k++)
+            pushed |= decode(m_frames.frame(k), m_frames.timestamps[k]);
+        return pushed;
+    };
+
+    /**
+     * @brief update_host_offset Host minus controller clock: the minimum over
+     * the reads is the least delayed reply, slowly released to follow the
+     * clock drift.
+     */
+    void
+    update_host_offset(uint64_t timestamp)
+    {
+        double offset = host_clock() - timestamp / 1000000.0;
+        double previous = m_host_offset.load(std::memory_order_relaxed);
+        if(std::isnan(previous) || offset < previous + 1e-6)
+            m_host_offset.store(offset, std::memory_order_relaxed);
+        else
+            m_host_offset.store(previous + 1e-6, std::memory_order_relaxed);
+    };
+
+    /**
+     * @brief decode Decode the 16 register bytes (DATA_STATUS..) of every
+     * module read at the timestamp (us) into the rings (see read_streams()).
+     */
+    int
+    decode(const uint8_t *buffer, uint64_t timestamp)
+    {
+        // ALARMB (bit 1): fetch the error registers of the alarmed modules
+        // in one masked read, at most once per error_period
+        uint8_t any = 0;
+        uint32_t alarms = 0;
+        for(size_t i = 0; i < this->modules.size(); i++)
+        {
+            any |= buffer[16 * i];
+            if(buffer[16 * i] & 0b10)
+                alarms |= ((uint32_t)1) << this->modules[i]->id;
+        }
+        if(alarms != 0 && host_clock() >= m_next_error_read)
+        {
+            m_next_error_read = host_clock() + error_period;
+            read_errors(alarms, timestamp / 1000000.0);
+        }
+        double *fast = (any & 0b00011100) ? fast_ring.reserve() : nullptr;
+        double *precise = (any & 0b11100000) ? precise_ring.reserve() : nullptr;
+        if(fast == nullptr && precise == nullptr)
+            return 0;
+
+        const double nan = std::numeric_limits<double>::quiet_NaN();
+        for(size_t i = 0; i < this->modules.size(); i++)
+        {
+            EMG_ADS1293 *emg = (EMG_ADS1293 *)this->modules[i];
+            uint8_t status = buffer[16 * i];
+            std::copy(buffer + 16 * i, buffer + 16 * (i + 1),
+                      emg->regsAddr() + ADS1293_Reg::DATA_STATUS_REG);
+            for(int ch = 0; ch < 3; ch++)
+            {
+                // P1_DRDY..P3_DRDY: bits 2-4, E1_DRDY..E3_DRDY: bits 5-7
+                if(fast != nullptr)
+                    fast[3 * i + ch] = ((status >> (2 + ch)) & 1)
+                                           ? emg->fast_value(ch)
+                                           : nan;
+                if(precise != nullptr)
+                    precise[3 * i + ch] = ((status >> (5 + ch)) & 1)
+                                              ? emg->precise_value(ch)
+                                              : nan;
+            }
+        }
+        double ts = timestamp / 1000000.0;
+        if(fast != nullptr)
+            fast_ring.commit(ts);
+        if(precise != nullptr)
+            precise_ring.commit(ts);
+        return (fast != nullptr ? 1 : 0) | (precise != nullptr ? 2 : 0);
+    };
+
+    /**
+     * @brief read_errors Read ERROR_LOD..ERROR_MISC of the modules of the
+     * mask in one transaction and push their reports.
+     */
+    void
+    read_errors(uint32_t mask, double timestamp)
+    {
+        size_t nb = 0;
+        for(auto &m : this->modules)
+            nb += (mask >> m->id) & 1;
+        m_error_buffer.resize(7 * nb);
+        uint8_t cmd = ADS1293_Reg::ERROR_LOD_REG | 0b10000000;
+        int n = m_device->controller->readCmd_multi(mask, 1, &cmd, 7,
+                                                    m_error_buffer.data());
+        if((size_t)n != 7 * nb)
+        {
+            logln("Error reading the error registers", true);
+            return;
+        }
+        for(size_t i = 0, k = 0; i < this->modules.size(); i++)
+        {
+            EMG_ADS1293 *emg = (EMG_ADS1293 *)this->modules[i];
+            if(!((mask >> emg->id) & 1))
+                continue;
+            ErrorReport report;
+            report.timestamp = timestamp;
+            report.module = i;
+            std::copy(m_error_buffer.data() + 7 * k,
+                      m_error_buffer.data() + 7 * (k + 1), report.regs);
+            std::copy(report.regs, report.regs + 7,
+                      emg->regsAddr() + ADS1293_Reg::ERROR_LOD_REG);
+            for(int ch = 0; ch < 3; ch++)
+                report.flags[ch] = emg->channel_errors(ch);
+            errors.push(report);
+            k++;
+        }
+    };
+
+    /**
+     * @brief measure Average the raw codes of every channel until each
+     * enabled one got settle + samples new precise samples (NaN for the
+     * channels that got none within a second).
+     */
+    void
+    measure(int samples,
+            int settle,
+            std::vector<double> &fast,
+            std::vector<double> &precise)
+    {
+        const size_t nb = this->modules.size();
+        std::vector<double> sum_fast(3 * nb, 0), sum_precise(3 * nb, 0);
+        std::vector<int> n_fast(3 * nb, 0), n_precise(3 * nb, 0);
+        m_buffer.resize(16 * nb);
+        uint8_t cmd = ADS1293_Reg::DATA_STATUS_REG | 0b10000000;
+        std::vector<bool> enabled(3 * nb);
+        for(size_t i = 0; i < nb; i++)
+            for(int ch = 0; ch < 3; ch++)
+                enabled[3 * i + ch] =
+                    !(((EMG_ADS1293 *)this->modules[i])
+                          ->regsAddr()[ADS1293_Reg::AFE_SHDN_CN_REG] &
+                      (0b001001 << ch));
+        double deadline = host_clock() + 1;
+        bool done = false;
+        while(!done && host_clock() < deadline)
+        {
+            int n = m_device->controller->readCmd_multi(m_mask, 1, &cmd, 16,
+                                                        m_buffer.data());
+            if((size_t)n != 16 * nb)
+                throw log_error("Error reading EMG data");
+            done = true;
+            for(size_t i = 0; i < nb; i++)
+            {
+                const uint8_t *b = m_buffer.data() + 16 * i;
+                for(int ch = 0; ch < 3; ch++)
+                {
+                    size_t k = 3 * i + ch;
+                    if(!enabled[k])
+                        continue;
+                    // P/E DRDY bits, big endian 16 (fast) and 24 (precise) bits
+                    if((b[0] >> (2 + ch)) & 1)
+                        if(n_fast[k]++ >= settle)
+                            sum_fast[k] += (b[1 + 2 * ch] << 8) | b[2 + 2 * ch];
+                    if((b[0] >> (5 + ch)) & 1)
+                        if(n_precise[k]++ >= settle)
+                            sum_precise[k] += (b[7 + 3 * ch] << 16) |
+                                              (b[8 + 3 * ch] << 8) |
+                                              b[9 + 3 * ch];
+                    if(n_precise[k] < settle + samples)
+                        done = false;
+                }
+            }
+        }
+        const double nan = std::numeric_limits<double>::quiet_NaN();
+        fast.assign(3 * nb, nan);
+        precise.assign(3 * nb, nan);
+        for(size_t k = 0; k < 3 * nb; k++)
+        {
+            if(n_fast[k] > settle)
+                fast[k] = sum_fast[k] / (n_fast[k] - settle);
+            if(n_precise[k] > settle)
+                precise[k] = sum_precise[k] / (n_precise[k] - settle);
+        }
+    };
+
+    std::vector<uint8_t> m_buffer;
+    std::vector<uint8_t> m_error_buffer;
+    double m_next_error_read = 0;
+    int m_fifo = FIFO_STOP; // Source of the controller FIFO, if used
+    uint64_t m_fifo_overflows = 0;
+    bool m_fifo_bulk = true; // Controller drains the FIFO in bulk
+    bool m_fifo_compressed = false; // Delta coded drain
+    bool m_sync = false; // Shared clock of the first module and SYNCB
+    FifoFrames m_frames;
+    std::atomic<double> m_host_offset{
+        std::numeric_limits<double>::quiet_NaN()};
 };
 
 
@@ -0,0 +1,263 @@
+#ifndef __CLV_HD_PLANNER_HPP__
+#define __CLV_HD_PLANNER_HPP__
+
+#include <string>
+
+#include <stdint.h> // uint8_t, uint16_t, uint32_t, uint64_t
+
+#include "clvHd_controller.hpp"
+#include "clvHd_module_ADS1293EMG.hpp"
+
+namespace ClvHd
+{
+
+/**
+ * @brief Model of the link between the host and the controller board.
+ *
+ * A polling read costs one request and one reply. Its duration is the
+ * measured round-trip time (turnaround of the USB/serial stack and of the
+ * firmware) plus the time needed to shift the bytes at the baud rate.
+ */
+struct LinkModel
+{
+    int baud = 460800;          // Baud rate of the serial link
+    double bits_per_byte = 10;  // 8N1: start + 8 data + stop bits
+    int request_bytes = 8;      // 'r' | mask(4) | n | n_cmd | cmd
+    int reply_header_bytes = 9; // timestamp(8) | size
+    int module_bytes = 16;      // DATA_STATUS..DATA_CH2_ECG per module
+    double rtt_s = 0.001;       // Measured round-trip time of an empty request
+    double poll_period_s = 0;   // Pause of the host loop between two reads
+    double margin = 0.8;        // Fraction of the capacity that can be used
+
+    /**
+     * @brief Duration of one polling read of nb_modules modules.
+     */
+    double
+    transaction_time(int nb_modules) const
+    {
+        int bytes =
+            request_bytes + reply_header_bytes + module_bytes * nb_modules;
+        return rtt_s + bytes * bits_per_byte / baud + poll_period_s;
+    };
+
+    /**
+     * @brief Maximal number of polling reads per second.
+     */
+    double
+    capacity(int nb_modules) const
+    {
+        return 1. / transaction_time(nb_modules);
+    };
+};
+
+/**
+ * @brief Result of the rate planning.
+ */
+struct RatePlan
+{
+    bool feasible = false;
+    EMG_ADS1293Config config; // Configuration to apply to the pack
+    double target_rate = 0;   // Requested rate (Hz)
+    double odr = 0;           // Output data rate of the planned stream (Hz)
+    double odr_fast = 0;      // Output data rate of the pace stream (Hz)
+    double odr_precise = 0;   // Output data rate of the ECG stream (Hz)
+    double capacity = 0;      // Polling reads per second the link sustains
+    double load = 0;          // Fraction of the link capacity used
+    double max_rate = 0;      // Highest feasible rate for this link
+    int status_bit = 2;       // DATA_STATUS bit flagging a new sample
+    std::string reason;       // Explanation if not feasible
+
+    std::string
+    str() const;
+};
+
+/**
+ * @brief Choose the ADS1293 decimation settings fitting the link bandwidth.
+ *
+ * In polling mode every sample of the planned stream needs one read of all
+ * the modules, so the output data rate is bounded by the link capacity.
+ * ODR_fast = fs / (R1 * R2) and ODR_precise = fs / (R1 * R2 * R3) with
+ * fs = 102.4kHz, or 204.8kHz in high frequency mode.
+ */
+class RatePlanner
+{
+    public:
+    static double
+    modulator_freq(bool high_freq)
+    {
+        return high_freq ? 204800. : 102400.;
+    };
+
+    static double
+    odr_fast(bool high_freq, int R1, int R2)
+    {
+        return modulator_freq(high_freq) / (R1 * R2);
+    };
+
+    static double
+    odr_precise(bool high_freq, int R1, int R2, int R3)
+    {
+        return odr_fast(high_freq, R1, R2) / R3;
+    };
+
+    /**
+     * @brief Measure the round-trip time of the controller board.
+     *
+     * @param controller Controller to measure.
+     * @param n Number of requests sent.
+     * @return double Median round-trip time in seconds, -1 if error.
+     */
+    static double
+    measure_rtt(Controller *controller, int n = 20);
+
+    /**
+     * @brief Plan the decimation settings for a target rate.
+     *
+     * The slowest configuration reaching the target rate is selected, so the
+     * samples are the most decimated (least noisy) the target allows.
+     *
+     * @param target_rate Requested output data rate (Hz).
+     * @param precise Plan the precise (ECG) stream instead of the fast one.
+     * @param chx_enable Channels to enable.
+     * @param nb_modules Number of modules read at each transaction.
+     * @param link Link model (baud rate, overheads and round-trip time).
+     * @param base Configuration providing the routing and resolution.
+     */
+    static RatePlan
+    plan(double target_rate,
+         bool precise,
+         const bool chx_enable[3],
+         int nb_modules,
+         const LinkModel &link,
+         const EMG_ADS1293Config &base = EMG_ADS1293Config());
+};
+
+/**
+ * @brief Runtime monitoring of the achieved rate against a plan.
+ *
+ * Fed with the timestamp and the DATA_STATUS register of each read, it
+ * counts the new samples, the reads that found no new sample and the samples
+ * that were overwritten before being read.
+ */
+class RateMonitor
+{
+    public:
+    void
+    set_plan(const RatePlan &plan)
+    {
+        set_plan(plan.odr, plan.status_bit);
+    };
+
+    void
+    set_plan(double odr, int status_bit)
+    {
+        m_odr = odr;
+        m_status_mask = (uint8_t)(1 << status_bit);
+        reset();
+    };
+
+    void
+    reset()
+    {
+        m_first_ts = 0;
+        m_last_ts = 0;
+        m_reads = 0;
+        m_samples = 0;
+        m_missed = 0;
+    };
+
+    /**
+     * @brief Account for one read.
+     *
+     * @param timestamp Timestamp of the read (us).
+     * @param status DATA_STATUS register of the read.
+     */
+    void
+    update(uint64_t timestamp, uint8_t status)
+    {
+        if(m_odr <= 0)
+            return;
+        if(m_reads > 0 && timestamp > m_last_ts)
+        {
+            double expected = (timestamp - m_last_ts) * 1e-6 * m_odr;
+            if(expected > 1.5)
+                m_missed += (uint64_t)(expected - 0.5);
+        }
+        else
+            m_first_ts = timestamp;
+        m_last_ts = timestamp;
+        m_reads++;
+        if(status & m_status_mask)
+            m_samples++;
+    };
+
+    /**
+     * @brief Account for the last read_all() of the pack.
+     */
+    void
+    update(EMG_ADS1293Pack &pack)
+    {
+        if(pack.modules.empty())
+            return;
+        Value *v = pack.sensorValues[0];
+        uint8_t status = ((EMG_ADS1293 *)pack.modules[0])
+                             ->regsAddr()[ADS1293_Reg::DATA_STATUS_REG];
+        update(v->time_s * 1000000 + v->time_ns, status);
+    };
+
+    double
+    elapsed() const
+    {
+        return (m_last_ts - m_first_ts) * 1e-6;
+    };
+
+    double
+    read_rate() const
+    {
+        return elapsed() > 0 ? (m_reads - 1) / elapsed() : 0;
+    };
+
+    double
+    achieved_rate() const
+    {
+        return elapsed() > 0 ? m_samples / elapsed() : 0;
+    };
+
+    /**
+     * @brief Ratio between the achieved and the planned rate.
+     */
+    double
+    ratio() const
+    {
+        return m_odr > 0 ? achieved_rate() / m_odr : 0;
+    };
+
+    uint64_t
+    missed() const
+    {
+        return m_missed;
+    };
+
+    std::string
+    str() const
+    {
+        return "planned " + std::to_string(m_odr) + "Hz, achieved " +
+               std::to_string(achieved_rate()) + "Hz (" +
+               std::to_string((int)(100 * ratio())) + "%), reads " +
+               std::to_string(read_rate()) + "Hz, missed " +
+               std::to_string(m_missed);
+    };
+
+    private:
+    double m_odr = 0;
+    uint8_t m_status_mask = 0;
+    uint64_t m_first_ts = 0;
+    uint64_t m_last_ts = 0;
+    uint64_t m_reads = 0;
+    uint64_t m_samples = 0;
+    uint64_t m_missed = 0;
+};
+
+} // namespace ClvHd
+
+#endif // __CLV_HD_PLANNER_HPP__
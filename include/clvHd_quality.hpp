@@ -0,0 +1,175 @@
+#ifndef __CLV_HD_QUALITY_HPP__
+#define __CLV_HD_QUALITY_HPP__
+
+#include <string>
+#include <vector>
+
+#include <stdint.h> // uint8_t, uint16_t, uint32_t, uint64_t
+
+#include "clvHd_module_ADS1293EMG.hpp"
+#include "clvHd_ring.hpp"
+
+namespace ClvHd
+{
+
+/**
+ * @brief Online signal quality of every channel, published at a low rate.
+ *
+ * Over each period, the stage accumulates per channel the DFT of the power
+ * line frequency and its harmonics (a phasor shared by the channels, so the
+ * inner loops run over contiguous channels), the power, the samples close to
+ * the saturation levels of the ADC and the new samples. At the end of the
+ * period it pushes a status frame in the output ring: the timestamp of the
+ * last sample and the values [LINE_RATIO ch0..chN-1, SATURATION ch0..,
+ * FLATLINE ch0.., ERRORS ch0..]:
+ * - LINE_RATIO: fraction of the power at the line frequency and harmonics,
+ * - SATURATION: fraction of the samples within margin of the rails,
+ * - FLATLINE: 1 if the channel had no new sample or a deviation below the
+ * threshold,
+ * - ERRORS: EMG_ADS1293::ChannelError flags reported during the period.
+ * A NaN sample (channel without a new sample) holds the previous value.
+ */
+class SignalQuality
+{
+    public:
+    enum Index
+    {
+        LINE_RATIO = 0,
+        SATURATION,
+        FLATLINE,
+        ERRORS,
+        NB_INDICES
+    };
+
+    SignalQuality(int nb_channels = 0,
+                  double fs = 1000,
+                  double line_hz = 50,
+                  double period_s = 0.5)
+    {
+        configure(nb_channels, fs, line_hz, period_s);
+    };
+
+    /**
+     * @brief Set the channels, the sampling rate, the line frequency and the
+     * period of the status frames. Clears the state.
+     */
+    void
+    configure(int nb_channels,
+              double fs,
+              double line_hz = 50,
+              double period_s = 0.5,
+              size_t capacity = 64);
+
+    /**
+     * @brief Set the saturation levels of the channels (see
+     * EMG_ADS1293Pack::rails()).
+     *
+     * @param margin Fraction of the range counted as saturated on each side.
+     */
+    void
+    set_rails(const std::vector<double> &low,
+              const std::vector<double> &high,
+              double margin = 0.01);
+
+    /**
+     * @brief Deviation below which a channel is flat (V).
+     */
+    void
+    set_flat_threshold(double threshold)
+    {
+        m_flat_threshold = threshold;
+    };
+
+    void
+    reset();
+
+    /**
+     * @brief Feed frames of nb_channels values.
+     *
+     * @return int Number of status frames pushed.
+     */
+    int
+    process(const double *timestamps, const double *frames, size_t n_frames);
+
+    /**
+     * @brief Feed all the pending frames of a ring, -1 if it does not have
+     * nb_channels channels.
+     */
+    int
+    process(SampleRing &ring);
+
+    /**
+     * @brief Merge the error reports of a pack into the current period.
+     *
+     * @return int Number of reports consumed.
+     */
+    int
+    process_errors(Ring<ErrorReport> &errors);
+
+    static std::string
+    index_name(int index);
+
+    int
+    channels() const
+    {
+        return m_channels;
+    };
+
+    /**
+     * @brief Number of samples of a period.
+     */
+    int
+    period() const
+    {
+        return m_period;
+    };
+
+    /**
+     * @brief Size of a status frame (NB_INDICES x nb_channels).
+     */
+    int
+    size() const
+    {
+        return NB_INDICES * m_channels;
+    };
+
+    SampleRing output; // Status frames
+
+    private:
+    void
+    emit(double timestamp);
+
+    static const int s_harmonics = 3;
+
+    int m_channels = 0;
+    double m_fs = 1;
+    double m_line_hz = 50;
+    int m_period = 1;
+    int m_nb_harmonics = 0;
+    double m_step_re[s_harmonics]; // Phasor increments e^(-i w_h)
+    double m_step_im[s_harmonics];
+    double m_flat_threshold = 1e-6;
+
+    int m_count = 0;                // Samples of the current period
+    double m_ph_re[s_harmonics];    // Phasor of the current sample
+    double m_ph_im[s_harmonics];
+    double m_w_re[s_harmonics];     // Sum of the phasors (DFT of the mean)
+    double m_w_im[s_harmonics];
+    std::vector<double> m_re;       // harmonic x channel
+    std::vector<double> m_im;
+    std::vector<double> m_sum;      // Sum of x - ref per channel
+    std::vector<double> m_sum2;
+    std::vector<double> m_ref;      // First value of the period
+    std::vector<double> m_saturated;
+    std::vector<double> m_new;      // New (non NaN) samples
+    std::vector<double> m_flags;
+    std::vector<double> m_low;      // Saturation thresholds
+    std::vector<double> m_high;
+    std::vector<double> m_last;     // Held values
+    std::vector<double> m_frame;
+    RingBlock m_block;              // Scratch of process(ring)
+};
+
+} // namespace ClvHd
+
+#endif // __CLV_HD_QUALITY_HPP__
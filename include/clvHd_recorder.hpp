@@ -0,0 +1,107 @@
+#ifndef __CLV_HD_RECORDER_HPP__
+#define __CLV_HD_RECORDER_HPP__
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <stdint.h> // uint8_t, uint16_t, uint32_t, uint64_t
+
+#include "clvHd_marker.hpp"
+#include "clvHd_ring.hpp"
+#include "strANSIseq.hpp"
+
+namespace ClvHd
+{
+
+/**
+ * @brief Write timestamped frames to a text file.
+ *
+ * One line per frame: "timestamp, v0, v1, ...", the format of the recording
+ * scripts. The frames usually come from a stage ring (pack stream,
+ * resampler, features...). The markers are interleaved at their timestamp
+ * as comment lines "# marker, timestamp, code, label", skipped by the
+ * loaders of the frames.
+ */
+class Recorder : virtual public ESC::CLI
+{
+    public:
+    Recorder(int verbose = -1) : ESC::CLI(verbose, "ClvHd-Recorder") {};
+    ~Recorder() { close(); };
+
+    /**
+     * @brief Open (truncate) the file.
+     *
+     * @param path Path of the file.
+     * @param nb_channels Number of values per frame.
+     * @param names Optional names of the columns, written as a '#' header.
+     * @return int 0 if success, -1 otherwise.
+     */
+    int
+    open(const std::string &path,
+         int nb_channels,
+         const std::vector<std::string> &names = {});
+
+    void
+    close()
+    {
+        if(m_file.is_open())
+            m_file.close();
+    };
+
+    bool
+    is_open() const
+    {
+        return m_file.is_open();
+    };
+
+    /**
+     * @brief Write n_frames frames (values: n_frames x nb_channels).
+     */
+    void
+    write(const double *timestamps, const double *values, size_t n_frames);
+
+    /**
+     * @brief Write all the pending frames of a ring.
+     *
+     * @return size_t Number of frames written.
+     */
+    size_t
+    record(SampleRing &ring);
+
+    /**
+     * @brief Write all the pending frames of a ring, each preceded by the
+     * markers not later than it (the later ones wait for the next frames).
+     * The recorder reads the markers with its own cursor, so the other
+     * consumers of the queue (LSL publisher, pop_markers()) still get them.
+     */
+    size_t
+    record(SampleRing &ring, Markers &markers);
+
+    void
+    write_marker(const Marker &marker);
+
+    int
+    channels() const
+    {
+        return m_channels;
+    };
+
+    uint64_t
+    frames() const
+    {
+        return m_frames;
+    };
+
+    private:
+    std::ofstream m_file;
+    int m_channels = 0;
+    uint64_t m_frames = 0;
+    RingBlock m_block;
+    const Markers *m_markers = nullptr; // Queue read by m_cursor
+    MarkerCursor m_cursor;
+};
+
+} // namespace ClvHd
+
+#endif // __CLV_HD_RECORDER_HPP__
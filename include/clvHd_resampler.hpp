@@ -0,0 +1,144 @@
+#ifndef __CLV_HD_RESAMPLER_HPP__
+#define __CLV_HD_RESAMPLER_HPP__
+
+#include <string>
+#include <vector>
+
+#include <stdint.h> // uint8_t, uint16_t, uint32_t, uint64_t
+
+#include "clvHd_ring.hpp"
+
+namespace ClvHd
+{
+
+/**
+ * @brief Streaming rational resampler to a uniform output rate.
+ *
+ * The ADS1293 samples are uniform at the output data rate of the chip, but
+ * their timestamps are the times of the polling reads. The input samples are
+ * placed on the grid of the nominal input rate (the samples missed by the
+ * polling are held, NaN values hold the previous value of the channel) and
+ * resampled by L/M with a polyphase windowed-sinc FIR. The output timestamps
+ * follow the grid, corrected by the smoothed offset of the read timestamps
+ * and by the group delay of the filter.
+ *
+ * The history is stored twice back to back, frames of contiguous channels,
+ * so the window of a phase is contiguous and the inner loop runs one channel
+ * per SIMD lane.
+ */
+class Resampler
+{
+    public:
+    Resampler(int nb_channels = 0,
+              double fs_in = 1000,
+              double fs_out = 500,
+              int zeros = 8,
+              size_t capacity = 4096)
+    {
+        configure(nb_channels, fs_in, fs_out, zeros, capacity);
+    };
+
+    /**
+     * @brief Set the channels and the rates and design the filter.
+     *
+     * @param nb_channels Number of channels.
+     * @param fs_in Nominal input rate (Hz), e.g. EMG_ADS1293Pack::odr().
+     * @param fs_out Requested output rate (Hz).
+     * @param zeros Zero crossings of the sinc on each side (quality vs
+     * latency).
+     * @param capacity Capacity of the output ring (frames).
+     */
+    void
+    configure(int nb_channels,
+              double fs_in,
+              double fs_out,
+              int zeros = 8,
+              size_t capacity = 4096);
+
+    /**
+     * @brief Clear the history and the timing (start of a new recording).
+     */
+    void
+    reset();
+
+    /**
+     * @brief Feed timestamped frames of nb_channels values.
+     *
+     * @return int Number of output frames pushed in output.
+     */
+    int
+    process(const double *timestamps, const double *frames, size_t n_frames);
+
+    /**
+     * @brief Feed all the pending frames of a ring (e.g. a pack stream).
+     *
+     * @return int Number of output frames pushed in output, -1 if the ring
+     * does not have nb_channels channels.
+     */
+    int
+    process(SampleRing &ring);
+
+    /**
+     * @brief Group delay of the filter (s).
+     */
+    double
+    delay() const
+    {
+        return m_delay;
+    };
+
+    /**
+     * @brief Exact output rate L/M x fs_in (Hz).
+     */
+    double
+    rate() const
+    {
+        return m_fs_in * m_L / m_M;
+    };
+
+    int
+    L() const
+    {
+        return m_L;
+    };
+
+    int
+    M() const
+    {
+        return m_M;
+    };
+
+    int
+    channels() const
+    {
+        return m_channels;
+    };
+
+    SampleRing output; // Uniformly sampled frames
+
+    private:
+    int
+    push_input(const double *frame);
+
+    int m_channels = 0;
+    double m_fs_in = 1;
+    int m_L = 1;
+    int m_M = 1;
+    int m_taps = 1;             // Taps per phase
+    double m_delay = 0;         // Group delay (s)
+    std::vector<double> m_poly; // phase x taps, taps reversed in time
+
+    std::vector<double> m_hist; // 2 x taps frames of nb_channels
+    size_t m_pos = 0;           // Next frame written in m_hist
+    int m_phase = 0;            // Position of the next output (1/L samples)
+    uint64_t m_n = 0;           // Input samples on the grid
+    bool m_started = false;
+    double m_t0 = 0;            // Timestamp of the first input sample
+    double m_offset = 0;        // Smoothed read timestamp - grid time
+    std::vector<double> m_last; // Last frame (held values)
+    RingBlock m_block;          // Scratch for process(SampleRing &)
+};
+
+} // namespace ClvHd
+
+#endif // __CLV_HD_RESAMPLER_HPP__
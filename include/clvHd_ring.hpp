@@ -0,0 +1,290 @@
+#ifndef __CLV_HD_RING_HPP__
+#define __CLV_HD_RING_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#include <stdint.h> // uint8_t, uint16_t, uint32_t, uint64_t
+
+namespace ClvHd
+{
+
+/**
+ * @brief Round up to the next power of two (ring capacities).
+ */
+inline size_t
+next_pow2(size_t n)
+{
+    size_t p = 1;
+    while(p < n) p <<= 1;
+    return p;
+}
+
+/**
+ * @brief Host monotonic clock (s), the time base of the latency measures.
+ */
+inline double
+host_clock()
+{
+    return std::chrono::duration<double>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/**
+ * @brief Single-producer single-consumer lock-free ring of elements.
+ *
+ * The producer and the consumer can run in different threads without any
+ * lock: each side only writes its own index. The capacity is rounded up to a
+ * power of two. When the ring is full, push() fails and the element is
+ * counted as dropped.
+ */
+template <typename T>
+class Ring
+{
+    public:
+    Ring(size_t capacity = 1024) { resize(capacity); };
+
+    /**
+     * @brief Resize and clear the ring. Not thread safe.
+     */
+    void
+    resize(size_t capacity)
+    {
+        m_data.assign(next_pow2(capacity), T());
+        m_mask = m_data.size() - 1;
+        m_head.store(0);
+        m_tail.store(0);
+        m_dropped.store(0);
+    };
+
+    bool
+    push(const T &value)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if(head - m_tail.load(std::memory_order_acquire) > m_mask)
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        m_data[head & m_mask] = value;
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    };
+
+    bool
+    pop(T &value)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if(tail == m_head.load(std::memory_order_acquire))
+            return false;
+        value = m_data[tail & m_mask];
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    };
+
+    size_t
+    size() const
+    {
+        return m_head.load(std::memory_order_acquire) -
+               m_tail.load(std::memory_order_acquire);
+    };
+
+    size_t
+    capacity() const
+    {
+        return m_data.size();
+    };
+
+    uint64_t
+    dropped() const
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    };
+
+    private:
+    std::vector<T> m_data;
+    size_t m_mask = 0;
+    std::atomic<size_t> m_head{0};
+    std::atomic<size_t> m_tail{0};
+    std::atomic<uint64_t> m_dropped{0};
+};
+
+/**
+ * @brief Single-producer single-consumer lock-free ring of sample frames.
+ *
+ * A frame is a timestamp (s) and one value per channel. The values of a
+ * frame are contiguous and the frames are stored back to back, so a block of
+ * frames can be copied out in one or two memcpy.
+ */
+class SampleRing
+{
+    public:
+    SampleRing(size_t nb_channels = 0, size_t capacity = 4096)
+    {
+        resize(nb_channels, capacity);
+    };
+
+    /**
+     * @brief Resize and clear the ring. Not thread safe.
+     */
+    void
+    resize(size_t nb_channels, size_t capacity = 4096)
+    {
+        m_channels = nb_channels;
+        m_timestamps.assign(next_pow2(capacity), 0);
+        m_values.assign(m_timestamps.size() * nb_channels, 0);
+        m_mask = m_timestamps.size() - 1;
+        m_head.store(0);
+        m_tail.store(0);
+        m_dropped.store(0);
+    };
+
+    /**
+     * @brief Reserve the next frame. Fill the returned values then call
+     * commit(). Returns nullptr (and counts a dropped frame) if the ring is
+     * full.
+     */
+    double *
+    reserve()
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if(head - m_tail.load(std::memory_order_acquire) > m_mask)
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return m_values.data() + (head & m_mask) * m_channels;
+    };
+
+    void
+    commit(double timestamp)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        m_timestamps[head & m_mask] = timestamp;
+        m_head.store(head + 1, std::memory_order_release);
+    };
+
+    bool
+    push(double timestamp, const double *values)
+    {
+        double *frame = reserve();
+        if(frame == nullptr)
+            return false;
+        std::memcpy(frame, values, m_channels * sizeof(double));
+        commit(timestamp);
+        return true;
+    };
+
+    /**
+     * @brief Pop up to max_frames frames.
+     *
+     * @param timestamps Destination of the timestamps (max_frames).
+     * @param values Destination of the values (max_frames x channels).
+     * @param max_frames Maximum number of frames to pop.
+     * @return size_t Number of frames popped.
+     */
+    size_t
+    pop(double *timestamps, double *values, size_t max_frames)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t n = m_head.load(std::memory_order_acquire) - tail;
+        n = (n < max_frames) ? n : max_frames;
+        for(size_t done = 0; done < n;)
+        {
+            // contiguous part up to the end of the storage
+            size_t idx = (tail + done) & m_mask;
+            size_t len = std::min(n - done, m_timestamps.size() - idx);
+            std::memcpy(timestamps + done, m_timestamps.data() + idx,
+                        len * sizeof(double));
+            std::memcpy(values + done * m_channels,
+                        m_values.data() + idx * m_channels,
+                        len * m_channels * sizeof(double));
+            done += len;
+        }
+        m_tail.store(tail + n, std::memory_order_release);
+        return n;
+    };
+
+    size_t
+    size() const
+    {
+        return m_head.load(std::memory_order_acquire) -
+               m_tail.load(std::memory_order_acquire);
+    };
+
+    size_t
+    capacity() const
+    {
+        return m_timestamps.size();
+    };
+
+    size_t
+    channels() const
+    {
+        return m_channels;
+    };
+
+    uint64_t
+    dropped() const
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    };
+
+    private:
+    size_t m_channels = 0;
+    size_t m_mask = 0;
+    std::vector<double> m_timestamps;
+    std::vector<double> m_values;
+    std::atomic<size_t> m_head{0};
+    std::atomic<size_t> m_tail{0};
+    std::atomic<uint64_t> m_dropped{0};
+};
+
+/**
+ * @brief Scratch block of frames to drain a SampleRing into a processing
+ * stage that works on arrays of frames.
+ */
+class RingBlock
+{
+    public:
+    RingBlock(size_t frames = 256) : m_frames(frames) {};
+
+    /**
+     * @brief Pop all the pending frames of a ring by blocks and pass each
+     * block to process(timestamps, frames, n_frames).
+     *
+     * @param ring Ring to drain.
+     * @param nb_channels Values per frame expected by the stage.
+     * @param process Called on each block, returns a count.
+     * @return int Sum of the counts, -1 (nothing popped) if the ring does
+     * not have nb_channels channels.
+     */
+    template <typename Process>
+    int
+    drain(SampleRing &ring, size_t nb_channels, Process process)
+    {
+        if(ring.channels() != nb_channels)
+            return -1;
+        m_timestamps.resize(m_frames);
+        m_values.resize(m_frames * nb_channels);
+        int count = 0;
+        size_t n;
+        while((n = ring.pop(m_timestamps.data(), m_values.data(), m_frames)) >
+              0)
+            count += process(m_timestamps.data(), m_values.data(), n);
+        return count;
+    }
+
+    private:
+    size_t m_frames;
+    std::vector<double> m_timestamps;
+    std::vector<double> m_values;
+};
+
+} // namespace ClvHd
+
+#endif // __CLV_HD_RING_HPP__
@@ -0,0 +1,231 @@
+#ifndef __CLV_HD_SHM_HPP__
+#define __CLV_HD_SHM_HPP__
+
+#include <atomic>
+#include <string>
+
+#include <stdint.h> // uint8_t, uint16_t, uint32_t, uint64_t
+
+#include "clvHd_ring.hpp"
+#include "strANSIseq.hpp"
+
+namespace ClvHd
+{
+
+#define CLVHD_SHM_MAGIC 0x44486C43 // "ClHD"
+#define CLVHD_SHM_VERSION 1
+
+/**
+ * @brief Header of a shared-memory ring, followed by the capacity
+ * timestamps (s) and the capacity x channels values (doubles).
+ *
+ * The publisher is the only writer: it announces the frames it is about to
+ * write in writing, fills their slots, then moves head to writing
+ * (release). The readers never write, each one keeps its own cursor. A
+ * slot is reused capacity frames later, so a reader checks after reading
+ * that writing did not move past its frames (seqlock).
+ */
+struct ShmHeader
+{
+    uint32_t magic;                 // CLVHD_SHM_MAGIC once initialised
+    uint32_t version;               // CLVHD_SHM_VERSION
+    uint32_t channels;              // Values per frame
+    uint32_t capacity;              // Frames, power of two
+    double rate;                    // Nominal frame rate (Hz), 0 if unknown
+    std::atomic<uint64_t> head;     // Number of frames published
+    std::atomic<uint64_t> writing;  // Frames published once written
+    std::atomic<uint32_t> closed;   // Set when the publisher stops
+    uint32_t pid;                   // Process of the publisher
+    uint32_t reserved[4];           // Header of 64 bytes
+};
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && sizeof(ShmHeader) == 64,
+              "The shared ring needs lock-free 64 bits atomics");
+
+/**
+ * @brief Publish frames in a POSIX shared-memory ring read by any number of
+ * processes (see ShmReader).
+ *
+ * The publisher never waits for the readers: a reader slower than the ring
+ * capacity loses the overwritten frames, which it counts.
+ */
+class ShmPublisher : virtual public ESC::CLI
+{
+    public:
+    ShmPublisher(int verbose = -1) : ESC::CLI(verbose, "ClvHd-ShmPublisher") {};
+    ~ShmPublisher() { close(); };
+
+    /**
+     * @brief Create the shared-memory ring. A ring of the same name is only
+     * replaced if it is closed, invalid or left by a process that no longer
+     * runs; the open fails if another publisher still owns it.
+     *
+     * @param name Name of the ring ("/clvhd_precise"...).
+     * @param nb_channels Number of values per frame.
+     * @param capacity Frames of the ring, rounded up to a power of two.
+     * @param rate Nominal frame rate (Hz), for the readers.
+     * @return int 0 if success, -1 otherwise.
+     */
+    int
+    open(const std::string &name,
+         int nb_channels,
+         size_t capacity = 1 << 16,
+         double rate = 0);
+
+    /**
+     * @brief Mark the ring closed for the readers and remove its name (the
+     * attached readers keep their mapping).
+     */
+    void
+    close();
+
+    bool
+    is_open() const
+    {
+        return m_header != nullptr;
+    };
+
+    /**
+     * @brief Publish n_frames frames (values: n_frames x nb_channels).
+     */
+    void
+    write(const double *timestamps, const double *values, size_t n_frames);
+
+    /**
+     * @brief Publish all the pending frames of a ring.
+     *
+     * @return size_t Number of frames published.
+     */
+    size_t
+    publish(SampleRing &ring);
+
+    size_t
+    channels() const
+    {
+        return m_header ? m_header->channels : 0;
+    };
+
+    uint64_t
+    frames() const
+    {
+        return m_header ? m_header->head.load(std::memory_order_relaxed) : 0;
+    };
+
+    private:
+    std::string m_name;
+    ShmHeader *m_header = nullptr;
+    size_t m_size = 0; // Bytes of the mapping
+    double *m_timestamps = nullptr;
+    double *m_values = nullptr;
+};
+
+/**
+ * @brief Read-only attachment to a ring of a ShmPublisher, possibly in
+ * another process.
+ *
+ * peek() gives the pending frames in place (no copy), up to the end of the
+ * ring storage, and consume() moves the cursor after checking that the
+ * publisher did not overwrite them in the meantime.
+ */
+class ShmReader : virtual public ESC::CLI
+{
+    public:
+    ShmReader(int verbose = -1) : ESC::CLI(verbose, "ClvHd-ShmReader") {};
+    ~ShmReader() { detach(); };
+
+    /**
+     * @brief Attach to a ring. The cursor starts at the newest frame.
+     *
+     * @return int 0 if success, -1 if the ring does not exist or is not
+     * initialised.
+     */
+    int
+    attach(const std::string &name);
+
+    void
+    detach();
+
+    /**
+     * @brief Contiguous pending frames, in place.
+     *
+     * @param timestamps Set to the timestamps of the frames.
+     * @param values Set to the values of the frames (frames x channels).
+     * @return size_t Number of frames (more may follow after the wrap).
+     */
+    size_t
+    peek(const double *&timestamps, const double *&values);
+
+    /**
+     * @brief Move the cursor after n peeked frames.
+     *
+     * @return size_t Number of these frames that were not overwritten while
+     * they were used (the first ones are lost otherwise).
+     */
+    size_t
+    consume(size_t n);
+
+    /**
+     * @brief Copy up to max_frames pending frames.
+     *
+     * @return size_t Number of frames copied.
+     */
+    size_t
+    read(double *timestamps, double *values, size_t max_frames);
+
+    size_t
+    pending() const;
+
+    /**
+     * @brief True if the publisher closed the ring.
+     */
+    bool
+    closed() const
+    {
+        return m_header == nullptr ||
+               m_header->closed.load(std::memory_order_acquire) != 0;
+    };
+
+    size_t
+    channels() const
+    {
+        return m_header ? m_header->channels : 0;
+    };
+
+    size_t
+    capacity() const
+    {
+        return m_header ? m_header->capacity : 0;
+    };
+
+    double
+    rate() const
+    {
+        return m_header ? m_header->rate : 0;
+    };
+
+    /**
+     * @brief Frames overwritten before they were read.
+     */
+    uint64_t
+    lost() const
+    {
+        return m_lost;
+    };
+
+    private:
+    /**
+     * @brief Skip the frames already overwritten by the publisher.
+     */
+    void
+    catch_up();
+
+    const ShmHeader *m_header = nullptr;
+    size_t m_size = 0;
+    const double *m_timestamps = nullptr;
+    const double *m_values = nullptr;
+    uint64_t m_cursor = 0;
+    uint64_t m_lost = 0;
+};
+
+} // namespace ClvHd
+
+#endif // __CLV_HD_SHM_HPP__
@@ -0,0 +1,206 @@
+#ifndef __CLV_HD_SPATIAL_HPP__
+#define __CLV_HD_SPATIAL_HPP__
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <stdint.h> // uint8_t, uint16_t, uint32_t, uint64_t
+
+#include "clvHd_ring.hpp"
+
+namespace ClvHd
+{
+
+/**
+ * @brief Linear combination of the channels: y = M x.
+ *
+ * The columns follow the channel order of the pack (module * 3 + channel),
+ * each row is an output (virtual) channel. The matrix is stored both
+ * transposed and dense (rows contiguous per input channel, for the blocked
+ * product) and as compressed sparse rows; the sparse form is used when less
+ * than a quarter of the coefficients are non-zero.
+ */
+class SpatialMatrix
+{
+    public:
+    SpatialMatrix(int rows = 0, int cols = 0) : m_rows(rows), m_cols(cols) {};
+
+    /**
+     * @brief Dense matrix (rows x cols, row major), e.g. PCA/ICA unmixing.
+     */
+    static SpatialMatrix
+    dense(int rows, int cols, const double *values);
+
+    /**
+     * @brief Bipolar derivations: one row x[a] - x[b] per pair (a, b).
+     */
+    static SpatialMatrix
+    bipolar(int cols, const std::vector<std::pair<int, int>> &pairs);
+
+    /**
+     * @brief Differential along the rows of an electrode grid.
+     *
+     * @param grid Channel of each electrode (rows x columns, -1 if none).
+     * @param double_diff Double differential x[i-1] - 2 x[i] + x[i+1]
+     * instead of the single differential x[i+1] - x[i].
+     */
+    static SpatialMatrix
+    differential(int cols,
+                 const std::vector<std::vector<int>> &grid,
+                 bool double_diff = false);
+
+    /**
+     * @brief Laplacian of an electrode grid: x[i] minus the mean of its 4
+     * neighbours (electrodes with at least one neighbour).
+     */
+    static SpatialMatrix
+    laplacian(int cols, const std::vector<std::vector<int>> &grid);
+
+    /**
+     * @brief Add (accumulate) a coefficient. Call finalize() after.
+     */
+    void
+    add(int row, int col, double value)
+    {
+        m_triplets.push_back({row, col, value});
+    };
+
+    /**
+     * @brief Build the dense and sparse forms.
+     *
+     * @return int Number of coefficients ignored because their row or column
+     * is out of the matrix (see ignored()).
+     */
+    int
+    finalize();
+
+    int
+    rows() const
+    {
+        return m_rows;
+    };
+
+    int
+    cols() const
+    {
+        return m_cols;
+    };
+
+    bool
+    sparse() const
+    {
+        return m_sparse;
+    };
+
+    /**
+     * @brief Coefficients out of the matrix at the last finalize(), e.g. a
+     * grid channel not below cols. They are not applied.
+     */
+    int
+    ignored() const
+    {
+        return m_ignored;
+    };
+
+    /**
+     * @brief y (n_frames x rows) = M x (n_frames x cols), frames blocked so
+     * a column of the transposed matrix stays in cache for the block.
+     */
+    void
+    apply(const double *x, double *y, size_t n_frames) const;
+
+    private:
+    struct Triplet
+    {
+        int row, col;
+        double value;
+    };
+
+    int m_rows;
+    int m_cols;
+    bool m_sparse = false;
+    int m_ignored = 0;
+    std::vector<Triplet> m_triplets;
+    std::vector<double> m_dense_t;   // cols x rows
+    std::vector<int> m_row_ptr;      // CSR
+    std::vector<int> m_col_idx;
+    std::vector<double> m_values;
+};
+
+/**
+ * @brief Spatial filter stage: applies a SpatialMatrix to blocks of frames.
+ *
+ * The matrix is held by a shared pointer read once per block, so it can be
+ * swapped atomically at runtime by another thread (the new matrix is used
+ * from the next block on). The outputs are pushed in the output ring as
+ * frames of virtual channels, like the pack streams.
+ */
+class SpatialFilter
+{
+    public:
+    SpatialFilter(size_t capacity = 4096) : m_capacity(capacity) {};
+
+    /**
+     * @brief Set the matrix and resize the output. Not thread safe.
+     */
+    void
+    configure(const SpatialMatrix &matrix);
+
+    /**
+     * @brief Swap the matrix while running (thread safe).
+     *
+     * @return bool False if the dimensions differ from the configured ones.
+     */
+    bool
+    swap(const SpatialMatrix &matrix);
+
+    std::shared_ptr<const SpatialMatrix>
+    matrix() const
+    {
+        return std::atomic_load(&m_matrix);
+    };
+
+    /**
+     * @brief Feed frames of cols values (NaN hold the previous value).
+     *
+     * @return int Number of output frames pushed.
+     */
+    int
+    process(const double *timestamps, const double *frames, size_t n_frames);
+
+    /**
+     * @brief Feed all the pending frames of a ring, -1 if it does not have
+     * cols channels.
+     */
+    int
+    process(SampleRing &ring);
+
+    int
+    inputs() const
+    {
+        return m_inputs;
+    };
+
+    int
+    outputs() const
+    {
+        return m_outputs;
+    };
+
+    SampleRing output; // Virtual channels
+
+    private:
+    size_t m_capacity;
+    int m_inputs = 0;
+    int m_outputs = 0;
+    std::shared_ptr<const SpatialMatrix> m_matrix;
+    std::vector<double> m_last;
+    std::vector<double> m_in;
+    std::vector<double> m_out;
+    RingBlock m_block;
+};
+
+} // namespace ClvHd
+
+#endif // __CLV_HD_SPATIAL_HPP__
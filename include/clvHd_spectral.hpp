@@ -0,0 +1,257 @@
+#ifndef __CLV_HD_SPECTRAL_HPP__
+#define __CLV_HD_SPECTRAL_HPP__
+
+#include <complex>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <stdint.h> // uint8_t, uint16_t, uint32_t, uint64_t
+
+#include "clvHd_ring.hpp"
+
+namespace ClvHd
+{
+
+/**
+ * @brief Allocator of cache line (and SIMD) aligned buffers.
+ */
+template <typename T, size_t Align = 64>
+struct AlignedAllocator
+{
+    typedef T value_type;
+    template <typename U>
+    struct rebind
+    {
+        typedef AlignedAllocator<U, Align> other;
+    };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Align> &) {}
+
+    T *
+    allocate(size_t n)
+    {
+        size_t bytes = (n * sizeof(T) + Align - 1) / Align * Align;
+        void *p = std::aligned_alloc(Align, bytes);
+        if(p == nullptr)
+            throw std::bad_alloc();
+        return static_cast<T *>(p);
+    };
+
+    void
+    deallocate(T *p, size_t)
+    {
+        std::free(p);
+    };
+
+    template <typename U>
+    bool
+    operator==(const AlignedAllocator<U, Align> &) const
+    {
+        return true;
+    }
+    template <typename U>
+    bool
+    operator!=(const AlignedAllocator<U, Align> &) const
+    {
+        return false;
+    }
+};
+
+template <typename T>
+using aligned_vector = std::vector<T, AlignedAllocator<T>>;
+
+/**
+ * @brief Plan of a real FFT of n samples (n power of two).
+ *
+ * The twiddle factors and the bit reversal table are computed once, the
+ * plan is then reused for every transform. The n real samples are
+ * transformed as a complex FFT of n/2 points followed by a split step.
+ */
+class FFTPlan
+{
+    public:
+    FFTPlan(size_t n = 0) { resize(n); };
+
+    void
+    resize(size_t n);
+
+    size_t
+    size() const
+    {
+        return m_n;
+    };
+
+    /**
+     * @brief Forward transform.
+     *
+     * @param in n real samples.
+     * @param out n/2 + 1 complex bins (DC to Nyquist).
+     */
+    void
+    forward(const double *in, std::complex<double> *out);
+
+    private:
+    size_t m_n = 0;
+    aligned_vector<std::complex<double>> m_twiddle; // complex FFT of n/2
+    aligned_vector<std::complex<double>> m_split;   // exp(-2i pi k / n)
+    std::vector<uint32_t> m_bitrev;
+    aligned_vector<std::complex<double>> m_buffer;
+};
+
+/**
+ * @brief Streaming short-time spectral analysis of every channel.
+ *
+ * Every hop samples, the last window samples of each channel are weighted
+ * by a Hann window and transformed, and the power spectral density is
+ * averaged over the last averages segments (Welch). A frame of spectral
+ * features is then pushed in the output ring, with the layout
+ * [MNF ch0..chN-1, MDF ch0.., power ch0.., band 0 ch0.., band 1 ch0.., ...]:
+ * mean and median frequency (Hz) and power in [fmin, fmax], then the power
+ * of each band.
+ */
+class SpectralAnalyzer
+{
+    public:
+    enum Feature
+    {
+        MNF = 0, // Mean frequency
+        MDF,     // Median frequency
+        POWER,   // Total power in [fmin, fmax]
+        NB_FEATURES
+    };
+
+    SpectralAnalyzer(int nb_channels = 0,
+                     double fs = 1000,
+                     size_t window = 256,
+                     double overlap = 0.5,
+                     int averages = 8)
+    {
+        configure(nb_channels, fs, window, overlap, averages);
+    };
+
+    /**
+     * @brief Set the channels, the rate, the window (rounded up to a power of
+     * two), the overlap of the segments (0 to <1) and the number of segments
+     * averaged. Clears the state.
+     */
+    void
+    configure(int nb_channels,
+              double fs,
+              size_t window,
+              double overlap = 0.5,
+              int averages = 8,
+              size_t capacity = 256);
+
+    /**
+     * @brief Frequency range of the MNF, MDF and total power (Hz).
+     */
+    void
+    set_range(double fmin, double fmax)
+    {
+        m_fmin = fmin;
+        m_fmax = fmax;
+    };
+
+    /**
+     * @brief Add a band whose power is published (Hz). Resizes the output.
+     */
+    void
+    add_band(double low, double high);
+
+    void
+    reset();
+
+    /**
+     * @brief Feed frames of nb_channels values (NaN hold the previous value).
+     *
+     * @return int Number of feature frames pushed in output.
+     */
+    int
+    process(const double *timestamps, const double *frames, size_t n_frames);
+
+    /**
+     * @brief Feed all the pending frames of a ring, -1 if it does not have
+     * nb_channels channels.
+     */
+    int
+    process(SampleRing &ring);
+
+    /**
+     * @brief Averaged power spectral density of a channel (window/2 + 1
+     * bins, unit^2/Hz).
+     */
+    std::vector<double>
+    psd(int channel) const;
+
+    double
+    resolution() const
+    {
+        return m_fs / m_window;
+    };
+
+    size_t
+    window() const
+    {
+        return m_window;
+    };
+
+    size_t
+    hop() const
+    {
+        return m_hop;
+    };
+
+    int
+    channels() const
+    {
+        return m_channels;
+    };
+
+    /**
+     * @brief Size of a feature frame ((3 + bands) x nb_channels).
+     */
+    int
+    size() const
+    {
+        return (NB_FEATURES + (int)m_bands.size()) * m_channels;
+    };
+
+    SampleRing output; // Spectral feature frames
+
+    private:
+    void
+    analyse(double timestamp);
+
+    int m_channels = 0;
+    double m_fs = 1;
+    size_t m_window = 1;
+    size_t m_hop = 1;
+    int m_averages = 1;
+    size_t m_capacity = 256;
+    double m_fmin = 0;
+    double m_fmax = 0;
+    std::vector<std::pair<double, double>> m_bands;
+
+    FFTPlan m_plan;
+    aligned_vector<double> m_taper;          // Hann window
+    double m_scale = 1;                      // |X|^2 to one-sided PSD
+    aligned_vector<double> m_history;        // channel x window (ring)
+    aligned_vector<double> m_segment;        // Windowed segment
+    aligned_vector<std::complex<double>> m_spectrum;
+    aligned_vector<double> m_psd_ring;       // averages x channel x bins
+    aligned_vector<double> m_psd_sum;        // channel x bins
+    std::vector<double> m_last;              // Held values
+    size_t m_pos = 0;                        // Next sample in m_history
+    uint64_t m_count = 0;                    // Samples received
+    uint64_t m_segments = 0;                 // Segments analysed
+    RingBlock m_block;                       // Scratch of process(ring)
+};
+
+} // namespace ClvHd
+
+#endif // __CLV_HD_SPECTRAL_HPP__
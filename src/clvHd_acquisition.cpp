@@ -0,0 +1,220 @@
+#include "clvHd_acquisition.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <errno.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <alloca.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+namespace ClvHd
+{
+
+std::string
+AcquisitionStats::str() const
+{
+    return "reads " + std::to_string(reads) + " (errors " +
+           std::to_string(errors) + "), latency mean " +
+           std::to_string(latency_mean * 1e6) + "us max " +
+           std::to_string(latency_max * 1e6) + "us, period mean " +
+           std::to_string(period_mean * 1e6) + "us jitter " +
+           std::to_string(period_jitter * 1e6) + "us max " +
+           std::to_string(period_max * 1e6) + "us, wake-up mean " +
+           std::to_string(wakeup_mean * 1e6) + "us max " +
+           std::to_string(wakeup_max * 1e6) + "us";
+}
+
+void
+Acquisition::start(const AcquisitionOptions &options)
+{
+    if(m_thread.joinable()) // Running, or stopped by an exception
+        stop();
+    m_options = options;
+    {
+        std::lock_guard<std::mutex> lock(m_stats_mutex);
+        m_stats = AcquisitionStats();
+        m_applied.clear();
+        m_error.clear();
+    }
+    m_running.store(true);
+    m_thread = std::thread(&Acquisition::loop, this);
+}
+
+void
+Acquisition::stop()
+{
+    m_running.store(false);
+    if(m_thread.joinable())
+        m_thread.join();
+#ifdef __linux__
+    if(m_locked)
+        munlockall();
+#endif
+    m_locked = false;
+}
+
+std::string
+Acquisition::apply_options()
+{
+    std::string report;
+#ifdef __linux__
+    if(m_options.policy != AcquisitionOptions::OTHER)
+    {
+        int policy = (m_options.policy == AcquisitionOptions::FIFO)
+                         ? SCHED_FIFO
+                         : SCHED_RR;
+        sched_param param;
+        param.sched_priority =
+            std::max(sched_get_priority_min(policy),
+                     std::min(m_options.priority,
+                              sched_get_priority_max(policy)));
+        int err = pthread_setschedparam(pthread_self(), policy, &param);
+        if(err == 0)
+            report += "scheduling " +
+                      std::string(policy == SCHED_FIFO ? "FIFO" : "RR") +
+                      " priority " + std::to_string(param.sched_priority);
+        else
+            report += "scheduling not applied (" +
+                      std::string(std::strerror(err)) + ")";
+        report += "; ";
+    }
+    if(m_options.cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(m_options.cpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if(err == 0)
+            report += "pinned to CPU " + std::to_string(m_options.cpu);
+        else
+            report += "CPU pinning not applied (" +
+                      std::string(std::strerror(err)) + ")";
+        report += "; ";
+    }
+    if(m_options.lock_memory)
+    {
+        if(mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+        {
+            m_locked = true;
+            // Touch the stack of the thread so the first reads do not page
+            // fault (the rings are already zero filled by their resize)
+            volatile uint8_t *probe =
+                (volatile uint8_t *)alloca(m_options.prefault_stack);
+            for(size_t i = 0; i < m_options.prefault_stack; i += 4096)
+                probe[i] = 0;
+            report += "memory locked";
+        }
+        else
+            report += "memory not locked (" +
+                      std::string(std::strerror(errno)) + ")";
+        report += "; ";
+    }
+#else
+    if(m_options.policy != AcquisitionOptions::OTHER || m_options.cpu >= 0 ||
+       m_options.lock_memory)
+        report += "real-time options not supported on this platform; ";
+#endif
+    report += m_options.busy_poll
+                  ? "busy poll"
+                  : "period " + std::to_string(m_options.period_s * 1e6) + "us";
+    return report;
+}
+
+void
+Acquisition::loop()
+{
+    using clk = std::chrono::steady_clock;
+    std::string report = apply_options();
+    logln(report, true);
+    {
+        std::lock_guard<std::mutex> lock(m_stats_mutex);
+        m_applied = report;
+    }
+
+    // Running statistics (Welford) kept by the thread and published without
+    // ever blocking on the readers
+    AcquisitionStats s;
+    double period_m2 = 0;
+    uint64_t nb_periods = 0, nb_wakeups = 0;
+
+    clk::duration period = std::chrono::duration_cast<clk::duration>(
+        std::chrono::duration<double>(m_options.period_s));
+    clk::time_point deadline = clk::now();
+    clk::time_point last_start;
+    while(m_running.load(std::memory_order_relaxed))
+    {
+        if(!m_options.busy_poll)
+        {
+            deadline += period;
+            std::this_thread::sleep_until(deadline);
+            double late =
+                std::chrono::duration<double>(clk::now() - deadline).count();
+            nb_wakeups++;
+            s.wakeup_mean += (late - s.wakeup_mean) / nb_wakeups;
+            s.wakeup_max = std::max(s.wakeup_max, late);
+            if(late > m_options.period_s) // overrun: do not try to catch up
+                deadline = clk::now();
+        }
+
+        clk::time_point t0 = clk::now();
+        try
+        {
+            m_pack->read_streams();
+        }
+        catch(const std::string &)
+        {
+            s.errors++;
+        }
+        catch(const std::exception &e)
+        {
+            fail(s, e.what());
+            break;
+        }
+        catch(...)
+        {
+            fail(s, "unknown exception");
+            break;
+        }
+        clk::time_point t1 = clk::now();
+
+        double latency = std::chrono::duration<double>(t1 - t0).count();
+        s.reads++;
+        s.latency_mean += (latency - s.latency_mean) / s.reads;
+        s.latency_max = std::max(s.latency_max, latency);
+        if(s.reads > 1)
+        {
+            double dt = std::chrono::duration<double>(t0 - last_start).count();
+            nb_periods++;
+            double delta = dt - s.period_mean;
+            s.period_mean += delta / nb_periods;
+            period_m2 += delta * (dt - s.period_mean);
+            s.period_jitter = std::sqrt(period_m2 / nb_periods);
+            s.period_max = std::max(s.period_max, dt);
+        }
+        last_start = t0;
+
+        std::unique_lock<std::mutex> lock(m_stats_mutex, std::try_to_lock);
+        if(lock.owns_lock())
+            m_stats = s;
+    }
+    std::lock_guard<std::mutex> lock(m_stats_mutex);
+    m_stats = s;
+}
+
+void
+Acquisition::fail(AcquisitionStats &s, const std::string &error)
+{
+    s.errors++;
+    m_running.store(false);
+    logln("Acquisition stopped: " + error, true);
+    std::lock_guard<std::mutex> lock(m_stats_mutex);
+    m_error = error;
+}
+
+} // namespace ClvHd
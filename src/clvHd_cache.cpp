@@ -0,0 +1,124 @@
+#include "clvHd_cache.hpp"
+
+#include <ctype.h> // isxdigit
+#include <fstream>
+#include <stdio.h>  // snprintf
+#include <stdlib.h> // strtol, strtod
+#include <sstream>
+
+namespace ClvHd
+{
+
+int
+ConfigCache::load()
+{
+    m_entries.clear();
+    std::ifstream file(m_path);
+    if(!file.is_open())
+    {
+        logln("No cache found at " + m_path, true);
+        return 0;
+    }
+
+    Entry *current = nullptr;
+    std::string line;
+    while(std::getline(file, line))
+    {
+        if(line.empty() || line[0] == '#')
+            continue;
+        if(line[0] == '[') // [key]
+        {
+            size_t end = line.find(']');
+            if(end == std::string::npos)
+                return -1;
+            std::string key = line.substr(1, end - 1);
+            current = &m_entries[key];
+            current->key = key;
+            continue;
+        }
+        if(current == nullptr)
+            return -1;
+
+        // <id> <type> <config> <regs>
+        std::istringstream ss(line);
+        int id = -1;
+        std::string type, config, hex;
+        if(!(ss >> id >> type >> config >> hex) || id < 0 || id > 31)
+            return -1;
+        if(hex == "-")
+            hex.clear();
+        if(hex.size() % 2 != 0)
+            return -1;
+        if(current->modules.size() <= (size_t)id)
+            current->modules.resize(id + 1);
+        ModuleImage &m = current->modules[id];
+        m.type = (type == "-") ? "" : type;
+        m.config = (config == "-") ? "" : config;
+        m.regs.resize(hex.size() / 2);
+        for(size_t i = 0; i < m.regs.size(); i++)
+        {
+            std::string byte = hex.substr(2 * i, 2);
+            char *end = nullptr;
+            long v = strtol(byte.c_str(), &end, 16);
+            if(end != byte.c_str() + 2 || !isxdigit((unsigned char)byte[0]))
+                return -1;
+            m.regs[i] = v;
+        }
+        m.calibration.clear();
+        std::string calibration;
+        if(ss >> calibration)
+        {
+            std::istringstream cs(calibration);
+            std::string value;
+            while(std::getline(cs, value, ','))
+            {
+                char *end = nullptr;
+                double v = strtod(value.c_str(), &end);
+                if(value.empty() || *end != '\0')
+                    return -1;
+                m.calibration.push_back(v);
+            }
+        }
+    }
+    logln("Loaded " + std::to_string(m_entries.size()) + " cache entries",
+          true);
+    return m_entries.size();
+}
+
+int
+ConfigCache::save()
+{
+    std::ofstream file(m_path, std::ios::trunc);
+    if(!file.is_open())
+    {
+        logln("Could not write the cache " + m_path, true);
+        return -1;
+    }
+
+    file.precision(9);
+    file << "# CleverHand configuration cache\n";
+    for(auto &e : m_entries)
+    {
+        file << "[" << e.first << "]\n";
+        for(size_t id = 0; id < e.second.modules.size(); id++)
+        {
+            ModuleImage &m = e.second.modules[id];
+            file << id << " " << (m.type.empty() ? "-" : m.type) << " "
+                 << (m.config.empty() ? "-" : m.config) << " ";
+            char buf[3];
+            for(uint8_t r : m.regs)
+            {
+                snprintf(buf, sizeof(buf), "%02x", r);
+                file << buf;
+            }
+            if(m.regs.empty())
+                file << "-";
+            for(size_t i = 0; i < m.calibration.size(); i++)
+                file << (i ? "," : " ") << m.calibration[i];
+            file << "\n";
+        }
+    }
+    return 0;
+}
+
+} // namespace ClvHd
@@ -0,0 +1,544 @@
+#include "clvHd_classifier.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+namespace ClvHd
+{
+
+namespace
+{
+/**
+ * @brief Minimal JSON value and reader (objects, arrays, numbers, strings,
+ * booleans, null), enough for the model files.
+ */
+struct Json
+{
+    enum Type
+    {
+        NUL,
+        BOOL,
+        NUMBER,
+        STRING,
+        ARRAY,
+        OBJECT
+    } type = NUL;
+    double number = 0;
+    std::string str;
+    std::vector<Json> items;
+    std::vector<std::pair<std::string, Json>> members;
+
+    const Json *
+    get(const std::string &key) const
+    {
+        for(const auto &m : members)
+            if(m.first == key)
+                return &m.second;
+        return nullptr;
+    };
+};
+
+class JsonReader
+{
+    public:
+    JsonReader(const std::string &text) : m_text(text) {};
+
+    bool
+    parse(Json &value)
+    {
+        return read(value) && (skip(), m_pos == m_text.size());
+    };
+
+    private:
+    void
+    skip()
+    {
+        while(m_pos < m_text.size() && std::isspace((unsigned char)m_text[m_pos]))
+            m_pos++;
+    };
+
+    bool
+    read_string(std::string &s)
+    {
+        if(m_text[m_pos] != '"')
+            return false;
+        for(m_pos++; m_pos < m_text.size() && m_text[m_pos] != '"'; m_pos++)
+        {
+            if(m_text[m_pos] == '\\' && m_pos + 1 < m_text.size())
+                m_pos++;
+            s += m_text[m_pos];
+        }
+        return m_pos++ < m_text.size();
+    };
+
+    bool
+    read(Json &v)
+    {
+        skip();
+        if(m_pos >= m_text.size())
+            return false;
+        char c = m_text[m_pos];
+        if(c == '{' || c == '[')
+        {
+            v.type = (c == '{') ? Json::OBJECT : Json::ARRAY;
+            char end = (c == '{') ? '}' : ']';
+            m_pos++;
+            skip();
+            if(m_pos < m_text.size() && m_text[m_pos] == end)
+                return ++m_pos;
+            while(true)
+            {
+                Json item;
+                std::string key;
+                if(v.type == Json::OBJECT)
+                {
+                    skip();
+                    if(!read_string(key))
+                        return false;
+                    skip();
+                    if(m_pos >= m_text.size() || m_text[m_pos++] != ':')
+                        return false;
+                }
+                if(!read(item))
+                    return false;
+                if(v.type == Json::OBJECT)
+                    v.members.push_back(std::make_pair(key, item));
+                else
+                    v.items.push_back(item);
+                skip();
+                if(m_pos >= m_text.size())
+                    return false;
+                if(m_text[m_pos] == ',')
+                    m_pos++;
+                else if(m_text[m_pos++] == end)
+                    return true;
+                else
+                    return false;
+            }
+        }
+        if(c == '"')
+        {
+            v.type = Json::STRING;
+            return read_string(v.str);
+        }
+        for(const char *word : {"true", "false", "null"})
+            if(m_text.compare(m_pos, std::strlen(word), word) == 0)
+            {
+                v.type = (word[0] == 'n') ? Json::NUL : Json::BOOL;
+                v.number = (word[0] == 't');
+                m_pos += std::strlen(word);
+                return true;
+            }
+        const char *start = m_text.c_str() + m_pos;
+        char *end = nullptr;
+        v.type = Json::NUMBER;
+        v.number = std::strtod(start, &end);
+        if(end == start)
+            return false;
+        m_pos += end - start;
+        return true;
+    };
+
+    const std::string &m_text;
+    size_t m_pos = 0;
+};
+
+bool
+to_floats(const Json *v, std::vector<float> &out)
+{
+    if(v == nullptr || v->type != Json::ARRAY)
+        return false;
+    for(const Json &x : v->items)
+    {
+        if(x.type != Json::NUMBER)
+            return false;
+        out.push_back((float)x.number);
+    }
+    return true;
+}
+
+Layer::Activation
+activation_from(const std::string &name)
+{
+    if(name == "relu")
+        return Layer::RELU;
+    if(name == "tanh")
+        return Layer::TANH;
+    if(name == "sigmoid")
+        return Layer::SIGMOID;
+    if(name == "softmax")
+        return Layer::SOFTMAX;
+    return Layer::LINEAR;
+}
+
+template <typename T>
+void
+put(std::ofstream &f, T v)
+{
+    f.write((const char *)&v, sizeof(T));
+}
+
+template <typename T>
+bool
+get(std::ifstream &f, T &v)
+{
+    return (bool)f.read((char *)&v, sizeof(T));
+}
+} // namespace
+
+void
+Classifier::clear()
+{
+    m_layers.clear();
+    m_mean.clear();
+    m_inv_std.clear();
+    labels.clear();
+}
+
+void
+Classifier::add_layer(int inputs,
+                      int outputs,
+                      const float *weights,
+                      const float *bias,
+                      Layer::Activation activation)
+{
+    Layer l;
+    l.inputs = inputs;
+    l.outputs = outputs;
+    l.activation = activation;
+    l.weights_t.resize((size_t)inputs * outputs);
+    for(int o = 0; o < outputs; o++)
+        for(int i = 0; i < inputs; i++)
+            l.weights_t[(size_t)i * outputs + o] = weights[(size_t)o * inputs + i];
+    l.bias.assign(bias, bias + outputs);
+    m_layers.push_back(l);
+    resize_outputs();
+}
+
+void
+Classifier::set_normalization(const std::vector<float> &mean,
+                              const std::vector<float> &std)
+{
+    m_mean = mean;
+    m_inv_std.resize(std.size());
+    for(size_t i = 0; i < std.size(); i++)
+        m_inv_std[i] = (std[i] != 0) ? 1 / std[i] : 1;
+}
+
+void
+Classifier::resize_outputs()
+{
+    size_t width = 0;
+    for(const Layer &l : m_layers)
+        width = std::max(width, (size_t)std::max(l.inputs, l.outputs));
+    m_a.resize(width);
+    m_b.resize(width);
+    m_p.resize(classes());
+    decisions.resize(256);
+    probabilities.resize(classes(), 256);
+}
+
+int
+Classifier::load(const std::string &path)
+{
+    if(path.size() > 5 && path.compare(path.size() - 5, 5, ".json") == 0)
+        return load_json(path);
+    return load_binary(path);
+}
+
+int
+Classifier::load_json(const std::string &path)
+{
+    std::ifstream file(path);
+    if(!file.is_open())
+    {
+        logln("Could not open " + path, true);
+        return -1;
+    }
+    std::stringstream ss;
+    ss << file.rdbuf();
+    std::string text = ss.str();
+    Json root;
+    if(!JsonReader(text).parse(root) || root.type != Json::OBJECT)
+    {
+        logln("Invalid JSON model " + path, true);
+        return -1;
+    }
+
+    // A failed load leaves an empty model
+    auto invalid = [&](const std::string &reason)
+    {
+        clear();
+        logln(reason + " in " + path, true);
+        return -1;
+    };
+    clear();
+    const Json *layers = root.get("layers");
+    if(layers == nullptr || layers->type != Json::ARRAY || layers->items.empty())
+        return invalid("No layers");
+    for(const Json &l : layers->items)
+    {
+        const Json *w = l.get("weights");
+        std::vector<float> weights, bias;
+        if(w == nullptr || w->type != Json::ARRAY || w->items.empty())
+            return invalid("Invalid weights");
+        int outputs = w->items.size();
+        int inputs = w->items[0].items.size();
+        for(const Json &row : w->items)
+            if((int)row.items.size() != inputs || !to_floats(&row, weights))
+                return invalid("Invalid weights");
+        if(!to_floats(l.get("bias"), bias))
+            bias.assign(outputs, 0);
+        if(inputs == 0 || (int)bias.size() != outputs ||
+           (!m_layers.empty() && m_layers.back().outputs != inputs))
+            return invalid("Inconsistent layer sizes");
+        const Json *act = l.get("activation");
+        add_layer(inputs, outputs, weights.data(), bias.data(),
+                  activation_from(act != nullptr ? act->str : ""));
+    }
+
+    std::vector<float> mean, std;
+    if(root.get("mean") != nullptr || root.get("std") != nullptr)
+    {
+        if(!to_floats(root.get("mean"), mean) ||
+           !to_floats(root.get("std"), std) || (int)mean.size() != inputs() ||
+           (int)std.size() != inputs())
+            return invalid("Invalid normalization");
+        set_normalization(mean, std);
+    }
+    const Json *names = root.get("labels");
+    if(names != nullptr)
+        for(const Json &n : names->items) labels.push_back(n.str);
+
+    logln("Loaded " + std::to_string(m_layers.size()) + " layers (" +
+              std::to_string(inputs()) + " inputs, " +
+              std::to_string(classes()) + " classes)",
+          true);
+    return 0;
+}
+
+int
+Classifier::save(const std::string &path) const
+{
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    if(!f.is_open())
+        return -1;
+    f.write("CLVM", 4);
+    put<uint32_t>(f, 1); // version
+    put<uint32_t>(f, labels.size());
+    for(const std::string &l : labels)
+    {
+        put<uint32_t>(f, l.size());
+        f.write(l.data(), l.size());
+    }
+    put<uint32_t>(f, m_mean.size());
+    for(size_t i = 0; i < m_mean.size(); i++) put<float>(f, m_mean[i]);
+    for(size_t i = 0; i < m_mean.size(); i++) put<float>(f, 1 / m_inv_std[i]);
+    put<uint32_t>(f, m_layers.size());
+    for(const Layer &l : m_layers)
+    {
+        put<uint32_t>(f, l.inputs);
+        put<uint32_t>(f, l.outputs);
+        put<uint32_t>(f, l.activation);
+        for(int o = 0; o < l.outputs; o++)
+            for(int i = 0; i < l.inputs; i++)
+                put<float>(f, l.weights_t[(size_t)i * l.outputs + o]);
+        for(float b : l.bias) put<float>(f, b);
+    }
+    return f.good() ? 0 : -1;
+}
+
+int
+Classifier::load_binary(const std::string &path)
+{
+    std::ifstream f(path, std::ios::binary);
+    char magic[4];
+    uint32_t version = 0, n = 0;
+    if(!f.read(magic, 4) || std::memcmp(magic, "CLVM", 4) != 0 ||
+       !get(f, version) || version != 1)
+    {
+        logln("Invalid binary model " + path, true);
+        return -1;
+    }
+    // A failed load leaves an empty model
+    auto invalid = [&]()
+    {
+        clear();
+        logln("Invalid binary model " + path, true);
+        return -1;
+    };
+    clear();
+    if(!get(f, n))
+        return invalid();
+    for(uint32_t i = 0; i < n; i++)
+    {
+        uint32_t len = 0;
+        if(!get(f, len))
+            return invalid();
+        std::string s(len, ' ');
+        if(!f.read(&s[0], len))
+            return invalid();
+        labels.push_back(s);
+    }
+    if(!get(f, n))
+        return invalid();
+    std::vector<float> mean(n), std(n);
+    for(float &v : mean)
+        if(!get(f, v))
+            return invalid();
+    for(float &v : std)
+        if(!get(f, v))
+            return invalid();
+    uint32_t nb_layers = 0;
+    if(!get(f, nb_layers))
+        return invalid();
+    for(uint32_t k = 0; k < nb_layers; k++)
+    {
+        uint32_t inputs = 0, outputs = 0, act = 0;
+        if(!get(f, inputs) || !get(f, outputs) || !get(f, act) ||
+           act > Layer::SOFTMAX || inputs == 0 || outputs == 0 ||
+           (!m_layers.empty() && (uint32_t)m_layers.back().outputs != inputs))
+            return invalid();
+        std::vector<float> weights((size_t)inputs * outputs), bias(outputs);
+        if(!f.read((char *)weights.data(), weights.size() * sizeof(float)) ||
+           !f.read((char *)bias.data(), bias.size() * sizeof(float)))
+            return invalid();
+        add_layer(inputs, outputs, weights.data(), bias.data(),
+                  (Layer::Activation)act);
+    }
+    if(m_layers.empty() || (n > 0 && (int)n != inputs()))
+        return invalid();
+    if(n > 0)
+        set_normalization(mean, std);
+    logln("Loaded " + std::to_string(m_layers.size()) + " layers (" +
+              std::to_string(inputs()) + " inputs, " +
+              std::to_string(classes()) + " classes)",
+          true);
+    return 0;
+}
+
+int
+Classifier::predict(const double *features, float *probabilities)
+{
+    if(m_layers.empty())
+        return -1;
+    float *x = m_a.data();
+    float *y = m_b.data();
+    int n = inputs();
+    bool norm = !m_mean.empty();
+    for(int i = 0; i < n; i++)
+        x[i] = norm ? (float)((features[i] - m_mean[i]) * m_inv_std[i])
+                    : (float)features[i];
+
+    for(const Layer &l : m_layers)
+    {
+        // y = W x + b as a sum of the columns of W: contiguous outputs in
+        // the inner loop, one output per SIMD lane
+        std::copy(l.bias.begin(), l.bias.end(), y);
+        for(int i = 0; i < l.inputs; i++)
+        {
+            const float *__restrict w = l.weights_t.data() + (size_t)i * l.outputs;
+            float *__restrict yo = y;
+            float xi = x[i];
+            for(int o = 0; o < l.outputs; o++) yo[o] += w[o] * xi;
+        }
+        switch(l.activation)
+        {
+        case Layer::RELU:
+            for(int o = 0; o < l.outputs; o++) y[o] = std::max(y[o], 0.f);
+            break;
+        case Layer::TANH:
+            for(int o = 0; o < l.outputs; o++) y[o] = std::tanh(y[o]);
+            break;
+        case Layer::SIGMOID:
+            for(int o = 0; o < l.outputs; o++) y[o] = 1 / (1 + std::exp(-y[o]));
+            break;
+        case Layer::SOFTMAX:
+        {
+            float m = *std::max_element(y, y + l.outputs), sum = 0;
+            for(int o = 0; o < l.outputs; o++) sum += (y[o] = std::exp(y[o] - m));
+            for(int o = 0; o < l.outputs; o++) y[o] /= sum;
+            break;
+        }
+        default: break;
+        }
+        std::swap(x, y);
+    }
+
+    int c = classes();
+    if(probabilities != nullptr)
+        std::copy(x, x + c, probabilities);
+    return std::max_element(x, x + c) - x;
+}
+
+int
+Classifier::process(const double *timestamps,
+                    const double *features,
+                    size_t n_vectors,
+                    double clock_offset)
+{
+    int n_in = inputs();
+    if(n_in == 0)
+        return 0;
+    int count = 0;
+    std::vector<float> &p = m_p;
+    for(size_t k = 0; k < n_vectors; k++)
+    {
+        double t0 = host_clock();
+        Decision d;
+        d.label = predict(features + k * n_in, p.data());
+        d.decided = host_clock();
+        d.timestamp = timestamps[k];
+        d.probability = p[d.label];
+        d.latency = std::isnan(clock_offset)
+                        ? std::numeric_limits<double>::quiet_NaN()
+                        : d.decided - (timestamps[k] + clock_offset);
+
+        double inference = d.decided - t0;
+        m_stats.decisions++;
+        m_stats.inference_mean +=
+            (inference - m_stats.inference_mean) / m_stats.decisions;
+        m_stats.inference_max = std::max(m_stats.inference_max, inference);
+        if(!std::isnan(d.latency))
+        {
+            m_latencies++;
+            m_stats.latency_mean +=
+                (d.latency - m_stats.latency_mean) / m_latencies;
+            m_stats.latency_max = std::max(m_stats.latency_max, d.latency);
+        }
+
+        double *out = probabilities.reserve();
+        if(out != nullptr)
+        {
+            std::copy(p.begin(), p.end(), out);
+            probabilities.commit(d.timestamp);
+        }
+        decisions.push(d);
+        count++;
+
+        if(d.label != m_last_label)
+        {
+            m_last_label = d.label;
+            if(m_feedback_module != nullptr &&
+               d.label < (int)m_feedback_colors.size())
+                m_feedback_module->setRGB(m_feedback_colors[d.label]);
+            if(m_callback)
+                m_callback(d);
+        }
+    }
+    return count;
+}
+
+int
+Classifier::process(SampleRing &features, double clock_offset)
+{
+    return m_block.drain(features, inputs(),
+                         [&](const double *ts, const double *vectors, size_t n)
+                         { return process(ts, vectors, n, clock_offset); });
+}
+
+} // namespace ClvHd
@@ -1,61 +1,694 @@
-// #include "clvHdMono.hpp"
-
-// namespace ClvHd
-// {
-// void
-// MonoController::clientThread(Communication::SOCKET s)
-// {
-//     //check if the socket is still connected
-//     int error = 0;
-//     socklen_t len = sizeof(error);
-//     int retval = getsockopt(s, SOL_SOCKET, SO_ERROR, &error, &len);
-//     logln("Client Thread started", true);
-//     //while the socket is still connected
-//     while(retval == 0 && error == 0)
-//     {
-//         if(serverTCP.is_available(s))
-//         {
-//             uint8_t c = 0;
-//             serverTCP.read_byte(s, &c, 1);
-//             switch(c)
-//             {
-//             case 'A':
-//             {
-//                 logln("Initial message received", true);
-//                 uint8_t size = 0;
-//                 serverTCP.read_byte(s, (uint8_t *)&size, 1, true);
-//                 logln("Size of the mac address: " + std::to_string(size), true);
-//                 uint8_t *buff = new uint8_t[size+1];
-//                 serverTCP.read_byte(s, buff, size, true);
-//                 buff[size]='\0';
-//                 logln("Mac address: " + std::string((char *)buff), true);
-//                 delete[] buff;
-//                 // serverTCP.send_data(buff, 2, s);
-//             }
-//             break;
-//             case 'R':
-//             {
-//                 uint16_t val = 0;
-//                 uint8_t size = 0;
-//                 serverTCP.read_byte(s, (uint8_t *)&size, 1, true);
-//                 logln("Reply receive: " + std::to_string(size), true);
-//                 for(int i = 0; i < size; i++)
-//                 {
-//                     serverTCP.read_byte(s, (uint8_t *)&val, 2, true);
-//                     logln("Received value: " + std::to_string(val), true);
-//                 }
-//             }
-//             break;
-//             default:
-//                 logln("Unknown message received: " + std::to_string((int)c) +
-//                       " : " + std::to_string(c));
-//                 break;
-//             }
-//         }
-
-//         std::this_thread::sleep_for(std::chrono::milliseconds(100));
-//         retval = getsockopt(s, SOL_SOCKET, SO_ERROR, &error, &len);
-//     }
-//     logln("Client disconnected", true);
-// };
-// } // namespace ClvHd
\ No newline at end of file
+#include "clvHd_controller_mono.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "clvHd_ring.hpp"
+
+namespace ClvHd
+{
+
+static void *const s_listen_tag = (void *)1; // epoll tags of the sockets
+static void *const s_udp_tag = (void *)2;
+
+static int
+open_socket(int type, uint16_t port)
+{
+    int fd = socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+        return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(type == SOCK_DGRAM)
+    {
+        // Room for the bursts of the streams while the I/O thread is busy
+        int rcvbuf = 1 << 20;
+        setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+       (type == SOCK_STREAM && listen(fd, 32) < 0))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void
+MonoController::start()
+{
+    if(m_running)
+        return;
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    m_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    m_listen = open_socket(SOCK_STREAM, m_tcp_port);
+    m_udp = open_socket(SOCK_DGRAM, m_udp_port);
+    if(m_epoll < 0 || m_wake < 0 || m_listen < 0 || m_udp < 0)
+    {
+        std::string error = strerror(errno);
+        stop();
+        throw log_error("Cannot open the servers: " + error);
+    }
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wake, &ev);
+    ev.data.ptr = s_listen_tag;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_listen, &ev);
+    ev.data.ptr = s_udp_tag;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_udp, &ev);
+    m_running = true;
+    m_io = std::thread(&MonoController::ioLoop, this);
+    logln("Listening on TCP " + std::to_string(m_tcp_port) +
+              ", discovery on UDP " + std::to_string(m_udp_port),
+          true);
+}
+
+void
+MonoController::stop()
+{
+    if(m_running)
+    {
+        m_running = false;
+        uint64_t one = 1;
+        if(::write(m_wake, &one, sizeof(one)) < 0)
+            logln("Cannot wake the I/O thread", true);
+        m_io.join();
+        logln("stopped", true);
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(auto &c : m_clients) close(c.first);
+    m_clients.clear();
+    std::fill(m_fds.begin(), m_fds.end(), -1);
+    for(int *fd : {&m_listen, &m_udp, &m_wake, &m_epoll})
+        if(*fd >= 0)
+        {
+            close(*fd);
+            *fd = -1;
+        }
+    m_cond.notify_all();
+}
+
+void
+MonoController::ioLoop()
+{
+    struct epoll_event events[64];
+    while(m_running)
+    {
+        int n = epoll_wait(m_epoll, events, 64, -1);
+        if(n < 0 && errno != EINTR)
+        {
+            logln("epoll: " + std::string(strerror(errno)), true);
+            break;
+        }
+        for(int i = 0; i < n; i++)
+        {
+            void *tag = events[i].data.ptr;
+            if(tag == nullptr)
+                continue; // Stop request
+            else if(tag == s_listen_tag)
+                acceptClients();
+            else if(tag == s_udp_tag)
+                receiveDatagrams();
+            else
+            {
+                Client *client = (Client *)tag;
+                if(!receive(*client))
+                    closeClient(client->fd);
+            }
+        }
+    }
+}
+
+void
+MonoController::acceptClients()
+{
+    while(true)
+    {
+        int fd = accept4(m_listen, nullptr, nullptr,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0)
+            break;
+        // The replies are small: send them without waiting for more
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        Client *client = new Client;
+        client->fd = fd;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_clients[fd].reset(client);
+        }
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = client;
+        epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev);
+        logln("New client", true);
+    }
+}
+
+void
+MonoController::receiveDatagrams()
+{
+    const int batch = 32;
+    uint8_t buffers[batch][1500];
+    struct mmsghdr msgs[batch];
+    struct iovec iov[batch];
+    struct sockaddr_in from[batch];
+    while(true)
+    {
+        for(int i = 0; i < batch; i++)
+        {
+            iov[i] = {buffers[i], sizeof(buffers[i])};
+            msgs[i] = {};
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &from[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+        }
+        int n = recvmmsg(m_udp, msgs, batch, MSG_DONTWAIT, nullptr);
+        if(n <= 0)
+            break;
+        double now = host_clock();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for(int i = 0; i < n; i++)
+                if(msgs[i].msg_len > 0 && buffers[i][0] == 'S')
+                    ingest(buffers[i], msgs[i].msg_len, now);
+        }
+        for(int i = 0; i < n; i++)
+            if(msgs[i].msg_len >= 7 &&
+               std::memcmp(buffers[i], "MONOMOD", 7) == 0)
+            {
+                // Little endian TCP port
+                uint8_t port[2] = {(uint8_t)m_tcp_port,
+                                   (uint8_t)(m_tcp_port >> 8)};
+                sendto(m_udp, port, 2, 0, (struct sockaddr *)&from[i],
+                       msgs[i].msg_hdr.msg_namelen);
+            }
+        if(n < batch)
+            break;
+    }
+}
+
+void
+MonoController::ingest(const uint8_t *buff, size_t size, double arrival)
+{
+    // 'S' | id | n | count | u32 seq | u32 index | count x (u32 clock | n)
+    if(size < 12 || buff[1] >= m_streams.size())
+        return;
+    Stream &s = m_streams[buff[1]];
+    const uint8_t n = buff[2], count = buff[3];
+    if(!s.active || n != s.size || size != 12 + (size_t)count * (4 + n))
+        return;
+    uint32_t seq, index;
+    std::memcpy(&seq, buff + 4, 4);
+    std::memcpy(&index, buff + 8, 4);
+    s.stats.datagrams++;
+    if(!s.started)
+    {
+        s.started = true;
+        s.first = s.next = seq;
+        s.index = index;
+    }
+
+    // Sequence number extended around the expected one
+    int32_t ahead = (int32_t)(seq - (uint32_t)s.next);
+    if(ahead < 0 && ((uint64_t)-(int64_t)ahead > s.next ||
+                     s.next + ahead < s.first))
+    {
+        // Sent before the first datagram received, its successors are out
+        s.stats.late++;
+        return;
+    }
+    uint64_t ext = s.next + ahead;
+    if(ahead < 0)
+    {
+        bool given_up = false;
+        for(auto &g : s.gaps)
+            given_up |= (ext >= g.first && ext < g.second);
+        if(given_up)
+            s.stats.late++;
+        else
+            s.stats.duplicates++;
+        return;
+    }
+    if(s.held.count(ext))
+    {
+        s.stats.duplicates++;
+        return;
+    }
+    if(ahead > 0)
+        s.stats.reordered++;
+    Datagram &d = s.held[ext];
+    d.arrival = arrival;
+    d.index = index;
+    d.count = count;
+    d.samples.assign(buff + 12, buff + size);
+    release(s, arrival);
+}
+
+void
+MonoController::release(Stream &s, double now)
+{
+    while(!s.held.empty())
+    {
+        auto it = s.held.begin();
+        if(it->first != s.next)
+        {
+            if(s.held.size() < m_window && now - it->second.arrival < m_hold)
+                break;
+            // Give up the missing datagrams
+            s.gaps.emplace_back(s.next, it->first);
+            if(s.gaps.size() > 32)
+                s.gaps.pop_front();
+            s.stats.lost += (uint32_t)(it->second.index - s.index);
+            s.overflow = true;
+            s.next = it->first;
+        }
+        deliver(s, it->second);
+        s.held.erase(it);
+        s.next++;
+    }
+}
+
+void
+MonoController::deliver(Stream &s, const Datagram &d)
+{
+    const size_t entry = 4 + s.size;
+    if(d.count == 0)
+        return;
+    std::vector<uint64_t> clocks(d.count);
+    for(size_t k = 0; k < d.count; k++)
+    {
+        uint32_t c;
+        std::memcpy(&c, d.samples.data() + k * entry, 4);
+        if(c < s.clock && s.clock - c > 0x80000000u)
+            s.wraps += (uint64_t)1 << 32;
+        s.clock = c;
+        clocks[k] = s.wraps | c;
+    }
+
+    // Smallest transfer delay, allowed to grow by 1 us per datagram (drift)
+    double offset = d.arrival * 1e6 - (double)clocks.back();
+    if(std::isnan(s.offset) || offset < s.offset + 1)
+        s.offset = offset;
+    else
+        s.offset += 1;
+
+    for(size_t k = 0; k < d.count; k++)
+    {
+        double h = (double)clocks[k] + s.offset;
+        uint64_t t = (h > 0) ? (uint64_t)std::llround(h) : 0;
+        if(!s.times.empty())
+        {
+            double dt = (double)t - (double)s.times.back();
+            if(dt > 0 && (s.period == 0 || dt < 4 * s.period))
+                s.period = (s.period == 0) ? dt : 0.95 * s.period + 0.05 * dt;
+        }
+        s.times.push_back(t);
+        const uint8_t *bytes = d.samples.data() + k * entry + 4;
+        s.data.insert(s.data.end(), bytes, bytes + s.size);
+        s.covered = std::max(s.covered, t);
+    }
+    s.index = d.index + d.count;
+    s.stats.samples += d.count;
+}
+
+bool
+MonoController::receive(Client &client)
+{
+    uint8_t chunk[2048];
+    bool open = true;
+    while(true)
+    {
+        ssize_t n = recv(client.fd, chunk, sizeof(chunk), 0);
+        if(n > 0)
+            client.rx.insert(client.rx.end(), chunk, chunk + n);
+        else if(n < 0 && errno == EINTR)
+            continue;
+        else
+        {
+            open = (n < 0 && errno == EAGAIN);
+            break;
+        }
+    }
+
+    // Messages: 'A' | n | mac[n] (identification), 'R' | n | data[n]
+    size_t pos = 0;
+    std::vector<uint8_t> &rx = client.rx;
+    while(pos + 2 <= rx.size())
+    {
+        uint8_t type = rx[pos];
+        size_t size = rx[pos + 1];
+        if(type != 'A' && type != 'R')
+        {
+            logln("Unknown message received: " + std::to_string(type), true);
+            pos++;
+            continue;
+        }
+        if(pos + 2 + size > rx.size())
+            break; // Incomplete
+        const uint8_t *payload = rx.data() + pos + 2;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(type == 'A')
+        {
+            std::string mac((const char *)payload, size);
+            auto it = std::find(m_macs.begin(), m_macs.end(), mac);
+            if(it == m_macs.end())
+            {
+                m_macs.push_back(mac);
+                m_fds.push_back(-1);
+                it = m_macs.end() - 1;
+            }
+            client.id = it - m_macs.begin();
+            m_fds[client.id] = client.fd;
+            logln("Module " + std::to_string(client.id) + ": " + mac, true);
+        }
+        else
+        {
+            client.reply.assign(payload, payload + size);
+            client.replied = true;
+        }
+        m_cond.notify_all();
+        pos += 2 + size;
+    }
+    rx.erase(rx.begin(), rx.begin() + pos);
+    return open;
+}
+
+void
+MonoController::dropClient(int id)
+{
+    int fd = m_fds[id];
+    m_fds[id] = -1;
+    // The I/O thread sees the end of the connection and closes it
+    shutdown(fd, SHUT_RDWR);
+    logln("Module " + std::to_string(id) + " dropped", true);
+}
+
+void
+MonoController::closeClient(int fd)
+{
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_clients.find(fd);
+    if(it != m_clients.end())
+    {
+        int id = it->second->id;
+        if(id >= 0 && m_fds[id] == fd)
+            m_fds[id] = -1;
+        logln("Module " + std::to_string(id) + " disconnected", true);
+        m_clients.erase(it);
+    }
+    close(fd);
+    m_cond.notify_all();
+}
+
+int
+MonoController::send(int id, const uint8_t *data, size_t size)
+{
+    int fd;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(id < 0 || (size_t)id >= m_fds.size() || m_fds[id] < 0)
+            return -1;
+        fd = m_fds[id];
+    }
+    size_t done = 0;
+    while(done < size)
+    {
+        ssize_t n = ::send(fd, data + done, size - done, MSG_NOSIGNAL);
+        if(n > 0)
+            done += n;
+        else if(n < 0 && (errno == EAGAIN || errno == EINTR))
+        {
+            struct pollfd p = {fd, POLLOUT, 0};
+            if(poll(&p, 1, (int)(m_timeout * 1000)) <= 0)
+                return -1;
+        }
+        else
+            return -1;
+    }
+    return size;
+}
+
+int
+MonoController::waitModules(int nb, double timeout)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cond.wait_for(lock, std::chrono::duration<double>(timeout),
+                    [&]() { return (int)m_macs.size() >= nb; });
+    return m_macs.size();
+}
+
+int
+MonoController::nbClients()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_macs.size();
+}
+
+std::string
+MonoController::macAddress(int id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return (id >= 0 && (size_t)id < m_macs.size()) ? m_macs[id] : "";
+}
+
+void
+MonoController::setRGB(int id_module, RGBColor &color)
+{
+    // 'l' | rgb of the two LEDs
+    uint8_t msg[7] = {'l', 0, 0, 0, 0, 0, 0};
+    for(size_t i = 0; i < 2; i++)
+    {
+        msg[1 + 3 * i] = (i < color.red.size()) ? color.red[i] : 0;
+        msg[2 + 3 * i] = (i < color.green.size()) ? color.green[i] : 0;
+        msg[3 + 3 * i] = (i < color.blue.size()) ? color.blue[i] : 0;
+    }
+    send(id_module, msg, 7);
+}
+
+int
+MonoController::readCmd_multi(uint32_t mask_id,
+                              uint8_t n_cmd,
+                              uint8_t *cmd,
+                              uint8_t size,
+                              const void *buff,
+                              uint64_t *timestamp)
+{
+    std::vector<int> ids;
+    std::vector<uint8_t> msg(3 + n_cmd);
+    msg[0] = 'r';
+    msg[1] = size;
+    msg[2] = n_cmd;
+    std::copy(cmd, cmd + n_cmd, msg.begin() + 3);
+    for(int id = 0; id < 32; id++)
+    {
+        if(!(mask_id & ((uint32_t)1 << id)))
+            continue;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if((size_t)id >= m_fds.size() || m_fds[id] < 0)
+                return -1;
+            m_clients[m_fds[id]]->replied = false;
+        }
+        if(send(id, msg.data(), msg.size()) < 0)
+            return -1;
+        ids.push_back(id);
+    }
+
+    // Gather the replies in the order of the ids
+    uint8_t *out = (uint8_t *)buff;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for(int id : ids)
+    {
+        auto replied = [&]() {
+            return m_fds[id] < 0 || m_clients[m_fds[id]]->replied;
+        };
+        if(!m_cond.wait_for(lock, std::chrono::duration<double>(m_timeout),
+                            replied) ||
+           m_fds[id] < 0)
+        {
+            logln("No reply of module " + std::to_string(id), true);
+            // The replies are not tagged: a late one would be taken by the
+            // next read, so drop the connections still owing one (the
+            // modules reconnect)
+            for(int other : ids)
+                if(m_fds[other] >= 0 && !m_clients[m_fds[other]]->replied)
+                    dropClient(other);
+            return -1;
+        }
+        Client &client = *m_clients[m_fds[id]];
+        if(client.reply.size() != size)
+            return -1;
+        std::copy(client.reply.begin(), client.reply.end(), out);
+        out += size;
+    }
+    if(timestamp != nullptr)
+        *timestamp = (uint64_t)(host_clock() * 1e6);
+    return out - (uint8_t *)buff;
+}
+
+int
+MonoController::writeCmd_multi(uint32_t mask_id,
+                               uint8_t n_cmd,
+                               uint8_t *cmd,
+                               uint8_t size,
+                               const void *data)
+{
+    // 'w' | n | command and data
+    std::vector<uint8_t> msg(2 + n_cmd + size);
+    msg[0] = 'w';
+    msg[1] = n_cmd + size;
+    std::copy(cmd, cmd + n_cmd, msg.begin() + 2);
+    if(size > 0)
+        std::memcpy(msg.data() + 2 + n_cmd, data, size);
+    int n = 0;
+    for(int id = 0; id < 32; id++)
+        if(mask_id & ((uint32_t)1 << id))
+            if(send(id, msg.data(), msg.size()) > 0)
+                n = size;
+    return n;
+}
+
+int
+MonoController::startFifo(uint32_t mask_id,
+                          uint8_t n_cmd,
+                          uint8_t *cmd,
+                          uint8_t size,
+                          uint8_t source)
+{
+    // 's' | id | n | n_cmd | cmd | u16 UDP port, n = 0 to stop
+    const bool start = (source != FIFO_STOP);
+    std::vector<uint8_t> msg(6 + n_cmd);
+    msg[0] = 's';
+    msg[2] = start ? size : 0;
+    msg[3] = n_cmd;
+    std::copy(cmd, cmd + n_cmd, msg.begin() + 4);
+    msg[4 + n_cmd] = (uint8_t)m_udp_port;
+    msg[5 + n_cmd] = (uint8_t)(m_udp_port >> 8);
+    for(int id = 0; id < 32; id++)
+    {
+        if(!(mask_id & ((uint32_t)1 << id)))
+            continue;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(m_streams.size() <= (size_t)id)
+                m_streams.resize(id + 1);
+            m_streams[id] = Stream();
+            m_streams[id].active = start;
+            m_streams[id].size = size;
+        }
+        msg[1] = id;
+        if(send(id, msg.data(), msg.size()) < 0)
+            return -1;
+    }
+    return start ? FIFO_POLL : FIFO_STOP;
+}
+
+int
+MonoController::drainFifo(uint16_t max_frames,
+                          FifoFrames &frames,
+                          bool compressed)
+{
+    (void)compressed;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    double now = host_clock();
+    uint32_t mask = 0;
+    uint8_t size = 0;
+    double period = 0;
+    std::vector<Stream *> active;
+    for(size_t id = 0; id < m_streams.size(); id++)
+    {
+        Stream &s = m_streams[id];
+        if(!s.active)
+            continue;
+        release(s, now);
+        mask |= (uint32_t)1 << id;
+        size = s.size;
+        period = std::max(period, s.period);
+        active.push_back(&s);
+    }
+    if(active.empty())
+        return -1;
+    frames.mask = mask;
+    frames.size = size;
+    frames.stride = active.size() * size;
+    frames.flags = 0;
+    frames.timestamp = (uint64_t)(now * 1e6);
+    frames.count = 0;
+    frames.timestamps.clear();
+    frames.data.clear();
+    for(Stream *s : active)
+        if(s->overflow)
+        {
+            frames.flags |= FIFO_OVERFLOW;
+            s->overflow = false;
+        }
+
+    // A module silent for the hold time is not waited for
+    const uint64_t stalled = (uint64_t)((now - m_hold) * 1e6);
+    const uint64_t tol = (uint64_t)(period / 2);
+    while(frames.count < max_frames)
+    {
+        // Earliest sample, each module having one close to it or none coming
+        uint64_t t = std::numeric_limits<uint64_t>::max();
+        for(Stream *s : active)
+            if(!s->times.empty())
+                t = std::min(t, s->times.front());
+        if(t == std::numeric_limits<uint64_t>::max())
+            break;
+        bool ready = true;
+        for(Stream *s : active)
+            if(s->times.empty() && std::max(s->covered, stalled) < t + tol)
+                ready = false;
+        if(!ready)
+            break;
+
+        frames.timestamps.push_back(t);
+        for(Stream *s : active)
+            if(!s->times.empty() && s->times.front() <= t + tol)
+            {
+                frames.data.insert(frames.data.end(), s->data.begin(),
+                                   s->data.begin() + size);
+                s->data.erase(s->data.begin(), s->data.begin() + size);
+                s->times.pop_front();
+            }
+            else
+                frames.data.insert(frames.data.end(), size, 0);
+        frames.count++;
+    }
+    if(frames.count == max_frames)
+        frames.flags |= FIFO_PENDING;
+    return frames.count;
+}
+
+StreamStats
+MonoController::streamStats(int id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(id < 0 || (size_t)id >= m_streams.size())
+        return StreamStats();
+    return m_streams[id].stats;
+}
+
+} // namespace ClvHd
@@ -0,0 +1,642 @@
+#include "clvHd_controller_multi.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "clvHd_ring.hpp"
+
+namespace ClvHd
+{
+
+static speed_t
+baud_flag(int baud)
+{
+    switch(baud)
+    {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 921600: return B921600;
+    default: return B460800; // Ignored by the USB CDC boards
+    }
+}
+
+BoardLink::~BoardLink()
+{
+    if(m_fd < 0)
+        return;
+    sendCmd('z');
+    ::close(m_fd);
+}
+
+int
+BoardLink::open(const char *path, int baud)
+{
+    m_fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if(m_fd < 0)
+    {
+        logln("Cannot open " + std::string(path) + ": " + strerror(errno),
+              true);
+        return -1;
+    }
+    struct termios tty;
+    if(tcgetattr(m_fd, &tty) == 0)
+    {
+        cfmakeraw(&tty);
+        cfsetispeed(&tty, baud_flag(baud));
+        cfsetospeed(&tty, baud_flag(baud));
+        tty.c_cflag |= CLOCAL | CREAD;
+        tcsetattr(m_fd, TCSANOW, &tty);
+    }
+    tcflush(m_fd, TCIOFLUSH);
+    return 0;
+}
+
+int
+BoardLink::sendCmd(uint8_t *data, size_t size)
+{
+    size_t done = 0;
+    while(done < size)
+    {
+        ssize_t n = ::write(m_fd, data + done, size - done);
+        if(n > 0)
+            done += n;
+        else if(n < 0 && (errno == EAGAIN || errno == EINTR))
+        {
+            // Output queue full: wait until the port drains
+            struct pollfd p = {m_fd, POLLOUT, 0};
+            if(poll(&p, 1, (int)(m_timeout * 1000)) <= 0)
+                break;
+        }
+        else
+            break;
+    }
+    if(done != size)
+    {
+        logln("Error sending command", true);
+        return -1;
+    }
+    return size;
+}
+
+bool
+BoardLink::pump()
+{
+    uint8_t chunk[4096];
+    bool open = true;
+    size_t total = 0;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(true)
+    {
+        ssize_t n = ::read(m_fd, chunk, sizeof(chunk));
+        if(n > 0)
+        {
+            // Drop the consumed bytes before growing the ring
+            if(m_head > 0 && m_head >= m_ring.size() / 2)
+            {
+                m_ring.erase(m_ring.begin(), m_ring.begin() + m_head);
+                m_head = 0;
+            }
+            m_ring.insert(m_ring.end(), chunk, chunk + n);
+            m_received += n;
+            total += n;
+        }
+        else if(n < 0 && errno == EINTR)
+            continue;
+        else
+        {
+            open = (n < 0 && errno == EAGAIN);
+            break;
+        }
+    }
+    m_closed = !open;
+    lock.unlock();
+    if(total > 0 || !open)
+        m_cond.notify_all();
+    return open;
+}
+
+void
+BoardLink::resync()
+{
+    SerialController::resync();
+    // A late reply comes within about a timeout of the failed one
+    std::unique_lock<std::mutex> lock(m_mutex);
+    uint64_t received;
+    do
+    {
+        received = m_received;
+        m_cond.wait_for(lock, std::chrono::duration<double>(m_timeout),
+                        [&]() { return m_received != received || m_closed; });
+    } while(received != m_received && !m_closed);
+    m_ring.clear();
+    m_head = 0;
+}
+
+int
+BoardLink::receive(uint8_t *buff, size_t size)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto ready = [&]() { return m_ring.size() - m_head >= size || m_closed; };
+    if(!m_cond.wait_for(lock, std::chrono::duration<double>(m_timeout),
+                        ready) ||
+       m_ring.size() - m_head < size)
+        return -1;
+    std::memcpy(buff, m_ring.data() + m_head, size);
+    m_head += size;
+    return size;
+}
+
+MultiController::~MultiController()
+{
+    if(m_running)
+    {
+        m_running = false;
+        uint64_t one = 1;
+        if(::write(m_wake, &one, sizeof(one)) < 0)
+            logln("Cannot wake the I/O thread", true);
+        m_io.join();
+    }
+    // The boards still send their stop command through the ports
+    m_boards.clear();
+    if(m_epoll >= 0)
+        ::close(m_epoll);
+    if(m_wake >= 0)
+        ::close(m_wake);
+}
+
+int
+MultiController::addBoard(const char *path, int baud)
+{
+    if(m_epoll < 0)
+    {
+        m_epoll = epoll_create1(EPOLL_CLOEXEC);
+        m_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        if(m_epoll < 0 || m_wake < 0 ||
+           epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wake, &ev) < 0)
+            throw log_error("Cannot create the I/O loop");
+        m_running = true;
+        m_io = std::thread(&MultiController::ioLoop, this);
+    }
+
+    Board b;
+    b.link.reset(new BoardLink(m_verbose));
+    if(b.link->open(path, baud) < 0)
+        return -1;
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = b.link.get();
+    if(epoll_ctl(m_epoll, EPOLL_CTL_ADD, b.link->fd(), &ev) < 0)
+    {
+        logln("Cannot poll " + std::string(path), true);
+        return -1;
+    }
+    m_boards.push_back(std::move(b));
+    logln("Board " + std::to_string(m_boards.size() - 1) + ": " + path, true);
+    return m_boards.size() - 1;
+}
+
+void
+MultiController::ioLoop()
+{
+    struct epoll_event events[16];
+    while(m_running)
+    {
+        int n = epoll_wait(m_epoll, events, 16, -1);
+        if(n < 0 && errno != EINTR)
+        {
+            logln("epoll: " + std::string(strerror(errno)), true);
+            break;
+        }
+        for(int i = 0; i < n; i++)
+        {
+            BoardLink *link = (BoardLink *)events[i].data.ptr;
+            if(link == nullptr)
+                continue; // Stop request
+            if(!link->pump())
+            {
+                epoll_ctl(m_epoll, EPOLL_CTL_DEL, link->fd(), nullptr);
+                logln("Board disconnected", true);
+            }
+        }
+    }
+}
+
+int
+MultiController::boardOf(int id, int *local) const
+{
+    for(size_t i = 0; i < m_boards.size(); i++)
+        if(id >= m_boards[i].first && id < m_boards[i].first + m_boards[i].nb)
+        {
+            if(local != nullptr)
+                *local = id - m_boards[i].first;
+            return i;
+        }
+    return -1;
+}
+
+double
+MultiController::clockOffset(size_t board) const
+{
+    if(board >= m_boards.size())
+        return NAN;
+    return m_boards[0].offset - m_boards[board].offset;
+}
+
+void
+MultiController::updateOffset(Board &b, uint64_t timestamp)
+{
+    // Smallest transfer delay, allowed to grow by 1 us per reply (drift)
+    double offset = host_clock() - timestamp / 1000000.0;
+    if(std::isnan(b.offset) || offset < b.offset + 1e-6)
+        b.offset = offset;
+    else
+        b.offset += 1e-6;
+}
+
+uint64_t
+MultiController::align(const Board &b, uint64_t timestamp) const
+{
+    double shift = (b.offset - m_boards[0].offset) * 1e6;
+    if(&b == &m_boards[0] || std::isnan(shift))
+        return timestamp;
+    double t = (double)timestamp + shift;
+    return (t > 0) ? (uint64_t)std::llround(t) : 0;
+}
+
+uint8_t
+MultiController::setup()
+{
+    // The boards enumerate their chains in parallel
+    for(Board &b : m_boards) b.link->sendCmd('s');
+    int total = 0;
+    for(size_t i = 0; i < m_boards.size(); i++)
+    {
+        Board &b = m_boards[i];
+        uint8_t nb = 0;
+        uint64_t ts;
+        b.first = total;
+        b.nb = (b.link->readReply(&nb, &ts) == 1) ? nb : 0;
+        if(b.nb > 0)
+            updateOffset(b, ts);
+        if(total + b.nb > 32)
+        {
+            logln("Board " + std::to_string(i) + ": only " +
+                      std::to_string(32 - total) + " of its modules fit in "
+                      "the 32 bits masks",
+                  true);
+            b.nb = 32 - total;
+        }
+        total += b.nb;
+        logln("Board " + std::to_string(i) + ": modules " +
+                  std::to_string(b.first) + " to " +
+                  std::to_string(b.first + b.nb - 1),
+              true);
+    }
+    return total;
+}
+
+uint8_t
+MultiController::getNbModules()
+{
+    for(Board &b : m_boards) b.link->sendCmd('n');
+    int total = 0;
+    bool enumerated = true;
+    for(Board &b : m_boards)
+    {
+        uint8_t nb = 0;
+        if(b.link->readReply(&nb) != 1 || nb == 0 || nb == 0xff)
+            enumerated = false;
+        b.first = total;
+        b.nb = std::min<int>(nb, 32 - total);
+        total += b.nb;
+    }
+    return enumerated ? total : 0;
+}
+
+std::string
+MultiController::getVersion(uint8_t *major, uint8_t *minor)
+{
+    // Lowest version of the boards, which bounds the common features
+    std::string version;
+    int lowest = -1;
+    for(Board &b : m_boards)
+    {
+        uint8_t ma = 0, mi = 0;
+        std::string v = b.link->getVersion(&ma, &mi);
+        if(v.empty())
+            return "";
+        if(lowest < 0 || 256 * ma + mi < lowest)
+        {
+            lowest = 256 * ma + mi;
+            version = v;
+            if(major != nullptr)
+                *major = ma;
+            if(minor != nullptr)
+                *minor = mi;
+        }
+    }
+    return version + "x" + std::to_string(m_boards.size());
+}
+
+int
+MultiController::readCmd_multi(uint32_t mask_id,
+                               uint8_t n_cmd,
+                               uint8_t *cmd,
+                               uint8_t size,
+                               const void *buff,
+                               uint64_t *timestamp)
+{
+    std::vector<bool> sent(m_boards.size(), false);
+    bool failed = false;
+    for(size_t i = 0; i < m_boards.size(); i++)
+    {
+        Board &b = m_boards[i];
+        if(localMask(b, mask_id) == 0)
+            continue;
+        sent[i] = b.link->requestRead(localMask(b, mask_id), n_cmd, cmd,
+                                      size) >= 0;
+        failed |= !sent[i];
+    }
+
+    // The replies are concatenated in the order of the global ids. Every
+    // sent request is read, even after a failure, so that no board is left
+    // one reply behind.
+    uint8_t *out = (uint8_t *)buff;
+    int total = 0;
+    bool first = true;
+    for(size_t i = 0; i < m_boards.size(); i++)
+    {
+        Board &b = m_boards[i];
+        if(!sent[i])
+            continue;
+        uint64_t ts = 0;
+        int n = b.link->readReply(out + total, &ts);
+        if(n < 0)
+        {
+            logln("No reply of board " + std::to_string(i), true);
+            b.link->resync();
+            failed = true;
+            continue;
+        }
+        updateOffset(b, ts);
+        if(first && timestamp != nullptr)
+            *timestamp = align(b, ts);
+        first = false;
+        total += n;
+    }
+    return failed ? -1 : total;
+}
+
+int
+MultiController::writeCmd_multi(uint32_t mask_id,
+                                uint8_t n_cmd,
+                                uint8_t *cmd,
+                                uint8_t size,
+                                const void *data)
+{
+    int n = 0;
+    for(Board &b : m_boards)
+        if(localMask(b, mask_id) != 0)
+            n = b.link->writeCmd_multi(localMask(b, mask_id), n_cmd, cmd,
+                                       size, data);
+    return n;
+}
+
+void
+MultiController::setRGB(int id_module, RGBColor &color)
+{
+    int local;
+    int i = boardOf(id_module, &local);
+    if(i >= 0)
+        m_boards[i].link->setRGB(local, color);
+}
+
+size_t
+MultiController::maxReplySize()
+{
+    size_t size = CLVHD_LONG_REPLY_SIZE;
+    for(Board &b : m_boards) size = std::min(size, b.link->maxReplySize());
+    return size;
+}
+
+int
+MultiController::startFifo(uint32_t mask_id,
+                           uint8_t n_cmd,
+                           uint8_t *cmd,
+                           uint8_t size,
+                           uint8_t source)
+{
+    // Every board samples its modules, the lowest common source is kept
+    int active = -1;
+    for(Board &b : m_boards)
+    {
+        b.fifo_mask = localMask(b, mask_id);
+        b.pending = FifoFrames();
+        b.pos = 0;
+        b.covered = 0;
+        b.period = 0;
+        if(b.fifo_mask == 0)
+            continue;
+        int s = b.link->startFifo(b.fifo_mask, n_cmd, cmd, size, source);
+        if(s < 0)
+            return -1;
+        active = (active < 0) ? s : std::min(active, s);
+    }
+    m_fifo_size = size;
+    return active;
+}
+
+int
+MultiController::drainFifo(uint16_t max_frames,
+                           FifoFrames &frames,
+                           bool compressed)
+{
+    std::vector<Board *> active;
+    for(Board &b : m_boards)
+        if(b.fifo_mask != 0 && b.nb > 0)
+            active.push_back(&b);
+    if(active.empty())
+        return -1;
+    std::vector<bool> sent(active.size());
+    bool failed = false;
+    for(size_t i = 0; i < active.size(); i++)
+    {
+        sent[i] = active[i]->link->requestDrain(0xFFFF, compressed);
+        failed |= !sent[i];
+    }
+
+    // Every sent drain is read, even after a failure, so that no board is
+    // left one reply behind (the frames of the others wait in pending)
+    uint8_t flags = 0;
+    FifoFrames drained;
+    for(size_t i = 0; i < active.size(); i++)
+    {
+        Board *b = active[i];
+        if(!sent[i])
+            continue;
+        if(b->link->readDrain(drained) < 0)
+        {
+            logln("No drain reply of a board", true);
+            b->link->resync();
+            failed = true;
+            continue;
+        }
+        updateOffset(*b, drained.timestamp);
+        flags |= drained.flags & (FIFO_OVERFLOW | FIFO_PENDING);
+
+        // Append to the frames not merged yet
+        FifoFrames &p = b->pending;
+        if(b->pos > 0)
+        {
+            p.timestamps.erase(p.timestamps.begin(),
+                               p.timestamps.begin() + b->pos);
+            p.data.erase(p.data.begin(), p.data.begin() + b->pos * p.stride);
+            p.count -= b->pos;
+            b->pos = 0;
+        }
+        p.mask = drained.mask;
+        p.size = drained.size;
+        p.stride = drained.stride;
+        for(size_t i = 0; i < drained.count; i++)
+        {
+            uint64_t t = align(*b, drained.timestamps[i]);
+            if(p.count > 0)
+            {
+                double dt = (double)t - (double)p.timestamps[p.count - 1];
+                if(dt > 0 && (b->period == 0 || dt < 4 * b->period))
+                    b->period = (b->period == 0) ? dt
+                                                 : 0.95 * b->period + 0.05 * dt;
+            }
+            p.timestamps.push_back(t);
+            p.count++;
+        }
+        p.data.insert(p.data.end(), drained.data.begin(), drained.data.end());
+        // Every sample older than the reply arrived, unless some are pending
+        b->covered = (drained.flags & FIFO_PENDING)
+                         ? (p.count > 0 ? p.timestamps.back() : b->covered)
+                         : align(*b, drained.timestamp);
+    }
+
+    if(failed)
+        return -1;
+
+    size_t n = merge(max_frames, frames);
+    for(Board *b : active)
+        if(b->pos < b->pending.count)
+            flags |= FIFO_PENDING; // Left for the next merge
+    frames.flags = flags;
+    frames.timestamp = 0;
+    for(Board *b : active)
+        frames.timestamp = std::max(frames.timestamp, b->covered);
+    return n;
+}
+
+size_t
+MultiController::merge(size_t max_frames, FifoFrames &frames)
+{
+    uint32_t mask = 0;
+    size_t stride = 0;
+    std::vector<size_t> strides(m_boards.size(), 0);
+    for(size_t i = 0; i < m_boards.size(); i++)
+    {
+        for(uint32_t m = m_boards[i].fifo_mask; m != 0; m &= m - 1)
+            strides[i] += m_fifo_size;
+        mask |= m_boards[i].fifo_mask << m_boards[i].first;
+        stride += strides[i];
+    }
+    frames.mask = mask;
+    frames.size = m_fifo_size;
+    frames.stride = stride;
+    frames.count = 0;
+    frames.timestamps.clear();
+    frames.data.clear();
+
+    while(frames.count < max_frames)
+    {
+        // Earliest pending sample and the tolerance of the pairing
+        uint64_t t = std::numeric_limits<uint64_t>::max();
+        double period = 0;
+        for(Board &b : m_boards)
+        {
+            if(b.fifo_mask == 0)
+                continue;
+            period = std::max(period, b.period);
+            if(b.pos < b.pending.count)
+                t = std::min(t, b.pending.timestamps[b.pos]);
+        }
+        if(t == std::numeric_limits<uint64_t>::max())
+            break;
+        const uint64_t tol = (uint64_t)(period / 2);
+
+        // Each board has a sample close to t, or none will come
+        bool ready = true;
+        for(Board &b : m_boards)
+            if(b.fifo_mask != 0 && b.pos == b.pending.count &&
+               b.covered < t + tol)
+                ready = false;
+        if(!ready)
+            break;
+
+        frames.timestamps.push_back(t);
+        size_t offset = frames.data.size();
+        frames.data.resize(offset + stride, 0);
+        for(size_t i = 0; i < m_boards.size(); i++)
+        {
+            Board &b = m_boards[i];
+            FifoFrames &p = b.pending;
+            if(b.pos < p.count && p.timestamps[b.pos] <= t + tol)
+            {
+                if(p.stride == strides[i])
+                    std::memcpy(frames.data.data() + offset, p.frame(b.pos),
+                                p.stride);
+                b.pos++;
+            }
+            offset += strides[i];
+        }
+        frames.count++;
+    }
+    return frames.count;
+}
+
+int
+MultiController::setSpiClock(uint32_t clock)
+{
+    int applied = -1;
+    for(Board &b : m_boards)
+    {
+        int c = b.link->setSpiClock(clock);
+        if(c < 0)
+            return -1;
+        applied = (applied < 0) ? c : std::min(applied, c);
+    }
+    return applied;
+}
+
+int
+MultiController::setAggregation(uint16_t packet, uint16_t budget_us)
+{
+    int applied = -1;
+    for(Board &b : m_boards)
+    {
+        int p = b.link->setAggregation(packet, budget_us);
+        if(p < 0)
+            return -1;
+        applied = p;
+    }
+    return applied;
+}
+
+} // namespace ClvHd
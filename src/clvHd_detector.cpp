@@ -0,0 +1,120 @@
+#include "clvHd_detector.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ClvHd
+{
+
+void
+Detector::configure(int nb_channels,
+                    double fs,
+                    const DetectorConfig &config,
+                    size_t capacity)
+{
+    m_channels = std::max(nb_channels, 0);
+    m_fs = fs;
+    m_config = config;
+    m_env_alpha = (config.envelope_hz > 0)
+                      ? 1 - std::exp(-2 * M_PI * config.envelope_hz / fs)
+                      : 1;
+    m_base_alpha = 1 / std::max(config.baseline_s * fs, 1.);
+    m_warmup = (uint64_t)std::max(config.warmup_s * fs, 1.);
+    events.resize(capacity);
+    reset();
+}
+
+void
+Detector::reset()
+{
+    m_state.assign(m_channels, Channel());
+    m_count = 0;
+    m_stats = DetectorStats();
+}
+
+int
+Detector::process(const double *timestamps,
+                  const double *frames,
+                  size_t n_frames)
+{
+    const DetectorConfig &c = m_config;
+    int pushed = 0;
+    for(size_t f = 0; f < n_frames; f++)
+    {
+        const double *in = frames + f * m_channels;
+        // Running mean during the warm-up, then the baseline time constant
+        double base_alpha =
+            std::max(m_base_alpha, 1. / std::min(m_count + 1, m_warmup));
+        bool armed = (m_count >= m_warmup);
+        m_count++;
+        for(int ch = 0; ch < m_channels; ch++)
+        {
+            Channel &s = m_state[ch];
+            double v = (in[ch] == in[ch]) ? in[ch] : s.x1;
+            double e = c.teager ? std::fabs(s.x1 * s.x1 - v * s.x2)
+                                : std::fabs(v);
+            s.x2 = s.x1;
+            s.x1 = v;
+            s.env += m_env_alpha * (e - s.env);
+
+            double sd = std::sqrt(s.var);
+            bool above = s.env > s.mean + c.h_on * sd;
+            if(!s.active && (!armed || !above))
+            {
+                // Baseline at rest only
+                double d = s.env - s.mean;
+                s.mean += base_alpha * d;
+                s.var += base_alpha * (d * d - s.var);
+            }
+            if(!armed)
+                continue;
+
+            bool beyond = s.active ? (s.env < s.mean + c.h_off * sd) : above;
+            if(!beyond)
+            {
+                s.count = 0;
+                continue;
+            }
+            if(s.count == 0)
+                s.since = timestamps[f];
+            s.count++;
+            if(s.count < (s.active ? c.min_off : c.min_on))
+                continue;
+
+            Event ev;
+            ev.timestamp = s.since;
+            ev.detected = now();
+            ev.channel = ch;
+            ev.onset = !s.active;
+            ev.value = s.env;
+            ev.delay = s.count - 1;
+            s.active = !s.active;
+            s.count = 0;
+            if(events.push(ev))
+                pushed++;
+        }
+    }
+    return pushed;
+}
+
+int
+Detector::process(SampleRing &ring)
+{
+    return m_block.drain(ring, m_channels,
+                         [this](const double *ts, const double *frames,
+                                size_t n) { return process(ts, frames, n); });
+}
+
+bool
+Detector::pop(Event &event)
+{
+    if(!events.pop(event))
+        return false;
+    double delay = now() - event.detected;
+    m_stats.events++;
+    m_stats.delay_mean += (delay - m_stats.delay_mean) / m_stats.events;
+    m_stats.delay_max = std::max(m_stats.delay_max, delay);
+    return true;
+}
+
+} // namespace ClvHd
@@ -0,0 +1,162 @@
+#include "clvHd_features.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ClvHd
+{
+
+void
+FeatureExtractor::configure(int nb_channels,
+                            int window,
+                            int hop,
+                            double zc_threshold,
+                            double ssc_threshold,
+                            size_t capacity)
+{
+    m_channels = std::max(nb_channels, 0);
+    m_window = std::max(window, 1);
+    m_hop = std::max(hop, 1);
+    m_zc_threshold = zc_threshold;
+    m_ssc_threshold = ssc_threshold;
+    output.resize(size(), capacity);
+    reset();
+}
+
+void
+FeatureExtractor::reset()
+{
+    m_count = 0;
+    m_seen.assign(m_channels, 0);
+    m_contrib.assign((size_t)m_window * NB_SUMS * m_channels, 0);
+    m_sum.assign((size_t)NB_SUMS * m_channels, 0);
+    m_prev1.assign(m_channels, 0);
+    m_prev2.assign(m_channels, 0);
+}
+
+std::string
+FeatureExtractor::feature_name(int feature)
+{
+    static const char *names[NB_FEATURES] = {"RMS", "MAV", "WL", "ZC", "SSC"};
+    return (feature >= 0 && feature < NB_FEATURES) ? names[feature] : "";
+}
+
+int
+FeatureExtractor::process(const double *timestamps,
+                          const double *frames,
+                          size_t n_frames)
+{
+    size_t nch = m_channels;
+    int emitted = 0;
+    for(size_t f = 0; f < n_frames; f++)
+    {
+        const double *in = frames + f * nch;
+        size_t slot = m_count % m_window;
+        double *c = m_contrib.data() + slot * NB_SUMS * nch;
+        double *sum = m_sum.data();
+        double *p1 = m_prev1.data();
+        double *p2 = m_prev2.data();
+
+        // Remove the contributions of the sample leaving the window and add
+        // the ones of the new sample in its slot (none if it is NaN)
+        for(size_t ch = 0; ch < nch; ch++)
+        {
+            double v = in[ch];
+            if(v != v)
+            {
+                for(int k = 0; k < NB_SUMS; k++)
+                {
+                    sum[k * nch + ch] -= c[k * nch + ch];
+                    c[k * nch + ch] = 0;
+                }
+                continue;
+            }
+            uint64_t seen = m_seen[ch]++;
+            double d = (seen == 0) ? 0 : v - p1[ch];
+            double sq = v * v;
+            double ab = std::fabs(v);
+            double wl = std::fabs(d);
+            double zc =
+                (seen >= 1 && v * p1[ch] < 0 && wl >= m_zc_threshold) ? 1 : 0;
+            double ssc = (seen >= 2 && (p1[ch] - p2[ch]) * (p1[ch] - v) >
+                                           m_ssc_threshold)
+                             ? 1
+                             : 0;
+            sum[RMS * nch + ch] += sq - c[RMS * nch + ch];
+            sum[MAV * nch + ch] += ab - c[MAV * nch + ch];
+            sum[WL * nch + ch] += wl - c[WL * nch + ch];
+            sum[ZC * nch + ch] += zc - c[ZC * nch + ch];
+            sum[SSC * nch + ch] += ssc - c[SSC * nch + ch];
+            sum[NEW * nch + ch] += 1 - c[NEW * nch + ch];
+            c[RMS * nch + ch] = sq;
+            c[MAV * nch + ch] = ab;
+            c[WL * nch + ch] = wl;
+            c[ZC * nch + ch] = zc;
+            c[SSC * nch + ch] = ssc;
+            c[NEW * nch + ch] = 1;
+            p2[ch] = p1[ch];
+            p1[ch] = v;
+        }
+        m_count++;
+
+        // Recompute the sums once per window so the rounding errors of the
+        // running sums do not accumulate
+        if(slot == (size_t)m_window - 1)
+            resum();
+
+        if(m_count >= (uint64_t)m_window &&
+           (m_count - m_window) % m_hop == 0)
+        {
+            emit(timestamps[f]);
+            emitted++;
+        }
+    }
+    return emitted;
+}
+
+int
+FeatureExtractor::process(SampleRing &ring)
+{
+    return m_block.drain(ring, m_channels,
+                         [this](const double *ts, const double *frames,
+                                size_t n) { return process(ts, frames, n); });
+}
+
+void
+FeatureExtractor::emit(double timestamp)
+{
+    double *out = output.reserve();
+    if(out == nullptr)
+        return;
+    size_t nch = m_channels;
+    const double *sum = m_sum.data();
+    for(size_t ch = 0; ch < nch; ch++)
+    {
+        double n = std::round(sum[NEW * nch + ch]);
+        if(n < 1)
+        {
+            for(int k = 0; k < NB_FEATURES; k++) out[k * nch + ch] = NAN;
+            continue;
+        }
+        out[RMS * nch + ch] = std::sqrt(std::max(sum[RMS * nch + ch], 0.) / n);
+        out[MAV * nch + ch] = sum[MAV * nch + ch] / n;
+        out[WL * nch + ch] = sum[WL * nch + ch];
+        out[ZC * nch + ch] = std::round(sum[ZC * nch + ch]);
+        out[SSC * nch + ch] = std::round(sum[SSC * nch + ch]);
+    }
+    output.commit(timestamp);
+}
+
+void
+FeatureExtractor::resum()
+{
+    size_t n = (size_t)NB_SUMS * m_channels;
+    std::fill(m_sum.begin(), m_sum.end(), 0.);
+    for(int s = 0; s < m_window; s++)
+    {
+        const double *c = m_contrib.data() + s * n;
+        for(size_t i = 0; i < n; i++) m_sum[i] += c[i];
+    }
+}
+
+} // namespace ClvHd
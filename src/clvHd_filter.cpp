@@ -0,0 +1,145 @@
+#include "clvHd_filter.hpp"
+
+#include <cmath>
+
+namespace ClvHd
+{
+
+Biquad
+Biquad::lowpass(double fc, double fs, double Q)
+{
+    double w0 = 2 * M_PI * fc / fs;
+    double cw = std::cos(w0), alpha = std::sin(w0) / (2 * Q);
+    double a0 = 1 + alpha;
+    Biquad c;
+    c.b0 = (1 - cw) / 2 / a0;
+    c.b1 = (1 - cw) / a0;
+    c.b2 = c.b0;
+    c.a1 = -2 * cw / a0;
+    c.a2 = (1 - alpha) / a0;
+    return c;
+}
+
+Biquad
+Biquad::highpass(double fc, double fs, double Q)
+{
+    double w0 = 2 * M_PI * fc / fs;
+    double cw = std::cos(w0), alpha = std::sin(w0) / (2 * Q);
+    double a0 = 1 + alpha;
+    Biquad c;
+    c.b0 = (1 + cw) / 2 / a0;
+    c.b1 = -(1 + cw) / a0;
+    c.b2 = c.b0;
+    c.a1 = -2 * cw / a0;
+    c.a2 = (1 - alpha) / a0;
+    return c;
+}
+
+Biquad
+Biquad::notch(double f0, double fs, double Q)
+{
+    double w0 = 2 * M_PI * f0 / fs;
+    double cw = std::cos(w0), alpha = std::sin(w0) / (2 * Q);
+    double a0 = 1 + alpha;
+    Biquad c;
+    c.b0 = 1 / a0;
+    c.b1 = -2 * cw / a0;
+    c.b2 = c.b0;
+    c.a1 = c.b1;
+    c.a2 = (1 - alpha) / a0;
+    return c;
+}
+
+Biquad
+Biquad::lowpass1(double fc, double fs)
+{
+    double K = std::tan(M_PI * fc / fs);
+    Biquad c;
+    c.b0 = K / (K + 1);
+    c.b1 = c.b0;
+    c.a1 = (K - 1) / (K + 1);
+    return c;
+}
+
+Biquad
+Biquad::highpass1(double fc, double fs)
+{
+    double K = std::tan(M_PI * fc / fs);
+    Biquad c;
+    c.b0 = 1 / (K + 1);
+    c.b1 = -c.b0;
+    c.a1 = (K - 1) / (K + 1);
+    return c;
+}
+
+/**
+ * @brief Q of the k-th conjugate pole pair of a Butterworth filter: the
+ * poles are at pi (2k + 1) / 2n from the real axis for an even order, and at
+ * pi (k + 1) / n for an odd order (the real pole being the first order
+ * section).
+ */
+static double
+butter_q(int order, int k)
+{
+    double angle = (order % 2) ? M_PI * (k + 1) / order
+                               : M_PI * (2 * k + 1) / (2 * order);
+    return 1 / (2 * std::cos(angle));
+}
+
+std::vector<Biquad>
+Biquad::butter_lowpass(int order, double fc, double fs)
+{
+    std::vector<Biquad> sos;
+    for(int k = 0; k < order / 2; k++)
+        sos.push_back(lowpass(fc, fs, butter_q(order, k)));
+    if(order % 2)
+        sos.push_back(lowpass1(fc, fs));
+    return sos;
+}
+
+std::vector<Biquad>
+Biquad::butter_highpass(int order, double fc, double fs)
+{
+    std::vector<Biquad> sos;
+    for(int k = 0; k < order / 2; k++)
+        sos.push_back(highpass(fc, fs, butter_q(order, k)));
+    if(order % 2)
+        sos.push_back(highpass1(fc, fs));
+    return sos;
+}
+
+void
+FilterBank::add(const Biquad &stage)
+{
+    m_stages.push_back(stage);
+    m_z1.resize(m_stages.size() * m_channels, 0);
+    m_z2.resize(m_stages.size() * m_channels, 0);
+}
+
+void
+FilterBank::add_bandpass(double low, double high, int order)
+{
+    add_highpass(low, order);
+    add_lowpass(high, order);
+}
+
+void
+FilterBank::add_highpass(double fc, int order)
+{
+    for(const Biquad &s : Biquad::butter_highpass(order, fc, m_fs)) add(s);
+}
+
+void
+FilterBank::add_lowpass(double fc, int order)
+{
+    for(const Biquad &s : Biquad::butter_lowpass(order, fc, m_fs)) add(s);
+}
+
+void
+FilterBank::add_notch(double f0, int harmonics, double Q)
+{
+    for(int h = 1; h <= harmonics && h * f0 < m_fs / 2; h++)
+        add(Biquad::notch(h * f0, m_fs, Q));
+}
+
+} // namespace ClvHd
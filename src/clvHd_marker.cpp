@@ -0,0 +1,100 @@
+#include "clvHd_marker.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace ClvHd
+{
+
+Markers::Markers(const std::atomic<double> *offset, size_t capacity)
+    : m_offset(offset)
+{
+    size_t n = next_pow2(std::max<size_t>(capacity, 2));
+    m_cells.reset(new Cell[n]);
+    m_mask = n - 1;
+    for(size_t i = 0; i < n; i++)
+        m_cells[i].sequence.store(0, std::memory_order_relaxed);
+}
+
+bool
+Markers::mark_at(double host, const std::string &label, int code)
+{
+    // Claim the next position, the cell of the oldest marker is reused
+    size_t pos = m_enqueue.fetch_add(1, std::memory_order_relaxed);
+    Cell *cell = &m_cells[pos & m_mask];
+    cell->sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    Marker &m = cell->marker;
+    m.host = host;
+    m.timestamp = to_stream(host);
+    m.code = code;
+    size_t len = std::min(label.size(), sizeof(m.label) - 1);
+    std::memcpy(m.label, label.data(), len);
+    m.label[len] = '\0';
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+MarkerCursor
+Markers::cursor() const
+{
+    MarkerCursor cursor;
+    size_t head = m_enqueue.load(std::memory_order_acquire);
+    cursor.next = (head > m_mask + 1) ? head - m_mask - 1 : 0;
+    return cursor;
+}
+
+bool
+Markers::pop(MarkerCursor &cursor, Marker &marker) const
+{
+    if(cursor.has_pending)
+    {
+        marker = cursor.pending;
+        cursor.has_pending = false;
+        return true;
+    }
+    while(true)
+    {
+        size_t head = m_enqueue.load(std::memory_order_acquire);
+        if(cursor.next == head)
+            return false;
+        if(head - cursor.next > m_mask + 1)
+        {
+            // Overwritten before being read: skip to the oldest marker kept
+            cursor.lost += head - m_mask - 1 - cursor.next;
+            cursor.next = head - m_mask - 1;
+        }
+        const Cell *cell = &m_cells[cursor.next & m_mask];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        if(seq == cursor.next + 1)
+        {
+            marker = cell->marker;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(cell->sequence.load(std::memory_order_relaxed) == seq)
+            {
+                cursor.next++;
+                return true;
+            }
+        }
+        else if(seq < cursor.next + 1 &&
+                m_enqueue.load(std::memory_order_acquire) - cursor.next <=
+                    m_mask + 1)
+            return false; // The producer is still writing it
+        // Overwritten meanwhile: the next turn skips it
+    }
+}
+
+bool
+Markers::pop_until(MarkerCursor &cursor, double timestamp,
+                   Marker &marker) const
+{
+    if(!cursor.has_pending)
+        cursor.has_pending = pop(cursor, cursor.pending);
+    if(!cursor.has_pending || cursor.pending.timestamp > timestamp)
+        return false;
+    marker = cursor.pending;
+    cursor.has_pending = false;
+    return true;
+}
+
+} // namespace ClvHd
@@ -1,5 +1,6 @@
 #include "clvHd_module.hpp"
 #include "clvHd_controller.hpp"
+#include "clvHd_device.hpp"
 
 namespace ClvHd
 {
@@ -10,4 +11,15 @@ Module::setRGB(RGBColor &color)
     m_controller->setRGB(id, color);
 };
 
+ModulePack::ModulePack(Device *device, int verbose)
+    : ESC::CLI(verbose, "ModulePack"), m_device(device)
+{
+    m_device->attachPack(this);
+}
+
+ModulePack::~ModulePack()
+{
+    m_device->detachPack(this);
+}
+
 } // namespace ClvHd
\ No newline at end of file
@@ -37,6 +37,7 @@ EMG_ADS1293::EMG_ADS1293(Controller *controller, int id, int verbose)
 
     m_fast_adc_max = 0x8000;
     for(int i = 0; i < 3; i++) { m_precise_adc_max[i] = 0x800000; }
+    update_conv();
 
     m_fast_value[0] = 0;
 
@@ -55,7 +56,8 @@ EMG_ADS1293::setup(int route_table[3][2],
                    int R1[3],
                    int R2,
                    int R3[3],
-                   bool clock_intern)
+                   bool clock_intern,
+                   bool clock_output)
 {
     CLK_SRC clk_src = (clock_intern)
                           ? INTERN
@@ -79,7 +81,7 @@ EMG_ADS1293::setup(int route_table[3][2],
     this->set_filters(R1, R2, R3);
 
     // logln("Seting n=" + std::to_string(n), true);
-    this->config_clock(true, clk_src, false);
+    this->config_clock(true, clk_src, clock_output);
 
     bool ret = is_clock_ext();
     std::string clk_src_s = std::string(ret ? "extern" : "intern");
@@ -196,6 +198,25 @@ EMG_ADS1293::set_mode(Mode mode)
     return this->writeReg(CONFIG_REG, mode);
 }
 
+int
+EMG_ADS1293::set_mode(Controller *controller,
+                      const std::vector<EMG_ADS1293 *> &modules,
+                      Mode mode)
+{
+    uint32_t mask = 0;
+    for(EMG_ADS1293 *emg : modules)
+    {
+        emg->m_mode = mode;
+        emg->m_regs[CONFIG_REG] = mode;
+        mask |= ((uint32_t)1) << emg->id;
+    }
+    if(mask == 0)
+        return 0;
+    uint8_t cmd = CONFIG_REG;
+    uint8_t val = mode;
+    return controller->writeCmd_multi(mask, 1, &cmd, 1, &val);
+}
+
 EMG_ADS1293::Mode
 EMG_ADS1293::get_mode()
 {
@@ -240,6 +261,15 @@ EMG_ADS1293::is_clock_output_enabled()
     return (val & 0b1);
 }
 
+int
+EMG_ADS1293::config_sync(bool output)
+{
+    // Reset value 0x40, SYNCB output enabled by bit 0
+    uint8_t val = 0x40 | (output ? 0x1 : 0x0);
+    m_regs[SYNCB_CN_REG] = val;
+    return this->writeReg(SYNCB_CN_REG, val);
+}
+
 int
 EMG_ADS1293::enable_ADC(bool ch0, bool ch1, bool ch2)
 {
@@ -338,11 +368,18 @@ EMG_ADS1293::is_high_freq_enabled(int ch)
 void
 EMG_ADS1293::get_filters(int R1[3], int *R2, int R3[3])
 {
-    this->readReg(R1_RATE_REG, 1, &m_regs[R1_RATE_REG]);
+    // R2_RATE, R3_RATE_CH0..2 and R1_RATE are contiguous
+    this->readReg(R2_RATE_REG, R1_RATE_REG - R2_RATE_REG + 1,
+                  &m_regs[R2_RATE_REG]);
+    decode_filters(R1, R2, R3);
+}
+
+void
+EMG_ADS1293::decode_filters(int R1[3], int *R2, int R3[3])
+{
     for(int i = 0; i < 3; i++)
     {
         R1[i] = ((m_regs[R1_RATE_REG] >> i) & 0b1) ? 2 : 4;
-        this->readReg(R3_RATE_CH0_REG + i, 1, &m_regs[R3_RATE_CH0_REG + i]);
         switch(m_regs[R3_RATE_CH0_REG + i])
         {
         case 0b00000001:
@@ -374,7 +411,6 @@ EMG_ADS1293::get_filters(int R1[3], int *R2, int R3[3])
             break;
         }
     }
-    this->readReg(R2_RATE_REG, 1, &m_regs[R2_RATE_REG]);
     switch(m_regs[R2_RATE_REG] & 0b1111)
     {
     case 0b0001:
@@ -396,10 +432,13 @@ EMG_ADS1293::get_filters(int R1[3], int *R2, int R3[3])
 }
 
 void
-EMG_ADS1293::update_adc_max()
+EMG_ADS1293::update_adc_max(bool pull)
 {
     int R1[3], R2, R3[3];
-    get_filters(R1, &R2, R3);
+    if(pull)
+        get_filters(R1, &R2, R3);
+    else
+        decode_filters(R1, &R2, R3);
 
     for(int i = 0; i < 3; i++)
     {
@@ -431,6 +470,22 @@ EMG_ADS1293::update_adc_max()
             break;
         }
     }
+    update_conv();
+}
+
+void
+EMG_ADS1293::update_conv()
+{
+    // (code / adc_max - 0.5) * 4.8 / 3.5, minus the offset, over the gain
+    const double k = 4.8 / 3.5;
+    const Calibration &c = m_calibration;
+    for(int i = 0; i < 3; i++)
+    {
+        m_fast_scale[i] = k / (m_fast_adc_max * c.fast_gain[i]);
+        m_fast_bias[i] = (-0.5 * k - c.fast_offset[i]) / c.fast_gain[i];
+        m_precise_scale[i] = k / (m_precise_adc_max[i] * c.gain[i]);
+        m_precise_bias[i] = (-0.5 * k - c.offset[i]) / c.gain[i];
+    }
 }
 
 void
@@ -502,6 +557,38 @@ EMG_ADS1293::set_filters(int R1[3], int R2, int R3[3])
     update_adc_max();
 }
 
+double
+EMG_ADS1293::odr(bool precise, int ch)
+{
+    int R1[3], R2, R3[3];
+    decode_filters(R1, &R2, R3);
+    if(!m_adc_enabled[ch] || R2 == 0 || (precise && R3[ch] == 0))
+        return 0;
+    // 102.4kHz modulator clock, doubled in high frequency mode
+    double fs = ((m_regs[AFE_RES_REG] >> (3 + ch)) & 0b1) ? 204800. : 102400.;
+    return fs / (R1[ch] * R2 * (precise ? R3[ch] : 1));
+}
+
+void
+EMG_ADS1293::load_regs(const uint8_t *regs, size_t n)
+{
+    std::copy(regs, regs + std::min(n, sizeof(m_regs)), m_regs);
+    m_mode = (Mode)m_regs[CONFIG_REG];
+    for(int i = 0; i < 3; i++)
+        m_adc_enabled[i] = !(m_regs[AFE_SHDN_CN_REG] & (0b001001 << i));
+    update_adc_max(false);
+}
+
+bool
+EMG_ADS1293::is_config_reg(uint8_t reg)
+{
+    // The operating mode, the error status, the data and the reserved
+    // registers are not part of the configuration.
+    return (reg >= FLEX_CH0_CN_REG && reg <= AFE_PACE_CN_REG && reg != 0x16) ||
+           (reg >= DIGO_STRENGTH_REG && reg <= MASK_ERR_REG && reg != 0x20) ||
+           reg == ALARM_FILTER_REG || reg == CH_CNFG_REG;
+}
+
 double
 EMG_ADS1293::precise_value(int ch, bool converted)
 {
@@ -519,7 +606,7 @@ EMG_ADS1293::fast_value(int ch, bool converted)
     if(!m_adc_enabled[ch])
         return 0;
     if(converted)
-        return conv(m_fast_value[ch]);
+        return conv_fast(ch, m_fast_value[ch]);
     else
         return m_fast_value[ch];
 };
@@ -532,7 +619,7 @@ EMG_ADS1293::read_fast_value(int ch, bool converted)
     this->readReg(DATA_CH0_PACE_REG + 2 * ch, 2,
                   (uint8_t *)&(m_fast_value[ch]));
     if(converted)
-        return conv(m_fast_value[ch]);
+        return conv_fast(ch, m_fast_value[ch]);
     else
         return m_fast_value[ch];
 }
@@ -582,11 +669,18 @@ EMG_ADS1293::conv(int ch, int32_t val)
     //m_regs[DATA_CH0_ECG_REG+3] =0x01;
     //std::cout << "32conv " << std::hex << (__builtin_bswap32(val) >> 8) << " "
     //           << m_precise_adc_max[ch] << std::dec << std::endl;
-    return ((__builtin_bswap32(val) >> 8) * 1. / m_precise_adc_max[ch] - 0.5) *
-           4.8 / 3.5;
+    return std::fma((double)(__builtin_bswap32(val) >> 8), m_precise_scale[ch],
+                    m_precise_bias[ch]);
     // return (((__builtin_bswap32(val) >> 8) * 1. / m_precise_adc_max[ch] - 0.5) * 3.246+1)*2.4;
 }
 
+double
+EMG_ADS1293::conv_fast(int ch, uint16_t val)
+{
+    return std::fma((double)__builtin_bswap16(val), m_fast_scale[ch],
+                    m_fast_bias[ch]);
+}
+
 int
 EMG_ADS1293::get_error()
 {
@@ -594,6 +688,25 @@ EMG_ADS1293::get_error()
     //return (Error *)&(m_regs[ERROR_LOD_REG]);
 }
 
+uint8_t
+EMG_ADS1293::channel_errors(int ch) const
+{
+    uint8_t flags = 0;
+    uint8_t route = m_regs[FLEX_CH0_CN_REG + ch];
+    int pos = route & 0b111, neg = (route >> 3) & 0b111;
+    uint8_t lod = m_regs[ERROR_LOD_REG];
+    if((pos > 0 && ((lod >> (pos - 1)) & 1)) ||
+       (neg > 0 && ((lod >> (neg - 1)) & 1)))
+        flags |= LEAD_OFF;
+    if(m_regs[ERROR_RANGE1_REG + ch] ||
+       ((m_regs[ERROR_STATUS_REG] >> (4 + ch)) & 1))
+        flags |= OUT_OF_RANGE;
+    // Common mode, right leg drive, low battery and synchronization errors
+    if(m_regs[ERROR_STATUS_REG] & 0b10000111)
+        flags |= MODULE_ERROR;
+    return flags;
+}
+
 std::string
 EMG_ADS1293::error_range_str()
 {
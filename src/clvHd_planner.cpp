@@ -0,0 +1,128 @@
+#include "clvHd_planner.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+namespace ClvHd
+{
+
+std::string
+RatePlan::str() const
+{
+    std::string s = feasible ? "Feasible plan: " : "Infeasible plan: ";
+    s += "target " + std::to_string(target_rate) + "Hz, ODR " +
+         std::to_string(odr) + "Hz (fast " + std::to_string(odr_fast) +
+         "Hz, precise " + std::to_string(odr_precise) + "Hz), link " +
+         std::to_string(capacity) + " reads/s, load " +
+         std::to_string((int)(100 * load)) + "%, max " +
+         std::to_string(max_rate) + "Hz";
+    if(!reason.empty())
+        s += " | " + reason;
+    return s;
+}
+
+double
+RatePlanner::measure_rtt(Controller *controller, int n)
+{
+    using clk = std::chrono::steady_clock;
+    std::vector<double> rtt;
+    for(int i = 0; i < n; i++)
+    {
+        clk::time_point t0 = clk::now();
+        if(controller->getVersion().empty())
+            return -1;
+        rtt.push_back(std::chrono::duration<double>(clk::now() - t0).count());
+    }
+    if(rtt.empty())
+        return -1;
+    std::nth_element(rtt.begin(), rtt.begin() + rtt.size() / 2, rtt.end());
+    return rtt[rtt.size() / 2];
+}
+
+RatePlan
+RatePlanner::plan(double target_rate,
+                  bool precise,
+                  const bool chx_enable[3],
+                  int nb_modules,
+                  const LinkModel &link,
+                  const EMG_ADS1293Config &base)
+{
+    static const int R1s[2] = {2, 4};
+    static const int R2s[4] = {4, 5, 6, 8};
+    static const int R3s[8] = {4, 6, 8, 12, 16, 32, 64, 128};
+
+    RatePlan plan;
+    plan.target_rate = target_rate;
+    plan.config = base;
+    plan.config.enable(chx_enable[0], chx_enable[1], chx_enable[2]);
+    plan.capacity = link.capacity(nb_modules);
+
+    int first_ch = -1;
+    for(int ch = 2; ch >= 0; ch--)
+        if(chx_enable[ch])
+            first_ch = ch;
+    if(first_ch < 0 || nb_modules <= 0)
+    {
+        plan.reason = "no channel or module to read";
+        return plan;
+    }
+    // E1_DRDY..E3_DRDY are bits 5 to 7, P1_DRDY..P3_DRDY bits 2 to 4
+    plan.status_bit = (precise ? 5 : 2) + first_ch;
+
+    // Every sample needs one read of all the modules
+    double usable = plan.capacity * link.margin;
+    bool found = false;
+    double best_odr = 0;
+    for(bool high_freq : {false, true})
+        for(int R1 : R1s)
+            for(int R2 : R2s)
+                for(int k = precise ? 0 : 7; k < 8; k++) // R3 only if precise
+                {
+                    int R3 = R3s[k];
+                    double odr = precise ? odr_precise(high_freq, R1, R2, R3)
+                                         : odr_fast(high_freq, R1, R2);
+                    if(odr <= usable)
+                        plan.max_rate = std::max(plan.max_rate, odr);
+                    if(odr < target_rate || odr > usable)
+                        continue;
+                    // Slowest rate reaching the target, then the lowest
+                    // modulator frequency (lower power)
+                    if(found && odr >= best_odr)
+                        continue;
+                    found = true;
+                    best_odr = odr;
+                    for(int ch = 0; ch < 3; ch++)
+                    {
+                        plan.config.set_high_freq(ch, high_freq);
+                        plan.config.set_R1(ch, R1);
+                        plan.config.set_R3(ch, precise ? R3 : base.R3[ch]);
+                    }
+                    plan.config.set_R2(R2);
+                }
+
+    if(!found)
+    {
+        if(plan.max_rate >= target_rate)
+            plan.reason = "no decimation setting reaches the target";
+        else if(plan.max_rate > 0)
+            plan.reason = "the link sustains at most " +
+                          std::to_string(plan.max_rate) + "Hz with " +
+                          std::to_string(nb_modules) + " modules";
+        else
+            plan.reason = "the link is too slow for the slowest decimation";
+        return plan;
+    }
+
+    plan.feasible = true;
+    plan.odr_fast = odr_fast(plan.config.chx_high_freq[first_ch],
+                             plan.config.R1[first_ch], plan.config.R2);
+    plan.odr_precise = odr_precise(plan.config.chx_high_freq[first_ch],
+                                   plan.config.R1[first_ch], plan.config.R2,
+                                   plan.config.R3[first_ch]);
+    plan.odr = precise ? plan.odr_precise : plan.odr_fast;
+    plan.load = plan.odr / plan.capacity;
+    return plan;
+}
+
+} // namespace ClvHd
@@ -0,0 +1,209 @@
+#include "clvHd_quality.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace ClvHd
+{
+
+void
+SignalQuality::configure(int nb_channels,
+                         double fs,
+                         double line_hz,
+                         double period_s,
+                         size_t capacity)
+{
+    m_channels = std::max(nb_channels, 0);
+    m_fs = fs > 0 ? fs : 1;
+    m_line_hz = line_hz;
+
+    // Whole number of line cycles per period, so the DC and the other
+    // harmonics do not leak into the line bins
+    double cycles = std::max(1., std::round(period_s * line_hz));
+    m_period = std::max(1, (int)std::lround(cycles * m_fs / line_hz));
+    m_nb_harmonics = 0;
+    for(int h = 1; h <= s_harmonics && h * line_hz < m_fs / 2; h++)
+    {
+        double w = 2 * M_PI * h * line_hz / m_fs;
+        m_step_re[h - 1] = std::cos(w);
+        m_step_im[h - 1] = -std::sin(w);
+        m_nb_harmonics = h;
+    }
+
+    const double inf = std::numeric_limits<double>::infinity();
+    m_low.assign(m_channels, -inf);
+    m_high.assign(m_channels, inf);
+    m_last.assign(m_channels, 0);
+    output.resize(size(), capacity);
+    reset();
+}
+
+void
+SignalQuality::set_rails(const std::vector<double> &low,
+                         const std::vector<double> &high,
+                         double margin)
+{
+    for(int ch = 0; ch < m_channels; ch++)
+    {
+        if((size_t)ch >= low.size() || (size_t)ch >= high.size())
+            break;
+        double m = margin * (high[ch] - low[ch]);
+        m_low[ch] = low[ch] + m;
+        m_high[ch] = high[ch] - m;
+    }
+}
+
+void
+SignalQuality::reset()
+{
+    m_count = 0;
+    for(int h = 0; h < s_harmonics; h++)
+    {
+        m_ph_re[h] = 1;
+        m_ph_im[h] = 0;
+        m_w_re[h] = 0;
+        m_w_im[h] = 0;
+    }
+    m_re.assign((size_t)s_harmonics * m_channels, 0);
+    m_im.assign((size_t)s_harmonics * m_channels, 0);
+    m_sum.assign(m_channels, 0);
+    m_sum2.assign(m_channels, 0);
+    m_ref.assign(m_channels, 0);
+    m_saturated.assign(m_channels, 0);
+    m_new.assign(m_channels, 0);
+    m_flags.assign(m_channels, 0);
+    m_frame.resize(size());
+}
+
+std::string
+SignalQuality::index_name(int index)
+{
+    static const char *names[NB_INDICES] = {"LINE_RATIO", "SATURATION",
+                                            "FLATLINE", "ERRORS"};
+    return (index >= 0 && index < NB_INDICES) ? names[index] : "";
+}
+
+int
+SignalQuality::process(const double *timestamps,
+                       const double *frames,
+                       size_t n_frames)
+{
+    size_t nch = m_channels;
+    int emitted = 0;
+    for(size_t f = 0; f < n_frames; f++)
+    {
+        const double *in = frames + f * nch;
+        double *last = m_last.data();
+        double *ref = m_ref.data();
+        double *sum = m_sum.data();
+        double *sum2 = m_sum2.data();
+        double *sat = m_saturated.data();
+        double *fresh = m_new.data();
+        for(size_t ch = 0; ch < nch; ch++)
+        {
+            double v = in[ch];
+            bool valid = (v == v);
+            if(valid)
+                last[ch] = v;
+            fresh[ch] += valid;
+            sat[ch] += (last[ch] <= m_low[ch] || last[ch] >= m_high[ch]);
+        }
+        if(m_count == 0)
+            std::copy(last, last + nch, ref);
+
+        // Shifted by the first value of the period against cancellation
+        for(size_t ch = 0; ch < nch; ch++)
+        {
+            double x = last[ch] - ref[ch];
+            sum[ch] += x;
+            sum2[ch] += x * x;
+        }
+        for(int h = 0; h < m_nb_harmonics; h++)
+        {
+            double cr = m_ph_re[h], ci = m_ph_im[h];
+            double *__restrict re = m_re.data() + h * nch;
+            double *__restrict im = m_im.data() + h * nch;
+            for(size_t ch = 0; ch < nch; ch++)
+            {
+                double x = last[ch] - ref[ch];
+                re[ch] += x * cr;
+                im[ch] += x * ci;
+            }
+            m_w_re[h] += cr;
+            m_w_im[h] += ci;
+            m_ph_re[h] = cr * m_step_re[h] - ci * m_step_im[h];
+            m_ph_im[h] = cr * m_step_im[h] + ci * m_step_re[h];
+        }
+
+        if(++m_count >= m_period)
+        {
+            emit(timestamps[f]);
+            emitted++;
+        }
+    }
+    return emitted;
+}
+
+void
+SignalQuality::emit(double timestamp)
+{
+    size_t nch = m_channels;
+    double n = m_count;
+    double *line = m_frame.data() + LINE_RATIO * nch;
+    double *saturation = m_frame.data() + SATURATION * nch;
+    double *flat = m_frame.data() + FLATLINE * nch;
+    double *errors = m_frame.data() + ERRORS * nch;
+    for(size_t ch = 0; ch < nch; ch++)
+    {
+        double mean = m_sum[ch] / n;
+        double energy = m_sum2[ch] - m_sum[ch] * mean;
+        // DFT of x - mean: X(x) - mean * X(1)
+        double p = 0;
+        for(int h = 0; h < m_nb_harmonics; h++)
+        {
+            double re = m_re[h * nch + ch] - mean * m_w_re[h];
+            double im = m_im[h * nch + ch] - mean * m_w_im[h];
+            p += re * re + im * im;
+        }
+        // A sinusoid of amplitude A has |X|^2 = (A n / 2)^2 and an energy
+        // n A^2 / 2, hence the ratio 2 |X|^2 / (n energy)
+        line[ch] = (energy > 0) ? std::min(1., 2 * p / (n * energy)) : 0;
+        saturation[ch] = m_saturated[ch] / n;
+        flat[ch] = (m_new[ch] == 0 ||
+                    energy <= n * m_flat_threshold * m_flat_threshold)
+                       ? 1
+                       : 0;
+        errors[ch] = m_flags[ch];
+    }
+    output.push(timestamp, m_frame.data());
+    reset();
+}
+
+int
+SignalQuality::process(SampleRing &ring)
+{
+    return m_block.drain(ring, m_channels,
+                         [this](const double *ts, const double *frames,
+                                size_t n) { return process(ts, frames, n); });
+}
+
+int
+SignalQuality::process_errors(Ring<ErrorReport> &errors)
+{
+    int n = 0;
+    ErrorReport report;
+    while(errors.pop(report))
+    {
+        for(int ch = 0; ch < 3; ch++)
+        {
+            int k = 3 * report.module + ch;
+            if(k >= 0 && k < m_channels)
+                m_flags[k] = (uint8_t)m_flags[k] | report.flags[ch];
+        }
+        n++;
+    }
+    return n;
+}
+
+} // namespace ClvHd
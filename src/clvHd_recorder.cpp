@@ -0,0 +1,112 @@
+#include "clvHd_recorder.hpp"
+
+#include <stdio.h> // snprintf
+
+namespace ClvHd
+{
+
+int
+Recorder::open(const std::string &path,
+               int nb_channels,
+               const std::vector<std::string> &names)
+{
+    close();
+    m_file.open(path, std::ios::trunc);
+    if(!m_file.is_open())
+    {
+        logln("Could not open " + path, true);
+        return -1;
+    }
+    m_channels = nb_channels;
+    m_frames = 0;
+    if(!names.empty())
+    {
+        m_file << "# timestamp";
+        for(const std::string &n : names) m_file << ", " << n;
+        m_file << "\n";
+    }
+    logln("Recording to " + path, true);
+    return 0;
+}
+
+void
+Recorder::write(const double *timestamps, const double *values, size_t n_frames)
+{
+    if(!m_file.is_open())
+        return;
+    char buf[32];
+    for(size_t f = 0; f < n_frames; f++)
+    {
+        snprintf(buf, sizeof(buf), "%.6f", timestamps[f]);
+        m_file << buf;
+        for(int ch = 0; ch < m_channels; ch++)
+        {
+            snprintf(buf, sizeof(buf), ", %.9g", values[f * m_channels + ch]);
+            m_file << buf;
+        }
+        m_file << "\n";
+    }
+    m_frames += n_frames;
+}
+
+size_t
+Recorder::record(SampleRing &ring)
+{
+    if(ring.channels() != (size_t)m_channels)
+    {
+        logln("The ring does not have " + std::to_string(m_channels) +
+                  " channels",
+              true);
+        return 0;
+    }
+    return m_block.drain(ring, m_channels,
+                         [this](const double *ts, const double *frames,
+                                size_t n)
+                         {
+                             write(ts, frames, n);
+                             return (int)n;
+                         });
+}
+
+size_t
+Recorder::record(SampleRing &ring, Markers &markers)
+{
+    if(ring.channels() != (size_t)m_channels)
+    {
+        logln("The ring does not have " + std::to_string(m_channels) +
+                  " channels",
+              true);
+        return 0;
+    }
+    if(m_markers != &markers)
+    {
+        m_markers = &markers;
+        m_cursor = markers.cursor();
+    }
+    Marker marker;
+    return m_block.drain(ring, m_channels,
+                         [&](const double *ts, const double *frames, size_t n)
+                         {
+                             for(size_t f = 0; f < n; f++)
+                             {
+                                 while(markers.pop_until(m_cursor, ts[f],
+                                                         marker))
+                                     write_marker(marker);
+                                 write(ts + f, frames + f * m_channels, 1);
+                             }
+                             return (int)n;
+                         });
+}
+
+void
+Recorder::write_marker(const Marker &marker)
+{
+    if(!m_file.is_open())
+        return;
+    char buf[48];
+    snprintf(buf, sizeof(buf), "# marker, %.6f, %d, ", marker.timestamp,
+             marker.code);
+    m_file << buf << marker.label << "\n";
+}
+
+} // namespace ClvHd
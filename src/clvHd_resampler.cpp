@@ -0,0 +1,183 @@
+#include "clvHd_resampler.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ClvHd
+{
+
+namespace
+{
+/**
+ * @brief Best rational approximation num/den of x with num, den <= max
+ * (continued fractions).
+ */
+void
+rational(double x, int max, int &num, int &den)
+{
+    long p0 = 0, q0 = 1, p1 = 1, q1 = 0;
+    double r = x;
+    for(int i = 0; i < 32; i++)
+    {
+        long a = (long)std::floor(r);
+        long p2 = a * p1 + p0, q2 = a * q1 + q0;
+        if(p2 > max || q2 > max)
+            break;
+        p0 = p1, q0 = q1, p1 = p2, q1 = q2;
+        if(r - a < 1e-9)
+            break;
+        r = 1 / (r - a);
+    }
+    num = (int)std::max(p1, 1L);
+    den = (int)std::max(q1, 1L);
+}
+} // namespace
+
+void
+Resampler::configure(int nb_channels,
+                     double fs_in,
+                     double fs_out,
+                     int zeros,
+                     size_t capacity)
+{
+    m_channels = std::max(nb_channels, 0);
+    m_fs_in = fs_in;
+    rational(fs_out / fs_in, 512, m_L, m_M);
+
+    // Prototype low-pass at the upsampled rate L x fs_in, cut below the
+    // lowest of the two Nyquist frequencies
+    double ratio = std::max(1., (double)m_M / m_L);
+    m_taps = (int)std::ceil(2 * zeros * ratio);
+    int N = m_L * m_taps;
+    double fc = 0.45 / ratio / m_L; // cycles per upsampled sample
+    double center = (N - 1) / 2.;
+    std::vector<double> h(N);
+    for(int i = 0; i < N; i++)
+    {
+        double t = i - center;
+        double sinc =
+            (t == 0) ? 2 * fc : std::sin(2 * M_PI * fc * t) / (M_PI * t);
+        double w = 0.42 - 0.5 * std::cos(2 * M_PI * i / (N - 1 + (N == 1))) +
+                   0.08 * std::cos(4 * M_PI * i / (N - 1 + (N == 1)));
+        h[i] = sinc * w;
+    }
+
+    // Phase p uses h[p + j L] on x[n - j]: stored oldest sample first and
+    // normalised to a unit gain at DC
+    m_poly.assign((size_t)m_L * m_taps, 0);
+    for(int p = 0; p < m_L; p++)
+    {
+        double sum = 0;
+        for(int j = 0; j < m_taps; j++) sum += h[p + j * m_L];
+        for(int j = 0; j < m_taps; j++)
+            m_poly[p * m_taps + (m_taps - 1 - j)] =
+                (sum != 0) ? h[p + j * m_L] / sum : 0;
+    }
+    m_delay = center / (m_L * fs_in);
+
+    output.resize(m_channels, capacity);
+    reset();
+}
+
+void
+Resampler::reset()
+{
+    m_hist.assign(2 * (size_t)m_taps * m_channels, 0);
+    m_last.assign(m_channels, 0);
+    m_pos = 0;
+    m_phase = 0;
+    m_n = 0;
+    m_started = false;
+    m_t0 = 0;
+    m_offset = 0;
+}
+
+int
+Resampler::push_input(const double *frame)
+{
+    int pushed = 0;
+    size_t nch = m_channels;
+    std::copy(frame, frame + nch, m_hist.begin() + m_pos * nch);
+    std::copy(frame, frame + nch, m_hist.begin() + (m_pos + m_taps) * nch);
+    m_pos = (m_pos + 1) % m_taps;
+    const double *window = m_hist.data() + m_pos * nch; // oldest first
+
+    for(; m_phase < m_L; m_phase += m_M)
+    {
+        double *out = output.reserve();
+        if(out == nullptr)
+            continue;
+        const double *c = m_poly.data() + (size_t)m_phase * m_taps;
+        std::fill(out, out + nch, 0.);
+        for(int k = 0; k < m_taps; k++)
+        {
+            const double *x = window + k * nch;
+            double ck = c[k];
+            for(size_t ch = 0; ch < nch; ch++) out[ch] += ck * x[ch];
+        }
+        output.commit(m_t0 + m_offset +
+                      ((double)m_n * m_L + m_phase) / (m_L * m_fs_in) -
+                      m_delay);
+        pushed++;
+    }
+    m_phase -= m_L;
+    m_n++;
+    return pushed;
+}
+
+int
+Resampler::process(const double *timestamps,
+                   const double *frames,
+                   size_t n_frames)
+{
+    size_t nch = m_channels;
+    int pushed = 0;
+    for(size_t f = 0; f < n_frames; f++)
+    {
+        if(m_started)
+        {
+            // Samples missed by the polling: hold the previous values
+            double late =
+                (timestamps[f] - (m_t0 + m_offset + m_n / m_fs_in)) * m_fs_in;
+            if(late > 1.5)
+            {
+                int missed = (int)(late - 0.5);
+                if(missed > 4 * m_taps) // long gap: restart the grid
+                    reset();
+                else
+                    for(int k = 0; k < missed; k++)
+                        pushed += push_input(m_last.data());
+            }
+        }
+
+        const double *in = frames + f * nch;
+        for(size_t ch = 0; ch < nch; ch++)
+            if(in[ch] == in[ch])
+                m_last[ch] = in[ch];
+
+        if(!m_started)
+        {
+            // Fill the history with the first frame to avoid the step of
+            // the offsets
+            m_started = true;
+            m_t0 = timestamps[f];
+            for(int k = 0; k < 2 * m_taps; k++)
+                std::copy(m_last.begin(), m_last.end(),
+                          m_hist.begin() + k * nch);
+        }
+        double err = timestamps[f] - (m_t0 + m_n / m_fs_in);
+        m_offset += 0.01 * (err - m_offset);
+        pushed += push_input(m_last.data());
+    }
+    return pushed;
+}
+
+int
+Resampler::process(SampleRing &ring)
+{
+    return m_block.drain(ring, m_channels,
+                         [this](const double *ts, const double *frames,
+                                size_t n) { return process(ts, frames, n); });
+}
+
+} // namespace ClvHd
@@ -0,0 +1,297 @@
+#include "clvHd_shm.hpp"
+
+#include <new>
+
+#include <errno.h>
+#include <fcntl.h>    // O_* constants
+#include <signal.h>   // kill
+#include <sys/mman.h> // shm_open, mmap
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // ftruncate, close, getpid
+
+namespace ClvHd
+{
+
+static size_t
+ring_bytes(size_t channels, size_t capacity)
+{
+    return sizeof(ShmHeader) + capacity * (1 + channels) * sizeof(double);
+}
+
+/**
+ * @brief True if a ring of this name can be replaced: none, invalid, closed,
+ * or left by a publisher that no longer runs (crashed).
+ */
+static bool
+replaceable(const std::string &name)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if(fd < 0)
+        return errno == ENOENT;
+    struct stat st;
+    void *addr = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ShmHeader))
+        addr = mmap(nullptr, sizeof(ShmHeader), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(addr == MAP_FAILED)
+        return true;
+    const ShmHeader *h = (const ShmHeader *)addr;
+    bool stale = h->magic != CLVHD_SHM_MAGIC ||
+                 h->closed.load(std::memory_order_acquire) != 0 ||
+                 (h->pid != 0 && kill(h->pid, 0) != 0 && errno == ESRCH);
+    munmap(addr, sizeof(ShmHeader));
+    return stale;
+}
+
+int
+ShmPublisher::open(const std::string &name,
+                   int nb_channels,
+                   size_t capacity,
+                   double rate)
+{
+    close();
+    capacity = next_pow2(capacity);
+    size_t size = ring_bytes(nb_channels, capacity);
+
+    // A stale ring is replaced (its readers keep it), a live one is kept
+    if(!replaceable(name))
+    {
+        logln(name + " is published by a running process", true);
+        return -1;
+    }
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(fd < 0)
+    {
+        logln("Could not create " + name, true);
+        return -1;
+    }
+    void *addr = MAP_FAILED;
+    if(ftruncate(fd, size) == 0)
+        addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(addr == MAP_FAILED)
+    {
+        shm_unlink(name.c_str());
+        logln("Could not map " + name, true);
+        return -1;
+    }
+
+    m_name = name;
+    m_size = size;
+    m_header = new(addr) ShmHeader();
+    m_header->version = CLVHD_SHM_VERSION;
+    m_header->channels = nb_channels;
+    m_header->capacity = capacity;
+    m_header->rate = rate;
+    m_header->pid = getpid();
+    m_timestamps = (double *)((uint8_t *)addr + sizeof(ShmHeader));
+    m_values = m_timestamps + capacity;
+    // The readers check the magic before anything else
+    std::atomic_thread_fence(std::memory_order_release);
+    m_header->magic = CLVHD_SHM_MAGIC;
+    logln("Publishing " + name + " (" + std::to_string(nb_channels) +
+              " channels, " + std::to_string(capacity) + " frames)",
+          true);
+    return 0;
+}
+
+void
+ShmPublisher::close()
+{
+    if(m_header == nullptr)
+        return;
+    m_header->closed.store(1, std::memory_order_release);
+    munmap(m_header, m_size);
+    shm_unlink(m_name.c_str());
+    m_header = nullptr;
+    m_timestamps = m_values = nullptr;
+}
+
+void
+ShmPublisher::write(const double *timestamps,
+                    const double *values,
+                    size_t n_frames)
+{
+    if(m_header == nullptr)
+        return;
+    const size_t cap = m_header->capacity, ch = m_header->channels;
+    uint64_t head = m_header->head.load(std::memory_order_relaxed);
+    for(size_t done = 0; done < n_frames;)
+    {
+        // Contiguous part up to the end of the storage
+        size_t idx = (head + done) & (cap - 1);
+        size_t len = std::min(n_frames - done, cap - idx);
+        m_header->writing.store(head + done + len, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(m_timestamps + idx, timestamps + done, len * sizeof(double));
+        std::memcpy(m_values + idx * ch, values + done * ch,
+                    len * ch * sizeof(double));
+        done += len;
+        m_header->head.store(head + done, std::memory_order_release);
+    }
+}
+
+size_t
+ShmPublisher::publish(SampleRing &ring)
+{
+    if(m_header == nullptr || ring.channels() != m_header->channels)
+        return 0;
+    const size_t cap = m_header->capacity, ch = m_header->channels;
+    size_t total = 0;
+    while(ring.size() > 0)
+    {
+        // Pop the frames directly into their slots
+        uint64_t head = m_header->head.load(std::memory_order_relaxed);
+        size_t idx = head & (cap - 1);
+        size_t len = std::min(ring.size(), cap - idx);
+        m_header->writing.store(head + len, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        len = ring.pop(m_timestamps + idx, m_values + idx * ch, len);
+        m_header->head.store(head + len, std::memory_order_release);
+        total += len;
+    }
+    return total;
+}
+
+int
+ShmReader::attach(const std::string &name)
+{
+    detach();
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if(fd < 0)
+    {
+        logln("No ring " + name, true);
+        return -1;
+    }
+    struct stat st;
+    void *addr = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ShmHeader))
+        addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(addr == MAP_FAILED)
+    {
+        logln("Could not map " + name, true);
+        return -1;
+    }
+    const ShmHeader *h = (const ShmHeader *)addr;
+    bool valid = (h->magic == CLVHD_SHM_MAGIC);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    valid = valid && h->version == CLVHD_SHM_VERSION &&
+            (size_t)st.st_size == ring_bytes(h->channels, h->capacity);
+    if(!valid)
+    {
+        munmap(addr, st.st_size);
+        logln("Ring " + name + " is not initialised", true);
+        return -1;
+    }
+    m_header = h;
+    m_size = st.st_size;
+    m_timestamps = (const double *)((const uint8_t *)addr + sizeof(ShmHeader));
+    m_values = m_timestamps + h->capacity;
+    m_cursor = h->head.load(std::memory_order_acquire);
+    m_lost = 0;
+    logln("Attached to " + name + " (" + std::to_string(h->channels) +
+              " channels)",
+          true);
+    return 0;
+}
+
+void
+ShmReader::detach()
+{
+    if(m_header == nullptr)
+        return;
+    munmap((void *)m_header, m_size);
+    m_header = nullptr;
+    m_timestamps = m_values = nullptr;
+}
+
+void
+ShmReader::catch_up()
+{
+    uint64_t writing = m_header->writing.load(std::memory_order_relaxed);
+    uint64_t first = (writing > m_header->capacity)
+                         ? writing - m_header->capacity
+                         : 0;
+    if(m_cursor < first)
+    {
+        m_lost += first - m_cursor;
+        m_cursor = first;
+    }
+}
+
+size_t
+ShmReader::peek(const double *&timestamps, const double *&values)
+{
+    if(m_header == nullptr)
+        return 0;
+    catch_up();
+    uint64_t head = m_header->head.load(std::memory_order_acquire);
+    if(head <= m_cursor)
+        return 0;
+    size_t idx = m_cursor & (m_header->capacity - 1);
+    size_t n = std::min((size_t)(head - m_cursor),
+                        (size_t)m_header->capacity - idx);
+    timestamps = m_timestamps + idx;
+    values = m_values + idx * m_header->channels;
+    return n;
+}
+
+size_t
+ShmReader::consume(size_t n)
+{
+    if(m_header == nullptr)
+        return 0;
+    // The frames below writing - capacity may have changed under the reader
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t writing = m_header->writing.load(std::memory_order_relaxed);
+    uint64_t first = (writing > m_header->capacity)
+                         ? writing - m_header->capacity
+                         : 0;
+    size_t valid = n;
+    if(m_cursor + n <= first)
+        valid = 0;
+    else if(m_cursor < first)
+        valid = m_cursor + n - first;
+    m_lost += n - valid;
+    m_cursor += n;
+    return valid;
+}
+
+size_t
+ShmReader::read(double *timestamps, double *values, size_t max_frames)
+{
+    const size_t ch = channels();
+    size_t done = 0;
+    while(done < max_frames)
+    {
+        const double *t, *v;
+        size_t n = std::min(peek(t, v), max_frames - done);
+        if(n == 0)
+            break;
+        std::memcpy(timestamps + done, t, n * sizeof(double));
+        std::memcpy(values + done * ch, v, n * ch * sizeof(double));
+        size_t valid = consume(n);
+        if(valid < n) // Keep the frames that were not overwritten
+        {
+            std::memmove(timestamps + done, timestamps + done + n - valid,
+                         valid * sizeof(double));
+            std::memmove(values + done * ch, values + (done + n - valid) * ch,
+                         valid * ch * sizeof(double));
+        }
+        done += valid;
+    }
+    return done;
+}
+
+size_t
+ShmReader::pending() const
+{
+    if(m_header == nullptr)
+        return 0;
+    uint64_t head = m_header->head.load(std::memory_order_acquire);
+    return std::min((size_t)(head - m_cursor), (size_t)m_header->capacity);
+}
+
+} // namespace ClvHd
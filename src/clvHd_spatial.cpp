@@ -0,0 +1,240 @@
+#include "clvHd_spatial.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace ClvHd
+{
+
+SpatialMatrix
+SpatialMatrix::dense(int rows, int cols, const double *values)
+{
+    SpatialMatrix m(rows, cols);
+    for(int r = 0; r < rows; r++)
+        for(int c = 0; c < cols; c++)
+            if(values[r * cols + c] != 0)
+                m.add(r, c, values[r * cols + c]);
+    m.finalize();
+    return m;
+}
+
+SpatialMatrix
+SpatialMatrix::bipolar(int cols, const std::vector<std::pair<int, int>> &pairs)
+{
+    SpatialMatrix m(pairs.size(), cols);
+    for(size_t r = 0; r < pairs.size(); r++)
+    {
+        m.add(r, pairs[r].first, 1);
+        m.add(r, pairs[r].second, -1);
+    }
+    m.finalize();
+    return m;
+}
+
+SpatialMatrix
+SpatialMatrix::differential(int cols,
+                            const std::vector<std::vector<int>> &grid,
+                            bool double_diff)
+{
+    auto at = [&](int i, int j) -> int
+    {
+        if(i < 0 || i >= (int)grid.size() || j < 0 || j >= (int)grid[i].size())
+            return -1;
+        return grid[i][j];
+    };
+    std::vector<Triplet> t;
+    int row = 0;
+    for(int i = 0; i < (int)grid.size(); i++)
+        for(int j = 0; j < (int)grid[i].size(); j++)
+        {
+            if(double_diff)
+            {
+                if(at(i - 1, j) < 0 || at(i, j) < 0 || at(i + 1, j) < 0)
+                    continue;
+                t.push_back({row, at(i - 1, j), 1});
+                t.push_back({row, at(i, j), -2});
+                t.push_back({row, at(i + 1, j), 1});
+            }
+            else
+            {
+                if(at(i, j) < 0 || at(i + 1, j) < 0)
+                    continue;
+                t.push_back({row, at(i + 1, j), 1});
+                t.push_back({row, at(i, j), -1});
+            }
+            row++;
+        }
+    SpatialMatrix m(row, cols);
+    m.m_triplets = t;
+    m.finalize();
+    return m;
+}
+
+SpatialMatrix
+SpatialMatrix::laplacian(int cols, const std::vector<std::vector<int>> &grid)
+{
+    auto at = [&](int i, int j) -> int
+    {
+        if(i < 0 || i >= (int)grid.size() || j < 0 || j >= (int)grid[i].size())
+            return -1;
+        return grid[i][j];
+    };
+    static const int di[4] = {-1, 1, 0, 0}, dj[4] = {0, 0, -1, 1};
+    std::vector<Triplet> t;
+    int row = 0;
+    for(int i = 0; i < (int)grid.size(); i++)
+        for(int j = 0; j < (int)grid[i].size(); j++)
+        {
+            if(at(i, j) < 0)
+                continue;
+            std::vector<int> neighbours;
+            for(int k = 0; k < 4; k++)
+                if(at(i + di[k], j + dj[k]) >= 0)
+                    neighbours.push_back(at(i + di[k], j + dj[k]));
+            if(neighbours.empty())
+                continue;
+            t.push_back({row, at(i, j), 1});
+            for(int n : neighbours)
+                t.push_back({row, n, -1. / neighbours.size()});
+            row++;
+        }
+    SpatialMatrix m(row, cols);
+    m.m_triplets = t;
+    m.finalize();
+    return m;
+}
+
+int
+SpatialMatrix::finalize()
+{
+    m_dense_t.assign((size_t)m_rows * m_cols, 0);
+    m_ignored = 0;
+    for(const Triplet &t : m_triplets)
+        if(t.row >= 0 && t.row < m_rows && t.col >= 0 && t.col < m_cols)
+            m_dense_t[(size_t)t.col * m_rows + t.row] += t.value;
+        else
+            m_ignored++;
+
+    m_row_ptr.assign(1, 0);
+    m_col_idx.clear();
+    m_values.clear();
+    for(int r = 0; r < m_rows; r++)
+    {
+        for(int c = 0; c < m_cols; c++)
+        {
+            double v = m_dense_t[(size_t)c * m_rows + r];
+            if(v != 0)
+            {
+                m_col_idx.push_back(c);
+                m_values.push_back(v);
+            }
+        }
+        m_row_ptr.push_back(m_values.size());
+    }
+    m_sparse = m_values.size() * 4 < (size_t)m_rows * m_cols;
+    return m_ignored;
+}
+
+void
+SpatialMatrix::apply(const double *x, double *y, size_t n_frames) const
+{
+    size_t R = m_rows, C = m_cols;
+    if(m_sparse)
+    {
+        for(size_t f = 0; f < n_frames; f++)
+        {
+            const double *xf = x + f * C;
+            double *yf = y + f * R;
+            for(size_t r = 0; r < R; r++)
+            {
+                double s = 0;
+                for(int k = m_row_ptr[r]; k < m_row_ptr[r + 1]; k++)
+                    s += m_values[k] * xf[m_col_idx[k]];
+                yf[r] = s;
+            }
+        }
+        return;
+    }
+
+    // Outer products of the columns of M with the block of frames: the
+    // inner loop over the outputs is contiguous and has no reduction
+    const size_t block = 16;
+    std::fill(y, y + n_frames * R, 0.);
+    for(size_t fb = 0; fb < n_frames; fb += block)
+    {
+        size_t fe = std::min(n_frames, fb + block);
+        for(size_t c = 0; c < C; c++)
+        {
+            const double *__restrict mt = m_dense_t.data() + c * R;
+            for(size_t f = fb; f < fe; f++)
+            {
+                double xv = x[f * C + c];
+                double *__restrict yf = y + f * R;
+                for(size_t r = 0; r < R; r++) yf[r] += mt[r] * xv;
+            }
+        }
+    }
+}
+
+void
+SpatialFilter::configure(const SpatialMatrix &matrix)
+{
+    m_inputs = matrix.cols();
+    m_outputs = matrix.rows();
+    m_last.assign(m_inputs, 0);
+    output.resize(m_outputs, m_capacity);
+    std::atomic_store(&m_matrix, std::make_shared<const SpatialMatrix>(matrix));
+}
+
+bool
+SpatialFilter::swap(const SpatialMatrix &matrix)
+{
+    if(matrix.cols() != m_inputs || matrix.rows() != m_outputs)
+        return false;
+    std::atomic_store(&m_matrix, std::make_shared<const SpatialMatrix>(matrix));
+    return true;
+}
+
+int
+SpatialFilter::process(const double *timestamps,
+                       const double *frames,
+                       size_t n_frames)
+{
+    // One matrix for the whole block, even if swapped meanwhile
+    std::shared_ptr<const SpatialMatrix> m = std::atomic_load(&m_matrix);
+    if(!m)
+        return 0;
+    const size_t chunk = 64;
+    m_in.resize(chunk * m_inputs);
+    m_out.resize(chunk * m_outputs);
+    int pushed = 0;
+    for(size_t f0 = 0; f0 < n_frames; f0 += chunk)
+    {
+        size_t n = std::min(chunk, n_frames - f0);
+        for(size_t f = 0; f < n; f++)
+        {
+            const double *in = frames + (f0 + f) * m_inputs;
+            for(int ch = 0; ch < m_inputs; ch++)
+            {
+                if(in[ch] == in[ch])
+                    m_last[ch] = in[ch];
+                m_in[f * m_inputs + ch] = m_last[ch];
+            }
+        }
+        m->apply(m_in.data(), m_out.data(), n);
+        for(size_t f = 0; f < n; f++)
+            if(output.push(timestamps[f0 + f], m_out.data() + f * m_outputs))
+                pushed++;
+    }
+    return pushed;
+}
+
+int
+SpatialFilter::process(SampleRing &ring)
+{
+    return m_block.drain(ring, m_inputs,
+                         [this](const double *ts, const double *frames,
+                                size_t n) { return process(ts, frames, n); });
+}
+
+} // namespace ClvHd
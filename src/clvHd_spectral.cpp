@@ -0,0 +1,250 @@
+#include "clvHd_spectral.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace ClvHd
+{
+
+void
+FFTPlan::resize(size_t n)
+{
+    m_n = next_pow2(std::max<size_t>(n, 2));
+    size_t m = m_n / 2;
+    m_twiddle.resize(std::max<size_t>(m / 2, 1));
+    for(size_t j = 0; j < m / 2; j++)
+        m_twiddle[j] = std::polar(1., -2 * M_PI * j / m);
+    m_split.resize(m + 1);
+    for(size_t k = 0; k <= m; k++)
+        m_split[k] = std::polar(1., -2 * M_PI * k / m_n);
+    int bits = 0;
+    while(((size_t)1 << bits) < m) bits++;
+    m_bitrev.resize(m);
+    for(size_t i = 0; i < m; i++)
+    {
+        uint32_t r = 0;
+        for(int b = 0; b < bits; b++)
+            if(i & ((size_t)1 << b))
+                r |= 1u << (bits - 1 - b);
+        m_bitrev[i] = r;
+    }
+    m_buffer.resize(m);
+}
+
+void
+FFTPlan::forward(const double *in, std::complex<double> *out)
+{
+    size_t m = m_n / 2;
+    std::complex<double> *z = m_buffer.data();
+    // Even samples as real part, odd samples as imaginary part
+    for(size_t k = 0; k < m; k++)
+        z[m_bitrev[k]] = std::complex<double>(in[2 * k], in[2 * k + 1]);
+
+    // Iterative radix-2 complex FFT of m points
+    for(size_t size = 2; size <= m; size *= 2)
+    {
+        size_t half = size / 2, step = m / size;
+        for(size_t start = 0; start < m; start += size)
+            for(size_t j = 0; j < half; j++)
+            {
+                std::complex<double> t = m_twiddle[j * step] * z[start + j + half];
+                z[start + j + half] = z[start + j] - t;
+                z[start + j] += t;
+            }
+    }
+
+    // Split the spectra of the even and odd samples
+    for(size_t k = 0; k <= m; k++)
+    {
+        std::complex<double> a = z[k % m];
+        std::complex<double> b = std::conj(z[(m - k) % m]);
+        std::complex<double> even = 0.5 * (a + b);
+        std::complex<double> odd = std::complex<double>(0, -0.5) * (a - b);
+        out[k] = even + m_split[k] * odd;
+    }
+}
+
+void
+SpectralAnalyzer::configure(int nb_channels,
+                            double fs,
+                            size_t window,
+                            double overlap,
+                            int averages,
+                            size_t capacity)
+{
+    m_channels = std::max(nb_channels, 0);
+    m_fs = fs;
+    m_window = next_pow2(std::max<size_t>(window, 2));
+    overlap = std::min(std::max(overlap, 0.), 0.99);
+    m_hop = std::max<size_t>(1, (size_t)std::lround(m_window * (1 - overlap)));
+    m_averages = std::max(averages, 1);
+    m_capacity = capacity;
+    m_fmin = 0;
+    m_fmax = fs / 2;
+
+    m_plan.resize(m_window);
+    m_taper.resize(m_window);
+    double energy = 0;
+    for(size_t i = 0; i < m_window; i++)
+    {
+        m_taper[i] = 0.5 * (1 - std::cos(2 * M_PI * i / m_window));
+        energy += m_taper[i] * m_taper[i];
+    }
+    m_scale = 1 / (fs * energy);
+    m_segment.resize(m_window);
+    m_spectrum.resize(m_window / 2 + 1);
+    reset();
+}
+
+void
+SpectralAnalyzer::add_band(double low, double high)
+{
+    m_bands.push_back(std::make_pair(low, high));
+    output.resize(size(), m_capacity);
+}
+
+void
+SpectralAnalyzer::reset()
+{
+    size_t bins = m_window / 2 + 1;
+    m_history.assign(m_window * m_channels, 0);
+    m_psd_ring.assign(m_averages * m_channels * bins, 0);
+    m_psd_sum.assign(m_channels * bins, 0);
+    m_last.assign(m_channels, 0);
+    m_pos = 0;
+    m_count = 0;
+    m_segments = 0;
+    output.resize(size(), m_capacity);
+}
+
+int
+SpectralAnalyzer::process(const double *timestamps,
+                          const double *frames,
+                          size_t n_frames)
+{
+    size_t nch = m_channels;
+    int emitted = 0;
+    for(size_t f = 0; f < n_frames; f++)
+    {
+        const double *in = frames + f * nch;
+        for(size_t ch = 0; ch < nch; ch++)
+        {
+            if(in[ch] == in[ch])
+                m_last[ch] = in[ch];
+            m_history[ch * m_window + m_pos] = m_last[ch];
+        }
+        m_pos = (m_pos + 1) % m_window;
+        m_count++;
+        if(m_count >= m_window && (m_count - m_window) % m_hop == 0)
+        {
+            analyse(timestamps[f]);
+            emitted++;
+        }
+    }
+    return emitted;
+}
+
+int
+SpectralAnalyzer::process(SampleRing &ring)
+{
+    return m_block.drain(ring, m_channels,
+                         [this](const double *ts, const double *frames,
+                                size_t n) { return process(ts, frames, n); });
+}
+
+void
+SpectralAnalyzer::analyse(double timestamp)
+{
+    size_t nch = m_channels;
+    size_t bins = m_window / 2 + 1;
+    size_t slot = m_segments % m_averages;
+    double df = m_fs / m_window;
+
+    for(size_t ch = 0; ch < nch; ch++)
+    {
+        // Oldest sample first, then the Hann window
+        const double *h = m_history.data() + ch * m_window;
+        size_t tail = m_window - m_pos;
+        std::memcpy(m_segment.data(), h + m_pos, tail * sizeof(double));
+        std::memcpy(m_segment.data() + tail, h, m_pos * sizeof(double));
+        for(size_t i = 0; i < m_window; i++) m_segment[i] *= m_taper[i];
+        m_plan.forward(m_segment.data(), m_spectrum.data());
+
+        double *ring = m_psd_ring.data() + (slot * nch + ch) * bins;
+        double *sum = m_psd_sum.data() + ch * bins;
+        for(size_t k = 0; k < bins; k++)
+        {
+            double p = std::norm(m_spectrum[k]) * m_scale;
+            if(k != 0 && k != bins - 1) // one-sided
+                p *= 2;
+            sum[k] += p - ring[k];
+            ring[k] = p;
+        }
+    }
+    m_segments++;
+
+    // Recompute the sums once per cycle of segments to bound the rounding
+    if(slot == (size_t)m_averages - 1)
+    {
+        std::fill(m_psd_sum.begin(), m_psd_sum.end(), 0.);
+        for(int s = 0; s < m_averages; s++)
+            for(size_t i = 0; i < nch * bins; i++)
+                m_psd_sum[i] += m_psd_ring[s * nch * bins + i];
+    }
+
+    double *out = output.reserve();
+    if(out == nullptr)
+        return;
+    double norm = 1. / std::min<uint64_t>(m_segments, m_averages);
+    size_t k0 = (size_t)std::max(0., std::ceil(m_fmin / df));
+    size_t k1 = std::min(bins - 1, (size_t)std::floor(m_fmax / df));
+    for(size_t ch = 0; ch < nch; ch++)
+    {
+        const double *P = m_psd_sum.data() + ch * bins;
+        double total = 0, moment = 0;
+        for(size_t k = k0; k <= k1; k++)
+        {
+            total += P[k];
+            moment += k * df * P[k];
+        }
+        double mdf = 0, cum = 0;
+        for(size_t k = k0; k <= k1 && total > 0; k++)
+        {
+            if(cum + P[k] >= total / 2)
+            {
+                // Linear interpolation inside the bin
+                mdf = (k - 0.5) * df + df * (total / 2 - cum) / P[k];
+                break;
+            }
+            cum += P[k];
+        }
+        out[MNF * nch + ch] = total > 0 ? moment / total : 0;
+        out[MDF * nch + ch] = std::max(mdf, 0.);
+        out[POWER * nch + ch] = total * norm * df;
+        for(size_t b = 0; b < m_bands.size(); b++)
+        {
+            double power = 0;
+            for(size_t k = 0; k < bins; k++)
+                if(k * df >= m_bands[b].first && k * df <= m_bands[b].second)
+                    power += P[k];
+            out[(NB_FEATURES + b) * nch + ch] = power * norm * df;
+        }
+    }
+    output.commit(timestamp);
+}
+
+std::vector<double>
+SpectralAnalyzer::psd(int channel) const
+{
+    size_t bins = m_window / 2 + 1;
+    std::vector<double> p(bins, 0);
+    if(channel < 0 || channel >= m_channels || m_segments == 0)
+        return p;
+    double norm = 1. / std::min<uint64_t>(m_segments, m_averages);
+    for(size_t k = 0; k < bins; k++)
+        p[k] = m_psd_sum[channel * bins + k] * norm;
+    return p;
+}
+
+} // namespace ClvHd
@@ -33,6 +33,18 @@ uint8_t sendBuffer[1024];
 uint8_t recvBuffer[1024];
 uint8_t spiCmd[255];
 
+// UDP stream of the samples: 'S' | id | n | count | u32 seq | u32 index of
+// the first sample | count x (u32 micros | n bytes)
+#define DATA_STATUS_REG 0x30
+#define STREAM_FLUSH_US 5000 // Longest wait of a sample in a datagram
+bool streaming = false;
+uint8_t streamId, streamN, streamNc;
+uint8_t streamCmd[16];
+uint16_t streamPort;
+uint32_t streamSeq, streamIndex, streamFirst;
+uint8_t streamCount, streamMax;
+uint8_t datagram[1472];
+
 Adafruit_NeoPixel LED(NB_LED, PIN_LED, NEO_GRB + NEO_KHZ800);
 void
 setRGB(
@@ -61,6 +73,53 @@ blink(int8_t r,
     }
 }
 
+void
+spiRead(uint8_t nc, uint8_t *cmd, uint8_t nr, uint8_t *data)
+{
+    digitalWrite(SPI_CS, LOW);
+    for(int i = 0; i < nc; i++) SPI.transfer(cmd[i]);
+    for(int i = 0; i < nr; i++) data[i] = SPI.transfer(0);
+    digitalWrite(SPI_CS, HIGH);
+}
+
+void
+sendDatagram()
+{
+    datagram[0] = 'S';
+    datagram[1] = streamId;
+    datagram[2] = streamN;
+    datagram[3] = streamCount;
+    memcpy(datagram + 4, &streamSeq, 4);
+    memcpy(datagram + 8, &streamIndex, 4);
+    udp.beginPacket(server_ip.c_str(), streamPort);
+    udp.write(datagram, 12 + streamCount * (4 + streamN));
+    udp.endPacket();
+    streamSeq++;
+    streamIndex += streamCount;
+    streamCount = 0;
+}
+
+// Read a sample if DATA_STATUS reports one, send the batch when full or old
+void
+pollStream()
+{
+    uint8_t cmd = DATA_STATUS_REG | 0x80;
+    uint8_t status = 0;
+    spiRead(1, &cmd, 1, &status);
+    if(status & 0b11111100) // P/E DRDY bit
+    {
+        uint32_t t = micros();
+        uint8_t *sample = datagram + 12 + streamCount * (4 + streamN);
+        memcpy(sample, &t, 4);
+        spiRead(streamNc, streamCmd, streamN, sample + 4);
+        if(streamCount++ == 0)
+            streamFirst = t;
+    }
+    if(streamCount == streamMax ||
+       (streamCount > 0 && micros() - streamFirst >= STREAM_FLUSH_US))
+        sendDatagram();
+}
+
 void
 storeCredentials(String ssid, String password)
 {
@@ -147,7 +206,7 @@ searchServer()
                 server_ip.c_str() + " on port " + String(server_port));
         char packetBuffer[255];
         int n = udp.read(packetBuffer, 255);
-        if(n = 2)
+        if(n == 2)
         {
             server_port = (packetBuffer[1] << 8) + packetBuffer[0];
             PRINTLN("Server port: " + String(server_port));
@@ -213,6 +272,7 @@ loop()
         if(client.connected())
         {
             PRINTLN("Connected to the PC");
+            client.setNoDelay(true); // the replies are small
             String macAddress = WiFi.macAddress();
             sendBuffer[0] = 'A';
             sendBuffer[1] = macAddress.length();
@@ -223,49 +283,84 @@ loop()
         }
         while(client.connected())
         {
-            if(client.available())
+            if(streaming)
+                pollStream();
+            if(!client.available())
             {
-                uint8_t c = client.read();
-                switch(c)
-                {
-                case 'l': //set leds
-                {
-                    uint8_t rgbbuff[6];
-                    client.readBytes(rgbbuff, 6);
-                    setRGB(rgbbuff[0], rgbbuff[1], rgbbuff[2], rgbbuff[3],
-                           rgbbuff[4], rgbbuff[5]);
-                }
-                case 'r': //read spi
-                {
-                    uint8_t nr = client.read(); //number of bytes to read
-                    uint8_t nc = client.read(); //size of the command to send
-                    client.readBytes(spiCmd, nc);
-                    digitalWrite(SPI_CS, LOW);
-                    //send the command
-                    for(int i = 0; i < nc; i++) SPI.transfer(spiCmd[i]);
-                    //read the data
-                    for(int i = 0; i < nr; i++) sendBuffer[i] = SPI.transfer(0);
-                    digitalWrite(SPI_CS, HIGH);
-                    client.write(sendBuffer, nr);
-                }
-                case 'w': //write spi
-                {
-                    uint8_t nc = client.read();   //size of the command to send
-                    client.readBytes(spiCmd, nc); //read the command
-                    digitalWrite(SPI_CS, LOW);
-                    for(int i = 0; i < nc; i++) SPI.transfer(spiCmd[i]);
-                    digitalWrite(SPI_CS, HIGH);
-                }
-                default:
-                {
-                    //unknown cmd, clear client buffer
-                    while(client.available()){client.read();}
-                }
-
-                }
+                if(!streaming)
+                    delay(1);
+                continue;
+            }
+            uint8_t c = client.read();
+            switch(c)
+            {
+            case 'l': //set leds
+            {
+                uint8_t rgbbuff[6];
+                client.readBytes(rgbbuff, 6);
+                setRGB(rgbbuff[0], rgbbuff[1], rgbbuff[2], rgbbuff[3],
+                       rgbbuff[4], rgbbuff[5]);
+            }
+            break;
+            case 'r': //read spi
+            {
+                uint8_t n[2];
+                client.readBytes(n, 2);
+                uint8_t nr = n[0]; //number of bytes to read
+                uint8_t nc = n[1]; //size of the command to send
+                client.readBytes(spiCmd, nc);
+                digitalWrite(SPI_CS, LOW);
+                //send the command
+                for(int i = 0; i < nc; i++) SPI.transfer(spiCmd[i]);
+                //read the data
+                for(int i = 0; i < nr; i++)
+                    sendBuffer[i + 2] = SPI.transfer(0);
+                digitalWrite(SPI_CS, HIGH);
+                //reply: 'R' | nr | data
+                sendBuffer[0] = 'R';
+                sendBuffer[1] = nr;
+                client.write(sendBuffer, nr + 2);
+            }
+            break;
+            case 'w': //write spi
+            {
+                uint8_t nc;
+                client.readBytes(&nc, 1);     //size of the command to send
+                client.readBytes(spiCmd, nc); //read the command and data
+                digitalWrite(SPI_CS, LOW);
+                for(int i = 0; i < nc; i++) SPI.transfer(spiCmd[i]);
+                digitalWrite(SPI_CS, HIGH);
+            }
+            break;
+            case 's': //start (n > 0) or stop the UDP stream
+            {
+                uint8_t h[3];
+                client.readBytes(h, 3); //id | n | size of the command
+                streamId = h[0];
+                streamN = h[1];
+                streamNc = (h[2] < sizeof(streamCmd)) ? h[2] : sizeof(streamCmd);
+                client.readBytes(spiCmd, h[2]);
+                memcpy(streamCmd, spiCmd, streamNc);
+                uint8_t port[2];
+                client.readBytes(port, 2);
+                streamPort = port[0] | (port[1] << 8);
+                streamSeq = streamIndex = 0;
+                streamCount = 0;
+                // The sample count of a datagram is one byte
+                uint16_t fit = (sizeof(datagram) - 12) / (4 + streamN);
+                streamMax = (fit < 255) ? fit : 255;
+                streaming = (streamN > 0);
+            }
+            break;
+            default:
+            {
+                //unknown cmd, clear client buffer
+                while(client.available()){client.read();}
+            }
+            break;
             }
-            delay(1);
         }
+        streaming = false;
         blink(255, 165, 0, 10, 100);//blink orange
         //disconnect from the PC
         client.stop();
@@ -1,5 +1,6 @@
 #include <SPI.h>
 #include <Wire.h>
+#include <atomic>
 
 #define READ 0b10000000
 #define WRITE 0b00000000
@@ -9,6 +10,9 @@
 #define SPI_POCI 16  
 #define SPI_SCK 18   
 
+#define CLVHD_SPI_CLOCK 20000000     // Default SPI clock (Hz)
+#define CLVHD_SPI_MAX_CLOCK 20000000 // Maximum SCLK of the ADS1293
+
 
 //class used to unify the different functions used to interact with the EMG modules
 class ClvHd {
@@ -23,7 +27,7 @@ public:
     SPI.setSCK(SPI_SCK);
     SPI.setTX(SPI_PICO);
     SPI.begin();
-    SPI.beginTransaction(SPISettings(20000000, MSBFIRST, SPI_MODE0));
+    setSpiClock(CLVHD_SPI_CLOCK);
     for (int i = 0; i < 5; i++) pinMode(m_addPins[i], OUTPUT);
     selectBrd(0xff);
     pinMode(m_availPin, INPUT_PULLUP);
@@ -92,38 +96,6 @@ public:
     selectBrd(0x00);
   }
 
-13:55:57.168 -> 1 Addr: 0 Reg: 33
-13:55:57.168 -> 2 Addr: 1 Reg: 33
-13:55:57.168 -> 3 Addr: 3 Reg: 33
-13:55:57.168 -> 4 Addr: 2 Reg: 33
-13:55:57.168 -> 5 Addr: 6 Reg: 33
-13:55:57.168 -> 6 Addr: 7 Reg: 33
-13:55:57.168 -> 7 Addr: 5 Reg: 33
-13:55:57.168 -> 8 Addr: 4 Reg: 33
-13:55:57.168 -> 9 Addr: C Reg: 33
-13:55:57.168 -> 10 Addr: D Reg: 33
-13:55:57.168 -> 11 Addr: F Reg: 33
-13:55:57.168 -> 12 Addr: E Reg: 33
-13:55:57.168 -> 13 Addr: A Reg: 33
-13:55:57.168 -> 14 Addr: B Reg: 33
-13:55:57.168 -> 15 Addr: 8 Reg: 33
-
-
-13:55:58.482 -> 1 Addr: 0 Reg: 33
-13:55:58.482 -> 2 Addr: 1 Reg: 33
-13:55:58.482 -> 3 Addr: 3 Reg: 33
-13:55:58.482 -> 4 Addr: 2 Reg: 33
-13:55:58.482 -> 5 Addr: 6 Reg: 33
-13:55:58.482 -> 6 Addr: 7 Reg: 33
-13:55:58.482 -> 7 Addr: 5 Reg: 33
-13:55:58.482 -> 8 Addr: 4 Reg: 33
-13:55:58.482 -> 9 Addr: C Reg: 33
-13:55:58.482 -> 10 Addr: D Reg: 33
-13:55:58.482 -> 11 Addr: F Reg: 33
-13:55:58.482 -> 12 Addr: E Reg: 33
-13:55:58.482 -> 13 Addr: A Reg: 33
-13:55:58.482 -> 14 Addr: B Reg: 33
-
   /**
      * @brief Write n uint8_t to the reg ad the module coreponding to id.
      *
@@ -142,12 +114,32 @@ public:
     selectBrd(0x00);
   }
 
+  /**
+   * @brief Set the SPI clock, up to the maximum of the ADS1293.
+   *
+   * @param clock Requested clock (Hz)
+   * @return uint32_t Applied clock (Hz)
+   */
+  uint32_t
+  setSpiClock(uint32_t clock) {
+    if (clock > CLVHD_SPI_MAX_CLOCK)
+      clock = CLVHD_SPI_MAX_CLOCK;
+    if (clock < 100000)
+      clock = 100000;
+    if (m_clock != 0)
+      SPI.endTransaction();
+    SPI.beginTransaction(SPISettings(clock, MSBFIRST, SPI_MODE0));
+    m_clock = clock;
+    return m_clock;
+  }
+
   uint8_t
   nbModules() {
     return m_nbModule;
   }
 
 private:
+  uint32_t m_clock = 0;
   bool initialized = false;
   const int m_addPins[5] = { 2, 3, 4, 5, 6 };
   int m_nbModule = 0;
@@ -158,3 +150,488 @@ private:
   // SPIClass mySPI(spi0); // Use spi0 interface
 
 };
+
+#define DATA_STATUS_REG 0x30
+
+// Sample FIFO of the controller (conversion time sampling, bulk fetch)
+#define CLVHD_FIFO_BYTES 32768
+#define CLVHD_DRDYB_PIN -1 // Input wired to the DRDYB lines, -1 if none
+
+#define FIFO_STOP 0
+#define FIFO_POLL 1  // Poll DATA_STATUS of the first module
+#define FIFO_DRDYB 2 // Falling edge of DRDYB
+
+volatile uint32_t drdyb_stamp = 0; // Time of the last edge
+volatile uint32_t drdyb_edges = 0; // Edges since the last read
+
+void
+drdyb_isr() {
+  drdyb_stamp = micros();
+  drdyb_edges = drdyb_edges + 1;
+}
+
+/**
+ * @brief FIFO of the samples of the modules, read at conversion time.
+ *
+ * Each entry is [u32 timestamp (us) | n bytes of every masked module], the
+ * timestamp being taken at the data ready edge (DRDYB interrupt) or when the
+ * polled DATA_STATUS reports a new sample. When the FIFO is full, the new
+ * entries are dropped and the overflow is reported by the next fetch.
+ *
+ * start(), stop() and poll() run on core 1 (owner of the SPI bus), fetch()
+ * and drain() on core 0: the entries are exchanged through a single
+ * producer, single consumer ring without lock.
+ */
+class SampleFifo {
+public:
+  /**
+   * @brief Start sampling the masked modules with the read command cmd.
+   *
+   * @return uint8_t Active source (FIFO_POLL if no DRDYB pin is wired).
+   */
+  uint8_t
+  start(ClvHd &clvHd, uint32_t mask, uint8_t n, uint8_t n_cmd, uint8_t cmd[],
+        uint8_t source) {
+    stop();
+    m_mask = mask;
+    m_n = n;
+    m_n_cmd = (n_cmd < sizeof(m_cmd)) ? n_cmd : sizeof(m_cmd);
+    memcpy(m_cmd, cmd, m_n_cmd);
+    m_nb = 0;
+    m_first = -1;
+    for (int i = 0; i < clvHd.nbModules(); i++)
+      if (mask & ((uint32_t)1 << i)) {
+        if (m_first < 0)
+          m_first = i;
+        m_nb++;
+      }
+    m_entry = 4 + m_n * m_nb;
+    if (source == FIFO_STOP || m_nb == 0 || 2 * m_entry > CLVHD_FIFO_BYTES)
+      return FIFO_STOP;
+    m_capacity = CLVHD_FIFO_BYTES / m_entry; // One slot kept empty
+    if (source == FIFO_DRDYB && CLVHD_DRDYB_PIN >= 0) {
+      pinMode(CLVHD_DRDYB_PIN, INPUT_PULLUP);
+      drdyb_edges = 0;
+      attachInterrupt(digitalPinToInterrupt(CLVHD_DRDYB_PIN), drdyb_isr,
+                      FALLING);
+    }
+    else
+      source = FIFO_POLL;
+    m_source = source;
+    return m_source;
+  }
+
+  void
+  stop() {
+    if (m_source == FIFO_DRDYB)
+      detachInterrupt(digitalPinToInterrupt(CLVHD_DRDYB_PIN));
+    m_source = FIFO_STOP;
+    m_head.store(0, std::memory_order_relaxed);
+    m_tail.store(0, std::memory_order_relaxed);
+    m_dropped.store(0, std::memory_order_relaxed);
+    m_dropped_seen = 0;
+  }
+
+  /**
+   * @brief Read the modules if a new sample is ready (called every loop of
+   * core 1).
+   */
+  void
+  poll(ClvHd &clvHd) {
+    uint32_t ts;
+    if (m_source == FIFO_DRDYB) {
+      if (drdyb_edges == 0)
+        return;
+      noInterrupts();
+      ts = drdyb_stamp;
+      uint32_t edges = drdyb_edges;
+      drdyb_edges = 0;
+      interrupts();
+      // Edges merged before this read: their samples were overwritten in
+      // the modules, report them as dropped (FIFO_OVERFLOW)
+      if (edges > 1)
+        m_dropped.store(m_dropped.load(std::memory_order_relaxed) + edges - 1,
+                        std::memory_order_release);
+    }
+    else if (m_source == FIFO_POLL) {
+      uint8_t cmd = DATA_STATUS_REG | READ;
+      uint8_t status = 0;
+      clvHd.readCmd(1, &cmd, 1, &status, m_first + 1);
+      if (!(status & 0b11111100)) // No P/E DRDY bit
+        return;
+      ts = micros();
+    }
+    else
+      return;
+
+    int tail = m_tail.load(std::memory_order_relaxed);
+    int next = (tail + 1 == m_capacity) ? 0 : tail + 1;
+    if (next == m_head.load(std::memory_order_acquire)) {
+      m_dropped.store(m_dropped.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_release);
+      return;
+    }
+    uint8_t *entry = m_data + tail * m_entry;
+    memcpy(entry, &ts, 4);
+    uint8_t *vals = entry + 4;
+    for (int i = 0; i < clvHd.nbModules(); i++)
+      if (m_mask & ((uint32_t)1 << i)) {
+        clvHd.readCmd(m_n_cmd, m_cmd, m_n, vals, i + 1);
+        vals += m_n;
+      }
+    m_tail.store(next, std::memory_order_release);
+  }
+
+  /**
+   * @brief Move up to max entries in buff: [count | flags | entries], flags
+   * bit 0 set if entries were dropped since the last fetch, bit 1 if
+   * entries are still pending.
+   *
+   * @param room Size of buff.
+   * @return int Number of bytes written.
+   */
+  int
+  fetch(uint8_t max, uint8_t *buff, int room) {
+    int head = m_head.load(std::memory_order_relaxed);
+    int pending = size(head);
+    int count = 0;
+    while (count < max && count < pending && 2 + (count + 1) * m_entry <= room) {
+      memcpy(buff + 2 + count * m_entry, m_data + head * m_entry, m_entry);
+      head = (head + 1 == m_capacity) ? 0 : head + 1;
+      count++;
+    }
+    m_head.store(head, std::memory_order_release);
+    buff[0] = count;
+    buff[1] = flags(pending - count);
+    return 2 + count * m_entry;
+  }
+
+  /**
+   * @brief Move up to max entries in buff, with compact timestamps:
+   * [u32 mask | u8 n | u16 count | u8 flags | u32 timestamp of the first
+   * entry | count x (u16 delay from the previous entry (us) | n bytes of
+   * every masked module)]. A delay above 65535 us ends the reply, the next
+   * one starting from a new timestamp.
+   *
+   * Compressed (flags bit 2, ADS1293 windows of 16 bytes only), the bytes
+   * of an entry are replaced by the delta coding of encode() against the
+   * previous entry of the reply, unless it is not shorter (saturation,
+   * steps): the entry is then sent raw, with bit 15 of its delay set (the
+   * delays are limited to 32767 us).
+   *
+   * @param room Size of buff.
+   * @return int Number of bytes written.
+   */
+  int
+  drain(uint16_t max, uint8_t *buff, int room, bool compress = false) {
+    const int header = 12;
+    const int raw = m_entry - 4;
+    compress = compress && m_n == 16 && m_cmd[0] == (DATA_STATUS_REG | READ);
+    const uint32_t max_dt = compress ? 0x7FFF : 0xFFFF;
+    int head = m_head.load(std::memory_order_relaxed);
+    int pending = size(head);
+    int pos = header;
+    uint16_t count = 0;
+    uint32_t prev = 0;
+    while (count < max && count < pending && pos + 2 + raw <= room) {
+      const uint8_t *entry = m_data + head * m_entry;
+      uint32_t ts;
+      memcpy(&ts, entry, 4);
+      if (count == 0) {
+        memcpy(buff + 8, &ts, 4);
+        memset(m_prev, 0, sizeof(m_prev));
+      }
+      else if (ts - prev > max_dt)
+        break;
+      uint16_t dt = (count == 0) ? 0 : ts - prev;
+      int len = compress ? encode(entry + 4, buff + pos + 2, raw) : raw;
+      if (len >= raw) {
+        memcpy(buff + pos + 2, entry + 4, raw);
+        dt |= compress ? 0x8000 : 0;
+        len = raw;
+      }
+      memcpy(buff + pos, &dt, 2);
+      pos += 2 + len;
+      prev = ts;
+      head = (head + 1 == m_capacity) ? 0 : head + 1;
+      count++;
+    }
+    m_head.store(head, std::memory_order_release);
+    memcpy(buff, &m_mask, 4);
+    buff[4] = m_n;
+    memcpy(buff + 5, &count, 2);
+    buff[7] = flags(pending - count) | (compress ? 4 : 0);
+    return pos;
+  }
+
+  uint16_t
+  capacity() {
+    return m_capacity > 0 ? m_capacity - 1 : 0;
+  }
+
+private:
+  // Entries written by core 1 and not yet read
+  int
+  size(int head) {
+    int tail = m_tail.load(std::memory_order_acquire);
+    return (tail >= head) ? tail - head : tail + m_capacity - head;
+  }
+
+  uint8_t
+  flags(int left) {
+    uint32_t dropped = m_dropped.load(std::memory_order_acquire);
+    uint8_t f = (dropped != m_dropped_seen ? 1 : 0) | (left > 0 ? 2 : 0);
+    m_dropped_seen = dropped;
+    return f;
+  }
+
+  /**
+   * @brief Delta coding of the ADS1293 windows of an entry: per module,
+   * the DATA_STATUS byte, then the zigzag varint of the difference of each
+   * pace (16 bits) and ECG (24 bits) value with the previous entry. Writes
+   * at most limit bytes but always updates the previous values.
+   *
+   * @return int Length of the coded entry (>= limit if it did not fit).
+   */
+  int
+  encode(const uint8_t *vals, uint8_t *out, int limit) {
+    int len = 0;
+    int32_t *prev = m_prev;
+    for (int m = 0; m < m_nb; m++, vals += 16) {
+      if (len < limit)
+        out[len] = vals[0];
+      len++;
+      for (int k = 0; k < 6; k++, prev++) {
+        const uint8_t *v = (k < 3) ? vals + 1 + 2 * k : vals + 7 + 3 * (k - 3);
+        int32_t value = (k < 3) ? (v[0] << 8) | v[1] : (v[0] << 16) | (v[1] << 8) | v[2];
+        int32_t d = value - *prev;
+        *prev = value;
+        uint32_t z = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+        do {
+          uint8_t b = z & 0x7F;
+          z >>= 7;
+          if (len < limit)
+            out[len] = b | (z ? 0x80 : 0);
+          len++;
+        } while (z);
+      }
+    }
+    return len;
+  }
+
+  uint8_t m_data[CLVHD_FIFO_BYTES];
+  int32_t m_prev[32 * 6];  // Previous values of the delta coding (core 0)
+  uint8_t m_source = FIFO_STOP;
+  uint32_t m_mask = 0;
+  uint8_t m_n = 0;
+  uint8_t m_n_cmd = 0;
+  uint8_t m_cmd[8];
+  int m_nb = 0;
+  int m_first = -1;
+  int m_entry = 4;
+  int m_capacity = 0;
+  std::atomic<int> m_head{ 0 };          // Next entry to read (core 0)
+  std::atomic<int> m_tail{ 0 };          // Next entry to write (core 1)
+  std::atomic<uint32_t> m_dropped{ 0 };  // Written by core 1 only
+  uint32_t m_dropped_seen = 0;           // Read by core 0 only
+};
+
+/**
+ * @brief Requests of core 0 (USB and commands) executed by core 1, the owner
+ * of the SPI bus and of the module selection.
+ *
+ * Core 0 fills the fields and posts a job, core 1 runs it between two FIFO
+ * polls. A multi-module read publishes the number of modules already read,
+ * so core 0 sends them over USB while core 1 reads the next ones.
+ */
+class SpiJobs {
+public:
+  enum Type {
+    JOB_READ = 1, // Read n bytes of every masked module into out
+    JOB_WRITE,    // Write the n bytes of val to every masked module
+    JOB_FIFO,     // Start (or stop) the sample FIFO
+    JOB_CLOCK,    // Set the SPI clock
+    JOB_INIT      // Enumerate the modules
+  };
+
+  // Core 0: start the job filled in the fields
+  void
+  post(uint8_t job) {
+    type = job;
+    m_progress.store(0, std::memory_order_relaxed);
+    m_state.store(POSTED, std::memory_order_release);
+  }
+
+  // Core 0: number of modules read by the current READ job
+  int
+  progress() {
+    return m_progress.load(std::memory_order_acquire);
+  }
+
+  // Core 0: wait for the end of the current job
+  void
+  wait() {
+    while (m_state.load(std::memory_order_acquire) != DONE) {}
+    m_state.store(IDLE, std::memory_order_relaxed);
+  }
+
+  // Core 1: run the posted job, if any
+  void
+  run(ClvHd &clvHd, SampleFifo &fifo) {
+    if (m_state.load(std::memory_order_acquire) != POSTED)
+      return;
+    switch (type) {
+      case JOB_READ:
+        {
+          int ir = 0;
+          for (int i = 0; i < clvHd.nbModules(); i++)
+            if (mask & ((uint32_t)1 << i)) {
+              clvHd.readCmd(n_cmd, cmd, n, out + n * ir, i + 1);
+              m_progress.store(++ir, std::memory_order_release);
+            }
+          break;
+        }
+      case JOB_WRITE:
+        for (int i = 0; i < clvHd.nbModules(); i++)
+          if (mask & ((uint32_t)1 << i))
+            clvHd.writeCmd(n_cmd, cmd, n, val, i + 1);
+        break;
+      case JOB_FIFO:
+        result = fifo.start(clvHd, mask, n, n_cmd, cmd, source);
+        break;
+      case JOB_CLOCK:
+        result = clvHd.setSpiClock(clock);
+        break;
+      case JOB_INIT:
+        result = clvHd.initModules();
+        break;
+    }
+    m_state.store(DONE, std::memory_order_release);
+  }
+
+  uint8_t type = 0;
+  uint32_t mask = 0;
+  uint8_t n = 0;
+  uint8_t n_cmd = 0;
+  uint8_t *cmd = nullptr;
+  uint8_t *val = nullptr;
+  uint8_t *out = nullptr;
+  uint8_t source = 0;
+  uint32_t clock = 0;
+  uint32_t result = 0;
+
+private:
+  enum State {
+    IDLE = 0,
+    POSTED,
+    DONE
+  };
+  std::atomic<uint8_t> m_state{ IDLE };
+  std::atomic<int> m_progress{ 0 };
+};
+
+// Aggregated replies (see ReplyBatch)
+#define CLVHD_BATCH_BYTES 4096
+#define CLVHD_BATCH_MAGIC 0xA5
+
+/**
+ * @brief Output of the replies, written through to the serial link or
+ * aggregated in packet aligned transfers: [0xA5 | u16 size | replies |
+ * zero padding up to a multiple of the USB packet size]. A reply can span
+ * two transfers. The transfer is sent when the buffer is full, as soon as
+ * no command is pending or, while commands keep arriving, when the oldest
+ * byte waited for the latency budget.
+ */
+class ReplyBatch : public Print {
+public:
+  ReplyBatch(Stream &link)
+    : m_link(link) {}
+
+  using Print::write;
+
+  size_t
+  write(uint8_t b) override {
+    return write(&b, 1);
+  }
+
+  size_t
+  write(const uint8_t *buff, size_t size) override {
+    if (m_packet == 0)
+      return m_link.write(buff, size);
+    size_t done = 0;
+    while (done < size) {
+      if (m_size == 0)
+        m_first = micros();
+      size_t k = size - done;
+      if (k > m_capacity - m_size)
+        k = m_capacity - m_size;
+      memcpy(m_data + 3 + m_size, buff + done, k);
+      m_size += k;
+      done += k;
+      if (m_size == m_capacity)
+        flush();
+    }
+    return size;
+  }
+
+  /**
+   * @brief Aggregate the replies in transfers of packet multiples (0:
+   * write through), sent after at most budget us.
+   *
+   * @return uint16_t Applied packet size.
+   */
+  uint16_t
+  configure(uint16_t packet, uint16_t budget) {
+    flush();
+    packet = clamp(packet);
+    m_packet = packet;
+    m_budget = budget;
+    m_capacity = (packet > 0) ? (CLVHD_BATCH_BYTES / packet) * packet - 3 : 0;
+    return m_packet;
+  }
+
+  // Packet size applied for a requested one
+  static uint16_t
+  clamp(uint16_t packet) {
+    if (packet > CLVHD_BATCH_BYTES / 2)
+      return CLVHD_BATCH_BYTES / 2;
+    if (packet > 0 && packet < 8)
+      return 8;
+    return packet;
+  }
+
+  /**
+   * @brief Send the transfer if no command is pending or if its latency
+   * budget is over (called every loop).
+   */
+  void
+  poll(bool input_pending) {
+    if (m_size == 0)
+      return;
+    if (!input_pending || (uint32_t)(micros() - m_first) >= m_budget)
+      flush();
+  }
+
+  void
+  flush() {
+    if (m_size == 0)
+      return;
+    uint16_t size = m_size;
+    m_data[0] = CLVHD_BATCH_MAGIC;
+    memcpy(m_data + 1, &size, 2);
+    size_t total = 3 + m_size;
+    size_t padded = ((total + m_packet - 1) / m_packet) * m_packet;
+    memset(m_data + total, 0, padded - total);
+    m_link.write(m_data, padded);
+    m_size = 0;
+  }
+
+private:
+  Stream &m_link;
+  uint8_t m_data[CLVHD_BATCH_BYTES];
+  uint16_t m_packet = 0;  // 0: write through
+  uint32_t m_budget = 0;  // us
+  size_t m_capacity = 0;  // Bytes of replies of a transfer
+  size_t m_size = 0;
+  uint32_t m_first = 0;  // Time of the oldest byte
+};
@@ -1,16 +1,66 @@
 #define VERSION_MAJOR 3
-#define VERSION_MINOR 0
+#define VERSION_MINOR 6
 #include "clvHd_util.hpp"
 
+#define MAX_REPLY 2048 //values of a reply: 32 modules x 64 bytes
+
 uint8_t recv_buff[64];
-uint8_t send_buff[255];
+uint8_t send_buff[MAX_REPLY + 11];
 uint64_t *timestamp = (uint64_t *)send_buff;
 uint8_t *size_buff = send_buff + 8;
 uint8_t *vals_buff = send_buff + 9;
 int i, n, reg, nb, id, val, n_cmd;
 uint32_t mask_id = 0;
 
+// Core 1 owns the SPI bus (jobs and FIFO sampling), core 0 the USB link
 ClvHd clvHd;
+SampleFifo fifo;
+ReplyBatch out(Serial); //replies, aggregated on request ('a')
+SpiJobs jobs;
+
+// Header of a reply of size bytes: timestamp | size, or timestamp | 0xFF |
+// size(2) above 254 bytes
+void
+sendHeader(uint16_t size)
+{
+    if(size < 0xFF)
+    {
+        *size_buff = size;
+        out.write(send_buff, 9);
+    }
+    else
+    {
+        *size_buff = 0xFF;
+        out.write(send_buff, 9);
+        out.write((uint8_t *)&size, 2);
+    }
+}
+
+// Read the len bytes following a command header into recv_buff + 7, or
+// skip them if they do not fit (returns false)
+bool
+readCommand(int len)
+{
+    if(len <= (int)sizeof(recv_buff) - 7)
+    {
+        Serial.readBytes((char *)recv_buff + 7, len);
+        return true;
+    }
+    uint8_t skip[16];
+    for(; len > 0; len -= 16)
+        Serial.readBytes((char *)skip, (len < 16) ? len : 16);
+    return false;
+}
+
+int
+countModules(uint32_t mask)
+{
+    int count = 0;
+    for(int i = 0; i < clvHd.nbModules(); i++)
+        if(mask & ((uint32_t)1 << i)) //check if the i-th bit is set
+            count++;
+    return count;
+}
 
 void
 setup()
@@ -18,12 +68,25 @@ setup()
 
     Serial.begin(500000);
     delay(1000);
+}
+
+void
+setup1()
+{
     clvHd.begin();
 }
 
+void
+loop1()
+{
+    jobs.run(clvHd, fifo);
+    fifo.poll(clvHd);
+}
+
 void
 loop()
 {
+    out.poll(Serial.available() > 0);
     if(Serial.available() >= 1)
     {
         recv_buff[0] = Serial.read();
@@ -35,22 +98,34 @@ loop()
             mask_id = *((uint32_t *)(recv_buff + 1)); //4 bytes mask_id
             n = recv_buff[5];     //1 byte number of bytes to read
             n_cmd = recv_buff[6]; //1 byte size of the command
-            Serial.readBytes((char *)recv_buff + 7, n_cmd);
+            int ir = countModules(mask_id);
+            bool fits = readCommand(n_cmd) && n * ir <= MAX_REPLY;
             *timestamp = micros(); //8 bytes timestamp stored in send_buff
-            int ir = 0;
-            for(i = 0; i < clvHd.nbModules(); i++)
+            if(!fits) //nothing read, the host sees an empty reply
             {
-                if(mask_id & ((uint32_t)1 << i)) //check if the i-th bit is set
+                sendHeader(0);
+                break;
+            }
+            //core 1 reads n bytes starting from reg address of every masked
+            //module in vals_buff, each one being sent as soon as it is read
+            jobs.mask = mask_id;
+            jobs.n = n;
+            jobs.n_cmd = n_cmd;
+            jobs.cmd = recv_buff + 7;
+            jobs.out = vals_buff;
+            jobs.post(SpiJobs::JOB_READ);
+            sendHeader(n * ir);
+            int sent = 0;
+            while(sent < ir)
+            {
+                int done = jobs.progress();
+                if(done > sent)
                 {
-                    //read n bytes starting from reg address of the module i
-                    //and store them in vals_buff (send_buff + 9)
-                    clvHd.readCmd(n_cmd, recv_buff + 7, n, vals_buff + n * ir,
-                                  i + 1);
-                    ir++;
+                    out.write(vals_buff + n * sent, n * (done - sent));
+                    sent = done;
                 }
             }
-            *size_buff = n * ir; //number of bytes read (send_buff + 8)
-            Serial.write(send_buff, 9 + (*size_buff));
+            jobs.wait();
             break;
         }
         case 'w': //> 'w' | mask id | n | n_cmd | cmd[n_cmd] | val[n] : write n bytes starting from reg
@@ -59,20 +134,18 @@ loop()
             mask_id = *((uint32_t *)(recv_buff + 1)); //4 bytes mask_id
             n = recv_buff[5];     //1 byte number of bytes to write
             n_cmd = recv_buff[6]; //1 byte size of the command
-            Serial.readBytes((char *)recv_buff + 7,
-                             n_cmd + n); //read n_cmd + n bytes
-            *timestamp = micros();       //8 bytes timestamp stored in send_buff
-            int iw = 0;
-            for(i = 0; i < clvHd.nbModules(); i++)
-            {
-                if(mask_id & ((uint32_t)1 << i)) //check if the i-th bit is set
-                {
-                    //write n bytes starting from reg address of the module i
-                    clvHd.writeCmd(n_cmd, recv_buff + 7, n,
-                                   recv_buff + 7 + n_cmd, i + 1);
-                    iw++;
-                }
-            }
+            if(!readCommand(n_cmd + n)) //read n_cmd + n bytes
+                break;
+            *timestamp = micros(); //8 bytes timestamp stored in send_buff
+            //core 1 writes n bytes starting from reg address of every masked
+            //module
+            jobs.mask = mask_id;
+            jobs.n = n;
+            jobs.n_cmd = n_cmd;
+            jobs.cmd = recv_buff + 7;
+            jobs.val = recv_buff + 7 + n_cmd;
+            jobs.post(SpiJobs::JOB_WRITE);
+            jobs.wait(); //recv_buff is reused by the next command
             break;
         }
         case 'n': // Nb module cmd > 'n'
@@ -82,7 +155,7 @@ loop()
             *vals_buff = nb;
             *size_buff = 1;
 
-            Serial.write(send_buff, 9 + *size_buff);
+            out.write(send_buff, 9 + *size_buff);
             break;
         }
         case 'b': // Blink cmd > 'b' | id | time_cs | nb_repeat
@@ -91,12 +164,14 @@ loop()
         }
         case 's': // Set pin cmd > 's' | id | pin | state
         {
-            //init clvHd
-            uint8_t n = clvHd.initModules();
+            //init clvHd (on core 1, owner of the module pins)
+            jobs.post(SpiJobs::JOB_INIT);
+            jobs.wait();
+            uint8_t n = jobs.result;
             *timestamp = 0; //micros();
             *vals_buff = n;
             *size_buff = 1;
-            Serial.write(send_buff, 9 + *size_buff);
+            out.write(send_buff, 9 + *size_buff);
             break;
         }
         case 'i': // I2c cmd > 'i' | id
@@ -119,7 +194,77 @@ loop()
             vals_buff[1] = recv_buff[3];
             vals_buff[2] = recv_buff[4];
             *size_buff = 3;
-            Serial.write(send_buff, 9 + *size_buff);
+            out.write(send_buff, 9 + *size_buff);
+            break;
+        }
+        case 'f': // FIFO cmd > 'f' | mask_id | n | n_cmd | cmd[n_cmd] | source : sample the modules at conversion time
+        {
+            Serial.readBytes((char *)recv_buff + 1, 6);
+            mask_id = *((uint32_t *)(recv_buff + 1)); //4 bytes mask_id
+            n = recv_buff[5];     //1 byte number of bytes to read per module
+            n_cmd = recv_buff[6]; //1 byte size of the command
+            uint8_t source = 0; //stopped if the command does not fit
+            if(readCommand(n_cmd + 1))
+            {
+                jobs.mask = mask_id;
+                jobs.n = n;
+                jobs.n_cmd = n_cmd;
+                jobs.cmd = recv_buff + 7;
+                jobs.source = recv_buff[7 + n_cmd];
+                jobs.post(SpiJobs::JOB_FIFO);
+                jobs.wait();
+                source = jobs.result;
+            }
+            *timestamp = micros();
+            vals_buff[0] = source; //active source (0: stopped)
+            *(uint16_t *)(vals_buff + 1) = fifo.capacity();
+            *size_buff = 3;
+            out.write(send_buff, 9 + *size_buff);
+            break;
+        }
+        case 'F': // Fetch FIFO cmd > 'F' | max_entries : count | flags | entries[count]
+        {
+            Serial.readBytes((char *)recv_buff + 1, 1);
+            *timestamp = micros();
+            *size_buff = fifo.fetch(recv_buff[1], vals_buff, 246);
+            out.write(send_buff, 9 + *size_buff);
+            break;
+        }
+        case 'D': // Drain FIFO cmd > 'D' | max_frames(2) : timestamp | size(2) | mask | n | count(2) | flags | ts0 | count x (dt(2) | vals)
+        case 'Z': // Compressed drain cmd > 'Z' | max_frames(2) : same, vals delta coded
+        {
+            Serial.readBytes((char *)recv_buff + 1, 2);
+            *timestamp = micros();
+            //16 bits size: the reply is larger than the 255 bytes of a frame
+            uint16_t size = fifo.drain(*(uint16_t *)(recv_buff + 1),
+                                       send_buff + 10, sizeof(send_buff) - 10,
+                                       recv_buff[0] == 'Z');
+            memcpy(send_buff + 8, &size, 2);
+            out.write(send_buff, 10 + size);
+            break;
+        }
+        case 'c': // SPI clock cmd > 'c' | clock(4) : applied clock(4)
+        {
+            Serial.readBytes((char *)recv_buff + 1, 4);
+            *timestamp = micros();
+            jobs.clock = *(uint32_t *)(recv_buff + 1);
+            jobs.post(SpiJobs::JOB_CLOCK);
+            jobs.wait();
+            *(uint32_t *)vals_buff = jobs.result;
+            *size_buff = 4;
+            out.write(send_buff, 9 + *size_buff);
+            break;
+        }
+        case 'a': // Aggregation cmd > 'a' | packet(2) | budget_us(2) : packet(2), replies in transfers of packets (0: write through)
+        {
+            Serial.readBytes((char *)recv_buff + 1, 4);
+            *timestamp = micros();
+            //replied in the current mode, the next replies in the new one
+            sendHeader(2);
+            uint16_t packet = ReplyBatch::clamp(*(uint16_t *)(recv_buff + 1));
+            out.write((uint8_t *)&packet, 2);
+            out.flush();
+            out.configure(packet, *(uint16_t *)(recv_buff + 3));
             break;
         }
         case 'v': // Version cmd > 'v'
@@ -128,7 +273,7 @@ loop()
             *(uint8_t *)vals_buff = VERSION_MAJOR;
             *(uint8_t *)(vals_buff + 1) = VERSION_MINOR;
             *size_buff = 2;
-            Serial.write(send_buff, 9 + *size_buff);
+            out.write(send_buff, 9 + *size_buff);
             break;
         }
         }
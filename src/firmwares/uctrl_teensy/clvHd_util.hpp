@@ -5,6 +5,10 @@
 #define WRITE 0b00000000
 #define REG_MASK 0b01111111
 
+#define CLVHD_SPI_CLOCK 20000000     // Default SPI clock (Hz)
+#define CLVHD_SPI_MAX_CLOCK 20000000 // Maximum SCLK of the ADS1293
+#define CLVHD_SPI_BUFFER 352         // Command + reply bytes of a transfer
+
 //class used to unify the different functions used to interact with the EMG modules
 class ClvHd
 {
@@ -17,9 +21,22 @@ class ClvHd
     begin()
     {
         SPI.begin();
-        SPI.beginTransaction(SPISettings(2000000, MSBFIRST, SPI_MODE0));
-        for(int i = 0; i < 5; i++) pinMode(m_addPins[i], OUTPUT);
-        selectBrd(0xff);
+        setSpiClock(CLVHD_SPI_CLOCK);
+        for(int i = 0; i < 5; i++)
+        {
+            pinMode(m_addPins[i], OUTPUT);
+#if defined(__IMXRT1062__)
+            m_set[i] = portSetRegister(m_addPins[i]);
+            m_clear[i] = portClearRegister(m_addPins[i]);
+            m_bit[i] = digitalPinToBitMask(m_addPins[i]);
+#endif
+            digitalWrite(m_addPins[i], HIGH);
+        }
+        m_selected = 0x1f;
+#ifdef SPI_HAS_TRANSFER_ASYNC
+        m_event.attachImmediate(&ClvHd::transferDone);
+        m_event.setContext((void *)&m_done);
+#endif
         pinMode(m_availPin, INPUT_PULLUP);
         pinMode(m_clkPin, OUTPUT); //CLK
         pinMode(m_outPin, OUTPUT); //pull LOW to stop counting
@@ -65,8 +82,42 @@ class ClvHd
     void
     selectBrd(uint8_t id)
     {
+        // Only the pins that change, with single register writes on Teensy 4
+        uint8_t diff = (id ^ m_selected) & 0x1f;
         for(unsigned i = 0; i < 5; i++)
+        {
+            if(!((diff >> i) & 1))
+                continue;
+#if defined(__IMXRT1062__)
+            if((id >> i) & 1)
+                *m_set[i] = m_bit[i];
+            else
+                *m_clear[i] = m_bit[i];
+#else
             digitalWrite(m_addPins[i], (id >> i) & 1);
+#endif
+        }
+        m_selected = id & 0x1f;
+    }
+
+    /**
+     * @brief Set the SPI clock, up to the maximum of the ADS1293.
+     *
+     * @param clock Requested clock (Hz)
+     * @return uint32_t Applied clock (Hz)
+     */
+    uint32_t
+    setSpiClock(uint32_t clock)
+    {
+        if(clock > CLVHD_SPI_MAX_CLOCK)
+            clock = CLVHD_SPI_MAX_CLOCK;
+        if(clock < 100000)
+            clock = 100000;
+        if(m_clock != 0)
+            SPI.endTransaction();
+        SPI.beginTransaction(SPISettings(clock, MSBFIRST, SPI_MODE0));
+        m_clock = clock;
+        return m_clock;
     }
 
     /**
@@ -82,10 +133,57 @@ class ClvHd
     readCmd(
         uint8_t n_cmd, uint8_t cmd[], uint8_t n, uint8_t val[], uint8_t id = 15)
     {
+        if(n_cmd + n > CLVHD_SPI_BUFFER)
+            return;
+        prepareTx(n_cmd, cmd, n);
         selectBrd(id);
-        for(unsigned i = 0; i < n_cmd; i++) SPI.transfer(cmd[i]);
-        for(unsigned i = 0; i < n; i++) *(val + i) = SPI.transfer(0x00);
+        SPI.transfer(m_tx, m_rx[0], n_cmd + n);
         selectBrd(0x00);
+        memcpy(val, m_rx[0] + n_cmd, n);
+    }
+
+    /**
+     * @brief Read n uint8_ts from every module of the mask and write them to
+     * out as they come. The transfer of a module runs on the DMA while the
+     * bytes of the previous one are written to out (double buffering).
+     *
+     * @return int Number of modules read
+     */
+    int
+    readMulti(uint32_t mask,
+              uint8_t n_cmd,
+              uint8_t cmd[],
+              uint8_t n,
+              Print &out)
+    {
+        if(n_cmd + n > CLVHD_SPI_BUFFER)
+            return 0;
+        prepareTx(n_cmd, cmd, n);
+        int count = 0;
+        int buf = 0;
+        for(int i = 0; i < m_nbModule; i++)
+        {
+            if(!(mask & ((uint32_t)1 << i)))
+                continue;
+            selectBrd(i + 1);
+#ifdef SPI_HAS_TRANSFER_ASYNC
+            m_done = false;
+            SPI.transfer(m_tx, m_rx[buf], n_cmd + n, m_event);
+            if(count > 0)
+                out.write(m_rx[buf ^ 1] + n_cmd, n);
+            while(!m_done) {}
+#else
+            SPI.transfer(m_tx, m_rx[buf], n_cmd + n);
+            if(count > 0)
+                out.write(m_rx[buf ^ 1] + n_cmd, n);
+#endif
+            selectBrd(0x00);
+            buf ^= 1;
+            count++;
+        }
+        if(count > 0)
+            out.write(m_rx[buf ^ 1] + n_cmd, n);
+        return count;
     }
 
     /**
@@ -101,9 +199,12 @@ class ClvHd
     writeCmd(
         uint8_t n_cmd, uint8_t cmd[], uint8_t n, uint8_t val[], uint8_t id = 15)
     {
+        if(n_cmd + n > CLVHD_SPI_BUFFER)
+            return;
+        memcpy(m_tx, cmd, n_cmd);
+        memcpy(m_tx + n_cmd, val, n);
         selectBrd(id);
-        for(unsigned i = 0; i < n_cmd; i++) SPI.transfer(cmd[i]);
-        for(unsigned i = 0; i < n; i++) SPI.transfer(val[i]);
+        SPI.transfer(m_tx, m_rx[0], n_cmd + n);
         selectBrd(0x00);
     }
 
@@ -114,6 +215,34 @@ class ClvHd
     }
 
     private:
+    // Command followed by the dummy bytes clocking the reply
+    void
+    prepareTx(uint8_t n_cmd, uint8_t cmd[], uint8_t n)
+    {
+        memcpy(m_tx, cmd, n_cmd);
+        memset(m_tx + n_cmd, 0x00, n);
+    }
+
+#ifdef SPI_HAS_TRANSFER_ASYNC
+    static void
+    transferDone(EventResponderRef event)
+    {
+        *(volatile bool *)event.getContext() = true;
+    }
+
+    EventResponder m_event;
+    volatile bool m_done = true;
+#endif
+    // Cache line aligned for the DMA
+    alignas(32) uint8_t m_tx[CLVHD_SPI_BUFFER];
+    alignas(32) uint8_t m_rx[2][CLVHD_SPI_BUFFER];
+#if defined(__IMXRT1062__)
+    volatile uint32_t *m_set[5];
+    volatile uint32_t *m_clear[5];
+    uint32_t m_bit[5];
+#endif
+    uint8_t m_selected = 0;
+    uint32_t m_clock = 0;
     bool initialized = false;
     const int m_addPins[5] = {2, 3, 4, 5, 6};
     int m_nbModule = 0;
@@ -121,3 +250,403 @@ class ClvHd
     int m_clkPin = 19;
     int m_outPin = 8;
 };
+
+#define DATA_STATUS_REG 0x30
+
+// Sample FIFO of the controller (conversion time sampling, bulk fetch)
+#define CLVHD_FIFO_BYTES 16384
+#define CLVHD_DRDYB_PIN -1 // Input wired to the DRDYB lines, -1 if none
+
+#define FIFO_STOP 0
+#define FIFO_POLL 1  // Poll DATA_STATUS of the first module
+#define FIFO_DRDYB 2 // Falling edge of DRDYB
+
+volatile uint32_t drdyb_stamp = 0; // Time of the last edge
+volatile uint32_t drdyb_edges = 0; // Edges since the last read
+
+void
+drdyb_isr()
+{
+    drdyb_stamp = micros();
+    drdyb_edges = drdyb_edges + 1;
+}
+
+/**
+ * @brief FIFO of the samples of the modules, read at conversion time.
+ *
+ * Each entry is [u32 timestamp (us) | n bytes of every masked module], the
+ * timestamp being taken at the data ready edge (DRDYB interrupt) or when the
+ * polled DATA_STATUS reports a new sample. When the FIFO is full, the new
+ * entries are dropped and the overflow is reported by the next fetch.
+ */
+class SampleFifo
+{
+    public:
+    /**
+     * @brief Start sampling the masked modules with the read command cmd.
+     *
+     * @return uint8_t Active source (FIFO_POLL if no DRDYB pin is wired).
+     */
+    uint8_t
+    start(ClvHd &clvHd,
+          uint32_t mask,
+          uint8_t n,
+          uint8_t n_cmd,
+          uint8_t cmd[],
+          uint8_t source)
+    {
+        stop();
+        m_mask = mask;
+        m_n = n;
+        m_n_cmd = (n_cmd < sizeof(m_cmd)) ? n_cmd : sizeof(m_cmd);
+        memcpy(m_cmd, cmd, m_n_cmd);
+        m_nb = 0;
+        m_first = -1;
+        for(int i = 0; i < clvHd.nbModules(); i++)
+            if(mask & ((uint32_t)1 << i))
+            {
+                if(m_first < 0)
+                    m_first = i;
+                m_nb++;
+            }
+        m_entry = 4 + m_n * m_nb;
+        if(source == FIFO_STOP || m_nb == 0 || m_entry > CLVHD_FIFO_BYTES)
+            return FIFO_STOP;
+        m_capacity = CLVHD_FIFO_BYTES / m_entry;
+        if(source == FIFO_DRDYB && CLVHD_DRDYB_PIN >= 0)
+        {
+            pinMode(CLVHD_DRDYB_PIN, INPUT_PULLUP);
+            drdyb_edges = 0;
+            attachInterrupt(digitalPinToInterrupt(CLVHD_DRDYB_PIN), drdyb_isr,
+                            FALLING);
+        }
+        else
+            source = FIFO_POLL;
+        m_source = source;
+        return m_source;
+    }
+
+    void
+    stop()
+    {
+        if(m_source == FIFO_DRDYB)
+            detachInterrupt(digitalPinToInterrupt(CLVHD_DRDYB_PIN));
+        m_source = FIFO_STOP;
+        m_head = m_count = 0;
+        m_overflow = false;
+    }
+
+    /**
+     * @brief Read the modules if a new sample is ready (called every loop).
+     */
+    void
+    poll(ClvHd &clvHd)
+    {
+        uint32_t ts;
+        if(m_source == FIFO_DRDYB)
+        {
+            if(drdyb_edges == 0)
+                return;
+            noInterrupts();
+            ts = drdyb_stamp;
+            uint32_t edges = drdyb_edges;
+            drdyb_edges = 0;
+            interrupts();
+            // Edges merged before this read: their samples were overwritten
+            // in the modules, report them as dropped (FIFO_OVERFLOW)
+            if(edges > 1)
+                m_overflow = true;
+        }
+        else if(m_source == FIFO_POLL)
+        {
+            uint8_t cmd = DATA_STATUS_REG | READ;
+            uint8_t status = 0;
+            clvHd.readCmd(1, &cmd, 1, &status, m_first + 1);
+            if(!(status & 0b11111100)) // No P/E DRDY bit
+                return;
+            ts = micros();
+        }
+        else
+            return;
+
+        if(m_count == m_capacity)
+        {
+            m_overflow = true;
+            return;
+        }
+        uint8_t *entry = m_data + ((m_head + m_count) % m_capacity) * m_entry;
+        memcpy(entry, &ts, 4);
+        uint8_t *vals = entry + 4;
+        for(int i = 0; i < clvHd.nbModules(); i++)
+            if(m_mask & ((uint32_t)1 << i))
+            {
+                clvHd.readCmd(m_n_cmd, m_cmd, m_n, vals, i + 1);
+                vals += m_n;
+            }
+        m_count++;
+    }
+
+    /**
+     * @brief Move up to max entries in buff: [count | flags | entries], flags
+     * bit 0 set if entries were dropped since the last fetch, bit 1 if
+     * entries are still pending.
+     *
+     * @param room Size of buff.
+     * @return int Number of bytes written.
+     */
+    int
+    fetch(uint8_t max, uint8_t *buff, int room)
+    {
+        int count = 0;
+        while(count < max && count < m_count && 2 + (count + 1) * m_entry <= room)
+        {
+            memcpy(buff + 2 + count * m_entry, m_data + m_head * m_entry,
+                   m_entry);
+            m_head = (m_head + 1) % m_capacity;
+            count++;
+        }
+        m_count -= count;
+        buff[0] = count;
+        buff[1] = (m_overflow ? 1 : 0) | (m_count > 0 ? 2 : 0);
+        m_overflow = false;
+        return 2 + count * m_entry;
+    }
+
+    /**
+     * @brief Move up to max entries in buff, with compact timestamps:
+     * [u32 mask | u8 n | u16 count | u8 flags | u32 timestamp of the first
+     * entry | count x (u16 delay from the previous entry (us) | n bytes of
+     * every masked module)]. A delay above 65535 us ends the reply, the next
+     * one starting from a new timestamp.
+     *
+     * Compressed (flags bit 2, ADS1293 windows of 16 bytes only), the bytes
+     * of an entry are replaced by the delta coding of encode() against the
+     * previous entry of the reply, unless it is not shorter (saturation,
+     * steps): the entry is then sent raw, with bit 15 of its delay set (the
+     * delays are limited to 32767 us).
+     *
+     * @param room Size of buff.
+     * @return int Number of bytes written.
+     */
+    int
+    drain(uint16_t max, uint8_t *buff, int room, bool compress = false)
+    {
+        const int header = 12;
+        const int raw = m_entry - 4;
+        compress = compress && m_n == 16 && m_cmd[0] == (DATA_STATUS_REG | READ);
+        const uint32_t max_dt = compress ? 0x7FFF : 0xFFFF;
+        int pos = header;
+        uint16_t count = 0;
+        uint32_t prev = 0;
+        while(count < max && count < m_count && pos + 2 + raw <= room)
+        {
+            const uint8_t *entry = m_data + m_head * m_entry;
+            uint32_t ts;
+            memcpy(&ts, entry, 4);
+            if(count == 0)
+            {
+                memcpy(buff + 8, &ts, 4);
+                memset(m_prev, 0, sizeof(m_prev));
+            }
+            else if(ts - prev > max_dt)
+                break;
+            uint16_t dt = (count == 0) ? 0 : ts - prev;
+            int len = compress ? encode(entry + 4, buff + pos + 2, raw) : raw;
+            if(len >= raw)
+            {
+                memcpy(buff + pos + 2, entry + 4, raw);
+                dt |= compress ? 0x8000 : 0;
+                len = raw;
+            }
+            memcpy(buff + pos, &dt, 2);
+            pos += 2 + len;
+            prev = ts;
+            m_head = (m_head + 1) % m_capacity;
+            count++;
+        }
+        m_count -= count;
+        memcpy(buff, &m_mask, 4);
+        buff[4] = m_n;
+        memcpy(buff + 5, &count, 2);
+        buff[7] = (m_overflow ? 1 : 0) | (m_count > 0 ? 2 : 0) |
+                  (compress ? 4 : 0);
+        m_overflow = false;
+        return pos;
+    }
+
+    uint16_t
+    capacity()
+    {
+        return m_capacity;
+    }
+
+    private:
+    /**
+     * @brief Delta coding of the ADS1293 windows of an entry: per module,
+     * the DATA_STATUS byte, then the zigzag varint of the difference of each
+     * pace (16 bits) and ECG (24 bits) value with the previous entry. Writes
+     * at most limit bytes but always updates the previous values.
+     *
+     * @return int Length of the coded entry (>= limit if it did not fit).
+     */
+    int
+    encode(const uint8_t *vals, uint8_t *out, int limit)
+    {
+        int len = 0;
+        int32_t *prev = m_prev;
+        for(int m = 0; m < m_nb; m++, vals += 16)
+        {
+            if(len < limit)
+                out[len] = vals[0];
+            len++;
+            for(int k = 0; k < 6; k++, prev++)
+            {
+                const uint8_t *v = (k < 3) ? vals + 1 + 2 * k
+                                           : vals + 7 + 3 * (k - 3);
+                int32_t value = (k < 3) ? (v[0] << 8) | v[1]
+                                        : (v[0] << 16) | (v[1] << 8) | v[2];
+                int32_t d = value - *prev;
+                *prev = value;
+                uint32_t z = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+                do
+                {
+                    uint8_t b = z & 0x7F;
+                    z >>= 7;
+                    if(len < limit)
+                        out[len] = b | (z ? 0x80 : 0);
+                    len++;
+                } while(z);
+            }
+        }
+        return len;
+    }
+
+    uint8_t m_data[CLVHD_FIFO_BYTES];
+    int32_t m_prev[32 * 6]; // Previous values of the delta coding
+    uint8_t m_source = FIFO_STOP;
+    uint32_t m_mask = 0;
+    uint8_t m_n = 0;
+    uint8_t m_n_cmd = 0;
+    uint8_t m_cmd[8];
+    int m_nb = 0;
+    int m_first = -1;
+    int m_entry = 4;
+    int m_capacity = 0;
+    int m_head = 0;
+    int m_count = 0;
+    bool m_overflow = false;
+};
+
+// Aggregated replies (see ReplyBatch)
+#define CLVHD_BATCH_BYTES 8192
+#define CLVHD_BATCH_MAGIC 0xA5
+
+/**
+ * @brief Output of the replies, written through to the serial link or
+ * aggregated in packet aligned transfers: [0xA5 | u16 size | replies |
+ * zero padding up to a multiple of the USB packet size]. A reply can span
+ * two transfers. The transfer is sent when the buffer is full, as soon as
+ * no command is pending or, while commands keep arriving, when the oldest
+ * byte waited for the latency budget.
+ */
+class ReplyBatch : public Print
+{
+    public:
+    ReplyBatch(Stream &link) : m_link(link) {}
+
+    using Print::write;
+
+    size_t
+    write(uint8_t b) override
+    {
+        return write(&b, 1);
+    }
+
+    size_t
+    write(const uint8_t *buff, size_t size) override
+    {
+        if(m_packet == 0)
+            return m_link.write(buff, size);
+        size_t done = 0;
+        while(done < size)
+        {
+            if(m_size == 0)
+                m_first = micros();
+            size_t k = size - done;
+            if(k > m_capacity - m_size)
+                k = m_capacity - m_size;
+            memcpy(m_data + 3 + m_size, buff + done, k);
+            m_size += k;
+            done += k;
+            if(m_size == m_capacity)
+                flush();
+        }
+        return size;
+    }
+
+    /**
+     * @brief Aggregate the replies in transfers of packet multiples (0:
+     * write through), sent after at most budget us.
+     *
+     * @return uint16_t Applied packet size.
+     */
+    uint16_t
+    configure(uint16_t packet, uint16_t budget)
+    {
+        flush();
+        packet = clamp(packet);
+        m_packet = packet;
+        m_budget = budget;
+        m_capacity = (packet > 0) ? (CLVHD_BATCH_BYTES / packet) * packet - 3
+                                  : 0;
+        return m_packet;
+    }
+
+    // Packet size applied for a requested one
+    static uint16_t
+    clamp(uint16_t packet)
+    {
+        if(packet > CLVHD_BATCH_BYTES / 2)
+            return CLVHD_BATCH_BYTES / 2;
+        if(packet > 0 && packet < 8)
+            return 8;
+        return packet;
+    }
+
+    /**
+     * @brief Send the transfer if no command is pending or if its latency
+     * budget is over (called every loop).
+     */
+    void
+    poll(bool input_pending)
+    {
+        if(m_size == 0)
+            return;
+        if(!input_pending || (uint32_t)(micros() - m_first) >= m_budget)
+            flush();
+    }
+
+    void
+    flush()
+    {
+        if(m_size == 0)
+            return;
+        uint16_t size = m_size;
+        m_data[0] = CLVHD_BATCH_MAGIC;
+        memcpy(m_data + 1, &size, 2);
+        size_t total = 3 + m_size;
+        size_t padded = ((total + m_packet - 1) / m_packet) * m_packet;
+        memset(m_data + total, 0, padded - total);
+        m_link.write(m_data, padded);
+        m_size = 0;
+    }
+
+    private:
+    Stream &m_link;
+    uint8_t m_data[CLVHD_BATCH_BYTES];
+    uint16_t m_packet = 0; // 0: write through
+    uint32_t m_budget = 0; // us
+    size_t m_capacity = 0; // Bytes of replies of a transfer
+    size_t m_size = 0;
+    uint32_t m_first = 0; // Time of the oldest byte
+};
@@ -1,9 +1,9 @@
 #define VERSION_MAJOR 3
-#define VERSION_MINOR 0
+#define VERSION_MINOR 6
 #include "clvHd_util.hpp"
 
 uint8_t recv_buff[64];
-uint8_t send_buff[1024];
+uint8_t send_buff[4096];
 uint64_t *timestamp = (uint64_t *)send_buff;
 uint8_t *size_buff = send_buff + 8;
 uint8_t *vals_buff = send_buff + 9;
@@ -11,6 +11,26 @@ int i, n, reg, nb, id, val, n_cmd;
 uint32_t mask_id = 0;
 
 ClvHd clvHd;
+SampleFifo fifo;
+ReplyBatch out(Serial); //replies, aggregated on request ('a')
+
+// Header of a reply of size bytes: timestamp | size, or timestamp | 0xFF |
+// size(2) above 254 bytes
+void
+sendHeader(uint16_t size)
+{
+    if(size < 0xFF)
+    {
+        *size_buff = size;
+        out.write(send_buff, 9);
+    }
+    else
+    {
+        *size_buff = 0xFF;
+        out.write(send_buff, 9);
+        out.write((uint8_t *)&size, 2);
+    }
+}
 
 void
 setup()
@@ -24,6 +44,8 @@ setup()
 void
 loop()
 {
+    fifo.poll(clvHd);
+    out.poll(Serial.available() > 0);
     if(Serial.available() >= 1)
     {
         recv_buff[0] = Serial.read();
@@ -39,18 +61,12 @@ loop()
             *timestamp = micros(); //8 bytes timestamp stored in send_buff
             int ir = 0;
             for(i = 0; i < clvHd.nbModules(); i++)
-            {
                 if(mask_id & ((uint32_t)1 << i)) //check if the i-th bit is set
-                {
-                    //read n bytes starting from reg address of the module i
-                    //and store them in vals_buff (send_buff + 9)
-                    clvHd.readCmd(n_cmd, recv_buff + 7, n, vals_buff + n * ir,
-                                  i + 1);
                     ir++;
-                }
-            }
-            *size_buff = n * ir; //number of bytes read (send_buff + 8)
-            Serial.write(send_buff, 9 + (*size_buff));
+            sendHeader(n * ir); //number of bytes read
+            //read n bytes starting from reg address of every masked module,
+            //each one being sent while the next one is read
+            clvHd.readMulti(mask_id, n_cmd, recv_buff + 7, n, out);
             break;
         }
         case 'w': //> 'w' | mask id | n | n_cmd | cmd[n_cmd] | val[n] : write n bytes starting from reg
@@ -82,7 +98,7 @@ loop()
             *vals_buff = nb;
             *size_buff = 1;
 
-            Serial.write(send_buff, 9 + *size_buff);
+            out.write(send_buff, 9 + *size_buff);
             break;
         }
         case 'b': // Blink cmd > 'b' | id | time_cs | nb_repeat
@@ -96,7 +112,7 @@ loop()
             *timestamp = 1; //micros();
             *vals_buff = n;
             *size_buff = 1;
-            Serial.write(send_buff, 9 + *size_buff);
+            out.write(send_buff, 9 + *size_buff);
             break;
         }
         case 'i': // I2c cmd > 'i' | id
@@ -119,7 +135,66 @@ loop()
             vals_buff[1] = recv_buff[3];
             vals_buff[2] = recv_buff[4];
             *size_buff = 3;
-            Serial.write(send_buff, 9 + *size_buff);
+            out.write(send_buff, 9 + *size_buff);
+            break;
+        }
+        case 'f': // FIFO cmd > 'f' | mask_id | n | n_cmd | cmd[n_cmd] | source : sample the modules at conversion time
+        {
+            Serial.readBytes((char *)recv_buff + 1, 6);
+            mask_id = *((uint32_t *)(recv_buff + 1)); //4 bytes mask_id
+            n = recv_buff[5];     //1 byte number of bytes to read per module
+            n_cmd = recv_buff[6]; //1 byte size of the command
+            Serial.readBytes((char *)recv_buff + 7, n_cmd + 1);
+            uint8_t source = fifo.start(clvHd, mask_id, n, n_cmd,
+                                        recv_buff + 7, recv_buff[7 + n_cmd]);
+            *timestamp = micros();
+            vals_buff[0] = source; //active source (0: stopped)
+            *(uint16_t *)(vals_buff + 1) = fifo.capacity();
+            *size_buff = 3;
+            out.write(send_buff, 9 + *size_buff);
+            break;
+        }
+        case 'F': // Fetch FIFO cmd > 'F' | max_entries : count | flags | entries[count]
+        {
+            Serial.readBytes((char *)recv_buff + 1, 1);
+            *timestamp = micros();
+            *size_buff = fifo.fetch(recv_buff[1], vals_buff, 246);
+            out.write(send_buff, 9 + *size_buff);
+            break;
+        }
+        case 'D': // Drain FIFO cmd > 'D' | max_frames(2) : timestamp | size(2) | mask | n | count(2) | flags | ts0 | count x (dt(2) | vals)
+        case 'Z': // Compressed drain cmd > 'Z' | max_frames(2) : same, vals delta coded
+        {
+            Serial.readBytes((char *)recv_buff + 1, 2);
+            *timestamp = micros();
+            //16 bits size: the reply is larger than the 255 bytes of a frame
+            uint16_t size = fifo.drain(*(uint16_t *)(recv_buff + 1),
+                                       send_buff + 10, sizeof(send_buff) - 10,
+                                       recv_buff[0] == 'Z');
+            memcpy(send_buff + 8, &size, 2);
+            out.write(send_buff, 10 + size);
+            break;
+        }
+        case 'c': // SPI clock cmd > 'c' | clock(4) : applied clock(4)
+        {
+            Serial.readBytes((char *)recv_buff + 1, 4);
+            *timestamp = micros();
+            *(uint32_t *)vals_buff =
+                clvHd.setSpiClock(*(uint32_t *)(recv_buff + 1));
+            *size_buff = 4;
+            out.write(send_buff, 9 + *size_buff);
+            break;
+        }
+        case 'a': // Aggregation cmd > 'a' | packet(2) | budget_us(2) : packet(2), replies in transfers of packets (0: write through)
+        {
+            Serial.readBytes((char *)recv_buff + 1, 4);
+            *timestamp = micros();
+            //replied in the current mode, the next replies in the new one
+            sendHeader(2);
+            uint16_t packet = ReplyBatch::clamp(*(uint16_t *)(recv_buff + 1));
+            out.write((uint8_t *)&packet, 2);
+            out.flush();
+            out.configure(packet, *(uint16_t *)(recv_buff + 3));
             break;
         }
         case 'v': // Version cmd > 'v'
@@ -128,7 +203,7 @@ loop()
             *(uint8_t *)vals_buff = VERSION_MAJOR;
             *(uint8_t *)(vals_buff + 1) = VERSION_MINOR;
             *size_buff = 2;
-            Serial.write(send_buff, 9 + *size_buff);
+            out.write(send_buff, 9 + *size_buff);
             break;
         }
         }
@@ -0,0 +1,87 @@
+#include "clvHd.hpp"
+#include <csignal>
+#include <thread>
+
+// Acquisition daemon: the only process opening the serial port, publishing
+// the fast and precise streams in shared-memory rings for any number of
+// readers (LSL forwarding, recording, dashboards, Python...).
+
+static volatile std::sig_atomic_t s_stop = 0;
+
+void
+on_signal(int)
+{
+    s_stop = 1;
+}
+
+void
+usage(char *name)
+{
+    std::cerr << "Usage: " << name << " <serial_port> [ring_name]"
+              << std::endl;
+}
+
+int
+main(int argc, char *argv[])
+{
+    std::string port = "/dev/ttyACM0";
+    std::string name = "/clvhd"; // Rings name_fast and name_precise
+    if(argc >= 2)
+        port = argv[1];
+    if(argc >= 3)
+        name = argv[2];
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    try
+    {
+        ClvHd::Device device(3);
+        std::cout << "Opening serial port: " << port << std::endl;
+        device.initSerial(port.c_str());
+
+        ClvHd::EMG_ADS1293Pack emg_pack(&device, 3);
+        emg_pack.setup();
+        ClvHd::EMG_ADS1293Config config;
+        emg_pack.configure(config);
+
+        // About 30 s of each stream, for the readers lagging behind
+        int nb_ch = emg_pack.modules.size() * 3;
+        ClvHd::ShmPublisher fast(3), precise(3);
+        if(fast.open(name + "_fast", nb_ch, 32 * emg_pack.odr(false),
+                     emg_pack.odr(false)) < 0 ||
+           precise.open(name + "_precise", nb_ch, 32 * emg_pack.odr(true),
+                        emg_pack.odr(true)) < 0)
+            throw std::string("Could not create the shared-memory rings");
+
+        emg_pack.start_acquisition();
+        ClvHd::Acquisition acquisition(&emg_pack, 3);
+        ClvHd::AcquisitionOptions options;
+        options.policy = ClvHd::AcquisitionOptions::FIFO;
+        options.priority = 80;
+        options.lock_memory = true;
+        acquisition.start(options);
+
+        std::cout << "[INFOS] Publishing " << name << "_fast and " << name
+                  << "_precise" << std::endl;
+        for(int t = 0; !s_stop; t++)
+        {
+            usleep(1000);
+            fast.publish(emg_pack.fast_ring);
+            precise.publish(emg_pack.precise_ring);
+            if(t % 5000 == 0)
+                std::cout << acquisition.stats().str() << "\npublished "
+                          << precise.frames() << " frames" << std::endl;
+        }
+        acquisition.stop();
+    }
+    catch(std::exception &e)
+    {
+        std::cerr << "[ERROR] Got an exception: " << e.what() << std::endl;
+    }
+    catch(std::string str)
+    {
+        std::cerr << "[ERROR] Got an exception: " << str << std::endl;
+        usage(argv[0]);
+    }
+    return 0;
+}
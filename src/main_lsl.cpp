@@ -1,11 +1,15 @@
 
 #include "clvHd.hpp"
+#include <atomic>
 #include <lsl_cpp.h>
+#include <poll.h>
+#include <thread>
 
 void
 usage(char *name)
 {
-    std::cerr << "Usage: " << name << " <serial_port>" << std::endl;
+    std::cerr << "Usage: " << name << " <serial_port> [precise_rate]"
+              << std::endl;
 }
 
 int
@@ -21,8 +25,10 @@ main(int argc, char *argv[])
     port = "COM3";
 #endif
 
-    if(argc == 2)
+    if(argc >= 2)
         port = argv[1];
+    // Resample the precise stream to a uniform rate (0: nominal ODR)
+    double rate = (argc >= 3) ? std::stod(argv[2]) : 0;
 
     try
     {
@@ -38,30 +44,168 @@ main(int argc, char *argv[])
         emg_pack.configure(config);
 
         int nb_ch = emg_pack.modules.size() * 3;
-        lsl::stream_info info_sample("EMG", "sample_fast", nb_ch, 0,
-                                     lsl::cf_double64);
-        lsl::stream_outlet outlet_sample(info_sample);
-        std::vector<double> sample_fast(nb_ch);
+        // The fast (pace) and precise (ECG) data are decoded from the same
+        // read and published as two streams with their own nominal rates
+        lsl::stream_info info_fast("EMG", "sample_fast", nb_ch,
+                                   emg_pack.odr(false), lsl::cf_double64);
+        lsl::stream_outlet outlet_fast(info_fast);
+        ClvHd::Resampler resampler(nb_ch, emg_pack.odr(true),
+                                   rate > 0 ? rate : emg_pack.odr(true));
+        double precise_rate = rate > 0 ? resampler.rate() : emg_pack.odr(true);
+        lsl::stream_info info_precise("EMG", "sample_precise", nb_ch,
+                                      precise_rate, lsl::cf_double64);
+        lsl::stream_outlet outlet_precise(info_precise);
+
+        // RMS, MAV, WL, ZC and SSC of the precise stream over 200 samples
+        // windows every 50 samples
+        ClvHd::FeatureExtractor features(nb_ch, 200, 50);
+        lsl::stream_info info_features("EMG_features", "features",
+                                       features.size(),
+                                       precise_rate / features.hop(),
+                                       lsl::cf_double64);
+        lsl::stream_outlet outlet_features(info_features);
+        std::vector<double> feature_vector(features.size());
+
+        // Mean/median frequency and power (20-450Hz) for fatigue monitoring
+        ClvHd::SpectralAnalyzer spectral(nb_ch, precise_rate, 256, 0.5, 8);
+        spectral.set_range(20, 450);
+        lsl::stream_info info_spectral("EMG_spectral", "spectral",
+                                       spectral.size(),
+                                       precise_rate / spectral.hop(),
+                                       lsl::cf_double64);
+        lsl::stream_outlet outlet_spectral(info_spectral);
+        std::vector<double> spectral_frame(spectral.size());
+
+        // Activation onsets/offsets as markers, pushed as soon as detected
+        ClvHd::Detector detector(nb_ch, precise_rate);
+        lsl::stream_info info_events("EMG_events", "Markers", 1,
+                                     lsl::IRREGULAR_RATE, lsl::cf_string);
+        lsl::stream_outlet outlet_events(info_events);
+
+        // Line noise, saturation, flatline and error flags of every channel,
+        // twice per second (the errors are read only on alarms)
+        ClvHd::SignalQuality quality(nb_ch, precise_rate, 50, 0.5);
+        std::vector<double> low, high;
+        emg_pack.rails(low, high);
+        quality.set_rails(low, high);
+        lsl::stream_info info_quality("EMG_quality", "quality",
+                                      quality.size(),
+                                      precise_rate / quality.period(),
+                                      lsl::cf_double64);
+        lsl::stream_outlet outlet_quality(info_quality);
+        std::vector<double> quality_frame(quality.size());
+
+        // Markers typed on the standard input (one label per line), stamped
+        // in the time base of the streams
+        lsl::stream_info info_markers("EMG_markers", "Markers", 1,
+                                      lsl::IRREGULAR_RATE, lsl::cf_string);
+        lsl::stream_outlet outlet_markers(info_markers);
+        // The input is polled so that the thread stops and is joined before
+        // emg_pack goes out of scope (even on an exception)
+        std::atomic<bool> stop_input{false};
+        std::thread input(
+            [&emg_pack, &stop_input]()
+            {
+                std::string line;
+                char buf[256];
+                while(!stop_input)
+                {
+                    pollfd pfd = {0, POLLIN, 0};
+                    if(poll(&pfd, 1, 100) <= 0)
+                        continue;
+                    ssize_t n = read(0, buf, sizeof(buf));
+                    if(n <= 0)
+                        break; // End of the input
+                    for(ssize_t i = 0; i < n; i++)
+                        if(buf[i] != '\n')
+                            line += buf[i];
+                        else
+                        {
+                            emg_pack.markers.mark(line);
+                            line.clear();
+                        }
+                }
+            });
+        struct JoinInput
+        {
+            std::atomic<bool> &stop;
+            std::thread &thread;
+            ~JoinInput()
+            {
+                stop = true;
+                thread.join();
+            };
+        } join_input{stop_input, input};
+
+        const size_t block = 64;
+        std::vector<double> ts(block);
+        std::vector<double> samples(block * nb_ch);
 
         emg_pack.start_acquisition();
         std::cout << "EMG modules started" << std::endl;
 
+        // The reads run in a real-time thread, this loop only publishes the
+        // frames (the options fall back silently without the privileges)
+        ClvHd::Acquisition acquisition(&emg_pack, 3);
+        ClvHd::AcquisitionOptions options;
+        options.policy = ClvHd::AcquisitionOptions::FIFO;
+        options.priority = 80;
+        options.lock_memory = true;
+        acquisition.start(options);
+
         std::cout << "[INFOS] Now sending data... " << std::endl;
-        while(true)
+        for(int t = 0;; t++)
         {
-            std::vector<ClvHd::Value *> values = emg_pack.read_all();
-            for(size_t i = 0; i < emg_pack.modules.size(); i++)
+            usleep(1000);
+            if(t % 5000 == 0)
+                std::cout << acquisition.stats().str() << "\nevent delay max "
+                          << detector.stats().delay_max * 1e6 << "us"
+                          << std::endl;
+            size_t n = emg_pack.fast_ring.pop(ts.data(), samples.data(), block);
+            for(size_t i = 0; i < n; i++)
             {
-                for(int j = 0; j < values[i]->data.size(); j++)
-                {
-                    sample_fast[3 * i + j] = values[i]->data[j] * 1000;
-                }
+                for(int j = 0; j < nb_ch; j++) samples[i * nb_ch + j] *= 1000;
+                outlet_fast.push_sample(samples.data() + i * nb_ch, ts[i]);
+            }
+            if(rate > 0)
+            {
+                resampler.process(emg_pack.precise_ring);
+                n = resampler.output.pop(ts.data(), samples.data(), block);
+            }
+            else
+                n = emg_pack.precise_ring.pop(ts.data(), samples.data(), block);
+            features.process(ts.data(), samples.data(), n);
+            spectral.process(ts.data(), samples.data(), n);
+            detector.process(ts.data(), samples.data(), n);
+            quality.process_errors(emg_pack.errors);
+            quality.process(ts.data(), samples.data(), n);
+            ClvHd::Marker marker;
+            while(emg_pack.markers.pop(marker))
+            {
+                std::string label = marker.str();
+                outlet_markers.push_sample(&label, marker.timestamp);
+            }
+            ClvHd::Event event;
+            while(detector.pop(event))
+            {
+                std::string marker = (event.onset ? "onset " : "offset ") +
+                                     std::to_string(event.channel);
+                outlet_events.push_sample(&marker, event.timestamp);
+            }
+            double ts_feature;
+            while(features.output.pop(&ts_feature, feature_vector.data(), 1))
+                outlet_features.push_sample(feature_vector, ts_feature);
+            while(spectral.output.pop(&ts_feature, spectral_frame.data(), 1))
+                outlet_spectral.push_sample(spectral_frame, ts_feature);
+            while(quality.output.pop(&ts_feature, quality_frame.data(), 1))
+                outlet_quality.push_sample(quality_frame, ts_feature);
+            for(size_t i = 0; i < n; i++)
+            {
+                for(int j = 0; j < nb_ch; j++) samples[i * nb_ch + j] *= 1000;
+                outlet_precise.push_sample(samples.data() + i * nb_ch, ts[i]);
+                std::cout << "timestamp: " << ts[i] << "\t"
+                          << samples[i * nb_ch] << "     \xd" << std::flush;
             }
-            double timestamp = values[0]->time_s + values[0]->time_ns / 1000000.0;
-            std::cout << "timestamp: " << timestamp << "\t" << sample_fast[0]
-                      << "     \xd" << std::flush;
-            outlet_sample.push_sample(sample_fast, timestamp);
-            usleep(50000);
         }
     }
     catch(std::exception &e)
@@ -0,0 +1,36 @@
+#include "clvHd_shm.hpp"
+#include <iostream>
+#include <unistd.h>
+
+// Reader of a ring of main_daemon, in place (no copy)
+
+int
+main(int argc, char *argv[])
+{
+    std::string name = (argc >= 2) ? argv[1] : "/clvhd_precise";
+    ClvHd::ShmReader reader(3);
+    if(reader.attach(name) < 0)
+        return 1;
+
+    uint64_t frames = 0;
+    for(int t = 0; !reader.closed(); t++)
+    {
+        const double *ts, *values;
+        size_t n;
+        while((n = reader.peek(ts, values)) > 0)
+        {
+            // Use the frames before consume(), which tells how many of them
+            // were not overwritten meanwhile
+            std::cout << "timestamp: " << ts[n - 1] << "\t"
+                      << values[(n - 1) * reader.channels()] << "     \xd"
+                      << std::flush;
+            frames += reader.consume(n);
+        }
+        usleep(1000);
+        if(t % 5000 == 0)
+            std::cout << "\n" << frames << " frames, " << reader.lost()
+                      << " lost" << std::endl;
+    }
+    std::cout << "\nThe publisher closed " << name << std::endl;
+    return 0;
+}
@@ -1,20 +1,28 @@
-// #include <iostream>
-// #include <string>
-// #include "clvHdMono.hpp"
+#include <iostream>
+#include <string>
+
+#include "clvHd_controller_mono.hpp"
 
 int
-main()
+main(int argc, char *argv[])
 {
-    // ClvHd::MonoController clvhd(2);
-    // clvhd.start();
-    // while(clvhd.nbClients() < 1)
-    // {
-    //     std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    // }
+    int nb = (argc > 1) ? std::stoi(argv[1]) : 1;
+    ClvHd::MonoController clvhd(2);
+    clvhd.start();
+    int n = clvhd.waitModules(nb, 30);
+    std::cout << n << " modules connected" << std::endl;
 
-    // std::this_thread::sleep_for(std::chrono::seconds(5));
-    // std::cout << "Stop" << std::endl;
-    // clvhd.stop();
+    // Read the REVID register (0x40) of all the modules at once
+    uint8_t cmd = 0x40 | 0b10000000;
+    uint8_t revid[32];
+    uint32_t mask = (n >= 32) ? 0xffffffff : (((uint32_t)1 << n) - 1);
+    if(clvhd.readCmd_multi(mask, 1, &cmd, 1, revid) == n)
+        for(int i = 0; i < n; i++)
+            std::cout << clvhd.macAddress(i) << ": REVID " << (int)revid[i]
+                      << std::endl;
+    else
+        std::cout << "Read failed" << std::endl;
 
+    clvhd.stop();
     return 0;
-}
\ No newline at end of file
+}